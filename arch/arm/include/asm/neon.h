@@ -0,0 +1,32 @@
+/*
+ * linux/arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef __ARM_NEON__
+/*
+ * C code built with -mfpu=neon may use the NEON registers anywhere,
+ * not only between kernel_neon_begin() and kernel_neon_end().
+ */
+#error You should not be using <asm/neon.h> in NEON code
+#endif
+
+/*
+ * Claim the NEON unit for use by the kernel.  The VFP/NEON state of
+ * whichever thread owns the registers is saved first, and reloaded
+ * lazily on its next VFP instruction.  Preemption is disabled until
+ * kernel_neon_end(); must not be called from interrupt context.
+ */
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
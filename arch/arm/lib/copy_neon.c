@@ -0,0 +1,69 @@
+/*
+ *  linux/arch/arm/lib/copy_neon.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  memcpy() and copy_page() front ends that hand large copies to the
+ *  NEON loops in memcpy_neon.S.  Claiming NEON saves the VFP state of
+ *  its owner and disables preemption, which only pays off for copies
+ *  of a couple of KB or more; everything else, and any caller in
+ *  interrupt or irqs-off context, goes to the ARM routines.
+ */
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <linux/string.h>
+
+#include <asm/neon.h>
+#include <asm/page.h>
+
+extern void *__memcpy_arm(void *dst, const void *src, size_t n);
+extern void __copy_page_arm(void *to, const void *from);
+extern void __memcpy_neon(void *dst, const void *src, size_t n);
+extern void __copy_page_neon(void *to, const void *from);
+
+/* smallest memcpy() done with NEON; 0 turns NEON copies off */
+static unsigned int neon_copy_min = 2048;
+core_param(neon_copy_min, neon_copy_min, uint, 0644);
+
+static inline int neon_copy_ok(size_t n)
+{
+	return neon_copy_min && n >= neon_copy_min && cpu_has_neon() &&
+	       !in_interrupt() && !irqs_disabled();
+}
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+	size_t bulk;
+
+	if (!neon_copy_ok(n))
+		return __memcpy_arm(dst, src, n);
+
+	bulk = n & ~63;
+	kernel_neon_begin();
+	__memcpy_neon(dst, src, bulk);
+	kernel_neon_end();
+
+	if (n != bulk)
+		__memcpy_arm(dst + bulk, src + bulk, n - bulk);
+	return dst;
+}
+
+void copy_page(void *to, const void *from)
+{
+	if (!neon_copy_ok(PAGE_SIZE)) {
+		__copy_page_arm(to, from);
+		return;
+	}
+
+	kernel_neon_begin();
+	__copy_page_neon(to, from);
+	kernel_neon_end();
+}
+
+/* for the benchmark module */
+EXPORT_SYMBOL_GPL(__memcpy_arm);
+EXPORT_SYMBOL_GPL(__copy_page_arm);
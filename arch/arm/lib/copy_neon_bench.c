@@ -0,0 +1,120 @@
+/*
+ *  linux/arch/arm/lib/copy_neon_bench.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ *  Load to compare the ARM and NEON copy routines; results, in MB/s,
+ *  go to the kernel log.  "neon" is memcpy() as built, so sizes below
+ *  neon_copy_min show the cost of the dispatch only.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+extern void *__memcpy_arm(void *dst, const void *src, size_t n);
+extern void __copy_page_arm(void *to, const void *from);
+
+static unsigned int max_kb = 1024;
+module_param(max_kb, uint, 0444);
+MODULE_PARM_DESC(max_kb, "largest memcpy to measure, in KB");
+
+static unsigned int iterations = 64;
+module_param(iterations, uint, 0444);
+
+static unsigned int bench_mbps(size_t len, s64 us)
+{
+	if (us <= 0)
+		return 0;
+	return (unsigned int)div64_u64((u64)len * iterations, (u64)us);
+}
+
+static void bench_memcpy(u8 *dst, u8 *src, size_t len)
+{
+	s64 arm_us, neon_us;
+	ktime_t t;
+	int i;
+
+	t = ktime_get();
+	for (i = 0; i < iterations; i++)
+		__memcpy_arm(dst, src, len);
+	arm_us = ktime_us_delta(ktime_get(), t);
+
+	memset(dst, 0, len);
+	t = ktime_get();
+	for (i = 0; i < iterations; i++)
+		memcpy(dst + 1, src + 1, len - 1);
+	neon_us = ktime_us_delta(ktime_get(), t);
+
+	printk(KERN_INFO "copy_neon_bench: memcpy %8zu bytes: arm %4u neon %4u MB/s%s\n",
+	       len, bench_mbps(len, arm_us), bench_mbps(len, neon_us),
+	       memcmp(dst + 1, src + 1, len - 1) ? " MISMATCH" : "");
+}
+
+static void bench_copy_page(u8 *dst, u8 *src)
+{
+	s64 arm_us, neon_us;
+	ktime_t t;
+	int i;
+
+	t = ktime_get();
+	for (i = 0; i < iterations; i++)
+		__copy_page_arm(dst, src);
+	arm_us = ktime_us_delta(ktime_get(), t);
+
+	memset(dst, 0, PAGE_SIZE);
+	t = ktime_get();
+	for (i = 0; i < iterations; i++)
+		copy_page(dst, src);
+	neon_us = ktime_us_delta(ktime_get(), t);
+
+	printk(KERN_INFO "copy_neon_bench: copy_page        : arm %4u neon %4u MB/s%s\n",
+	       bench_mbps(PAGE_SIZE, arm_us), bench_mbps(PAGE_SIZE, neon_us),
+	       memcmp(dst, src, PAGE_SIZE) ? " MISMATCH" : "");
+}
+
+static int __init copy_neon_bench_init(void)
+{
+	unsigned int order = get_order(max_kb * 1024 + 1);
+	u8 *src, *dst;
+	size_t len;
+	int i;
+
+	src = (u8 *)__get_free_pages(GFP_KERNEL, order);
+	dst = (u8 *)__get_free_pages(GFP_KERNEL, order);
+	if (!src || !dst) {
+		printk(KERN_ERR "copy_neon_bench: cannot allocate 2 x %uKB\n", max_kb);
+		goto out;
+	}
+
+	for (i = 0; i < (PAGE_SIZE << order); i++)
+		src[i] = i * 7 + (i >> 8);
+
+	for (len = 256; len <= max_kb * 1024; len *= 4)
+		bench_memcpy(dst, src, len);
+	bench_copy_page(dst, src);
+
+out:
+	if (src)
+		free_pages((unsigned long)src, order);
+	if (dst)
+		free_pages((unsigned long)dst, order);
+	return 0;
+}
+
+static void __exit copy_neon_bench_exit(void)
+{
+}
+
+module_init(copy_neon_bench_init);
+module_exit(copy_neon_bench_exit);
+
+MODULE_DESCRIPTION("ARM vs NEON memcpy/copy_page benchmark");
+MODULE_LICENSE("GPL");
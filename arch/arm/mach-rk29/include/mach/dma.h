@@ -19,7 +19,8 @@ enum rk29_dma_buffresult {
 enum rk29_dmasrc {
 	RK29_DMASRC_HW,		/* source is memory */
 	RK29_DMASRC_MEM,		/* source is hardware */
-	RK29_DMASRC_MEMTOMEM
+	RK29_DMASRC_MEMTOMEM,
+	RK29_DMASRC_MEMSET		/* fixed source word, e.g. for fills */
 };
 
 /* enum rk29_chan_op
@@ -95,6 +96,17 @@ extern int rk29_dma_free(unsigned int channel, struct rk29_dma_client *);
 extern int rk29_dma_enqueue(unsigned int channel, void *id,
 			       dma_addr_t data, int size);
 
+/* rk29_dma_enqueue_sg
+ *
+ * place a dma-mapped scatterlist of up to RK29_DMA_SG_MAX entries onto
+ * the queue as a single operation; the callback fires once, with the
+ * total length, when the last segment completes.
+*/
+
+struct scatterlist;
+extern int rk29_dma_enqueue_sg(unsigned int channel, void *id,
+			       struct scatterlist *sg, int nents);
+
 /* rk29_dma_config
  *
  * configure the dma channel
@@ -0,0 +1,58 @@
+/*
+ * arch/arm/mach-rk29/include/mach/memcpy_dma.h
+ *
+ * Memory to memory copies and fills on the PL330 DMAC0 memtomem channel.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef __MACH_RK29_MEMCPY_DMA_H
+#define __MACH_RK29_MEMCPY_DMA_H
+
+#include <linux/types.h>
+#include <linux/list.h>
+
+/* dst, src and len of an async request must be multiples of this */
+#define RK29_MEMCPY_DMA_ALIGN	8
+
+struct rk29_memcpy_req {
+	dma_addr_t	dst;
+	dma_addr_t	src;		/* copies only */
+	size_t		len;
+	int		value;		/* fills only: the byte to store */
+
+	/* called from tasklet context; result is 0 or -EIO */
+	void		(*complete)(struct rk29_memcpy_req *req, int result);
+	void		*context;
+
+	/* private to memcpy_dma.c */
+	struct list_head node;
+	int		fill;
+	int		pending;
+	int		result;
+	int		slot;
+};
+
+/*
+ * Queue a copy or fill of bus addresses; the caller owns cache
+ * maintenance.  Requests run in submission order.  Safe from atomic
+ * context.
+ */
+extern int rk29_memcpy_dma_async(struct rk29_memcpy_req *req);
+extern int rk29_memset_dma_async(struct rk29_memcpy_req *req);
+
+/* Wait until everything queued so far has completed. */
+extern void rk29_memcpy_dma_flush(void);
+
+/*
+ * Drop-in memcpy()/memset() for lowmem kernel buffers.  Copies below
+ * the "threshold" parameter, or that DMA cannot take, stay on the CPU.
+ * May sleep when the DMA is used.
+ */
+extern void *rk29_memcpy(void *dst, const void *src, size_t len);
+extern void *rk29_memset(void *dst, int c, size_t len);
+
+#endif /* __MACH_RK29_MEMCPY_DMA_H */
@@ -14,6 +14,9 @@
 #define RK29_DMAF_AUTOSTART		(1 << 0)
 #define RK29_DMAF_CIRCULAR		(1 << 1)
 
+/* Max segments rk29_dma_enqueue_sg() chains into one request */
+#define RK29_DMA_SG_MAX			16
+
 /*
  * PL330 can assign any channel to communicate with
  * any of the peripherals attched to the DMAC.
@@ -73,4 +76,10 @@ struct rk29_pl330_platdata {
 
 #include <mach/dma.h>
 
+#ifdef CONFIG_RK29_DMA_ENGINE
+/* dmaengine filter: param is the enum dma_ch of the wanted channel */
+struct dma_chan;
+extern bool rk29_dma_filter(struct dma_chan *chan, void *param);
+#endif
+
 #endif	/* __RK29_DMA_PL330_H_ */
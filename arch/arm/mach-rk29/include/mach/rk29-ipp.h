@@ -1,6 +1,8 @@
 #ifndef _RK29_IPP_DRIVER_H_
 #define _RK29_IPP_DRIVER_H_
 
+#include <linux/list.h>
+#include <linux/completion.h>
 
 #define IPP_BLIT_SYNC	0x5017
 #define IPP_BLIT_ASYNC  0x5018
@@ -129,4 +131,24 @@ typedef enum
 
 int ipp_blit_async(const struct rk29_ipp_req *req);
 int ipp_blit_sync(const struct rk29_ipp_req *req);
+
+/*
+ * Queued blits: the requests of a job run back to back, then
+ * complete(job, ret) is called from the queue's worker thread.
+ * ret is the first failing ipp_blit_sync() result, nr_done the
+ * number of requests that finished before it.
+ */
+struct rk29_ipp_job {
+	struct rk29_ipp_req	*reqs;
+	int			nr_reqs;
+	void			(*complete)(struct rk29_ipp_job *job, int ret);
+
+	int			nr_done;
+	struct list_head	node;
+	struct completion	done;
+};
+
+int ipp_queue_job(struct rk29_ipp_job *job);
+void ipp_job_wait(struct rk29_ipp_job *job);
+void ipp_queue_flush(void);
 #endif /*_RK29_IPP_DRIVER_H_*/
\ No newline at end of file
@@ -1,3 +1,14 @@
+/*
+ * arch/arm/mach-rk29/memcpy_dma.c
+ *
+ * Memory to memory copies and fills on the PL330 DMAC0 memtomem channel.
+ *
+ * Requests are kept on a software submission queue and handed to the
+ * channel up to RK29_MEMCPY_DMA_DEPTH at a time, split into chunks the
+ * PL330 microcode can loop over.  Fills use the same channel with a
+ * fixed source word, so the channel only switches between copies and
+ * fills once it has drained.  Completions are run from a tasklet.
+ */
 #include <linux/module.h>
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
@@ -5,21 +16,60 @@
 #include <linux/io.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
+#include <linux/hardirq.h>
+#include <linux/string.h>
 
 #include <mach/rk29_iomap.h>
 #include <mach/rk29-dma-pl330.h>
+#include <mach/memcpy_dma.h>
 #include <asm/uaccess.h>
 #include <asm/current.h>
 
+#define RK29_MEMCPY_DMA_CH	DMACH_DMAC0_MEMTOMEM
+#define RK29_MEMCPY_DMA_DEPTH	16		/* requests handed to the channel at once */
+#define RK29_MEMCPY_DMA_CHUNK	(1024 * 1024)	/* bytes per PL330 xfer */
 
-static DECLARE_WAIT_QUEUE_HEAD(wq);
-static int wq_condition = 0;
-//wait_queue_head_t	dma_memcpy_wait;
+static unsigned int rk29_memcpy_threshold = 128 * 1024;
+module_param_named(threshold, rk29_memcpy_threshold, uint, 0644);
+MODULE_PARM_DESC(threshold, "smallest rk29_memcpy()/rk29_memset() sent to the DMA, in bytes");
 
 static struct rk29_dma_client rk29_dma_memcpy_client = {
         .name = "rk29-dma-memcpy",
 };
 
+struct rk29_memcpy_stats {
+	unsigned long cpu_calls;
+	unsigned long long cpu_bytes;
+	unsigned long dma_reqs;
+	unsigned long long dma_bytes;
+	unsigned long errors;
+};
+
+static struct platform_device *rk29_memcpy_pdev;
+static int rk29_memcpy_ready;
+
+/* rk29_memcpy_lock covers the lists and counters; it is taken from the DMA callback */
+static DEFINE_SPINLOCK(rk29_memcpy_lock);
+/* rk29_memcpy_hw_lock keeps each devconfig + enqueue pair together */
+static DEFINE_SPINLOCK(rk29_memcpy_hw_lock);
+static LIST_HEAD(rk29_memcpy_queue);
+static LIST_HEAD(rk29_memcpy_active);
+static LIST_HEAD(rk29_memcpy_done);
+static int rk29_memcpy_inflight;
+static int rk29_memcpy_outstanding;
+static int rk29_memcpy_fill_mode;
+static unsigned long rk29_memcpy_slots;
+static DECLARE_WAIT_QUEUE_HEAD(rk29_memcpy_wait);
+static struct rk29_memcpy_stats rk29_memcpy_stats;
+
+/* one fill word per in-flight request */
+static u8 *rk29_memcpy_pattern;
+static dma_addr_t rk29_memcpy_pattern_dma;
+
+static void rk29_memcpy_tasklet_fn(unsigned long data);
+static DECLARE_TASKLET(rk29_memcpy_tasklet, rk29_memcpy_tasklet_fn, 0);
 
 struct Dma_MemToMem {
 	int SrcAddr;
@@ -27,34 +77,296 @@ struct Dma_MemToMem {
 	int MenSize;
 };
 
+/* Drop one reference on @req; the last one moves it to the done list. */
+static void rk29_memcpy_put(struct rk29_memcpy_req *req, enum rk29_dma_buffresult result)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rk29_memcpy_lock, flags);
+	if (result != RK29_RES_OK)
+		req->result = -EIO;
+	if (--req->pending == 0) {
+		list_move_tail(&req->node, &rk29_memcpy_done);
+		rk29_memcpy_inflight--;
+		if (req->fill)
+			clear_bit(req->slot, &rk29_memcpy_slots);
+		tasklet_schedule(&rk29_memcpy_tasklet);
+	}
+	spin_unlock_irqrestore(&rk29_memcpy_lock, flags);
+}
 
 static void rk29_dma_memcpy_callback(void *buf_id, int size, enum rk29_dma_buffresult result)
 {
-    wq_condition = 1;
- 	wake_up_interruptible(&wq);
-	//wake_up_interruptible(&dma_memcpy_wait);
+	if (buf_id)
+		rk29_memcpy_put(buf_id, result);
+}
+
+/* Hand @req to the channel, chunk by chunk; called with rk29_memcpy_hw_lock held. */
+static void rk29_memcpy_start(struct rk29_memcpy_req *req)
+{
+	enum rk29_dmasrc type = req->fill ? RK29_DMASRC_MEMSET : RK29_DMASRC_MEMTOMEM;
+	dma_addr_t src;
+	size_t off, n;
+	int ret;
+
+	for (off = 0; off < req->len; off += n) {
+		n = min_t(size_t, req->len - off, RK29_MEMCPY_DMA_CHUNK);
+		if (req->fill)
+			src = rk29_memcpy_pattern_dma + req->slot * RK29_MEMCPY_DMA_ALIGN;
+		else
+			src = req->src + off;
+
+		spin_lock(&rk29_memcpy_lock);
+		req->pending++;
+		spin_unlock(&rk29_memcpy_lock);
+
+		ret = rk29_dma_devconfig(RK29_MEMCPY_DMA_CH, type, src);
+		if (!ret)
+			ret = rk29_dma_enqueue(RK29_MEMCPY_DMA_CH, req, req->dst + off, n);
+		if (ret) {
+			rk29_memcpy_put(req, RK29_RES_ERR);
+			break;
+		}
+	}
+	/* drop the reference taken when the request was activated */
+	rk29_memcpy_put(req, RK29_RES_OK);
+}
+
+/* Move as many queued requests to the channel as it may take. */
+static void rk29_memcpy_kick(void)
+{
+	struct rk29_memcpy_req *req;
+	unsigned long flags;
+	int started = 0;
+
+	spin_lock_irqsave(&rk29_memcpy_hw_lock, flags);
+	for (;;) {
+		spin_lock(&rk29_memcpy_lock);
+		if (list_empty(&rk29_memcpy_queue) ||
+		    rk29_memcpy_inflight >= RK29_MEMCPY_DMA_DEPTH) {
+			spin_unlock(&rk29_memcpy_lock);
+			break;
+		}
+		req = list_first_entry(&rk29_memcpy_queue, struct rk29_memcpy_req, node);
+		if (rk29_memcpy_inflight && req->fill != rk29_memcpy_fill_mode) {
+			/* the channel config is shared: let it drain first */
+			spin_unlock(&rk29_memcpy_lock);
+			break;
+		}
+		rk29_memcpy_fill_mode = req->fill;
+		rk29_memcpy_inflight++;
+		list_move_tail(&req->node, &rk29_memcpy_active);
+		req->pending = 1;
+		if (req->fill) {
+			req->slot = find_first_zero_bit(&rk29_memcpy_slots, RK29_MEMCPY_DMA_DEPTH);
+			set_bit(req->slot, &rk29_memcpy_slots);
+			memset(rk29_memcpy_pattern + req->slot * RK29_MEMCPY_DMA_ALIGN,
+			       req->value, RK29_MEMCPY_DMA_ALIGN);
+		}
+		spin_unlock(&rk29_memcpy_lock);
+
+		rk29_memcpy_start(req);
+		started = 1;
+	}
+	spin_unlock_irqrestore(&rk29_memcpy_hw_lock, flags);
+
+	if (started)
+		rk29_dma_ctrl(RK29_MEMCPY_DMA_CH, RK29_DMAOP_START);
+}
+
+static void rk29_memcpy_tasklet_fn(unsigned long data)
+{
+	struct rk29_memcpy_req *req, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+	int n = 0;
+
+	spin_lock_irqsave(&rk29_memcpy_lock, flags);
+	list_splice_init(&rk29_memcpy_done, &done);
+	spin_unlock_irqrestore(&rk29_memcpy_lock, flags);
+
+	rk29_memcpy_kick();
+
+	list_for_each_entry_safe(req, tmp, &done, node) {
+		list_del(&req->node);
+		if (req->result)
+			rk29_memcpy_stats.errors++;
+		if (req->complete)
+			req->complete(req, req->result);
+		n++;
+	}
+
+	spin_lock_irqsave(&rk29_memcpy_lock, flags);
+	rk29_memcpy_outstanding -= n;
+	spin_unlock_irqrestore(&rk29_memcpy_lock, flags);
+	wake_up_all(&rk29_memcpy_wait);
 }
 
-//int slecount = 0;
+static int rk29_memcpy_submit(struct rk29_memcpy_req *req, int fill)
+{
+	unsigned long flags;
+
+	if (!rk29_memcpy_ready)
+		return -ENODEV;
+	if (!req->len || ((req->dst | req->len | (fill ? 0 : req->src)) & (RK29_MEMCPY_DMA_ALIGN - 1)))
+		return -EINVAL;
+
+	req->fill = fill;
+	req->pending = 0;
+	req->result = 0;
+
+	spin_lock_irqsave(&rk29_memcpy_lock, flags);
+	list_add_tail(&req->node, &rk29_memcpy_queue);
+	rk29_memcpy_outstanding++;
+	rk29_memcpy_stats.dma_reqs++;
+	rk29_memcpy_stats.dma_bytes += req->len;
+	spin_unlock_irqrestore(&rk29_memcpy_lock, flags);
+
+	rk29_memcpy_kick();
+	return 0;
+}
+
+int rk29_memcpy_dma_async(struct rk29_memcpy_req *req)
+{
+	return rk29_memcpy_submit(req, 0);
+}
+EXPORT_SYMBOL(rk29_memcpy_dma_async);
+
+int rk29_memset_dma_async(struct rk29_memcpy_req *req)
+{
+	return rk29_memcpy_submit(req, 1);
+}
+EXPORT_SYMBOL(rk29_memset_dma_async);
+
+static int rk29_memcpy_idle(void)
+{
+	unsigned long flags;
+	int idle;
+
+	spin_lock_irqsave(&rk29_memcpy_lock, flags);
+	idle = !rk29_memcpy_outstanding;
+	spin_unlock_irqrestore(&rk29_memcpy_lock, flags);
+	return idle;
+}
+
+void rk29_memcpy_dma_flush(void)
+{
+	wait_event(rk29_memcpy_wait, rk29_memcpy_idle());
+}
+EXPORT_SYMBOL(rk29_memcpy_dma_flush);
+
+static void rk29_memcpy_sync_done(struct rk29_memcpy_req *req, int result)
+{
+	complete(req->context);
+}
+
+/* Whether a synchronous call for @len bytes at @dst/@src should use the DMA. */
+static int rk29_memcpy_use_dma(void *dst, const void *src, size_t len)
+{
+	if (!rk29_memcpy_ready || len < rk29_memcpy_threshold ||
+	    len < RK29_MEMCPY_DMA_ALIGN || in_atomic() || irqs_disabled())
+		return 0;
+	if (((unsigned long)dst | (unsigned long)src) & (RK29_MEMCPY_DMA_ALIGN - 1))
+		return 0;
+	/* the buffers must be in the linear map to be physically contiguous */
+	if (!virt_addr_valid(dst) || !virt_addr_valid(dst + len - 1))
+		return 0;
+	if (src && (!virt_addr_valid(src) || !virt_addr_valid(src + len - 1)))
+		return 0;
+	return 1;
+}
+
+static int rk29_memcpy_sync(void *dst, const void *src, int c, size_t len)
+{
+	struct device *dev = &rk29_memcpy_pdev->dev;
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct rk29_memcpy_req req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.len = len;
+	req.value = c;
+	req.complete = rk29_memcpy_sync_done;
+	req.context = &done;
+
+	if (src)
+		req.src = dma_map_single(dev, (void *)src, len, DMA_TO_DEVICE);
+	req.dst = dma_map_single(dev, dst, len, DMA_FROM_DEVICE);
+
+	ret = rk29_memcpy_submit(&req, src ? 0 : 1);
+	if (!ret) {
+		wait_for_completion(&done);
+		ret = req.result;
+	}
+
+	dma_unmap_single(dev, req.dst, len, DMA_FROM_DEVICE);
+	if (src)
+		dma_unmap_single(dev, req.src, len, DMA_TO_DEVICE);
+	return ret;
+}
+
+void *rk29_memcpy(void *dst, const void *src, size_t len)
+{
+	size_t body = len & ~(RK29_MEMCPY_DMA_ALIGN - 1);
+
+	if (rk29_memcpy_use_dma(dst, src, len) && !rk29_memcpy_sync(dst, src, 0, body)) {
+		memcpy(dst + body, src + body, len - body);
+		return dst;
+	}
+
+	rk29_memcpy_stats.cpu_calls++;
+	rk29_memcpy_stats.cpu_bytes += len;
+	return memcpy(dst, src, len);
+}
+EXPORT_SYMBOL(rk29_memcpy);
+
+void *rk29_memset(void *dst, int c, size_t len)
+{
+	size_t body = len & ~(RK29_MEMCPY_DMA_ALIGN - 1);
+
+	if (rk29_memcpy_use_dma(dst, NULL, len) && !rk29_memcpy_sync(dst, NULL, c, body)) {
+		memset(dst + body, c, len - body);
+		return dst;
+	}
+
+	rk29_memcpy_stats.cpu_calls++;
+	rk29_memcpy_stats.cpu_bytes += len;
+	return memset(dst, c, len);
+}
+EXPORT_SYMBOL(rk29_memset);
+
 static ssize_t memcpy_dma_read(struct device *device,struct device_attribute *attr, char *argv)
 {
+	struct rk29_memcpy_stats *s = &rk29_memcpy_stats;
 
-     return 0;
+	return sprintf(argv, "threshold=%u dma=%lu/%lluB cpu=%lu/%lluB errors=%lu outstanding=%d\n",
+		       rk29_memcpy_threshold, s->dma_reqs, s->dma_bytes,
+		       s->cpu_calls, s->cpu_bytes, s->errors, rk29_memcpy_outstanding);
 }
 
+/* Test hook: copy MenSize bytes between the bus addresses passed in a struct Dma_MemToMem. */
 static ssize_t memcpy_dma_write(struct device *device, struct device_attribute *attr, const char *argv, size_t count)
 {
-    int rt;
-    struct Dma_MemToMem  *DmaMemInfo = (struct Dma_MemToMem *)argv;
- 
-    rt = rk29_dma_devconfig(DMACH_DMAC0_MEMTOMEM, RK29_DMASRC_MEMTOMEM, DmaMemInfo->SrcAddr);
-    rt = rk29_dma_enqueue(DMACH_DMAC0_MEMTOMEM, NULL, DmaMemInfo->DstAddr, DmaMemInfo->MenSize);
-    rt = rk29_dma_ctrl(DMACH_DMAC0_MEMTOMEM, RK29_DMAOP_START);    
-    wait_event_interruptible_timeout(wq, wq_condition, 200);
-    wq_condition = 0;  
-	//init_waitqueue_head(&dma_memcpy_wait);
-	//interruptible_sleep_on(&dma_memcpy_wait);
-    return 0;
+	struct Dma_MemToMem *DmaMemInfo = (struct Dma_MemToMem *)argv;
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct rk29_memcpy_req req;
+	int ret;
+
+	if (count < sizeof(*DmaMemInfo))
+		return -EINVAL;
+
+	memset(&req, 0, sizeof(req));
+	req.src = DmaMemInfo->SrcAddr;
+	req.dst = DmaMemInfo->DstAddr;
+	req.len = DmaMemInfo->MenSize;
+	req.complete = rk29_memcpy_sync_done;
+	req.context = &done;
+
+	ret = rk29_memcpy_dma_async(&req);
+	if (ret)
+		return ret;
+	wait_for_completion(&done);
+	return req.result ? req.result : count;
 }
 
 static DEVICE_ATTR(dmamemcpy,  S_IRUGO|S_IALLUGO, memcpy_dma_read, memcpy_dma_write);
@@ -63,31 +375,49 @@ static DEVICE_ATTR(dmamemcpy,  S_IRUGO|S_IALLUGO, memcpy_dma_read, memcpy_dma_wr
 static int __devinit dma_memcpy_probe(struct platform_device *pdev)
 {
     int ret;
-      
+
+    rk29_memcpy_pattern = dma_alloc_coherent(&pdev->dev,
+		    RK29_MEMCPY_DMA_DEPTH * RK29_MEMCPY_DMA_ALIGN,
+		    &rk29_memcpy_pattern_dma, GFP_KERNEL);
+    if (!rk29_memcpy_pattern)
+        return -ENOMEM;
+
+    ret = rk29_dma_request(RK29_MEMCPY_DMA_CH, &rk29_dma_memcpy_client, NULL);
+    if (ret) {
+        dma_free_coherent(&pdev->dev, RK29_MEMCPY_DMA_DEPTH * RK29_MEMCPY_DMA_ALIGN,
+                          rk29_memcpy_pattern, rk29_memcpy_pattern_dma);
+        return ret;
+    }
+    rk29_dma_config(RK29_MEMCPY_DMA_CH, 8, 16);
+    rk29_dma_set_buffdone_fn(RK29_MEMCPY_DMA_CH, rk29_dma_memcpy_callback);
+    rk29_memcpy_pdev = pdev;
+    rk29_memcpy_ready = 1;
+
     ret = device_create_file(&pdev->dev, &dev_attr_dmamemcpy);
-    rk29_dma_request(DMACH_DMAC0_MEMTOMEM, &rk29_dma_memcpy_client, NULL); 
-    rk29_dma_config(DMACH_DMAC0_MEMTOMEM, 8, 16);
-    rk29_dma_set_buffdone_fn(DMACH_DMAC0_MEMTOMEM, rk29_dma_memcpy_callback);
     if(ret)
     {
-        printk(">> fb1 dsp win0 info device_create_file err\n");
-        ret = -EINVAL;
+        printk(">> dma memcpy device_create_file err\n");
     }
-   // printk(">>>>>>>>>>>>>>>>>>>>> dam_test_probe ok>>>>>>>>>>>>>>>>>>>>>>>>");        
     return 0;
 }
 
 static int __devexit dma_memcpy_remove(struct platform_device *pdev)
 {
     device_remove_file(&pdev->dev, &dev_attr_dmamemcpy);
-  
+
+    rk29_memcpy_ready = 0;
+    rk29_memcpy_dma_flush();
+    tasklet_kill(&rk29_memcpy_tasklet);
+    rk29_dma_free(RK29_MEMCPY_DMA_CH, &rk29_dma_memcpy_client);
+    dma_free_coherent(&pdev->dev, RK29_MEMCPY_DMA_DEPTH * RK29_MEMCPY_DMA_ALIGN,
+                      rk29_memcpy_pattern, rk29_memcpy_pattern_dma);
     return 0;
 }
 
 static struct platform_driver dma_mempcy_driver = {
         .driver = {
                 .name   = "dma_memcpy",
-                .owner  = THIS_MODULE,                
+                .owner  = THIS_MODULE,
         },
         .probe          = dma_memcpy_probe,
         .remove         = __devexit_p(dma_memcpy_remove),
@@ -107,10 +437,6 @@ static void __exit dma_test_exit(void)
 module_init(dma_test_init);
 module_exit(dma_test_exit);
 
-MODULE_DESCRIPTION("RK29 PL330 Dma Test Deiver");
+MODULE_DESCRIPTION("RK29 PL330 Dma memcpy/memset offload");
 MODULE_LICENSE("GPL V2");
 MODULE_AUTHOR("ZhenFu Fang <fzf@rock-chips.com>");
-
-
-
-
@@ -0,0 +1,149 @@
+/*
+ * arch/arm/mach-rk29/memcpy_dma_bench.c
+ *
+ * Load to compare the CPU memcpy() (arch/arm/lib/memcpy.S) against the
+ * PL330 offload in memcpy_dma.c over a range of sizes; results go to
+ * the kernel log and the module stays loaded doing nothing.
+ *
+ * For each size three figures are printed, in MB/s:
+ *   cpu   - memcpy()
+ *   dma   - rk29_memcpy_dma_async() on premapped buffers, so DMA only
+ *   sync  - dma_map_single() + DMA + unmap, what rk29_memcpy() costs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <mach/memcpy_dma.h>
+
+static unsigned int max_kb = 4096;
+module_param(max_kb, uint, 0444);
+MODULE_PARM_DESC(max_kb, "largest copy to measure, in KB");
+
+static unsigned int iterations = 16;
+module_param(iterations, uint, 0444);
+
+static void bench_done(struct rk29_memcpy_req *req, int result)
+{
+	complete(req->context);
+}
+
+static int bench_dma(dma_addr_t dst, dma_addr_t src, size_t len)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct rk29_memcpy_req req;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.dst = dst;
+	req.src = src;
+	req.len = len;
+	req.complete = bench_done;
+	req.context = &done;
+
+	ret = rk29_memcpy_dma_async(&req);
+	if (ret)
+		return ret;
+	wait_for_completion(&done);
+	return req.result;
+}
+
+static unsigned int bench_mbps(size_t len, s64 us)
+{
+	if (us <= 0)
+		return 0;
+	return (unsigned int)div64_u64((u64)len * iterations, (u64)us);
+}
+
+static void bench_size(u8 *dst, u8 *src, size_t len)
+{
+	dma_addr_t dma_dst, dma_src;
+	s64 cpu_us, dma_us, sync_us;
+	ktime_t t;
+	int i, ret = 0;
+
+	t = ktime_get();
+	for (i = 0; i < iterations; i++)
+		memcpy(dst, src, len);
+	cpu_us = ktime_us_delta(ktime_get(), t);
+
+	memset(dst, 0, len);
+	dma_src = dma_map_single(NULL, src, len, DMA_TO_DEVICE);
+	dma_dst = dma_map_single(NULL, dst, len, DMA_FROM_DEVICE);
+	t = ktime_get();
+	for (i = 0; i < iterations && !ret; i++)
+		ret = bench_dma(dma_dst, dma_src, len);
+	dma_us = ktime_us_delta(ktime_get(), t);
+	dma_unmap_single(NULL, dma_dst, len, DMA_FROM_DEVICE);
+	dma_unmap_single(NULL, dma_src, len, DMA_TO_DEVICE);
+	if (!ret && memcmp(dst, src, len))
+		ret = -EIO;
+
+	t = ktime_get();
+	for (i = 0; i < iterations && !ret; i++) {
+		dma_src = dma_map_single(NULL, src, len, DMA_TO_DEVICE);
+		dma_dst = dma_map_single(NULL, dst, len, DMA_FROM_DEVICE);
+		ret = bench_dma(dma_dst, dma_src, len);
+		dma_unmap_single(NULL, dma_dst, len, DMA_FROM_DEVICE);
+		dma_unmap_single(NULL, dma_src, len, DMA_TO_DEVICE);
+	}
+	sync_us = ktime_us_delta(ktime_get(), t);
+
+	if (ret) {
+		printk(KERN_ERR "memcpy_dma_bench: %8zu bytes: dma failed (%d)\n", len, ret);
+		return;
+	}
+	printk(KERN_INFO "memcpy_dma_bench: %8zu bytes: cpu %4u dma %4u sync %4u MB/s\n",
+	       len, bench_mbps(len, cpu_us), bench_mbps(len, dma_us), bench_mbps(len, sync_us));
+}
+
+static int __init memcpy_dma_bench_init(void)
+{
+	unsigned int order = get_order(max_kb * 1024);
+	u8 *src, *dst;
+	size_t len;
+	int i;
+
+	src = (u8 *)__get_free_pages(GFP_KERNEL, order);
+	dst = (u8 *)__get_free_pages(GFP_KERNEL, order);
+	if (!src || !dst) {
+		printk(KERN_ERR "memcpy_dma_bench: cannot allocate 2 x %uKB\n", max_kb);
+		goto out;
+	}
+
+	for (i = 0; i < (PAGE_SIZE << order); i++)
+		src[i] = i * 7 + (i >> 8);
+
+	for (len = 4096; len <= max_kb * 1024; len *= 4)
+		bench_size(dst, src, len);
+
+out:
+	if (src)
+		free_pages((unsigned long)src, order);
+	if (dst)
+		free_pages((unsigned long)dst, order);
+	return 0;
+}
+
+static void __exit memcpy_dma_bench_exit(void)
+{
+}
+
+module_init(memcpy_dma_bench_init);
+module_exit(memcpy_dma_bench_exit);
+
+MODULE_DESCRIPTION("RK29 PL330 memcpy offload benchmark");
+MODULE_LICENSE("GPL");
@@ -15,6 +15,7 @@
 #include <linux/io.h>
 #include <linux/slab.h>
 #include <linux/platform_device.h>
+#include <linux/scatterlist.h>
 
 #include <asm/hardware/pl330.h>
 
@@ -42,14 +43,24 @@ struct rk29_pl330_dmac {
  * @node: To attach to the list of xfers on a channel.
  * @px: Xfer for PL330 core.
  * @chan: Owner channel of this xfer.
+ * @len: Total bytes of @px and every xfer chained after it.
+ * @sg: Xfers chained after @px for a scatterlist enqueue, NULL otherwise.
  */
 struct rk29_pl330_xfer {
 	void			*token;
 	struct list_head	node;
 	struct pl330_xfer	px;
 	struct rk29_pl330_chan	*chan;
+	u32			len;
+	struct pl330_xfer	*sg;
 };
 
+/*
+ * Microcode buffer per channel thread, half for each of the two
+ * requests.  Big enough for RK29_DMA_SG_MAX chained xfers.
+ */
+#define RK29_PL330_MCBUFSZ	2048
+
 /**
  * struct rk29_pl330_chan - Logical channel to communicate with
  * 	a Physical peripheral.
@@ -411,11 +422,13 @@ static inline void _finish_off(struct rk29_pl330_xfer *xfer,
 	/* Do callback */
 
 	if (ch->callback_fn)
-		ch->callback_fn(xfer->token, xfer->px.bytes, res);
+		ch->callback_fn(xfer->token, xfer->len, res);
 
 	/* Force Free or if buffer is not needed anymore */
-	if (ffree || !(ch->options & RK29_DMAF_CIRCULAR))
+	if (ffree || !(ch->options & RK29_DMAF_CIRCULAR)) {
+		kfree(xfer->sg);
 		kmem_cache_free(ch->dmac->kmcache, xfer);
+	}
 }
 
 static inline int rk29_pl330_submit(struct rk29_pl330_chan *ch,
@@ -437,7 +450,7 @@ static inline int rk29_pl330_submit(struct rk29_pl330_chan *ch,
 		if (r->rqtype == MEMTOMEM) {
 			struct pl330_info *pi = xfer->chan->dmac->pi;
 			int burst = 1 << ch->rqcfg.brst_size;
-			u32 bytes = r->x->bytes;
+			struct pl330_xfer *x;
 			int bl;
 
 			bl = pi->pcfg.data_bus_width / 8;
@@ -448,8 +461,12 @@ static inline int rk29_pl330_submit(struct rk29_pl330_chan *ch,
 			if (bl > 16)
 				bl = 16;
 
+			/* Every chained xfer must be a multiple of the burst */
 			while (bl > 1) {
-				if (!(bytes % (bl * burst)))
+				for (x = r->x; x; x = x->next)
+					if (x->bytes % (bl * burst))
+						break;
+				if (!x)
 					break;
 				bl--;
 			}
@@ -695,6 +712,8 @@ int rk29_dma_enqueue(enum dma_ch id, void *token,
 	xfer->chan = ch;
 	xfer->px.bytes = size;
 	xfer->px.next = NULL; /* Single request */
+	xfer->len = size;
+	xfer->sg = NULL;
 
 	/* For rk29 DMA API, direction is always fixed for all xfers */
 	if (ch->req[0].rqtype == MEMTODEV) {
@@ -729,6 +748,105 @@ enq_exit:
 }
 EXPORT_SYMBOL(rk29_dma_enqueue);
 
+/*
+ * Queue a whole scatterlist as one request: the segments are chained
+ * into a single PL330 microcode program, so the client gets one
+ * callback (with the total length) instead of one per segment.
+ */
+int rk29_dma_enqueue_sg(enum dma_ch id, void *token,
+			struct scatterlist *sgl, int nents)
+{
+	struct rk29_pl330_chan *ch;
+	struct rk29_pl330_xfer *xfer;
+	struct pl330_xfer *px;
+	struct scatterlist *sg;
+	unsigned long flags;
+	int i, idx, ret = 0;
+
+	if (nents < 1 || nents > RK29_DMA_SG_MAX)
+		return -EINVAL;
+
+	spin_lock_irqsave(&res_lock, flags);
+
+	ch = id_to_chan(id);
+
+	/* Error if invalid or free channel */
+	if (!ch || chan_free(ch)) {
+		ret = -EINVAL;
+		goto enq_exit;
+	}
+
+	/* Error if any segment is unaligned */
+	for_each_sg(sgl, sg, nents, i) {
+		if (!sg_dma_len(sg) || (ch->rqcfg.brst_size &&
+				sg_dma_len(sg) % (1 << ch->rqcfg.brst_size))) {
+			ret = -EINVAL;
+			goto enq_exit;
+		}
+	}
+
+	xfer = kmem_cache_alloc(ch->dmac->kmcache, GFP_ATOMIC);
+	if (!xfer) {
+		ret = -ENOMEM;
+		goto enq_exit;
+	}
+
+	xfer->sg = NULL;
+	if (nents > 1) {
+		xfer->sg = kmalloc((nents - 1) * sizeof(*px), GFP_ATOMIC);
+		if (!xfer->sg) {
+			kmem_cache_free(ch->dmac->kmcache, xfer);
+			ret = -ENOMEM;
+			goto enq_exit;
+		}
+	}
+
+	xfer->token = token;
+	xfer->chan = ch;
+	xfer->len = 0;
+
+	px = &xfer->px;
+	for_each_sg(sgl, sg, nents, i) {
+		if (i)
+			px = px->next;
+		px->bytes = sg_dma_len(sg);
+		px->next = i + 1 < nents ? &xfer->sg[i] : NULL;
+
+		/* For rk29 DMA API, direction is always fixed for all xfers */
+		if (ch->req[0].rqtype == MEMTODEV) {
+			px->src_addr = sg_dma_address(sg);
+			px->dst_addr = ch->sdaddr;
+		} else {
+			px->src_addr = ch->sdaddr;
+			px->dst_addr = sg_dma_address(sg);
+		}
+		xfer->len += px->bytes;
+	}
+
+	add_to_queue(ch, xfer, 0);
+
+	/* Try submitting on either request */
+	idx = (ch->lrq == &ch->req[0]) ? 1 : 0;
+
+	if (!ch->req[idx].x)
+		rk29_pl330_submit(ch, &ch->req[idx]);
+	else
+		rk29_pl330_submit(ch, &ch->req[1 - idx]);
+
+	spin_unlock_irqrestore(&res_lock, flags);
+
+	if (ch->options & RK29_DMAF_AUTOSTART)
+		rk29_dma_ctrl(id, RK29_DMAOP_START);
+
+	return 0;
+
+enq_exit:
+	spin_unlock_irqrestore(&res_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(rk29_dma_enqueue_sg);
+
 int rk29_dma_request(enum dma_ch id,
 			struct rk29_dma_client *client,
 			void *dev)
@@ -1017,6 +1135,12 @@ int rk29_dma_devconfig(enum dma_ch id, enum rk29_dmasrc source,
 		ch->rqcfg.src_inc = 1;
 		ch->rqcfg.dst_inc = 1;
                 break;
+	case RK29_DMASRC_MEMSET:
+		ch->req[0].rqtype = MEMTOMEM;
+		ch->req[1].rqtype = MEMTOMEM;
+		ch->rqcfg.src_inc = 0;
+		ch->rqcfg.dst_inc = 1;
+		break;
 	default:
 		ret = -EINVAL;
 		goto devcfg_exit;
@@ -1081,6 +1205,7 @@ static int pl330_probe(struct platform_device *pdev)
 
 	pl330_info->pl330_data = NULL;
 	pl330_info->dev = &pdev->dev;
+	pl330_info->mcbufsz = RK29_PL330_MCBUFSZ;
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res) {
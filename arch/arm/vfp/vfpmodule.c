@@ -14,11 +14,13 @@
 #include <linux/kernel.h>
 #include <linux/notifier.h>
 #include <linux/signal.h>
+#include <linux/hardirq.h>
 #include <linux/sched.h>
 #include <linux/smp.h>
 #include <linux/init.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -508,6 +510,45 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_NEON
+void kernel_neon_begin(void)
+{
+	unsigned int cpu;
+	u32 fpexc;
+
+	/*
+	 * Only outside interrupt context and with preemption disabled, so
+	 * the kernel's own NEON registers never need to be preserved.
+	 */
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * The registers may hold the state of current or, thanks to the
+	 * lazy switching on UP, of some other thread: save it either way
+	 * and let the owner reload it on its next VFP trap.
+	 */
+	if (vfp_current_hw_state[cpu]) {
+		vfp_save_state(vfp_current_hw_state[cpu], fpexc);
+#ifdef CONFIG_SMP
+		vfp_current_hw_state[cpu]->hard.cpu = cpu;
+#endif
+	}
+	vfp_current_hw_state[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+#endif
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
@@ -0,0 +1,544 @@
+/*
+ *  Flash I/O scheduler
+ *
+ *  For NAND behind an FTL and for SD/MMC cards.  There is no seek to
+ *  optimise for, so there is no idling; what hurts is a read queued
+ *  behind a long run of writes, and behind the garbage collection those
+ *  writes trigger inside the FTL.  So:
+ *
+ *  - reads are served ahead of writes, in sector order, and writes are
+ *    only passed over for writes_starved read batches;
+ *  - while reads are waiting, a write batch ends after write_batch_kb,
+ *    charged in device pages so that small unaligned writes count for
+ *    the read-modify-write they cost the FTL; a batch that is filling an
+ *    erase unit sequentially may finish it (up to twice the budget);
+ *  - sync and async requests have separate deadlines in each direction.
+ *
+ *  The page and erase unit come from the queue limits (io_min, and the
+ *  discard granularity or io_opt) unless set through sysfs.
+ *
+ *  Based on the deadline scheduler.
+ */
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/blkdev.h>
+#include <linux/elevator.h>
+#include <linux/bio.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/init.h>
+#include <linux/compiler.h>
+#include <linux/rbtree.h>
+#include <linux/log2.h>
+
+/*
+ * See Documentation/block/flash-iosched.txt
+ */
+static const int read_expire = HZ / 20;		/* sync reads */
+static const int read_async_expire = HZ / 4;	/* readahead */
+static const int write_expire = HZ / 5;		/* fsync, O_SYNC */
+static const int write_async_expire = 2 * HZ;	/* writeback */
+static const int write_batch_kb = 512;
+static const int writes_starved = 4;
+
+struct flash_data {
+	struct request_queue *queue;
+
+	/*
+	 * requests are present on both sort_list and fifo_list
+	 */
+	struct rb_root sort_list[2];
+	struct list_head fifo_list[2][2];	/* [data dir][sync] */
+
+	/*
+	 * next in sort order, and the current batch
+	 */
+	struct request *next_rq[2];
+	int batch_dir;
+	unsigned int batched;		/* pages written in this batch */
+	sector_t batch_end;
+	unsigned int starved;		/* read batches while writes wait */
+
+	/*
+	 * settings that change how the i/o scheduler behaves
+	 */
+	int fifo_expire[2][2];
+	int write_batch_kb;
+	int writes_starved;
+	unsigned int page_sectors;	/* 0: from the queue limits */
+	unsigned int erase_sectors;
+};
+
+static inline struct rb_root *
+flash_rb_root(struct flash_data *fd, struct request *rq)
+{
+	return &fd->sort_list[rq_data_dir(rq)];
+}
+
+/* Sectors, rounded down to a power of two so units can be masked. */
+static unsigned int flash_unit(unsigned int bytes)
+{
+	unsigned int sectors = bytes >> 9;
+
+	return sectors ? rounddown_pow_of_two(sectors) : 0;
+}
+
+static unsigned int flash_page_sectors(struct flash_data *fd)
+{
+	if (fd->page_sectors)
+		return fd->page_sectors;
+	return flash_unit(queue_io_min(fd->queue)) ? : 1;
+}
+
+static unsigned int flash_erase_sectors(struct flash_data *fd)
+{
+	struct queue_limits *limits = &fd->queue->limits;
+
+	if (fd->erase_sectors)
+		return fd->erase_sectors;
+	return flash_unit(limits->discard_granularity ? : limits->io_opt);
+}
+
+/* Device pages a request programs, partial pages counting in full. */
+static unsigned int flash_rq_pages(struct flash_data *fd, struct request *rq)
+{
+	unsigned int page = flash_page_sectors(fd);
+	sector_t first = blk_rq_pos(rq) & ~(sector_t)(page - 1);
+	sector_t end = (rq_end_sector(rq) + page - 1) & ~(sector_t)(page - 1);
+
+	return (end - first) >> ilog2(page);
+}
+
+/*
+ * get the request after `rq' in sector-sorted order
+ */
+static inline struct request *
+flash_latter_request(struct request *rq)
+{
+	struct rb_node *node = rb_next(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
+}
+
+static void
+flash_add_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	struct rb_root *root = flash_rb_root(fd, rq);
+	struct request *__alias;
+
+	while (unlikely(__alias = elv_rb_add(root, rq)))
+		elv_dispatch_sort(fd->queue, __alias);
+}
+
+static inline void
+flash_del_rq_rb(struct flash_data *fd, struct request *rq)
+{
+	const int data_dir = rq_data_dir(rq);
+
+	if (fd->next_rq[data_dir] == rq)
+		fd->next_rq[data_dir] = flash_latter_request(rq);
+
+	elv_rb_del(flash_rb_root(fd, rq), rq);
+}
+
+/*
+ * add rq to rbtree and fifo
+ */
+static void
+flash_add_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int data_dir = rq_data_dir(rq);
+	const int sync = rq_is_sync(rq);
+
+	flash_add_rq_rb(fd, rq);
+
+	/*
+	 * set expire time and add to fifo list
+	 */
+	rq_set_fifo_time(rq, jiffies + fd->fifo_expire[data_dir][sync]);
+	list_add_tail(&rq->queuelist, &fd->fifo_list[data_dir][sync]);
+}
+
+/*
+ * remove rq from rbtree and fifo.
+ */
+static void flash_remove_request(struct request_queue *q, struct request *rq)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	rq_fifo_clear(rq);
+	flash_del_rq_rb(fd, rq);
+}
+
+static int
+flash_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	struct request *__rq;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+
+	/*
+	 * check for front merge; back merges are found by the elevator hash
+	 */
+	__rq = elv_rb_find(&fd->sort_list[bio_data_dir(bio)], sector);
+	if (__rq) {
+		BUG_ON(sector != blk_rq_pos(__rq));
+
+		if (elv_rq_merge_ok(__rq, bio)) {
+			*req = __rq;
+			return ELEVATOR_FRONT_MERGE;
+		}
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void flash_merged_request(struct request_queue *q,
+				 struct request *req, int type)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+
+	/*
+	 * if the merge was a front merge, we need to reposition request
+	 */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(flash_rb_root(fd, req), req);
+		flash_add_rq_rb(fd, req);
+	}
+}
+
+static void
+flash_merged_requests(struct request_queue *q, struct request *req,
+		      struct request *next)
+{
+	/*
+	 * if next expires before rq, assign its expire time to rq
+	 * and move into next position (next will be deleted) in fifo
+	 */
+	if (!list_empty(&req->queuelist) && !list_empty(&next->queuelist)) {
+		if (time_before(rq_fifo_time(next), rq_fifo_time(req))) {
+			list_move(&req->queuelist, &next->queuelist);
+			rq_set_fifo_time(req, rq_fifo_time(next));
+		}
+	}
+
+	/*
+	 * kill knowledge of next, this one is a goner
+	 */
+	flash_remove_request(q, next);
+}
+
+/*
+ * move request from sort list to dispatch queue.
+ */
+static void
+flash_move_request(struct flash_data *fd, struct request *rq)
+{
+	const int data_dir = rq_data_dir(rq);
+
+	fd->next_rq[READ] = NULL;
+	fd->next_rq[WRITE] = NULL;
+	fd->next_rq[data_dir] = flash_latter_request(rq);
+
+	flash_remove_request(fd->queue, rq);
+	elv_dispatch_add_tail(fd->queue, rq);
+}
+
+/*
+ * the request at the head of a fifo, if any
+ */
+static inline struct request *
+flash_fifo_head(struct flash_data *fd, int data_dir, int sync)
+{
+	struct list_head *fifo = &fd->fifo_list[data_dir][sync];
+
+	return list_empty(fifo) ? NULL : rq_entry_fifo(fifo->next);
+}
+
+/*
+ * the expired request that has waited longest in direction data_dir,
+ * or NULL if none has expired
+ */
+static struct request *
+flash_expired_request(struct flash_data *fd, int data_dir)
+{
+	struct request *sync = flash_fifo_head(fd, data_dir, 1);
+	struct request *async = flash_fifo_head(fd, data_dir, 0);
+
+	if (sync && !time_after_eq(jiffies, rq_fifo_time(sync)))
+		sync = NULL;
+	if (async && !time_after_eq(jiffies, rq_fifo_time(async)))
+		async = NULL;
+	if (sync && async)
+		return time_before(rq_fifo_time(async), rq_fifo_time(sync)) ?
+			async : sync;
+	return sync ? : async;
+}
+
+/*
+ * whether the batch in progress should go on with rq
+ */
+static int flash_continue_batch(struct flash_data *fd, struct request *rq,
+				int reads, int writes)
+{
+	unsigned int budget, erase;
+
+	if (fd->batch_dir == READ)
+		return !flash_expired_request(fd, READ) &&
+			!(writes && flash_expired_request(fd, WRITE));
+
+	if (!reads)
+		return 1;
+	if (flash_expired_request(fd, READ))
+		return 0;
+
+	budget = fd->write_batch_kb * 2 / flash_page_sectors(fd);
+	if (fd->batched < budget)
+		return 1;
+
+	/* finish an erase unit that is being filled sequentially */
+	erase = flash_erase_sectors(fd);
+	return erase && fd->batched < 2 * budget &&
+		blk_rq_pos(rq) == fd->batch_end &&
+		(fd->batch_end & (erase - 1));
+}
+
+/*
+ * flash_dispatch_requests selects the best request according to
+ * read/write preference, deadlines and batch budgets
+ */
+static int flash_dispatch_requests(struct request_queue *q, int force)
+{
+	struct flash_data *fd = q->elevator->elevator_data;
+	const int reads = !RB_EMPTY_ROOT(&fd->sort_list[READ]);
+	const int writes = !RB_EMPTY_ROOT(&fd->sort_list[WRITE]);
+	struct request *rq;
+	int data_dir;
+
+	/*
+	 * carry on with the current batch if it may
+	 */
+	rq = fd->next_rq[fd->batch_dir];
+	if (rq && flash_continue_batch(fd, rq, reads, writes))
+		goto dispatch_request;
+
+	/*
+	 * at this point we are not running a batch. select the appropriate
+	 * data direction (read / write)
+	 */
+	if (reads) {
+		if (writes && (fd->starved++ >= fd->writes_starved ||
+			       flash_expired_request(fd, WRITE)))
+			goto dispatch_writes;
+
+		data_dir = READ;
+		goto dispatch_find_request;
+	}
+
+	if (writes) {
+dispatch_writes:
+		fd->starved = 0;
+		data_dir = WRITE;
+		goto dispatch_find_request;
+	}
+
+	return 0;
+
+dispatch_find_request:
+	/*
+	 * start with an expired request, then carry on in sort order;
+	 * failing both, sync requests go first
+	 */
+	rq = flash_expired_request(fd, data_dir);
+	if (!rq)
+		rq = fd->next_rq[data_dir];
+	if (!rq)
+		rq = flash_fifo_head(fd, data_dir, 1);
+	if (!rq)
+		rq = flash_fifo_head(fd, data_dir, 0);
+
+	fd->batch_dir = data_dir;
+	fd->batched = 0;
+
+dispatch_request:
+	if (fd->batch_dir == WRITE)
+		fd->batched += flash_rq_pages(fd, rq);
+	fd->batch_end = rq_end_sector(rq);
+	flash_move_request(fd, rq);
+
+	return 1;
+}
+
+static void flash_exit_queue(struct elevator_queue *e)
+{
+	struct flash_data *fd = e->elevator_data;
+
+	BUG_ON(!list_empty(&fd->fifo_list[READ][0]));
+	BUG_ON(!list_empty(&fd->fifo_list[READ][1]));
+	BUG_ON(!list_empty(&fd->fifo_list[WRITE][0]));
+	BUG_ON(!list_empty(&fd->fifo_list[WRITE][1]));
+
+	kfree(fd);
+}
+
+/*
+ * initialize elevator private data (flash_data).
+ */
+static void *flash_init_queue(struct request_queue *q)
+{
+	struct flash_data *fd;
+
+	fd = kmalloc_node(sizeof(*fd), GFP_KERNEL | __GFP_ZERO, q->node);
+	if (!fd)
+		return NULL;
+
+	fd->queue = q;
+	INIT_LIST_HEAD(&fd->fifo_list[READ][0]);
+	INIT_LIST_HEAD(&fd->fifo_list[READ][1]);
+	INIT_LIST_HEAD(&fd->fifo_list[WRITE][0]);
+	INIT_LIST_HEAD(&fd->fifo_list[WRITE][1]);
+	fd->sort_list[READ] = RB_ROOT;
+	fd->sort_list[WRITE] = RB_ROOT;
+	fd->fifo_expire[READ][1] = read_expire;
+	fd->fifo_expire[READ][0] = read_async_expire;
+	fd->fifo_expire[WRITE][1] = write_expire;
+	fd->fifo_expire[WRITE][0] = write_async_expire;
+	fd->write_batch_kb = write_batch_kb;
+	fd->writes_starved = writes_starved;
+	fd->batch_dir = READ;
+	return fd;
+}
+
+/*
+ * sysfs parts below
+ */
+
+static ssize_t
+flash_var_show(int var, char *page)
+{
+	return sprintf(page, "%d\n", var);
+}
+
+static ssize_t
+flash_var_store(int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtol(p, &p, 10);
+	return count;
+}
+
+#define SHOW_FUNCTION(__FUNC, __VAR, __CONV)				\
+static ssize_t __FUNC(struct elevator_queue *e, char *page)		\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data = __VAR;						\
+	if (__CONV)							\
+		__data = jiffies_to_msecs(__data);			\
+	return flash_var_show(__data, (page));				\
+}
+SHOW_FUNCTION(flash_read_expire_show, fd->fifo_expire[READ][1], 1);
+SHOW_FUNCTION(flash_read_async_expire_show, fd->fifo_expire[READ][0], 1);
+SHOW_FUNCTION(flash_write_expire_show, fd->fifo_expire[WRITE][1], 1);
+SHOW_FUNCTION(flash_write_async_expire_show, fd->fifo_expire[WRITE][0], 1);
+SHOW_FUNCTION(flash_write_batch_kb_show, fd->write_batch_kb, 0);
+SHOW_FUNCTION(flash_writes_starved_show, fd->writes_starved, 0);
+SHOW_FUNCTION(flash_page_size_show, flash_page_sectors(fd) << 9, 0);
+SHOW_FUNCTION(flash_erase_size_show, flash_erase_sectors(fd) << 9, 0);
+#undef SHOW_FUNCTION
+
+#define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < (MIN))						\
+		__data = (MIN);						\
+	else if (__data > (MAX))					\
+		__data = (MAX);						\
+	if (__CONV)							\
+		*(__PTR) = msecs_to_jiffies(__data);			\
+	else								\
+		*(__PTR) = __data;					\
+	return ret;							\
+}
+STORE_FUNCTION(flash_read_expire_store, &fd->fifo_expire[READ][1], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_read_async_expire_store, &fd->fifo_expire[READ][0], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_write_expire_store, &fd->fifo_expire[WRITE][1], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_write_async_expire_store, &fd->fifo_expire[WRITE][0], 0, INT_MAX, 1);
+STORE_FUNCTION(flash_write_batch_kb_store, &fd->write_batch_kb, 1, INT_MAX, 0);
+STORE_FUNCTION(flash_writes_starved_store, &fd->writes_starved, INT_MIN, INT_MAX, 0);
+#undef STORE_FUNCTION
+
+/* in bytes; 0 goes back to what the device reports */
+#define STORE_UNIT(__FUNC, __PTR)					\
+static ssize_t __FUNC(struct elevator_queue *e, const char *page, size_t count)	\
+{									\
+	struct flash_data *fd = e->elevator_data;			\
+	int __data;							\
+	int ret = flash_var_store(&__data, (page), count);		\
+	if (__data < 0)							\
+		__data = 0;						\
+	*(__PTR) = flash_unit(__data);					\
+	return ret;							\
+}
+STORE_UNIT(flash_page_size_store, &fd->page_sectors);
+STORE_UNIT(flash_erase_size_store, &fd->erase_sectors);
+#undef STORE_UNIT
+
+#define DD_ATTR(name) \
+	__ATTR(name, S_IRUGO|S_IWUSR, flash_##name##_show, \
+				      flash_##name##_store)
+
+static struct elv_fs_entry flash_attrs[] = {
+	DD_ATTR(read_expire),
+	DD_ATTR(read_async_expire),
+	DD_ATTR(write_expire),
+	DD_ATTR(write_async_expire),
+	DD_ATTR(write_batch_kb),
+	DD_ATTR(writes_starved),
+	DD_ATTR(page_size),
+	DD_ATTR(erase_size),
+	__ATTR_NULL
+};
+
+static struct elevator_type iosched_flash = {
+	.ops = {
+		.elevator_merge_fn = 		flash_merge,
+		.elevator_merged_fn =		flash_merged_request,
+		.elevator_merge_req_fn =	flash_merged_requests,
+		.elevator_dispatch_fn =		flash_dispatch_requests,
+		.elevator_add_req_fn =		flash_add_request,
+		.elevator_former_req_fn =	elv_rb_former_request,
+		.elevator_latter_req_fn =	elv_rb_latter_request,
+		.elevator_init_fn =		flash_init_queue,
+		.elevator_exit_fn =		flash_exit_queue,
+	},
+
+	.elevator_attrs = flash_attrs,
+	.elevator_name = "flash",
+	.elevator_owner = THIS_MODULE,
+};
+
+static int __init flash_init(void)
+{
+	elv_register(&iosched_flash);
+
+	return 0;
+}
+
+static void __exit flash_exit(void)
+{
+	elv_unregister(&iosched_flash);
+}
+
+module_init(flash_init);
+module_exit(flash_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Flash IO scheduler");
@@ -115,6 +115,7 @@ static void handle_update(struct work_struct *work);
  * The mutex locks both lists.
  */
 static BLOCKING_NOTIFIER_HEAD(cpufreq_policy_notifier_list);
+static ATOMIC_NOTIFIER_HEAD(cpufreq_frame_notifier_list);
 static struct srcu_notifier_head cpufreq_transition_notifier_list;
 
 static bool init_cpufreq_transition_notifier_list_called;
@@ -1343,12 +1344,14 @@ static struct syscore_ops cpufreq_syscore_ops = {
 /**
  *	cpufreq_register_notifier - register a driver with cpufreq
  *	@nb: notifier function to register
- *      @list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *      @list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *             CPUFREQ_FRAME_NOTIFIER
  *
- *	Add a driver to one of two lists: either a list of drivers that
+ *	Add a driver to one of three lists: a list of drivers that
  *      are notified about clock rate changes (once before and once after
- *      the transition), or a list of drivers that are notified about
- *      changes in cpufreq policy.
+ *      the transition), a list of drivers that are notified about
+ *      changes in cpufreq policy, or a list of governors that are told
+ *      about display frames (see cpufreq_notify_frame()).
  *
  *	This function may sleep, and has the same return conditions as
  *	blocking_notifier_chain_register.
@@ -1368,6 +1371,10 @@ int cpufreq_register_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_register(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_FRAME_NOTIFIER:
+		ret = atomic_notifier_chain_register(
+				&cpufreq_frame_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1380,7 +1387,8 @@ EXPORT_SYMBOL(cpufreq_register_notifier);
 /**
  *	cpufreq_unregister_notifier - unregister a driver with cpufreq
  *	@nb: notifier block to be unregistered
- *      @list: CPUFREQ_TRANSITION_NOTIFIER or CPUFREQ_POLICY_NOTIFIER
+ *      @list: CPUFREQ_TRANSITION_NOTIFIER, CPUFREQ_POLICY_NOTIFIER or
+ *             CPUFREQ_FRAME_NOTIFIER
  *
  *	Remove a driver from the CPU frequency notifier list.
  *
@@ -1400,6 +1408,10 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 		ret = blocking_notifier_chain_unregister(
 				&cpufreq_policy_notifier_list, nb);
 		break;
+	case CPUFREQ_FRAME_NOTIFIER:
+		ret = atomic_notifier_chain_unregister(
+				&cpufreq_frame_notifier_list, nb);
+		break;
 	default:
 		ret = -EINVAL;
 	}
@@ -1408,6 +1420,20 @@ int cpufreq_unregister_notifier(struct notifier_block *nb, unsigned int list)
 }
 EXPORT_SYMBOL(cpufreq_unregister_notifier);
 
+/**
+ *	cpufreq_notify_frame - tell governors about a display refresh
+ *	@posted: a new frame was latched for this refresh
+ *
+ *	Called by display drivers at every vsync, from interrupt context,
+ *	so that a governor can tell frames that miss their deadline.  The
+ *	CPUFREQ_FRAME_NOTIFIER chain is called with @posted as its value.
+ */
+void cpufreq_notify_frame(int posted)
+{
+	atomic_notifier_call_chain(&cpufreq_frame_notifier_list, posted, NULL);
+}
+EXPORT_SYMBOL_GPL(cpufreq_notify_frame);
+
 
 /*********************************************************************
  *                              GOVERNORS                            *
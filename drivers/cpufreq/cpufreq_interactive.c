@@ -27,9 +27,16 @@
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
 #include <linux/mutex.h>
+#include <linux/input.h>
+#include <linux/slab.h>
 
 #include <asm/cputime.h>
 
+#include "cpufreq_interactive_policy.h"
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_interactive.h>
+
 static atomic_t active_count = ATOMIC_INIT(0);
 
 struct cpufreq_interactive_cpuinfo {
@@ -44,6 +51,7 @@ struct cpufreq_interactive_cpuinfo {
 	struct cpufreq_policy *policy;
 	struct cpufreq_frequency_table *freq_table;
 	unsigned int target_freq;
+	struct interactive_load_state load_state;
 	int governor_enabled;
 };
 
@@ -82,6 +90,36 @@ static unsigned long min_sample_time;
 #define DEFAULT_TIMER_RATE 20 * USEC_PER_MSEC
 static unsigned long timer_rate;
 
+/*
+ * Weight of the newest sample in the predicted load, in 1/8ths; 0 plans
+ * on the last sample alone, as before.
+ */
+#define DEFAULT_PREDICT_WEIGHT 3
+static unsigned long predict_weight;
+
+/*
+ * How long an input event holds hispeed_freq, in usecs; 0 disables.
+ */
+#define DEFAULT_INPUT_BOOST_TIME 100 * USEC_PER_MSEC
+static unsigned long input_boost_time;
+static unsigned long input_boost_until;
+static int input_handler_registered;
+
+/*
+ * Frame deadlines, fed by the display driver at every vsync through
+ * cpufreq_notify_frame().  A frame that arrives a vsync late in a
+ * stream that was keeping up raises frame_floor one step above the
+ * current speed; the floor holds while frames keep coming and is
+ * dropped after FRAME_RELAX_RUN frames in a row are on time.
+ */
+#define FRAME_RELAX_RUN		60
+#define FRAME_STREAM_RUN	3
+static unsigned long frame_boost = 1;
+static unsigned int frame_floor;
+static unsigned long frame_active_until;
+static unsigned int frame_run;
+static unsigned int frame_late;
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -95,12 +133,63 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+/* Lowest speed an input or frame boost currently allows. */
+static unsigned int cpufreq_interactive_floor(void)
+{
+	unsigned int floor = 0;
+
+	if (time_before(jiffies, input_boost_until))
+		floor = hispeed_freq;
+	if (time_before(jiffies, frame_active_until) && frame_floor > floor)
+		floor = frame_floor;
+
+	return floor;
+}
+
+/*
+ * Raise every CPU running this governor to at least freq now, without
+ * waiting for its next sample.  Safe from interrupt context.
+ */
+static void cpufreq_interactive_boost(const char *reason, unsigned int freq)
+{
+	unsigned int cpu;
+	unsigned int target;
+	unsigned long flags;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	int wake = 0;
+
+	trace_cpufreq_interactive_boost(reason, freq);
+
+	spin_lock_irqsave(&up_cpumask_lock, flags);
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		target = min(freq, pcpu->policy->max);
+		if (pcpu->target_freq < target) {
+			pcpu->target_freq = target;
+			cpumask_set_cpu(cpu, &up_cpumask);
+			wake = 1;
+		}
+	}
+	spin_unlock_irqrestore(&up_cpumask_lock, flags);
+
+	if (wake)
+		wake_up_process(up_task);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
 	unsigned int delta_time;
 	int cpu_load;
 	int load_since_change;
+	unsigned int pred_load;
+	unsigned int floor_freq;
+	struct interactive_tunables tunables;
 	u64 time_in_idle;
 	u64 idle_exit_time;
 	struct cpufreq_interactive_cpuinfo *pcpu =
@@ -167,14 +256,20 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
-	if (cpu_load >= go_hispeed_load) {
-		if (pcpu->policy->cur == pcpu->policy->min)
-			new_freq = hispeed_freq;
-		else
-			new_freq = pcpu->policy->max * cpu_load / 100;
-	} else {
-		new_freq = pcpu->policy->cur * cpu_load / 100;
-	}
+	tunables.go_hispeed_load = go_hispeed_load;
+	tunables.hispeed_freq = hispeed_freq;
+	tunables.predict_weight = predict_weight;
+
+	pred_load = interactive_predict_load(&tunables, &pcpu->load_state,
+					     cpu_load);
+	new_freq = interactive_choose_freq(&tunables, pred_load,
+					   pcpu->policy->cur,
+					   pcpu->policy->min,
+					   pcpu->policy->max);
+
+	floor_freq = cpufreq_interactive_floor();
+	if (new_freq < floor_freq)
+		new_freq = floor_freq;
 
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
@@ -185,6 +280,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	}
 
 	new_freq = pcpu->freq_table[index].frequency;
+	trace_cpufreq_interactive_load(data, cpu_load, pred_load,
+				       pcpu->policy->cur, new_freq);
 
 #ifdef CONFIG_ARCH_RK29
 	pcpu->target_freq = pcpu->policy->cur;
@@ -528,11 +625,82 @@ static ssize_t store_timer_rate(struct kobject *kobj,
 static struct global_attr timer_rate_attr = __ATTR(timer_rate, 0644,
 		show_timer_rate, store_timer_rate);
 
+static ssize_t show_predict_weight(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", predict_weight);
+}
+
+static ssize_t store_predict_weight(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val > 8)
+		return -EINVAL;
+	predict_weight = val;
+	return count;
+}
+
+static struct global_attr predict_weight_attr = __ATTR(predict_weight, 0644,
+		show_predict_weight, store_predict_weight);
+
+static ssize_t show_input_boost_time(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_time);
+}
+
+static ssize_t store_input_boost_time(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	input_boost_time = val;
+	return count;
+}
+
+static struct global_attr input_boost_time_attr = __ATTR(input_boost_time, 0644,
+		show_input_boost_time, store_input_boost_time);
+
+static ssize_t show_frame_boost(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", frame_boost);
+}
+
+static ssize_t store_frame_boost(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	frame_boost = val;
+	return count;
+}
+
+static struct global_attr frame_boost_attr = __ATTR(frame_boost, 0644,
+		show_frame_boost, store_frame_boost);
+
 static struct attribute *interactive_attributes[] = {
 	&hispeed_freq_attr.attr,
 	&go_hispeed_load_attr.attr,
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
+	&predict_weight_attr.attr,
+	&input_boost_time_attr.attr,
+	&frame_boost_attr.attr,
 	NULL,
 };
 
@@ -541,6 +709,155 @@ static struct attribute_group interactive_attr_group = {
 	.name = "interactive",
 };
 
+/*
+ * Input boost.  The handler binds next to evdev on every touchscreen and
+ * keypad and raises the speed on the first report of a gesture, before
+ * the reader has even been woken, instead of a sample or two later.
+ */
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	unsigned long now = jiffies;
+
+	if (type != EV_SYN || !input_boost_time)
+		return;
+
+	/* already boosted for at least another half period */
+	if (time_before(now + usecs_to_jiffies(input_boost_time / 2),
+			input_boost_until))
+		return;
+
+	input_boost_until = now + usecs_to_jiffies(input_boost_time);
+	cpufreq_interactive_boost("input", hispeed_freq);
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+/*
+ * CPUFREQ_FRAME_NOTIFIER callback, run by the display driver at every
+ * vsync from its interrupt, with posted set when a new frame was
+ * latched for this one.
+ */
+static int cpufreq_interactive_frame(struct notifier_block *nb,
+				     unsigned long posted, void *data)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	unsigned int late = frame_late;
+	unsigned int index;
+
+	if (!frame_boost || !atomic_read(&active_count))
+		return NOTIFY_DONE;
+
+	if (!posted) {
+		if (frame_late <= 2)
+			frame_late++;
+		return NOTIFY_DONE;
+	}
+
+	frame_late = 0;
+	frame_active_until = jiffies + HZ / 10;
+
+	if (!late) {
+		if (++frame_run == FRAME_RELAX_RUN)
+			frame_floor = 0;
+		return NOTIFY_DONE;
+	}
+
+	/*
+	 * One or two vsyncs late after a run at the display rate: the
+	 * frame missed its deadline.  Longer gaps are just pauses.
+	 */
+	if (late > 2) {
+		frame_floor = 0;
+	} else if (frame_run >= FRAME_STREAM_RUN) {
+		pcpu = &per_cpu(cpuinfo, smp_processor_id());
+		if (pcpu->governor_enabled &&
+		    !cpufreq_frequency_table_target(pcpu->policy,
+						    pcpu->freq_table,
+						    pcpu->policy->cur + 1,
+						    CPUFREQ_RELATION_L,
+						    &index)) {
+			frame_floor = pcpu->freq_table[index].frequency;
+			cpufreq_interactive_boost("frame", frame_floor);
+		}
+	}
+	frame_run = 1;
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block cpufreq_interactive_frame_nb = {
+	.notifier_call = cpufreq_interactive_frame,
+};
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event)
 {
@@ -562,6 +879,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->policy = policy;
 			pcpu->target_freq = policy->cur;
 			pcpu->freq_table = freq_table;
+			pcpu->load_state.avg = 0;
 			pcpu->freq_change_time_in_idle =
 				get_cpu_idle_time_us(j,
 					     &pcpu->freq_change_time);
@@ -588,6 +906,13 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (rc)
 			return rc;
 
+		rc = input_register_handler(&cpufreq_interactive_input_handler);
+		if (rc)
+			pr_warn("%s: failed to register input handler, %d\n",
+				__func__, rc);
+		else
+			input_handler_registered = 1;
+
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -610,6 +935,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		if (input_handler_registered) {
+			input_unregister_handler(
+				&cpufreq_interactive_input_handler);
+			input_handler_registered = 0;
+		}
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
 
@@ -656,6 +986,8 @@ static int __init cpufreq_interactive_init(void)
 	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
 	timer_rate = DEFAULT_TIMER_RATE;
+	predict_weight = DEFAULT_PREDICT_WEIGHT;
+	input_boost_time = DEFAULT_INPUT_BOOST_TIME;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -688,6 +1020,8 @@ static int __init cpufreq_interactive_init(void)
 	mutex_init(&set_speed_lock);
 
 	idle_notifier_register(&cpufreq_interactive_idle_nb);
+	cpufreq_register_notifier(&cpufreq_interactive_frame_nb,
+				  CPUFREQ_FRAME_NOTIFIER);
 
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
 
@@ -705,6 +1039,8 @@ module_init(cpufreq_interactive_init);
 static void __exit cpufreq_interactive_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
+	cpufreq_unregister_notifier(&cpufreq_interactive_frame_nb,
+				    CPUFREQ_FRAME_NOTIFIER);
 	kthread_stop(up_task);
 	put_task_struct(up_task);
 	destroy_workqueue(down_wq);
@@ -0,0 +1,72 @@
+/*
+ * drivers/cpufreq/cpufreq_interactive_policy.h
+ *
+ * Frequency selection of the interactive governor, kept free of kernel
+ * headers so tools/power/cpufreq-interactive can replay recorded load
+ * traces through exactly the same code.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _CPUFREQ_INTERACTIVE_POLICY_H
+#define _CPUFREQ_INTERACTIVE_POLICY_H
+
+struct interactive_tunables {
+	unsigned int go_hispeed_load;
+	unsigned int hispeed_freq;
+	/* weight of the newest sample in the load average, in 1/8ths */
+	unsigned int predict_weight;
+};
+
+struct interactive_load_state {
+	int avg;		/* load EWMA, percent << 8 */
+};
+
+/*
+ * Fold a load sample into the running average and return the load to
+ * plan for: the sample itself, or the average extrapolated one sample
+ * ahead if that is higher.  A rising trend is met a sample early and a
+ * single quiet sample in the middle of a busy stretch does not drop
+ * the speed.  predict_weight 0 turns this off.
+ */
+static inline unsigned int
+interactive_predict_load(const struct interactive_tunables *t,
+			 struct interactive_load_state *s, unsigned int load)
+{
+	int prev = s->avg;
+	int pred;
+
+	if (!t->predict_weight)
+		return load;
+
+	s->avg = prev + ((int)(load << 8) - prev) * (int)t->predict_weight / 8;
+	pred = (2 * s->avg - prev) / 256;
+	if (pred > 100)
+		pred = 100;
+
+	return pred > (int)load ? (unsigned int)pred : load;
+}
+
+/* Target speed for a load, before rounding to the frequency table. */
+static inline unsigned int
+interactive_choose_freq(const struct interactive_tunables *t,
+			unsigned int load, unsigned int cur,
+			unsigned int min, unsigned int max)
+{
+	if (load >= t->go_hispeed_load) {
+		if (cur == min)
+			return t->hispeed_freq;
+		return max * load / 100;
+	}
+
+	return cur * load / 100;
+}
+
+#endif /* _CPUFREQ_INTERACTIVE_POLICY_H */
@@ -0,0 +1,349 @@
+/*
+ * drivers/dma/rk29_dma.c
+ *
+ * dmaengine slave wrapper around the RK29 PL330 DMA API.
+ *
+ * Each rk29 peripheral channel (enum dma_ch) is exposed as one dmaengine
+ * channel.  Clients pick theirs with rk29_dma_filter() and the channel
+ * ID as the filter parameter; a prepared scatterlist is queued with
+ * rk29_dma_enqueue_sg(), so it runs as one chained PL330 program with a
+ * single completion interrupt.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/interrupt.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/dmaengine.h>
+
+#include <mach/rk29-dma-pl330.h>
+
+struct rk29_dma_desc {
+	struct dma_async_tx_descriptor txd;
+	struct list_head	node;
+	enum rk29_dma_buffresult res;
+	unsigned int		nents;
+	struct scatterlist	sg[RK29_DMA_SG_MAX];
+};
+
+struct rk29_dma_chan {
+	struct dma_chan		chan;
+	enum dma_ch		id;
+	struct rk29_dma_client	client;
+	int			requested;
+	enum dma_data_direction	dir;	/* as set by DMA_SLAVE_CONFIG */
+	spinlock_t		lock;
+	struct list_head	submitted;	/* tx_submit'ed, not issued */
+	struct list_head	active;		/* handed to rk29_dma */
+	struct list_head	done;		/* waiting for the tasklet */
+	dma_cookie_t		completed;
+	dma_cookie_t		failed;		/* last cookie that failed */
+	struct tasklet_struct	tasklet;
+};
+
+static struct dma_device rk29_dma_dev;
+static struct rk29_dma_chan rk29_dma_chans[DMACH_MAX];
+
+static inline struct rk29_dma_chan *to_rk29_chan(struct dma_chan *chan)
+{
+	return container_of(chan, struct rk29_dma_chan, chan);
+}
+
+static inline struct rk29_dma_desc *to_rk29_desc(struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct rk29_dma_desc, txd);
+}
+
+bool rk29_dma_filter(struct dma_chan *chan, void *param)
+{
+	if (chan->device != &rk29_dma_dev)
+		return false;
+	return to_rk29_chan(chan)->id == (enum dma_ch)param;
+}
+EXPORT_SYMBOL(rk29_dma_filter);
+
+/* Called by rk29-pl330 once per enqueued scatterlist */
+static void rk29_dma_buffdone(void *token, int size,
+			      enum rk29_dma_buffresult res)
+{
+	struct rk29_dma_desc *desc = token;
+	struct rk29_dma_chan *rc = to_rk29_chan(desc->txd.chan);
+	unsigned long flags;
+
+	spin_lock_irqsave(&rc->lock, flags);
+	desc->res = res;
+	if (res != RK29_RES_ABORT)
+		rc->completed = desc->txd.cookie;
+	if (res == RK29_RES_ERR)
+		rc->failed = desc->txd.cookie;
+	list_move_tail(&desc->node, &rc->done);
+	spin_unlock_irqrestore(&rc->lock, flags);
+
+	tasklet_schedule(&rc->tasklet);
+}
+
+/* Client callbacks run here, outside the rk29 DMA API's locks */
+static void rk29_dma_tasklet(unsigned long data)
+{
+	struct rk29_dma_chan *rc = (struct rk29_dma_chan *)data;
+	struct rk29_dma_desc *desc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rc->lock, flags);
+	while (!list_empty(&rc->done)) {
+		desc = list_first_entry(&rc->done, struct rk29_dma_desc, node);
+		list_del(&desc->node);
+		spin_unlock_irqrestore(&rc->lock, flags);
+
+		if (desc->res == RK29_RES_OK && desc->txd.callback)
+			desc->txd.callback(desc->txd.callback_param);
+		kfree(desc);
+
+		spin_lock_irqsave(&rc->lock, flags);
+	}
+	spin_unlock_irqrestore(&rc->lock, flags);
+}
+
+static dma_cookie_t rk29_dma_tx_submit(struct dma_async_tx_descriptor *txd)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(txd->chan);
+	struct rk29_dma_desc *desc = to_rk29_desc(txd);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rc->lock, flags);
+	cookie = rc->chan.cookie + 1;
+	if (cookie < 0)
+		cookie = 1;
+	rc->chan.cookie = txd->cookie = cookie;
+	list_add_tail(&desc->node, &rc->submitted);
+	spin_unlock_irqrestore(&rc->lock, flags);
+
+	return cookie;
+}
+
+static struct dma_async_tx_descriptor *rk29_dma_prep_slave_sg(
+		struct dma_chan *chan, struct scatterlist *sgl,
+		unsigned int sg_len, enum dma_data_direction direction,
+		unsigned long flags)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+	struct rk29_dma_desc *desc;
+	struct scatterlist *sg;
+	int i;
+
+	if (!sg_len || sg_len > RK29_DMA_SG_MAX || direction != rc->dir)
+		return NULL;
+
+	desc = kzalloc(sizeof(*desc), GFP_ATOMIC);
+	if (!desc)
+		return NULL;
+
+	sg_init_table(desc->sg, sg_len);
+	for_each_sg(sgl, sg, sg_len, i) {
+		sg_dma_address(&desc->sg[i]) = sg_dma_address(sg);
+		sg_dma_len(&desc->sg[i]) = sg_dma_len(sg);
+	}
+	desc->nents = sg_len;
+
+	dma_async_tx_descriptor_init(&desc->txd, chan);
+	desc->txd.tx_submit = rk29_dma_tx_submit;
+	desc->txd.flags = flags;
+	INIT_LIST_HEAD(&desc->node);
+
+	return &desc->txd;
+}
+
+static void rk29_dma_issue_pending(struct dma_chan *chan)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+	struct rk29_dma_desc *desc;
+	unsigned long flags;
+	int issued = 0;
+
+	spin_lock_irqsave(&rc->lock, flags);
+	while (!list_empty(&rc->submitted)) {
+		desc = list_first_entry(&rc->submitted,
+					struct rk29_dma_desc, node);
+		list_move_tail(&desc->node, &rc->active);
+		spin_unlock_irqrestore(&rc->lock, flags);
+
+		if (rk29_dma_enqueue_sg(rc->id, desc, desc->sg, desc->nents))
+			rk29_dma_buffdone(desc, 0, RK29_RES_ERR);
+		else
+			issued++;
+
+		spin_lock_irqsave(&rc->lock, flags);
+	}
+	spin_unlock_irqrestore(&rc->lock, flags);
+
+	if (issued)
+		rk29_dma_ctrl(rc->id, RK29_DMAOP_START);
+}
+
+static int rk29_dma_slave_config(struct rk29_dma_chan *rc,
+				 struct dma_slave_config *cfg)
+{
+	int ret;
+
+	if (cfg->direction == DMA_TO_DEVICE) {
+		ret = rk29_dma_devconfig(rc->id, RK29_DMASRC_MEM,
+					 cfg->dst_addr);
+		if (!ret)
+			ret = rk29_dma_config(rc->id, cfg->dst_addr_width,
+					      cfg->dst_maxburst ? : 1);
+	} else if (cfg->direction == DMA_FROM_DEVICE) {
+		ret = rk29_dma_devconfig(rc->id, RK29_DMASRC_HW,
+					 cfg->src_addr);
+		if (!ret)
+			ret = rk29_dma_config(rc->id, cfg->src_addr_width,
+					      cfg->src_maxburst ? : 1);
+	} else {
+		return -EINVAL;
+	}
+
+	if (!ret)
+		rc->dir = cfg->direction;
+	return ret;
+}
+
+static int rk29_dma_control(struct dma_chan *chan, enum dma_ctrl_cmd cmd,
+			    unsigned long arg)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+	struct rk29_dma_desc *desc, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	switch (cmd) {
+	case DMA_TERMINATE_ALL:
+		/* Aborted xfers come back through rk29_dma_buffdone() */
+		rk29_dma_ctrl(rc->id, RK29_DMAOP_FLUSH);
+
+		spin_lock_irqsave(&rc->lock, flags);
+		list_splice_init(&rc->submitted, &list);
+		rc->completed = rc->chan.cookie;
+		spin_unlock_irqrestore(&rc->lock, flags);
+
+		list_for_each_entry_safe(desc, tmp, &list, node)
+			kfree(desc);
+		return 0;
+
+	case DMA_SLAVE_CONFIG:
+		return rk29_dma_slave_config(rc, (struct dma_slave_config *)arg);
+
+	default:
+		return -ENXIO;
+	}
+}
+
+static enum dma_status rk29_dma_tx_status(struct dma_chan *chan,
+		dma_cookie_t cookie, struct dma_tx_state *txstate)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+	dma_cookie_t last_used, last_complete, failed;
+	enum dma_status status;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rc->lock, flags);
+	last_used = chan->cookie;
+	last_complete = rc->completed;
+	failed = rc->failed;
+	spin_unlock_irqrestore(&rc->lock, flags);
+
+	dma_set_tx_state(txstate, last_complete, last_used, 0);
+	status = dma_async_is_complete(cookie, last_complete, last_used);
+	if (status == DMA_SUCCESS && cookie == failed)
+		status = DMA_ERROR;
+	return status;
+}
+
+static int rk29_dma_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+	int ret;
+
+	ret = rk29_dma_request(rc->id, &rc->client, NULL);
+	if (ret)
+		return ret;
+
+	rk29_dma_set_buffdone_fn(rc->id, rk29_dma_buffdone);
+	rc->requested = 1;
+	rc->dir = DMA_NONE;
+	rc->completed = chan->cookie = 1;
+	rc->failed = 0;
+
+	return 1;
+}
+
+static void rk29_dma_free_chan_resources(struct dma_chan *chan)
+{
+	struct rk29_dma_chan *rc = to_rk29_chan(chan);
+
+	if (!rc->requested)
+		return;
+
+	rk29_dma_control(chan, DMA_TERMINATE_ALL, 0);
+	tasklet_kill(&rc->tasklet);
+	rk29_dma_tasklet((unsigned long)rc);
+
+	rk29_dma_free(rc->id, &rc->client);
+	rc->requested = 0;
+}
+
+static int __init rk29_dma_engine_init(void)
+{
+	struct platform_device *pdev;
+	struct rk29_dma_chan *rc;
+	int i, ret;
+
+	pdev = platform_device_register_simple("rk29-dmaengine", -1, NULL, 0);
+	if (IS_ERR(pdev))
+		return PTR_ERR(pdev);
+
+	INIT_LIST_HEAD(&rk29_dma_dev.channels);
+	dma_cap_set(DMA_SLAVE, rk29_dma_dev.cap_mask);
+	dma_cap_set(DMA_PRIVATE, rk29_dma_dev.cap_mask);
+
+	for (i = 0; i < DMACH_MAX; i++) {
+		rc = &rk29_dma_chans[i];
+		rc->id = i;
+		rc->client.name = "rk29-dmaengine";
+		spin_lock_init(&rc->lock);
+		INIT_LIST_HEAD(&rc->submitted);
+		INIT_LIST_HEAD(&rc->active);
+		INIT_LIST_HEAD(&rc->done);
+		tasklet_init(&rc->tasklet, rk29_dma_tasklet, (unsigned long)rc);
+		rc->chan.device = &rk29_dma_dev;
+		list_add_tail(&rc->chan.device_node, &rk29_dma_dev.channels);
+	}
+
+	rk29_dma_dev.dev = &pdev->dev;
+	rk29_dma_dev.device_alloc_chan_resources = rk29_dma_alloc_chan_resources;
+	rk29_dma_dev.device_free_chan_resources = rk29_dma_free_chan_resources;
+	rk29_dma_dev.device_prep_slave_sg = rk29_dma_prep_slave_sg;
+	rk29_dma_dev.device_control = rk29_dma_control;
+	rk29_dma_dev.device_tx_status = rk29_dma_tx_status;
+	rk29_dma_dev.device_issue_pending = rk29_dma_issue_pending;
+
+	ret = dma_async_device_register(&rk29_dma_dev);
+	if (ret) {
+		platform_device_unregister(pdev);
+		return ret;
+	}
+
+	printk(KERN_INFO "rk29 dmaengine: %d slave channels\n", DMACH_MAX);
+	return 0;
+}
+module_init(rk29_dma_engine_init);
+
+MODULE_DESCRIPTION("dmaengine wrapper for the RK29 PL330 DMA API");
+MODULE_LICENSE("GPL");
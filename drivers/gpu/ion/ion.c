@@ -578,6 +578,17 @@ end:
 	return handle;
 }
 
+size_t ion_share_file_size(struct file *file)
+{
+	struct ion_buffer *buffer;
+
+	if (file->f_op != &ion_share_fops)
+		return 0;
+	buffer = file->private_data;
+	return buffer->size;
+}
+EXPORT_SYMBOL(ion_share_file_size);
+
 static int ion_debug_client_show(struct seq_file *s, void *unused)
 {
 	struct ion_client *client = s->private;
@@ -1139,6 +1150,8 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 		seq_printf(s, "%16.s %16u %16u\n", client->name, client->pid,
 			   size);
 	}
+	if (heap->ops->debug_show)
+		heap->ops->debug_show(heap, s);
 	return 0;
 }
 
@@ -15,80 +15,378 @@
  */
 
 #include <linux/err.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
 #include <linux/mm.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
 #include "ion_priv.h"
 
+/*
+ * The system heap builds buffers out of chunks of order ION_SYSTEM_ORDERS[]
+ * pages taken from per-order pools.  Freed chunks go back to their pool
+ * dirty and are cleared by a background thread, so that the next
+ * allocation can usually take an already zeroed chunk instead of going
+ * to the page allocator.  Pooled pages are given back under memory
+ * pressure by a shrinker.  The scatterlist describing a buffer is built
+ * once at allocation time and handed out by map_dma.
+ */
+static const unsigned int ion_system_orders[] = {4, 0};
+#define ION_SYSTEM_NUM_ORDERS	ARRAY_SIZE(ion_system_orders)
+#define ION_SYSTEM_POOL_MAX	((16 << 20) >> PAGE_SHIFT)	/* pooled pages */
+
+struct ion_page_pool {
+	unsigned int order;
+	struct list_head clean;		/* zeroed chunks */
+	struct list_head dirty;		/* chunks waiting to be zeroed */
+	int clean_count;
+	int dirty_count;
+	unsigned long hits;		/* served from the clean list */
+	unsigned long sync_zero;	/* served from the dirty list */
+	unsigned long misses;		/* served by the page allocator */
+};
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	spinlock_t lock;		/* protects the pools */
+	struct ion_page_pool pools[ION_SYSTEM_NUM_ORDERS];
+	unsigned long pool_pages;
+	struct task_struct *zero_thread;
+	wait_queue_head_t zero_wait;
+	struct shrinker shrinker;
+};
+
+static void ion_page_pool_zero(struct page *page, unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage(page + i);
+}
+
+static struct page *ion_page_pool_alloc(struct ion_system_heap *sys_heap,
+					struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	int dirty = 0;
+	gfp_t gfp = GFP_HIGHUSER | __GFP_ZERO | __GFP_NOWARN;
+
+	spin_lock(&sys_heap->lock);
+	if (pool->clean_count) {
+		page = list_first_entry(&pool->clean, struct page, lru);
+		pool->clean_count--;
+		pool->hits++;
+	} else if (pool->dirty_count) {
+		page = list_first_entry(&pool->dirty, struct page, lru);
+		pool->dirty_count--;
+		pool->sync_zero++;
+		dirty = 1;
+	}
+	if (page) {
+		list_del(&page->lru);
+		sys_heap->pool_pages -= 1 << pool->order;
+	}
+	spin_unlock(&sys_heap->lock);
+
+	if (dirty)
+		ion_page_pool_zero(page, pool->order);
+	if (page)
+		return page;
+
+	if (pool->order)
+		gfp |= __GFP_NORETRY | __GFP_NO_KSWAPD;
+	page = alloc_pages(gfp, pool->order);
+	if (page) {
+		spin_lock(&sys_heap->lock);
+		pool->misses++;
+		spin_unlock(&sys_heap->lock);
+	}
+	return page;
+}
+
+static void ion_page_pool_free(struct ion_system_heap *sys_heap,
+			       struct ion_page_pool *pool, struct page *page)
+{
+	spin_lock(&sys_heap->lock);
+	if (sys_heap->pool_pages + (1 << pool->order) > ION_SYSTEM_POOL_MAX) {
+		spin_unlock(&sys_heap->lock);
+		__free_pages(page, pool->order);
+		return;
+	}
+	list_add_tail(&page->lru, &pool->dirty);
+	pool->dirty_count++;
+	sys_heap->pool_pages += 1 << pool->order;
+	spin_unlock(&sys_heap->lock);
+	wake_up(&sys_heap->zero_wait);
+}
+
+static int ion_system_heap_dirty(struct ion_system_heap *sys_heap)
+{
+	int i, dirty = 0;
+
+	spin_lock(&sys_heap->lock);
+	for (i = 0; i < ION_SYSTEM_NUM_ORDERS; i++)
+		dirty += sys_heap->pools[i].dirty_count;
+	spin_unlock(&sys_heap->lock);
+	return dirty;
+}
+
+static int ion_system_heap_zero_thread(void *data)
+{
+	struct ion_system_heap *sys_heap = data;
+	struct ion_page_pool *pool;
+	struct page *page;
+	int i;
+
+	while (!kthread_should_stop()) {
+		wait_event_interruptible(sys_heap->zero_wait,
+					 ion_system_heap_dirty(sys_heap) ||
+					 kthread_should_stop());
+
+		for (i = 0; i < ION_SYSTEM_NUM_ORDERS; i++) {
+			pool = &sys_heap->pools[i];
+			for (;;) {
+				spin_lock(&sys_heap->lock);
+				if (!pool->dirty_count) {
+					spin_unlock(&sys_heap->lock);
+					break;
+				}
+				page = list_first_entry(&pool->dirty,
+							struct page, lru);
+				list_del(&page->lru);
+				pool->dirty_count--;
+				spin_unlock(&sys_heap->lock);
+
+				ion_page_pool_zero(page, pool->order);
+
+				spin_lock(&sys_heap->lock);
+				list_add_tail(&page->lru, &pool->clean);
+				pool->clean_count++;
+				spin_unlock(&sys_heap->lock);
+				cond_resched();
+			}
+		}
+	}
+	return 0;
+}
+
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap =
+		container_of(shrinker, struct ion_system_heap, shrinker);
+	struct ion_page_pool *pool;
+	struct page *page;
+	int i, nr = sc->nr_to_scan;
+
+	/* dirty chunks go first, they would cost a clear to reuse anyway */
+	for (i = ION_SYSTEM_NUM_ORDERS - 1; i >= 0 && nr > 0; i--) {
+		pool = &sys_heap->pools[i];
+		while (nr > 0) {
+			struct list_head *list;
+
+			spin_lock(&sys_heap->lock);
+			if (pool->dirty_count) {
+				list = &pool->dirty;
+				pool->dirty_count--;
+			} else if (pool->clean_count) {
+				list = &pool->clean;
+				pool->clean_count--;
+			} else {
+				spin_unlock(&sys_heap->lock);
+				break;
+			}
+			page = list_first_entry(list, struct page, lru);
+			list_del(&page->lru);
+			sys_heap->pool_pages -= 1 << pool->order;
+			spin_unlock(&sys_heap->lock);
+
+			__free_pages(page, pool->order);
+			nr -= 1 << pool->order;
+		}
+	}
+	return sys_heap->pool_pages;
+}
+
+static struct ion_page_pool *ion_system_heap_pool(struct ion_system_heap *sys_heap,
+						  unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < ION_SYSTEM_NUM_ORDERS; i++)
+		if (sys_heap->pools[i].order == order)
+			return &sys_heap->pools[i];
+	BUG();
+	return NULL;
+}
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
-	buffer->priv_virt = vmalloc_user(size);
-	if (!buffer->priv_virt)
-		return -ENOMEM;
+	struct ion_system_heap *sys_heap =
+		container_of(heap, struct ion_system_heap, heap);
+	struct scatterlist *sglist, *sg;
+	struct page *page, *tmp;
+	LIST_HEAD(chunks);
+	unsigned long remaining = PAGE_ALIGN(size);
+	int first = 0;
+	int i, nents = 0;
+
+	while (remaining) {
+		page = NULL;
+		for (i = first; i < ION_SYSTEM_NUM_ORDERS; i++) {
+			unsigned int order = ion_system_orders[i];
+
+			if (remaining < (PAGE_SIZE << order))
+				continue;
+			page = ion_page_pool_alloc(sys_heap,
+						   &sys_heap->pools[i]);
+			if (page) {
+				set_page_private(page, order);
+				break;
+			}
+			/* don't retry orders that just failed */
+			first = i + 1;
+		}
+		if (!page)
+			goto err;
+		list_add_tail(&page->lru, &chunks);
+		remaining -= PAGE_SIZE << page_private(page);
+		nents++;
+	}
+
+	sglist = vmalloc(nents * sizeof(struct scatterlist));
+	if (!sglist)
+		goto err;
+	sg_init_table(sglist, nents);
+	sg = sglist;
+	list_for_each_entry_safe(page, tmp, &chunks, lru) {
+		list_del(&page->lru);
+		sg_set_page(sg, page, PAGE_SIZE << page_private(page), 0);
+		sg = sg_next(sg);
+	}
+	buffer->priv_virt = sglist;
 	return 0;
+
+err:
+	list_for_each_entry_safe(page, tmp, &chunks, lru) {
+		list_del(&page->lru);
+		ion_page_pool_free(sys_heap,
+			ion_system_heap_pool(sys_heap, page_private(page)),
+			page);
+	}
+	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
-	vfree(buffer->priv_virt);
+	struct ion_system_heap *sys_heap =
+		container_of(buffer->heap, struct ion_system_heap, heap);
+	struct scatterlist *sglist = buffer->priv_virt;
+	struct scatterlist *sg;
+
+	for (sg = sglist; sg; sg = sg_next(sg))
+		ion_page_pool_free(sys_heap,
+			ion_system_heap_pool(sys_heap, get_order(sg->length)),
+			sg_page(sg));
+	vfree(sglist);
 }
 
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
-	struct scatterlist *sglist;
-	struct page *page;
-	int i;
-	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	void *vaddr = buffer->priv_virt;
-
-	sglist = vmalloc(npages * sizeof(struct scatterlist));
-	if (!sglist)
-		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, npages * sizeof(struct scatterlist));
-	sg_init_table(sglist, npages);
-	for (i = 0; i < npages; i++) {
-		page = vmalloc_to_page(vaddr);
-		if (!page)
-			goto end;
-		sg_set_page(&sglist[i], page, PAGE_SIZE, 0);
-		vaddr += PAGE_SIZE;
-	}
 	/* XXX do cache maintenance for dma? */
-	return sglist;
-end:
-	vfree(sglist);
-	return NULL;
+	return buffer->priv_virt;
 }
 
 void ion_system_heap_unmap_dma(struct ion_heap *heap,
 			       struct ion_buffer *buffer)
 {
-	/* XXX undo cache maintenance for dma? */
-	if (buffer->sglist)
-		vfree(buffer->sglist);
+	/* the scatterlist lives as long as the buffer */
 }
 
 void *ion_system_heap_map_kernel(struct ion_heap *heap,
 				 struct ion_buffer *buffer)
 {
-	return buffer->priv_virt;
+	struct scatterlist *sg;
+	struct page **pages;
+	void *vaddr;
+	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	int i, j = 0;
+
+	pages = vmalloc(npages * sizeof(struct page *));
+	if (!pages)
+		return ERR_PTR(-ENOMEM);
+	for (sg = buffer->priv_virt; sg; sg = sg_next(sg))
+		for (i = 0; i < sg->length / PAGE_SIZE && j < npages; i++)
+			pages[j++] = sg_page(sg) + i;
+	vaddr = vmap(pages, npages, VM_MAP, PAGE_KERNEL);
+	vfree(pages);
+	return vaddr ? vaddr : ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_unmap_kernel(struct ion_heap *heap,
 				  struct ion_buffer *buffer)
 {
+	vunmap(buffer->vaddr);
 }
 
 int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			     struct vm_area_struct *vma)
 {
-	return remap_vmalloc_range(vma, buffer->priv_virt, vma->vm_pgoff);
+	struct scatterlist *sg;
+	unsigned long addr = vma->vm_start;
+	unsigned long offset = vma->vm_pgoff * PAGE_SIZE;
+	unsigned long len;
+	int ret;
+
+	for (sg = buffer->priv_virt; sg; sg = sg_next(sg)) {
+		if (offset >= sg->length) {
+			offset -= sg->length;
+			continue;
+		}
+		len = min(sg->length - offset, vma->vm_end - addr);
+		ret = remap_pfn_range(vma, addr,
+				      page_to_pfn(sg_page(sg)) +
+				      offset / PAGE_SIZE,
+				      len, vma->vm_page_prot);
+		if (ret)
+			return ret;
+		offset = 0;
+		addr += len;
+		if (addr >= vma->vm_end)
+			return 0;
+	}
+	return -EINVAL;
+}
+
+static void ion_system_heap_debug_show(struct ion_heap *heap,
+				       struct seq_file *s)
+{
+	struct ion_system_heap *sys_heap =
+		container_of(heap, struct ion_system_heap, heap);
+	struct ion_page_pool *pool;
+	int i;
+
+	spin_lock(&sys_heap->lock);
+	seq_printf(s, "\npool pages %lu / %lu\n", sys_heap->pool_pages,
+		   (unsigned long)ION_SYSTEM_POOL_MAX);
+	seq_printf(s, "%8.s %8.s %8.s %10.s %10.s %10.s\n", "order", "clean",
+		   "dirty", "hits", "sync zero", "misses");
+	for (i = 0; i < ION_SYSTEM_NUM_ORDERS; i++) {
+		pool = &sys_heap->pools[i];
+		seq_printf(s, "%8u %8d %8d %10lu %10lu %10lu\n", pool->order,
+			   pool->clean_count, pool->dirty_count, pool->hits,
+			   pool->sync_zero, pool->misses);
+	}
+	spin_unlock(&sys_heap->lock);
 }
 
 static struct ion_heap_ops vmalloc_ops = {
@@ -99,23 +397,50 @@ static struct ion_heap_ops vmalloc_ops = {
 	.map_kernel = ion_system_heap_map_kernel,
 	.unmap_kernel = ion_system_heap_unmap_kernel,
 	.map_user = ion_system_heap_map_user,
+	.debug_show = ion_system_heap_debug_show,
 };
 
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *sys_heap;
+	int i;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
-	if (!heap)
+	sys_heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
+	if (!sys_heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	sys_heap->heap.ops = &vmalloc_ops;
+	sys_heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+	spin_lock_init(&sys_heap->lock);
+	init_waitqueue_head(&sys_heap->zero_wait);
+	for (i = 0; i < ION_SYSTEM_NUM_ORDERS; i++) {
+		sys_heap->pools[i].order = ion_system_orders[i];
+		INIT_LIST_HEAD(&sys_heap->pools[i].clean);
+		INIT_LIST_HEAD(&sys_heap->pools[i].dirty);
+	}
+
+	sys_heap->zero_thread = kthread_run(ion_system_heap_zero_thread,
+					    sys_heap, "ion_zero");
+	if (IS_ERR(sys_heap->zero_thread)) {
+		kfree(sys_heap);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	sys_heap->shrinker.shrink = ion_system_heap_shrink;
+	sys_heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&sys_heap->shrinker);
+	return &sys_heap->heap;
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap =
+		container_of(heap, struct ion_system_heap, heap);
+	struct shrink_control sc = { .nr_to_scan = INT_MAX };
+
+	unregister_shrinker(&sys_heap->shrinker);
+	kthread_stop(sys_heap->zero_thread);
+	ion_system_heap_shrink(&sys_heap->shrinker, &sc);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -157,6 +482,24 @@ struct scatterlist *ion_system_contig_heap_map_dma(struct ion_heap *heap,
 	return sglist;
 }
 
+void ion_system_contig_heap_unmap_dma(struct ion_heap *heap,
+				      struct ion_buffer *buffer)
+{
+	if (buffer->sglist)
+		vfree(buffer->sglist);
+}
+
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+					struct ion_buffer *buffer)
+{
+	return buffer->priv_virt;
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+					 struct ion_buffer *buffer)
+{
+}
+
 int ion_system_contig_heap_map_user(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    struct vm_area_struct *vma)
@@ -173,9 +516,9 @@ static struct ion_heap_ops kmalloc_ops = {
 	.free = ion_system_contig_heap_free,
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
-	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.unmap_dma = ion_system_contig_heap_unmap_dma,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
 };
 
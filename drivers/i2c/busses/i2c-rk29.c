@@ -28,6 +28,12 @@
 #include <linux/i2c.h>
 #include <linux/wakelock.h>
 #include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <mach/board.h>
 #include <asm/io.h>
 
@@ -42,6 +48,8 @@
 #define RK29_I2C_STOP_TIMEOUT_COUNT			70//1000
 /*max START delay time = RK29_I2C_START_TIMEOUT_COUNT * RK29_UDELAY_TIME(scl_rate)   us */
 #define RK29_I2C_START_TIMEOUT_COUNT		1000
+/* clients tracked one by one in debugfs; the rest share the last slot */
+#define RK29_I2C_STATS_CLIENTS				16
 
 
 
@@ -76,6 +84,25 @@ enum rk29_event {
 	RK29_EVENT_MAX
 };
 
+struct rk29_i2c_client_stats {
+	unsigned short			addr;
+	unsigned long			xfers;
+	unsigned long			errors;
+	unsigned long			bytes;
+	u64						total_us;
+	unsigned long			max_us;
+};
+
+struct rk29_i2c_stats {
+	ktime_t					since;
+	u64						busy_us;
+	unsigned long			xfers;
+	unsigned long			async_reqs;
+	unsigned int			async_depth;
+	unsigned int			async_max_depth;
+	struct rk29_i2c_client_stats	client[RK29_I2C_STATS_CLIENTS];
+};
+
 struct rk29_i2c_data {
 	struct device			*dev;  
 	struct i2c_adapter		adap;
@@ -106,12 +133,28 @@ struct rk29_i2c_data {
 	unsigned int			msg_num;
 	int						udelay;
 	int (*io_init)(void);
+
+	/* data phase driven from the irq handler, see rk29_i2c_burst_step() */
+	struct i2c_msg			*burst_msg;
+	unsigned int			burst_pos;
+	int						burst_err;
+
+	/* requests queued by i2c_transfer_async() */
+	spinlock_t				async_lock;
+	struct list_head		async_list;
+	struct work_struct		async_work;
+	struct workqueue_struct	*async_wq;
+
+	spinlock_t				stats_lock;
+	struct rk29_i2c_stats	stats;
+	struct dentry			*debugfs;
 #ifdef CONFIG_CPU_FREQ
 		struct notifier_block	freq_transition;
 #endif	
 };
 
 static struct wake_lock idlelock; /* only for i2c0 */
+static struct dentry *rk29_i2c_debugfs_root;
 
 static void rk29_set_ack(struct rk29_i2c_data *i2c)
 {
@@ -239,6 +282,44 @@ static int rk29_event_occurred(struct rk29_i2c_data *i2c)
 	return 0;
 }
 
+/*
+ * Move the data phase of burst_msg on by one byte, from the irq handler
+ * with cmd_lock held.  Returns 1 once the message has finished or
+ * failed, 0 when the next byte has been started.
+ */
+static int rk29_i2c_burst_step(struct rk29_i2c_data *i2c)
+{
+	struct i2c_msg *msg = i2c->burst_msg;
+	unsigned long lsr;
+
+	if(i2c->cmd_event == RK29_EVENT_MRX_NEED_ACK)
+	{
+		msg->buf[i2c->burst_pos++] = (uint8_t)readl(i2c->regs + I2C_MRXR);
+		if(i2c->burst_pos == msg->len)
+		{
+			rk29_set_nak(i2c);
+			return 1;
+		}
+		rk29_set_ack(i2c);
+	}
+	else
+	{
+		lsr = readl(i2c->regs + I2C_LSR);
+		if((lsr & I2C_LSR_RCV_NAK) && (i2c->burst_pos != msg->len - 1) && !(msg->flags & I2C_M_IGNORE_NAK))
+		{
+			i2c->burst_err = -EINVAL;
+			return 1;
+		}
+		if(++i2c->burst_pos == msg->len)
+			return 1;
+		writel(msg->buf[i2c->burst_pos], i2c->regs + I2C_MTXR);
+		rk29_set_ack(i2c);
+	}
+	writel(I2C_LCMR_RESUME, i2c->regs + I2C_LCMR);
+	rk29_i2c_enable_irqs(i2c);
+	return 0;
+}
+
 static irqreturn_t rk29_i2c_irq(int irq, void *data)
 {
 	struct rk29_i2c_data *i2c = (struct rk29_i2c_data *)data;
@@ -250,7 +331,10 @@ static irqreturn_t rk29_i2c_irq(int irq, void *data)
 	if(res)
 	{
 		if(i2c->mode == I2C_MODE_IRQ)
-			complete(&i2c->cmd_complete);
+		{
+			if(!i2c->burst_msg || rk29_i2c_burst_step(i2c))
+				complete(&i2c->cmd_complete);
+		}
 		else
 			i2c->poll_status = 1;
 	}
@@ -405,6 +489,47 @@ static int rk29_send_address(struct rk29_i2c_data *i2c,
 	return ret;
 }
 
+/*
+ * Run the whole data phase of @msg from the irq handler and sleep once
+ * for it, instead of once per byte.
+ */
+static int rk29_i2c_burst(struct rk29_i2c_data *i2c, struct i2c_msg *msg,
+					enum rk29_event event)
+{
+	unsigned long flags;
+	int ret;
+
+	i2c->burst_pos = 0;
+	i2c->burst_err = 0;
+	i2c->burst_msg = msg;
+	INIT_COMPLETION(i2c->cmd_complete);
+	if(event == RK29_EVENT_MTX_RCVD_ACK)
+	{
+		i2c_dbg(i2c->dev, "i2c send buf[0]: %x, len %d\n", msg->buf[0], msg->len);
+		writel(msg->buf[0], i2c->regs + I2C_MTXR);
+		rk29_set_ack(i2c);
+	}
+	writel(I2C_LCMR_RESUME, i2c->regs + I2C_LCMR);
+
+	ret = rk29_wait_event(i2c, event);
+
+	spin_lock_irqsave(&i2c->cmd_lock, flags);
+	i2c->burst_msg = NULL;
+	rk29_i2c_disable_irqs(i2c);
+	spin_unlock_irqrestore(&i2c->cmd_lock, flags);
+
+	if(ret)
+		return ret;
+	if(i2c->burst_err)
+		return i2c->burst_err;
+	if(i2c->burst_pos != msg->len)
+	{
+		i2c_err(i2c->dev, "burst stopped at %d/%d\n", i2c->burst_pos, msg->len);
+		return -ETIMEDOUT;
+	}
+	return 0;
+}
+
 static int rk29_i2c_send_msg(struct rk29_i2c_data *i2c, struct i2c_msg *msg)
 {
 	int i, ret = 0;
@@ -414,6 +539,9 @@ static int rk29_i2c_send_msg(struct rk29_i2c_data *i2c, struct i2c_msg *msg)
 	conr |= I2C_CONR_MTX_MODE;
 	//conr |= I2C_CONR_MPORT_ENABLE;
 	writel(conr, i2c->regs + I2C_CONR);
+
+	if(i2c->mode == I2C_MODE_IRQ && !i2c->udelay)
+		return rk29_i2c_burst(i2c, msg, RK29_EVENT_MTX_RCVD_ACK);
 	
 	for(i = 0; i < msg->len; i++)
 	{
@@ -443,6 +571,9 @@ static int rk29_i2c_recv_msg(struct rk29_i2c_data *i2c, struct i2c_msg *msg)
 	conr &= I2C_CONR_MRX_MODE;
 	//conr |= I2C_CONR_MPORT_ENABLE;
 	writel(conr, i2c->regs + I2C_CONR);
+
+	if(i2c->mode == I2C_MODE_IRQ && !i2c->udelay)
+		return rk29_i2c_burst(i2c, msg, RK29_EVENT_MRX_NEED_ACK);
 	
 	for(i = 0; i < msg->len; i++)
 	{
@@ -528,12 +659,44 @@ exit:
 
 }
 
+static void rk29_i2c_account(struct rk29_i2c_data *i2c, struct i2c_msg *msgs,
+						int num, int ret, unsigned long us)
+{
+	struct rk29_i2c_client_stats *c = NULL;
+	unsigned long flags, bytes = 0;
+	int i;
+
+	for(i = 0; i < num; i++)
+		bytes += msgs[i].len;
+
+	spin_lock_irqsave(&i2c->stats_lock, flags);
+	for(i = 0; i < RK29_I2C_STATS_CLIENTS; i++)
+	{
+		c = &i2c->stats.client[i];
+		if(!c->xfers || c->addr == msgs[0].addr)
+			break;
+	}
+	if(!c->xfers)
+		c->addr = msgs[0].addr;
+	c->xfers++;
+	if(ret < 0)
+		c->errors++;
+	c->bytes += bytes;
+	c->total_us += us;
+	if(us > c->max_us)
+		c->max_us = us;
+	i2c->stats.xfers++;
+	i2c->stats.busy_us += us;
+	spin_unlock_irqrestore(&i2c->stats_lock, flags);
+}
+
 static int rk29_i2c_xfer(struct i2c_adapter *adap,
 			struct i2c_msg *msgs, int num)
 {
 	int ret = -1;
-	int i;
+	int i, nmsgs = num;
 	struct rk29_i2c_data *i2c = (struct rk29_i2c_data *)adap->algo_data;
+	ktime_t start = ktime_get();
 
 	//int retry = i2c->retry;
 	/*
@@ -584,6 +747,7 @@ static int rk29_i2c_xfer(struct i2c_adapter *adap,
 	*/
 	if(num < 0)
 		dev_err(i2c->dev, "i2c transfer err, client address is 0x%x [20110106]\n", msgs[0].addr);
+	rk29_i2c_account(i2c, msgs, nmsgs, num, ktime_us_delta(ktime_get(), start));
 	return num;
 }
 
@@ -597,6 +761,148 @@ static const struct i2c_algorithm rk29_i2c_algorithm = {
 	.functionality		= rk29_i2c_func,
 };
 
+static void rk29_i2c_async_work(struct work_struct *work)
+{
+	struct rk29_i2c_data *i2c = container_of(work, struct rk29_i2c_data, async_work);
+	struct i2c_async_req *req;
+	unsigned long flags;
+
+	for(;;)
+	{
+		spin_lock_irqsave(&i2c->async_lock, flags);
+		if(list_empty(&i2c->async_list))
+		{
+			spin_unlock_irqrestore(&i2c->async_lock, flags);
+			break;
+		}
+		req = list_first_entry(&i2c->async_list, struct i2c_async_req, node);
+		list_del(&req->node);
+		spin_unlock_irqrestore(&i2c->async_lock, flags);
+
+		spin_lock_irqsave(&i2c->stats_lock, flags);
+		i2c->stats.async_depth--;
+		spin_unlock_irqrestore(&i2c->stats_lock, flags);
+
+		/* takes the bus lock, so queued and synchronous transfers interleave per transaction */
+		req->ret = i2c_transfer(&i2c->adap, req->msgs, req->num);
+		if(req->complete)
+			req->complete(req);
+	}
+}
+
+int i2c_transfer_async(struct i2c_adapter *adap, struct i2c_async_req *req)
+{
+	struct rk29_i2c_data *i2c;
+	unsigned long flags;
+
+	if(adap->algo != &rk29_i2c_algorithm || !req->msgs || req->num <= 0)
+		return -EINVAL;
+	i2c = (struct rk29_i2c_data *)adap->algo_data;
+	if(!i2c->async_wq)
+		return -ENODEV;
+
+	spin_lock_irqsave(&i2c->async_lock, flags);
+	list_add_tail(&req->node, &i2c->async_list);
+	spin_unlock_irqrestore(&i2c->async_lock, flags);
+
+	spin_lock_irqsave(&i2c->stats_lock, flags);
+	i2c->stats.async_reqs++;
+	if(++i2c->stats.async_depth > i2c->stats.async_max_depth)
+		i2c->stats.async_max_depth = i2c->stats.async_depth;
+	spin_unlock_irqrestore(&i2c->stats_lock, flags);
+
+	queue_work(i2c->async_wq, &i2c->async_work);
+	return 0;
+}
+EXPORT_SYMBOL(i2c_transfer_async);
+
+#ifdef CONFIG_DEBUG_FS
+static int rk29_i2c_stats_show(struct seq_file *s, void *v)
+{
+	struct rk29_i2c_data *i2c = s->private;
+	struct rk29_i2c_stats *st;
+	struct rk29_i2c_client_stats *c;
+	unsigned long flags;
+	u64 elapsed;
+	int i;
+
+	st = kmalloc(sizeof(*st), GFP_KERNEL);
+	if(!st)
+		return -ENOMEM;
+	spin_lock_irqsave(&i2c->stats_lock, flags);
+	*st = i2c->stats;
+	spin_unlock_irqrestore(&i2c->stats_lock, flags);
+
+	elapsed = ktime_us_delta(ktime_get(), st->since);
+	seq_printf(s, "scl %lukHz, %lu xfers, busy %llu of %llu ms (%llu%%)\n",
+		   i2c->scl_rate / 1000, st->xfers, st->busy_us / 1000, elapsed / 1000,
+		   elapsed ? div64_u64(st->busy_us * 100, elapsed) : 0);
+	seq_printf(s, "async %lu reqs, queued %u, max queued %u\n",
+		   st->async_reqs, st->async_depth, st->async_max_depth);
+	seq_printf(s, "addr   xfers  errors     bytes  avg_us  max_us   busy%%\n");
+	for(i = 0; i < RK29_I2C_STATS_CLIENTS; i++)
+	{
+		c = &st->client[i];
+		if(!c->xfers)
+			break;
+		seq_printf(s, "0x%02x%s %6lu  %6lu  %8lu  %6llu  %6lu  %5llu\n",
+			   c->addr, (i == RK29_I2C_STATS_CLIENTS - 1) ? "+" : " ",
+			   c->xfers, c->errors, c->bytes,
+			   div64_u64(c->total_us, c->xfers), c->max_us,
+			   st->busy_us ? div64_u64(c->total_us * 100, st->busy_us) : 0);
+	}
+	kfree(st);
+	return 0;
+}
+
+static int rk29_i2c_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rk29_i2c_stats_show, inode->i_private);
+}
+
+/* any write clears the statistics */
+static ssize_t rk29_i2c_stats_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct rk29_i2c_data *i2c = ((struct seq_file *)file->private_data)->private;
+	unsigned long flags;
+	unsigned int depth;
+
+	spin_lock_irqsave(&i2c->stats_lock, flags);
+	depth = i2c->stats.async_depth;
+	memset(&i2c->stats, 0, sizeof(i2c->stats));
+	i2c->stats.async_depth = depth;
+	i2c->stats.since = ktime_get();
+	spin_unlock_irqrestore(&i2c->stats_lock, flags);
+	return count;
+}
+
+static const struct file_operations rk29_i2c_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rk29_i2c_stats_open,
+	.read		= seq_read,
+	.write		= rk29_i2c_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void rk29_i2c_debugfs_init(struct rk29_i2c_data *i2c)
+{
+	if(!rk29_i2c_debugfs_root)
+		return;
+	i2c->debugfs = debugfs_create_file(dev_name(&i2c->adap.dev), S_IRUGO | S_IWUSR,
+					   rk29_i2c_debugfs_root, i2c, &rk29_i2c_stats_fops);
+}
+
+static void rk29_i2c_debugfs_exit(struct rk29_i2c_data *i2c)
+{
+	debugfs_remove(i2c->debugfs);
+}
+#else
+static inline void rk29_i2c_debugfs_init(struct rk29_i2c_data *i2c) {}
+static inline void rk29_i2c_debugfs_exit(struct rk29_i2c_data *i2c) {}
+#endif
+
 int i2c_suspended(struct i2c_adapter *adap)
 {
 	struct rk29_i2c_data *i2c = (struct rk29_i2c_data *)adap->algo_data;
@@ -723,6 +1029,11 @@ static int rk29_i2c_probe(struct platform_device *pdev)
 	i2c->adap.class   	= I2C_CLASS_HWMON;
 	i2c->adap.nr		= pdata->bus_num;
 	spin_lock_init(&i2c->cmd_lock);
+	spin_lock_init(&i2c->async_lock);
+	spin_lock_init(&i2c->stats_lock);
+	INIT_LIST_HEAD(&i2c->async_list);
+	INIT_WORK(&i2c->async_work, rk29_i2c_async_work);
+	i2c->stats.since = ktime_get();
 
 	i2c->dev = &pdev->dev;
 	
@@ -785,18 +1096,29 @@ static int rk29_i2c_probe(struct platform_device *pdev)
 		goto err_irq;
 	}
 
+	i2c->async_wq = create_singlethread_workqueue(dev_name(&pdev->dev));
+	if (i2c->async_wq == NULL) {
+		i2c_err(&pdev->dev, "cannot create async workqueue\n");
+		ret = -ENOMEM;
+		goto err_cpufreq;
+	}
+
 	ret = i2c_add_numbered_adapter(&i2c->adap);
 	if (ret < 0) {
 		i2c_err(&pdev->dev, "failed to add bus to i2c core\n");
-		goto err_cpufreq;
+		goto err_wq;
 	}
 
 	platform_set_drvdata(pdev, i2c);
 	rk29_i2c_init_hw(i2c);
+	rk29_i2c_debugfs_init(i2c);
 	
 	dev_info(&pdev->dev, "%s: RK29 I2C adapter\n", dev_name(&i2c->adap.dev));
 	return 0;
 
+ err_wq:
+	destroy_workqueue(i2c->async_wq);
+
  err_cpufreq:
 	rk29_i2c_unregister_cpufreq(i2c);
 
@@ -825,6 +1147,8 @@ static int rk29_i2c_remove(struct platform_device *pdev)
 	struct rk29_i2c_data *i2c = platform_get_drvdata(pdev);
 
 
+	rk29_i2c_debugfs_exit(i2c);
+	destroy_workqueue(i2c->async_wq);
 	rk29_i2c_deinit_hw(i2c);
 	rk29_i2c_unregister_cpufreq(i2c);
 
@@ -885,12 +1209,18 @@ static struct platform_driver rk29_i2c_driver = {
 static int __init rk29_i2c_adap_init(void)
 {
 	wake_lock_init(&idlelock, WAKE_LOCK_IDLE, "i2c0");
+#ifdef CONFIG_DEBUG_FS
+	rk29_i2c_debugfs_root = debugfs_create_dir("rk29_i2c", NULL);
+	if (IS_ERR(rk29_i2c_debugfs_root))
+		rk29_i2c_debugfs_root = NULL;
+#endif
 	return platform_driver_register(&rk29_i2c_driver);
 }
 
 static void __exit rk29_i2c_adap_exit(void)
 {
 	platform_driver_unregister(&rk29_i2c_driver);
+	debugfs_remove(rk29_i2c_debugfs_root);
 }
 
 subsys_initcall(rk29_i2c_adap_init);
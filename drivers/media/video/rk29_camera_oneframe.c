@@ -29,6 +29,9 @@
 #include <linux/platform_device.h>
 #include <linux/mutex.h>
 #include <linux/videodev2.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <mach/rk29_camera.h>
 #include <mach/rk29_iomap.h>
 #include <mach/iomux.h>
@@ -52,6 +55,10 @@
 static int debug;
 module_param(debug, int, S_IRUGO|S_IWUSR);
 
+/* capture into both VIP frame buffers alternately when the crop allows it */
+static int pingpong = 1;
+module_param(pingpong, int, S_IRUGO|S_IWUSR);
+
 #define dprintk(level, fmt, arg...) do {			\
 	if (debug >= level) 					\
 	printk(KERN_WARNING"rk29xx_camera: " fmt , ## arg); } while (0)
@@ -111,6 +118,12 @@ module_param(debug, int, S_IRUGO|S_IWUSR);
 #define  VIP_RAWINPUT_POSITIVE_EDGE   (0x01<<13)
 #define  VIP_RAWINPUT_NEGATIVE_EDGE   (0x02<<13)
 
+//VIP_FB_SR
+#define  VIP_F1_READY                 (0x01<<0)
+#define  VIP_F2_READY                 (0x01<<1)
+#define  VIP_FRAME_LOSS               (0x01<<2)
+#define  VIP_F2_IS_LATEST             (0x01<<3)
+
 // GRF_SOC_CON0 Reg
 #define  GRF_SOC_CON0_Reg             0xbc
 #define  VIP_AXIMASTER                (0x00<<0)
@@ -183,6 +196,7 @@ module_param(debug, int, S_IRUGO|S_IWUSR);
 #define RK29_CAM_FRAME_INVAL_INIT 3
 #define RK29_CAM_FRAME_INVAL_DC 3          /* ddl@rock-chips.com :  */
 #define RK29_CAM_FRAME_MEASURE  5
+#define RK29_CAM_HIST_BUCKETS   16      /* log2(us) latency buckets, last one is open ended */
 
 #define RK29_CAM_AXI   0
 #define RK29_CAM_AHB   1
@@ -198,6 +212,9 @@ struct rk29_buffer
     struct videobuf_buffer vb;
     enum v4l2_mbus_pixelcode	code;
     int			inwork;
+    ktime_t		t_queue;        /* handed to the driver */
+    ktime_t		t_arm;          /* programmed into a VIP frame buffer */
+    ktime_t		t_done;         /* VIP finished writing it */
 };
 enum rk29_camera_reg_state
 {
@@ -214,11 +231,15 @@ struct rk29_camera_reg
 	unsigned int VipCrm;
 	enum rk29_camera_reg_state Inval;
 };
+/* IPP dest is at most 2047x1088, bigger frames are scaled as tiles */
+#define RK29_CAM_IPP_TILES	16
 struct rk29_camera_work
 {
 	struct videobuf_buffer *vb;
 	struct rk29_camera_dev *pcdev;
 	struct work_struct work;
+	struct rk29_ipp_job ipp_job;
+	struct rk29_ipp_req ipp_req[RK29_CAM_IPP_TILES];
 };
 struct rk29_camera_frmivalenum
 {
@@ -236,6 +257,20 @@ struct rk29_camera_zoominfo
     struct v4l2_crop a;
     int zoom_rate;
 };
+enum rk29_camera_stage
+{
+	RK29_CAM_STAGE_QUEUE,       /* queued -> armed */
+	RK29_CAM_STAGE_CAPTURE,     /* armed -> frame done */
+	RK29_CAM_STAGE_PROCESS,     /* frame done -> buffer ready (IPP zoom included) */
+	RK29_CAM_STAGE_NUM
+};
+struct rk29_camera_stats
+{
+	unsigned int hist[RK29_CAM_STAGE_NUM][RK29_CAM_HIST_BUCKETS];
+	unsigned int frames;
+	unsigned int starved;       /* a frame buffer was left unarmed, no free videobuf */
+	unsigned int frame_loss;    /* VIP dropped a frame, both frame buffers were full */
+};
 struct rk29_camera_dev
 {
     struct soc_camera_host	soc_host;
@@ -284,6 +319,8 @@ struct rk29_camera_dev
     spinlock_t		lock;
 
     struct videobuf_buffer	*active;
+    struct videobuf_buffer	*active2;       /* frame 2 buffer in ping-pong mode */
+    int pingpong;
 	struct rk29_camera_reg reginfo_suspend;
 	struct workqueue_struct *camera_wq;
 	struct rk29_camera_work *camera_work;
@@ -293,6 +330,8 @@ struct rk29_camera_dev
     int icd_init;
     rk29_camera_sensor_cb_s icd_cb;
     struct rk29_camera_frmivalinfo icd_frmival[2];
+    struct rk29_camera_stats stats;
+    struct dentry *debugfs;
 };
 
 static const struct v4l2_queryctrl rk29_camera_controls[] =
@@ -352,6 +391,8 @@ static int rk29_videobuf_setup(struct videobuf_queue *vq, unsigned int *count,
     		}
         }
 		if ((pcdev->camera_work_count != *count) && pcdev->camera_work) {
+			flush_workqueue(pcdev->camera_wq);
+			ipp_queue_flush();
 			kfree(pcdev->camera_work);
 			pcdev->camera_work = NULL;
 			pcdev->camera_work_count = 0;
@@ -452,12 +493,20 @@ out:
     return ret;
 }
 
-static inline void rk29_videobuf_capture(struct videobuf_buffer *vb)
+static void rk29_camera_stage_done(struct rk29_camera_dev *pcdev, int stage, ktime_t from)
+{
+	s64 us = ktime_us_delta(ktime_get(), from);
+	int i = 0;
+
+	if (us > 0)
+		i = min(fls64(us), RK29_CAM_HIST_BUCKETS-1);
+	pcdev->stats.hist[stage][i]++;
+}
+static void rk29_videobuf_addr(struct videobuf_buffer *vb, unsigned int *y, unsigned int *uv)
 {
 	unsigned int y_addr,uv_addr;
 	struct rk29_camera_dev *pcdev = rk29_camdev_info_ptr;
 
-    if (vb) {
 		if (CAM_WORKQUEUE_IS_EN()) {
 			y_addr = pcdev->vipmem_phybase + vb->i*pcdev->vipmem_bsize;
 			uv_addr = y_addr + pcdev->host_width*pcdev->host_height;
@@ -471,6 +520,24 @@ static inline void rk29_videobuf_capture(struct videobuf_buffer *vb)
 			y_addr = vb->boff;
 			uv_addr = y_addr + vb->width * vb->height;
 		}
+	*y = y_addr;
+	*uv = uv_addr;
+}
+static void rk29_videobuf_armed(struct rk29_camera_dev *pcdev, struct videobuf_buffer *vb)
+{
+	struct rk29_buffer *buf = container_of(vb, struct rk29_buffer, vb);
+
+	buf->t_arm = ktime_get();
+	rk29_camera_stage_done(pcdev, RK29_CAM_STAGE_QUEUE, buf->t_queue);
+}
+static inline void rk29_videobuf_capture(struct videobuf_buffer *vb)
+{
+	unsigned int y_addr,uv_addr;
+	struct rk29_camera_dev *pcdev = rk29_camdev_info_ptr;
+
+    if (vb) {
+		rk29_videobuf_addr(vb, &y_addr, &uv_addr);
+		rk29_videobuf_armed(pcdev, vb);
         write_vip_reg(RK29_VIP_CAPTURE_F1SA_Y, y_addr);
         write_vip_reg(RK29_VIP_CAPTURE_F1SA_UV, uv_addr);
         write_vip_reg(RK29_VIP_CAPTURE_F2SA_Y, y_addr);
@@ -478,6 +545,50 @@ static inline void rk29_videobuf_capture(struct videobuf_buffer *vb)
         write_vip_reg(RK29_VIP_FB_SR,  0x00000002);//frame1 has been ready to receive data,frame 2 is not used
     }
 }
+/*
+ * Ping-pong mode: the VIP fills frame 1 and frame 2 alternately, and a
+ * frame buffer is handed to it by clearing its READY bit.  Each frame
+ * buffer owns its own videobuf, so the next frame already has a target
+ * while the previous one is being dequeued or zoomed by the IPP.
+ */
+static struct videobuf_buffer **rk29_pingpong_slot(struct rk29_camera_dev *pcdev, int frame)
+{
+	return frame ? &pcdev->active2 : &pcdev->active;
+}
+static void rk29_pingpong_arm(struct rk29_camera_dev *pcdev, int frame, struct videobuf_buffer *vb)
+{
+	unsigned int y_addr,uv_addr;
+
+	*rk29_pingpong_slot(pcdev, frame) = vb;
+	rk29_videobuf_addr(vb, &y_addr, &uv_addr);
+	rk29_videobuf_armed(pcdev, vb);
+	if (frame) {
+		write_vip_reg(RK29_VIP_CAPTURE_F2SA_Y, y_addr);
+		write_vip_reg(RK29_VIP_CAPTURE_F2SA_UV, uv_addr);
+		write_vip_reg(RK29_VIP_FB_SR, read_vip_reg(RK29_VIP_FB_SR) & ~VIP_F2_READY);
+	} else {
+		write_vip_reg(RK29_VIP_CAPTURE_F1SA_Y, y_addr);
+		write_vip_reg(RK29_VIP_CAPTURE_F1SA_UV, uv_addr);
+		write_vip_reg(RK29_VIP_FB_SR, read_vip_reg(RK29_VIP_FB_SR) & ~VIP_F1_READY);
+	}
+}
+/* Arm every idle frame buffer with the oldest queued videobuf not yet armed */
+static void rk29_pingpong_fill(struct rk29_camera_dev *pcdev)
+{
+	struct videobuf_buffer *vb;
+	int frame;
+
+	for (frame=0; frame<2; frame++) {
+		if (*rk29_pingpong_slot(pcdev, frame))
+			continue;
+		list_for_each_entry(vb, &pcdev->capture, queue) {
+			if ((vb != pcdev->active) && (vb != pcdev->active2)) {
+				rk29_pingpong_arm(pcdev, frame, vb);
+				break;
+			}
+		}
+	}
+}
 /* Locking: Caller holds q->irqlock */
 static void rk29_videobuf_queue(struct videobuf_queue *vq,
                                 struct videobuf_buffer *vb)
@@ -490,6 +601,7 @@ static void rk29_videobuf_queue(struct videobuf_queue *vq,
             vb, vb->baddr, vb->bsize);
 
     vb->state = VIDEOBUF_QUEUED;
+	container_of(vb, struct rk29_buffer, vb)->t_queue = ktime_get();
 
 	if (list_empty(&pcdev->capture)) {
 		list_add_tail(&vb->queue, &pcdev->capture);
@@ -499,7 +611,9 @@ static void rk29_videobuf_queue(struct videobuf_queue *vq,
 		else
 			BUG();    /* ddl@rock-chips.com : The same videobuffer queue again */
 	}
-    if (!pcdev->active) {
+    if (pcdev->pingpong) {
+        rk29_pingpong_fill(pcdev);
+    } else if (!pcdev->active) {
         pcdev->active = vb;
         rk29_videobuf_capture(vb);
     }
@@ -528,12 +642,45 @@ static int rk29_pixfmt2ippfmt(unsigned int pixfmt, int *ippfmt)
 rk29_pixfmt2ippfmt_err:
 	return -1;
 }
+static void rk29_camera_ipp_done(struct rk29_ipp_job *job, int ret)
+{
+	struct rk29_camera_work *camera_work = container_of(job, struct rk29_camera_work, ipp_job);
+	struct videobuf_buffer *vb = camera_work->vb;
+	struct rk29_camera_dev *pcdev = camera_work->pcdev;
+	struct rk29_ipp_req *ipp_req;
+	unsigned long int flags;
+
+	if (ret) {
+		spin_lock_irqsave(&pcdev->lock, flags);
+		vb->state = VIDEOBUF_ERROR;
+		spin_unlock_irqrestore(&pcdev->lock, flags);
+
+		ipp_req = &job->reqs[job->nr_done];
+		RK29CAMERA_TR("Capture image(vb->i:0x%x) which IPP operated is error:\n",vb->i);
+		RK29CAMERA_TR("tile:%d of %d ",job->nr_done,job->nr_reqs);
+		RK29CAMERA_TR("ipp_req.src0.YrgbMst:0x%x ipp_req.src0.CbrMst:0x%x \n", ipp_req->src0.YrgbMst,ipp_req->src0.CbrMst);
+		RK29CAMERA_TR("ipp_req.src0.w:0x%x ipp_req.src0.h:0x%x \n",ipp_req->src0.w,ipp_req->src0.h);
+		RK29CAMERA_TR("ipp_req.src0.fmt:0x%x\n",ipp_req->src0.fmt);
+		RK29CAMERA_TR("ipp_req.dst0.YrgbMst:0x%x ipp_req.dst0.CbrMst:0x%x \n",ipp_req->dst0.YrgbMst,ipp_req->dst0.CbrMst);
+		RK29CAMERA_TR("ipp_req.dst0.w:0x%x ipp_req.dst0.h:0x%x \n",ipp_req->dst0.w ,ipp_req->dst0.h);
+		RK29CAMERA_TR("ipp_req.dst0.fmt:0x%x\n",ipp_req->dst0.fmt);
+		RK29CAMERA_TR("ipp_req.src_vir_w:0x%x ipp_req.dst_vir_w :0x%x\n",ipp_req->src_vir_w ,ipp_req->dst_vir_w);
+		RK29CAMERA_TR("ipp_req.timeout:0x%x ipp_req.flag :0x%x\n",ipp_req->timeout,ipp_req->flag);
+	} else {
+		rk29_camera_stage_done(pcdev, RK29_CAM_STAGE_PROCESS,
+			container_of(vb, struct rk29_buffer, vb)->t_done);
+		if (pcdev->icd_cb.sensor_cb)
+			(pcdev->icd_cb.sensor_cb)(vb);
+	}
+
+	wake_up(&vb->done);
+}
 static void rk29_camera_capture_process(struct work_struct *work)
 {
 	struct rk29_camera_work *camera_work = container_of(work, struct rk29_camera_work, work);
 	struct videobuf_buffer *vb = camera_work->vb;
 	struct rk29_camera_dev *pcdev = camera_work->pcdev;
-	struct rk29_ipp_req ipp_req;
+	struct rk29_ipp_req ipp_req, *tile;
 	unsigned long int flags;
     int src_y_offset,src_uv_offset,dst_y_offset,dst_uv_offset,src_y_size,dst_y_size;
     int scale_times,w,h,vipdata_base;
@@ -548,6 +695,10 @@ static void rk29_camera_capture_process(struct work_struct *work)
     } else {
         scale_times = 1;
     }
+    if (scale_times*scale_times > RK29_CAM_IPP_TILES) {
+        RK29CAMERA_TR("%s: %dx%d needs too many IPP tiles\n",__FUNCTION__,pcdev->icd->user_width,pcdev->icd->user_height);
+        goto do_ipp_err;
+    }
     
     memset(&ipp_req, 0, sizeof(struct rk29_ipp_req));
     
@@ -568,6 +719,8 @@ static void rk29_camera_capture_process(struct work_struct *work)
     src_y_size = pcdev->host_width*pcdev->host_height;
     dst_y_size = pcdev->icd->user_width*pcdev->icd->user_height;
     
+    /* every tile goes to the IPP queue as one job, run back to back */
+    tile = camera_work->ipp_req;
     for (h=0; h<scale_times; h++) {
         for (w=0; w<scale_times; w++) {
             
@@ -584,51 +737,165 @@ static void rk29_camera_capture_process(struct work_struct *work)
     		ipp_req.dst0.YrgbMst = vb->boff + dst_y_offset;
     		ipp_req.dst0.CbrMst = vb->boff + dst_y_size + dst_uv_offset;
 
-    		if (ipp_blit_sync(&ipp_req)) {
-    			spin_lock_irqsave(&pcdev->lock, flags);
-    			vb->state = VIDEOBUF_ERROR;
-    			spin_unlock_irqrestore(&pcdev->lock, flags);
-
-                RK29CAMERA_TR("Capture image(vb->i:0x%x) which IPP operated is error:\n",vb->i);
-                RK29CAMERA_TR("widx:%d hidx:%d ",w,h);
-                RK29CAMERA_TR("%dx%d@(%d,%d)->%dx%d\n",pcdev->zoominfo.a.c.width,pcdev->zoominfo.a.c.height,pcdev->zoominfo.a.c.left,pcdev->zoominfo.a.c.top,pcdev->icd->user_width,pcdev->icd->user_height);
-            	RK29CAMERA_TR("ipp_req.src0.YrgbMst:0x%x ipp_req.src0.CbrMst:0x%x \n", ipp_req.src0.YrgbMst,ipp_req.src0.CbrMst);
-            	RK29CAMERA_TR("ipp_req.src0.w:0x%x ipp_req.src0.h:0x%x \n",ipp_req.src0.w,ipp_req.src0.h);
-            	RK29CAMERA_TR("ipp_req.src0.fmt:0x%x\n",ipp_req.src0.fmt);
-            	RK29CAMERA_TR("ipp_req.dst0.YrgbMst:0x%x ipp_req.dst0.CbrMst:0x%x \n",ipp_req.dst0.YrgbMst,ipp_req.dst0.CbrMst);
-            	RK29CAMERA_TR("ipp_req.dst0.w:0x%x ipp_req.dst0.h:0x%x \n",ipp_req.dst0.w ,ipp_req.dst0.h);
-            	RK29CAMERA_TR("ipp_req.dst0.fmt:0x%x\n",ipp_req.dst0.fmt);
-            	RK29CAMERA_TR("ipp_req.src_vir_w:0x%x ipp_req.dst_vir_w :0x%x\n",ipp_req.src_vir_w ,ipp_req.dst_vir_w);
-            	RK29CAMERA_TR("ipp_req.timeout:0x%x ipp_req.flag :0x%x\n",ipp_req.timeout,ipp_req.flag);
-                
-    			goto do_ipp_err;
-    		}
+    		*tile++ = ipp_req;
         }
     }
 
-    if (pcdev->icd_cb.sensor_cb)
-        (pcdev->icd_cb.sensor_cb)(vb);
-	
-do_ipp_err:
     up(&pcdev->zoominfo.sem);
+
+    camera_work->ipp_job.reqs = camera_work->ipp_req;
+    camera_work->ipp_job.nr_reqs = scale_times*scale_times;
+    camera_work->ipp_job.complete = rk29_camera_ipp_done;
+    if (ipp_queue_job(&camera_work->ipp_job) == 0)
+        return;
+
+do_ipp_err:
+	spin_lock_irqsave(&pcdev->lock, flags);
+	vb->state = VIDEOBUF_ERROR;
+	spin_unlock_irqrestore(&pcdev->lock, flags);
     wake_up(&(camera_work->vb->done)); 
 	return;
 }
-static irqreturn_t rk29_camera_irq(int irq, void *data)
+static void rk29_camera_frame_measure(struct rk29_camera_dev *pcdev)
 {
-    struct rk29_camera_dev *pcdev = data;
-    struct videobuf_buffer *vb;
-	struct rk29_camera_work *wk;
     static struct timeval first_tv;
     struct timeval tv;
 
-    read_vip_reg(RK29_VIP_INT_STS);    /* clear vip interrupte single  */
-    /* ddl@rock-chps.com : Current VIP is run in One Frame Mode, Frame 1 is validate */
-    if (read_vip_reg(RK29_VIP_FB_SR) & 0x01) {
         if (!pcdev->fps) {
             do_gettimeofday(&first_tv);            
         }
 		pcdev->fps++;
+        if(pcdev->fps == RK29_CAM_FRAME_MEASURE) {
+            do_gettimeofday(&tv);            
+            pcdev->frame_interval = ((tv.tv_sec*1000000 + tv.tv_usec) - (first_tv.tv_sec*1000000 + first_tv.tv_usec))
+                                    /(RK29_CAM_FRAME_MEASURE-1);
+        }
+}
+/* Hand a captured videobuf on: to the IPP zoom work, or straight to the reader */
+static void rk29_camera_frame_done(struct rk29_camera_dev *pcdev, struct videobuf_buffer *vb)
+{
+	struct rk29_buffer *buf = container_of(vb, struct rk29_buffer, vb);
+	struct rk29_camera_work *wk;
+
+	buf->t_done = ktime_get();
+	rk29_camera_stage_done(pcdev, RK29_CAM_STAGE_CAPTURE, buf->t_arm);
+	pcdev->stats.frames++;
+
+		if (CAM_WORKQUEUE_IS_EN()) {
+			wk = pcdev->camera_work + vb->i;
+			INIT_WORK(&(wk->work), rk29_camera_capture_process);
+			wk->vb = vb;
+			wk->pcdev = pcdev;
+			queue_work(pcdev->camera_wq, &(wk->work));
+		} else {		    
+			rk29_camera_stage_done(pcdev, RK29_CAM_STAGE_PROCESS, buf->t_done);
+			wake_up(&vb->done);
+		}
+}
+static void rk29_pingpong_frame(struct rk29_camera_dev *pcdev, int frame)
+{
+	struct videobuf_buffer **slot = rk29_pingpong_slot(pcdev, frame);
+	struct videobuf_buffer *vb = *slot;
+
+	if (pcdev->frame_inval>0) {
+		pcdev->frame_inval--;
+		rk29_pingpong_arm(pcdev, frame, vb);
+		return;
+	} else if (pcdev->frame_inval) {
+		RK29CAMERA_TR("frame_inval : %0x",pcdev->frame_inval);
+		pcdev->frame_inval = 0;
+	}
+
+	*slot = NULL;
+	/* ddl@rock-chips.com : this vb may be deleted from queue */
+	if ((vb->state == VIDEOBUF_QUEUED) || (vb->state == VIDEOBUF_ACTIVE)) {
+		list_del_init(&vb->queue);
+		vb->state = VIDEOBUF_DONE;
+		do_gettimeofday(&vb->ts);
+		vb->field_count++;
+	}
+
+	/* refill before the reader sees this frame, the VIP must never idle */
+	rk29_pingpong_fill(pcdev);
+	if (*slot == NULL) {
+		pcdev->stats.starved++;
+		RK29CAMERA_DG("%s video_buf queue is empty!\n",__FUNCTION__);
+	}
+
+	rk29_camera_frame_done(pcdev, vb);
+}
+static void rk29_pingpong_irq(struct rk29_camera_dev *pcdev)
+{
+	unsigned int fb_sr = read_vip_reg(RK29_VIP_FB_SR);
+	int first,i,frame;
+
+	if (fb_sr & VIP_FRAME_LOSS) {
+		pcdev->stats.frame_loss++;
+		write_vip_reg(RK29_VIP_FB_SR, fb_sr & ~VIP_FRAME_LOSS);
+	}
+
+	/* when both frame buffers are full, the older one is completed first */
+	first = (fb_sr & VIP_F2_IS_LATEST) ? 0 : 1;
+	for (i=0; i<2; i++) {
+		frame = first ^ i;
+		if (!(fb_sr & (frame ? VIP_F2_READY : VIP_F1_READY)))
+			continue;
+		if (*rk29_pingpong_slot(pcdev, frame) == NULL)
+			continue;           /* idle frame buffer, READY is ours */
+		rk29_camera_frame_measure(pcdev);
+		rk29_pingpong_frame(pcdev, frame);
+	}
+}
+static int rk29_camera_latency_show(struct seq_file *s, void *v)
+{
+	struct rk29_camera_dev *pcdev = s->private;
+	struct rk29_camera_stats *st = &pcdev->stats;
+	int i;
+
+	seq_printf(s, "mode: %s frames: %u starved: %u frame_loss: %u\n",
+		pcdev->pingpong ? "ping-pong" : "oneframe", st->frames, st->starved, st->frame_loss);
+	seq_printf(s, "%10s %10s %10s %10s\n", "us", "queue", "capture", "process");
+	for (i=0; i<RK29_CAM_HIST_BUCKETS; i++) {
+		seq_printf(s, "%s%8lu %10u %10u %10u\n", (i == RK29_CAM_HIST_BUCKETS-1) ? ">=" : "< ",
+			(i == RK29_CAM_HIST_BUCKETS-1) ? (1UL<<(i-1)) : (1UL<<i),
+			st->hist[RK29_CAM_STAGE_QUEUE][i], st->hist[RK29_CAM_STAGE_CAPTURE][i],
+			st->hist[RK29_CAM_STAGE_PROCESS][i]);
+	}
+	return 0;
+}
+static int rk29_camera_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, rk29_camera_latency_show, inode->i_private);
+}
+static ssize_t rk29_camera_latency_write(struct file *file, const char __user *buf,
+			size_t count, loff_t *ppos)
+{
+	struct rk29_camera_dev *pcdev = ((struct seq_file *)file->private_data)->private;
+
+	memset(&pcdev->stats, 0, sizeof(pcdev->stats));
+	return count;
+}
+static const struct file_operations rk29_camera_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = rk29_camera_latency_open,
+	.read = seq_read,
+	.write = rk29_camera_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+static irqreturn_t rk29_camera_irq(int irq, void *data)
+{
+    struct rk29_camera_dev *pcdev = data;
+    struct videobuf_buffer *vb;
+
+    read_vip_reg(RK29_VIP_INT_STS);    /* clear vip interrupte single  */
+    if (pcdev->pingpong) {
+        rk29_pingpong_irq(pcdev);
+        goto RK29_CAMERA_IRQ_END;
+    }
+    /* ddl@rock-chps.com : Current VIP is run in One Frame Mode, Frame 1 is validate */
+    if (read_vip_reg(RK29_VIP_FB_SR) & 0x01) {
+		rk29_camera_frame_measure(pcdev);
 		if (!pcdev->active)
 			goto RK29_CAMERA_IRQ_END;
 
@@ -641,12 +908,6 @@ static irqreturn_t rk29_camera_irq(int irq, void *data)
             pcdev->frame_inval = 0;
         }
 
-        if(pcdev->fps == RK29_CAM_FRAME_MEASURE) {
-            do_gettimeofday(&tv);            
-            pcdev->frame_interval = ((tv.tv_sec*1000000 + tv.tv_usec) - (first_tv.tv_sec*1000000 + first_tv.tv_usec))
-                                    /(RK29_CAM_FRAME_MEASURE-1);
-        }
-
         vb = pcdev->active;
 		/* ddl@rock-chips.com : this vb may be deleted from queue */
 		if ((vb->state == VIDEOBUF_QUEUED) || (vb->state == VIDEOBUF_ACTIVE)) {
@@ -662,6 +923,7 @@ static irqreturn_t rk29_camera_irq(int irq, void *data)
         }
 
         if (pcdev->active == NULL) {
+			pcdev->stats.starved++;
 			RK29CAMERA_DG("%s video_buf queue is empty!\n",__FUNCTION__);
         }
 
@@ -671,15 +933,7 @@ static irqreturn_t rk29_camera_irq(int irq, void *data)
 	        vb->field_count++;
 		}
 
-		if (CAM_WORKQUEUE_IS_EN()) {
-			wk = pcdev->camera_work + vb->i;
-			INIT_WORK(&(wk->work), rk29_camera_capture_process);
-			wk->vb = vb;
-			wk->pcdev = pcdev;
-			queue_work(pcdev->camera_wq, &(wk->work));
-		} else {		    
-			wake_up(&vb->done);
-		}
+		rk29_camera_frame_done(pcdev, vb);
     }
 
 RK29_CAMERA_IRQ_END:
@@ -714,7 +968,7 @@ static void rk29_videobuf_release(struct videobuf_queue *vq,
             break;
     }
 #endif	
-	if (vb == pcdev->active) {
+	if ((vb == pcdev->active) || (vb == pcdev->active2)) {
 		RK29CAMERA_DG("%s Wait for this video buf(0x%x) write finished!\n ",__FUNCTION__,(unsigned int)vb);
 		interruptible_sleep_on_timeout(&vb->done, 100);
 		RK29CAMERA_DG("%s This video buf(0x%x) write finished, release now!!\n",__FUNCTION__,(unsigned int)vb);
@@ -878,6 +1132,7 @@ static int rk29_camera_add_device(struct soc_camera_device *icd)
     
 	pcdev->frame_inval = RK29_CAM_FRAME_INVAL_INIT;
     pcdev->active = NULL;
+    pcdev->active2 = NULL;
     pcdev->icd = NULL;
 	pcdev->reginfo_suspend.Inval = Reg_Invalidate;
     pcdev->zoominfo.zoom_rate = 100;
@@ -953,12 +1208,15 @@ static void rk29_camera_remove_device(struct soc_camera_device *icd)
 	rk29_camera_deactivate(pcdev);
 
 	if (pcdev->camera_work) {
+		flush_workqueue(pcdev->camera_wq);
+		ipp_queue_flush();
 		kfree(pcdev->camera_work);
 		pcdev->camera_work = NULL;
 		pcdev->camera_work_count = 0;
 	}
 
 	pcdev->active = NULL;
+	pcdev->active2 = NULL;
     pcdev->icd = NULL;
     pcdev->icd_cb.sensor_cb = NULL;
 	pcdev->reginfo_suspend.Inval = Reg_Invalidate;
@@ -1102,7 +1360,7 @@ static void rk29_camera_setup_format(struct soc_camera_device *icd, __u32 host_p
 	struct soc_camera_host *ici = to_soc_camera_host(icd->dev.parent);
     struct rk29_camera_dev *pcdev = ici->priv;
     unsigned int vip_fs = 0,vip_crop = 0;
-    unsigned int vip_ctrl_val = VIP_SENSOR|ONEFRAME|DISABLE_CAPTURE;
+    unsigned int vip_ctrl_val = VIP_SENSOR|DISABLE_CAPTURE;
 	int x_offset=0;
 	
 	if(strstr(dev_name(icd->pdev), RK29_CAM_SENSOR_NAME_NT99250))
@@ -1110,6 +1368,11 @@ static void rk29_camera_setup_format(struct soc_camera_device *icd, __u32 host_p
 //    else if(strstr(dev_name(icd->pdev), RK29_CAM_SENSOR_NAME_OV2655_BACK))
 //        x_offset=OV2655_BACK_X_OFFSET;
 
+	/* VIP can't crop in ping-pong mode */
+	pcdev->pingpong = pingpong && !(rect->left+x_offset) && !rect->top;
+	vip_ctrl_val |= pcdev->pingpong ? PING_PONG : ONEFRAME;
+	pcdev->active2 = NULL;
+
     switch (host_pixfmt)
     {
         case V4L2_PIX_FMT_NV16:
@@ -1151,7 +1414,8 @@ static void rk29_camera_setup_format(struct soc_camera_device *icd, __u32 host_p
         vip_crop = (((rect->left+x_offset)<<16) + rect->top);
         vip_fs  = (((rect->width + rect->left+x_offset)<<16) + (rect->height+rect->top));
     } else if (vip_ctrl_val & PING_PONG) {
-        BUG();
+        vip_crop = 0;
+        vip_fs  = ((rect->width<<16) + rect->height);
     }
 
     write_vip_reg(RK29_VIP_CROP, vip_crop);
@@ -1684,7 +1948,15 @@ static int rk29_camera_resume(struct soc_camera_device *icd)
 			write_vip_reg(RK29_VIP_CROP, pcdev->reginfo_suspend.VipCrop);
 			write_vip_reg(RK29_VIP_FS, pcdev->reginfo_suspend.VipFs);
 
-			rk29_videobuf_capture(pcdev->active);
+			if (pcdev->pingpong) {
+				write_vip_reg(RK29_VIP_FB_SR, VIP_F1_READY|VIP_F2_READY);
+				if (pcdev->active)
+					rk29_pingpong_arm(pcdev, 0, pcdev->active);
+				if (pcdev->active2)
+					rk29_pingpong_arm(pcdev, 1, pcdev->active2);
+			} else {
+				rk29_videobuf_capture(pcdev->active);
+			}
 			rk29_camera_s_stream(icd, 1);
 			pcdev->reginfo_suspend.Inval = Reg_Invalidate;
 		} else {
@@ -2165,6 +2437,12 @@ static int rk29_camera_probe(struct platform_device *pdev)
 	pcdev->fps_timer.function = rk29_camera_fps_func;
     pcdev->icd_cb.sensor_cb = NULL;
 
+	/* per-stage latency histograms, any write clears them */
+	pcdev->debugfs = debugfs_create_dir("rk29_camera", NULL);
+	if (!IS_ERR_OR_NULL(pcdev->debugfs))
+		debugfs_create_file("latency", S_IRUGO|S_IWUSR, pcdev->debugfs, pcdev,
+			&rk29_camera_latency_fops);
+
     RK29CAMERA_DG("%s..%s..%d  \n",__FUNCTION__,__FILE__,__LINE__);
     return 0;
 
@@ -2241,6 +2519,7 @@ static int __devexit rk29_camera_remove(struct platform_device *pdev)
     int i;
     
     free_irq(pcdev->irq, pcdev);
+    debugfs_remove_recursive(pcdev->debugfs);
 
 	if (pcdev->camera_wq) {
 		destroy_workqueue(pcdev->camera_wq);
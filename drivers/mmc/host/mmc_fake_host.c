@@ -0,0 +1,482 @@
+/* drivers/mmc/host/mmc_fake_host.c
+ *
+ * A host controller with a RAM backed SD or eMMC card behind it, for
+ * measuring the MMC core and block driver on any board without touching
+ * a card:
+ *
+ *	insmod mmc_fake_host.ko type=mmc size_mb=256
+ *	blk-bench -w /dev/block/mmcblk2		(tools/block/blk-bench)
+ *
+ * The card answers the identification sequence of an SDHC card
+ * (type=sd) or a sector addressed eMMC 4.41 device (type=mmc) and then
+ * serves single and multiple block reads and writes from memory.  Each
+ * request completes from a timer after cmd_us plus the transfer time at
+ * read_kbps/write_kbps, so the bus is idle for as long as the core and
+ * block driver take between requests, as on real hardware.
+ *
+ * Mapping a request for DMA costs map_us of CPU time, spent in pre_req()
+ * when the core prepares the next request while the current one is on
+ * the bus, or in request() otherwise.  fail_every=N fails every Nth read
+ * with a data CRC error to exercise the error path.  The number of
+ * requests and of those that were mapped ahead are in debugfs, under
+ * mmcN/fake_requests and mmcN/fake_premapped.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/platform_device.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/scatterlist.h>
+#include <linux/debugfs.h>
+#include <linux/mmc/host.h>
+#include <linux/mmc/card.h>
+#include <linux/mmc/mmc.h>
+#include <linux/mmc/sd.h>
+#include <linux/mmc/sdio.h>
+
+#define FAKE_NAME	"mmc_fake_host"
+#define FAKE_OCR	(MMC_VDD_32_33 | MMC_VDD_33_34)
+#define FAKE_RCA	0x0001
+#define FAKE_STATUS	(R1_READY_FOR_DATA | (R1_STATE_TRAN << 9))
+
+static char *type = "sd";
+module_param(type, charp, 0444);
+MODULE_PARM_DESC(type, "card to emulate, sd or mmc");
+
+static unsigned int size_mb = 64;
+module_param(size_mb, uint, 0444);
+MODULE_PARM_DESC(size_mb, "capacity of the card");
+
+static unsigned int cmd_us = 30;
+module_param(cmd_us, uint, 0644);
+MODULE_PARM_DESC(cmd_us, "bus time of every command");
+
+static unsigned int map_us = 40;
+module_param(map_us, uint, 0644);
+MODULE_PARM_DESC(map_us, "CPU time to map a data request");
+
+static unsigned int read_kbps = 20000;
+module_param(read_kbps, uint, 0644);
+MODULE_PARM_DESC(read_kbps, "read bandwidth in KB/s, 0 for no delay");
+
+static unsigned int write_kbps = 10000;
+module_param(write_kbps, uint, 0644);
+MODULE_PARM_DESC(write_kbps, "write bandwidth in KB/s, 0 for no delay");
+
+static unsigned int fail_every;
+module_param(fail_every, uint, 0644);
+MODULE_PARM_DESC(fail_every, "fail every Nth read with a CRC error");
+
+struct fake_host {
+	struct mmc_host		*mmc;
+	struct mmc_request	*mrq;		/* the request on the bus */
+	struct hrtimer		timer;		/* completes mrq */
+	int			is_mmc;
+	int			app_cmd;	/* last command was CMD55 */
+	u8			*data;
+	unsigned long		sectors;
+	unsigned int		last_write;	/* blocks, for ACMD22 */
+	u32			cid[4];
+	u32			csd[4];
+	u8			scr[8];
+	u8			ext_csd[512];
+	u32			requests;
+	u32			premapped;
+	u32			reads;
+};
+
+static struct platform_device *fake_pdev;
+static struct mmc_host *fake_mmc;
+
+/* the inverse of UNSTUFF_BITS(): resp[0] holds bits 127..96 */
+static void fake_set_bits(u32 *resp, int start, int size, u32 val)
+{
+	int i;
+
+	for (i = 0; i < size; i++, start++)
+		if (val & (1 << i))
+			resp[3 - start / 32] |= 1 << (start % 32);
+}
+
+static void fake_init_regs(struct fake_host *host)
+{
+	u32 *cid = host->cid, *csd = host->csd;
+	u8 *ext_csd = host->ext_csd;
+
+	/* product name "FAKE" in the bytes both CID layouts share */
+	fake_set_bits(cid, 96, 8, 'F');
+	fake_set_bits(cid, 88, 8, 'A');
+	fake_set_bits(cid, 80, 8, 'K');
+	fake_set_bits(cid, 72, 8, 'E');
+	fake_set_bits(cid, 0, 1, 1);
+
+	fake_set_bits(csd, 112, 8, 0x0e);	/* TAAC, 1ms */
+	fake_set_bits(csd, 96, 8, 0x32);	/* TRAN_SPEED, 25MHz */
+	fake_set_bits(csd, 84, 12, 0x115);	/* basic, block r/w, app */
+	fake_set_bits(csd, 80, 4, 9);		/* READ_BL_LEN */
+	fake_set_bits(csd, 26, 3, 2);		/* R2W_FACTOR */
+	fake_set_bits(csd, 22, 4, 9);		/* WRITE_BL_LEN */
+	fake_set_bits(csd, 0, 1, 1);
+
+	if (!host->is_mmc) {
+		/* CSD 2.0, C_SIZE in units of 512KB */
+		fake_set_bits(csd, 126, 2, 1);
+		fake_set_bits(csd, 48, 22, (host->sectors >> 10) - 1);
+		/* SD 1.0 and 1 or 4 bit bus, so no CMD6 switch function */
+		host->scr[1] = SD_SCR_BUS_WIDTH_1 | SD_SCR_BUS_WIDTH_4;
+		return;
+	}
+
+	/* CSD 1.2, MMC 4.x; the capacity is in EXT_CSD */
+	fake_set_bits(csd, 126, 2, 2);
+	fake_set_bits(csd, 122, 4, 4);
+	fake_set_bits(csd, 62, 12, 0xfff);
+	fake_set_bits(csd, 47, 3, 7);
+
+	ext_csd[EXT_CSD_REV] = 5;
+	ext_csd[EXT_CSD_STRUCTURE] = 2;
+	ext_csd[EXT_CSD_CARD_TYPE] = EXT_CSD_CARD_TYPE_26 |
+				     EXT_CSD_CARD_TYPE_52;
+	ext_csd[EXT_CSD_SEC_CNT + 0] = host->sectors >> 0;
+	ext_csd[EXT_CSD_SEC_CNT + 1] = host->sectors >> 8;
+	ext_csd[EXT_CSD_SEC_CNT + 2] = host->sectors >> 16;
+	ext_csd[EXT_CSD_SEC_CNT + 3] = host->sectors >> 24;
+}
+
+static void fake_copy_out(struct mmc_data *data, const void *buf, size_t len)
+{
+	sg_copy_from_buffer(data->sg, data->sg_len, (void *)buf, len);
+	data->bytes_xfered = len;
+}
+
+static void fake_transfer(struct fake_host *host, struct mmc_command *cmd,
+			  struct mmc_data *data, int write)
+{
+	/* both cards are sector addressed */
+	unsigned long sector = cmd->arg;
+	size_t len = data->blksz * data->blocks;
+
+	if (data->blksz != 512 || sector + data->blocks > host->sectors) {
+		cmd->resp[0] |= R1_OUT_OF_RANGE;
+		data->error = -EIO;
+		return;
+	}
+
+	if (write) {
+		sg_copy_to_buffer(data->sg, data->sg_len,
+				  host->data + ((size_t)sector << 9), len);
+		host->last_write = data->blocks;
+	} else {
+		if (fail_every && ++host->reads % fail_every == 0) {
+			data->error = -EILSEQ;
+			return;
+		}
+		sg_copy_from_buffer(data->sg, data->sg_len,
+				    host->data + ((size_t)sector << 9), len);
+	}
+	data->bytes_xfered = len;
+}
+
+static void fake_app_command(struct fake_host *host, struct mmc_command *cmd,
+			     struct mmc_data *data)
+{
+	static const u8 ssr[64];
+	__be32 written;
+
+	switch (cmd->opcode) {
+	case SD_APP_OP_COND:
+		cmd->resp[0] = FAKE_OCR | MMC_CARD_BUSY |
+			       (cmd->arg & SD_OCR_CCS);
+		break;
+	case SD_APP_SET_BUS_WIDTH:
+		cmd->resp[0] = FAKE_STATUS | R1_APP_CMD;
+		break;
+	case SD_APP_SEND_SCR:
+		cmd->resp[0] = FAKE_STATUS | R1_APP_CMD;
+		fake_copy_out(data, host->scr, sizeof(host->scr));
+		break;
+	case SD_APP_SD_STATUS:
+		cmd->resp[0] = FAKE_STATUS | R1_APP_CMD;
+		fake_copy_out(data, ssr, sizeof(ssr));
+		break;
+	case SD_APP_SEND_NUM_WR_BLKS:
+		cmd->resp[0] = FAKE_STATUS | R1_APP_CMD;
+		written = cpu_to_be32(host->last_write);
+		fake_copy_out(data, &written, sizeof(written));
+		break;
+	default:
+		cmd->error = -ETIMEDOUT;
+	}
+}
+
+static void fake_command(struct fake_host *host, struct mmc_command *cmd,
+			 struct mmc_data *data)
+{
+	cmd->error = 0;
+	memset(cmd->resp, 0, sizeof(cmd->resp));
+
+	if (host->app_cmd) {
+		host->app_cmd = 0;
+		fake_app_command(host, cmd, data);
+		return;
+	}
+
+	switch (cmd->opcode) {
+	case MMC_GO_IDLE_STATE:
+		break;
+	case MMC_SEND_OP_COND:
+		if (!host->is_mmc)
+			goto no_response;
+		/* bit 30: sector addressed */
+		cmd->resp[0] = FAKE_OCR | MMC_CARD_BUSY | (1 << 30);
+		break;
+	case MMC_ALL_SEND_CID:
+	case MMC_SEND_CID:
+		memcpy(cmd->resp, host->cid, sizeof(host->cid));
+		break;
+	case MMC_SET_RELATIVE_ADDR:	/* SD_SEND_RELATIVE_ADDR */
+		cmd->resp[0] = host->is_mmc ? FAKE_STATUS :
+			       FAKE_RCA << 16 | (R1_STATE_TRAN << 9);
+		break;
+	case MMC_SEND_CSD:
+		memcpy(cmd->resp, host->csd, sizeof(host->csd));
+		break;
+	case MMC_SEND_EXT_CSD:		/* SD_SEND_IF_COND */
+		if (!host->is_mmc) {
+			cmd->resp[0] = cmd->arg & 0xfff;
+			break;
+		}
+		if (!data)
+			goto no_response;
+		cmd->resp[0] = FAKE_STATUS;
+		fake_copy_out(data, host->ext_csd, sizeof(host->ext_csd));
+		break;
+	case MMC_SWITCH:		/* SD_SWITCH */
+		if (!host->is_mmc)
+			goto no_response;
+		if ((cmd->arg >> 24 & 3) == MMC_SWITCH_MODE_WRITE_BYTE)
+			host->ext_csd[cmd->arg >> 16 & 0xff] = cmd->arg >> 8;
+		cmd->resp[0] = FAKE_STATUS;
+		break;
+	case MMC_APP_CMD:
+		if (host->is_mmc)
+			goto no_response;
+		host->app_cmd = 1;
+		cmd->resp[0] = FAKE_STATUS | R1_APP_CMD;
+		break;
+	case MMC_SELECT_CARD:
+	case MMC_SEND_STATUS:
+	case MMC_SET_BLOCKLEN:
+	case MMC_SET_BLOCK_COUNT:
+	case MMC_STOP_TRANSMISSION:
+		cmd->resp[0] = FAKE_STATUS;
+		break;
+	case MMC_READ_SINGLE_BLOCK:
+	case MMC_READ_MULTIPLE_BLOCK:
+	case MMC_WRITE_BLOCK:
+	case MMC_WRITE_MULTIPLE_BLOCK:
+		cmd->resp[0] = FAKE_STATUS;
+		if (data)
+			fake_transfer(host, cmd, data,
+				      data->flags & MMC_DATA_WRITE);
+		break;
+	default:
+		goto no_response;
+	}
+	return;
+
+no_response:
+	/* SDIO probing and the other card type's commands end up here */
+	cmd->error = -ETIMEDOUT;
+}
+
+static enum hrtimer_restart fake_timer(struct hrtimer *timer)
+{
+	struct fake_host *host = container_of(timer, struct fake_host, timer);
+	struct mmc_request *mrq = host->mrq;
+
+	host->mrq = NULL;
+	mmc_request_done(host->mmc, mrq);
+	return HRTIMER_NORESTART;
+}
+
+static void fake_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			 bool is_first_req)
+{
+	struct mmc_data *data = mrq->data;
+
+	if (!data || data->host_cookie)
+		return;
+	udelay(map_us);
+	data->host_cookie = 1;
+}
+
+static void fake_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  int err)
+{
+	if (mrq->data)
+		mrq->data->host_cookie = 0;
+}
+
+static void fake_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct fake_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	u64 ns = (u64)cmd_us * 1000;
+
+	WARN_ON(host->mrq);
+	host->mrq = mrq;
+
+	if (mrq->sbc)
+		fake_command(host, mrq->sbc, NULL);
+
+	if (data) {
+		data->error = 0;
+		data->bytes_xfered = 0;
+		host->requests++;
+		if (data->host_cookie)
+			host->premapped++;
+		else
+			udelay(map_us);
+	}
+
+	fake_command(host, mrq->cmd, data);
+
+	if (data && data->bytes_xfered) {
+		unsigned int kbps = data->flags & MMC_DATA_WRITE ?
+				    write_kbps : read_kbps;
+
+		/* KB/s to ns: 10^9 / 1024 */
+		if (kbps)
+			ns += div_u64((u64)data->bytes_xfered * 976562, kbps);
+	}
+	if (data && mrq->stop)
+		fake_command(host, mrq->stop, NULL);
+
+	hrtimer_start(&host->timer, ns_to_ktime(ns), HRTIMER_MODE_REL);
+}
+
+static void fake_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
+{
+}
+
+static int fake_get_ro(struct mmc_host *mmc)
+{
+	return 0;
+}
+
+static int fake_get_cd(struct mmc_host *mmc)
+{
+	return 1;
+}
+
+static const struct mmc_host_ops fake_host_ops = {
+	.pre_req	= fake_pre_req,
+	.post_req	= fake_post_req,
+	.request	= fake_request,
+	.set_ios	= fake_set_ios,
+	.get_ro		= fake_get_ro,
+	.get_cd		= fake_get_cd,
+};
+
+static int __init fake_host_init(void)
+{
+	struct fake_host *host;
+	struct mmc_host *mmc;
+	int ret;
+
+	if (strcmp(type, "sd") && strcmp(type, "mmc"))
+		return -EINVAL;
+	if (!size_mb || size_mb > 2048)
+		return -EINVAL;
+
+	fake_pdev = platform_device_register_simple(FAKE_NAME, -1, NULL, 0);
+	if (IS_ERR(fake_pdev))
+		return PTR_ERR(fake_pdev);
+
+	mmc = mmc_alloc_host(sizeof(struct fake_host), &fake_pdev->dev);
+	if (!mmc) {
+		ret = -ENOMEM;
+		goto err_pdev;
+	}
+	host = mmc_priv(mmc);
+	host->mmc = mmc;
+	host->is_mmc = !strcmp(type, "mmc");
+	host->sectors = (unsigned long)size_mb << 11;
+	host->data = vmalloc(host->sectors << 9);
+	if (!host->data) {
+		ret = -ENOMEM;
+		goto err_host;
+	}
+	memset(host->data, 0, host->sectors << 9);
+	fake_init_regs(host);
+	hrtimer_init(&host->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	host->timer.function = fake_timer;
+
+	mmc->ops = &fake_host_ops;
+	mmc->f_min = 400000;
+	mmc->f_max = 50000000;
+	mmc->ocr_avail = FAKE_OCR;
+	mmc->caps = MMC_CAP_4_BIT_DATA | MMC_CAP_NONREMOVABLE;
+	mmc->max_segs = 64;
+	mmc->max_blk_size = 512;
+	mmc->max_blk_count = 4096;
+	mmc->max_req_size = mmc->max_blk_size * mmc->max_blk_count;
+	mmc->max_seg_size = mmc->max_req_size;
+
+	ret = mmc_add_host(mmc);
+	if (ret)
+		goto err_data;
+
+#ifdef CONFIG_DEBUG_FS
+	if (mmc->debugfs_root) {
+		debugfs_create_u32("fake_requests", S_IRUSR, mmc->debugfs_root,
+				   &host->requests);
+		debugfs_create_u32("fake_premapped", S_IRUSR,
+				   mmc->debugfs_root, &host->premapped);
+	}
+#endif
+	fake_mmc = mmc;
+	printk(KERN_INFO "%s: %uMB %s card on %s\n", FAKE_NAME, size_mb,
+	       host->is_mmc ? "eMMC" : "SDHC", mmc_hostname(mmc));
+	return 0;
+
+err_data:
+	vfree(host->data);
+err_host:
+	mmc_free_host(mmc);
+err_pdev:
+	platform_device_unregister(fake_pdev);
+	return ret;
+}
+
+static void __exit fake_host_exit(void)
+{
+	struct fake_host *host = mmc_priv(fake_mmc);
+
+	mmc_remove_host(fake_mmc);
+	hrtimer_cancel(&host->timer);
+	vfree(host->data);
+	mmc_free_host(fake_mmc);
+	platform_device_unregister(fake_pdev);
+}
+
+module_init(fake_host_init);
+module_exit(fake_host_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RAM backed SD/eMMC card on a fake MMC host");
@@ -35,6 +35,8 @@
 #include <linux/irq.h>
 #include <linux/slab.h>
 #include <linux/version.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/mmc/host.h>
 #include <linux/mmc/mmc.h>
 #include <linux/mmc/card.h>
@@ -74,6 +76,13 @@ int debug_level = 5;
 #define RK29_SDMMC_WAIT_DTO_INTERNVAL   4500  //The time interval from the CMD_DONE_INT to DTO_INT
 #define RK29_SDMMC_REMOVAL_DELAY        2000  //The time interval from the CD_INT to detect_timer react.
 
+#define RK29_SDMMC_PROFILE_DIVS         8     //dividers tracked one by one; larger dividers share the last slot
+#define RK29_SDMMC_PROFILE_LAT_BUCKETS  16    //log2 buckets of the request latency, in us
+#define RK29_SDMMC_FALLBACK_ERRORS      3     //consecutive data errors before the clock is halved
+#define RK29_SDMMC_FALLBACK_MIN_FREQ    5000000
+#define RK29_SDMMC_UPSCALE_REQUESTS     2048  //clean data requests before a faster clock is tried again
+#define RK29_SDMMC_UPSCALE_REQUESTS_MAX (1 << 20)
+
 #define RK29_SDMMC_VERSION "Ver.2.16 The last modify date is 2012-02-13,modifyed by XBW." 
 
 #if !defined(CONFIG_USE_SDMMC0_FOR_WIFI_DEVELOP_BOARD)	
@@ -106,6 +115,51 @@ enum rk29_sdmmc_state {
 	STATE_SENDING_STOP,
 };
 
+/*
+ * Per-card performance profile.  Every data request is accounted to the
+ * clock divider it ran at; a run of errors halves the clock, and a long
+ * enough run of clean requests at a reduced clock tries the faster one
+ * again.  The profile is dropped when the card is powered off.
+ */
+struct rk29_sdmmc_profile {
+    u64     bytes[2];       //0--read, 1--write
+    u64     usecs[2];
+    u32     reqs[2];
+    u32     ok[RK29_SDMMC_PROFILE_DIVS];
+    u32     err[RK29_SDMMC_PROFILE_DIVS];
+    u32     lat[RK29_SDMMC_PROFILE_LAT_BUCKETS];
+    u32     fallbacks;
+    u32     upscales;
+
+    u32     ios_clock;      //the clock asked for by the mmc core
+    u32     clk_cap;        //0--no limit
+    u32     err_run;
+    u32     ok_run;
+    u32     ok_need;        //clean requests needed before the next upscale
+    int     retune;         //apply clk_cap before the next request
+    ktime_t start;
+};
+
+static u32 rk29_sdmmc_profile_kbps(struct rk29_sdmmc_profile *prof, int dir)
+{
+    if(!prof->usecs[dir])
+        return 0;
+
+    return (u32)div64_u64(prof->bytes[dir] * 1000000ULL, prof->usecs[dir] * 1024);
+}
+
+//forget everything learned about the card, keeping the clock the core asked for.
+static void rk29_sdmmc_profile_reset(struct rk29_sdmmc_profile *prof)
+{
+    u32 ios_clock = prof->ios_clock;
+    int retune = prof->clk_cap ? 1 : 0;
+
+    memset(prof, 0, sizeof(*prof));
+    prof->ios_clock = ios_clock;
+    prof->ok_need = RK29_SDMMC_UPSCALE_REQUESTS;
+    prof->retune = retune;
+}
+
 struct rk29_sdmmc_dma_info {
 	enum dma_ch chn;
 	char *name;
@@ -216,6 +270,7 @@ struct rk29_sdmmc {
 
     void (*set_iomux)(int device_id, unsigned int bus_width);
 
+    struct rk29_sdmmc_profile   profile;
 };
 
 
@@ -468,9 +523,86 @@ struct kobj_attribute mmc_reset_attrs =
         .show = NULL,
         .store = rk29_sdmmc_progress_store,
 };
+static int rk29_sdmmc_profile_print(struct rk29_sdmmc *host, char *buf)
+{
+    struct rk29_sdmmc_profile *prof = &host->profile;
+    char *p = buf;
+    int i;
+
+    p += sprintf(p, "%s: clk=%uKhz ios=%uKhz cap=%uKhz width=%d fallbacks=%u upscales=%u\n",
+            host->dma_name, host->clock/1000, prof->ios_clock/1000, prof->clk_cap/1000,
+            (SDMMC_CTYPE_4BIT == host->ctype) ? 4 : 1, prof->fallbacks, prof->upscales);
+    p += sprintf(p, "  read:  %u reqs %u KB/s\n  write: %u reqs %u KB/s\n",
+            prof->reqs[0], rk29_sdmmc_profile_kbps(prof, 0),
+            prof->reqs[1], rk29_sdmmc_profile_kbps(prof, 1));
+
+    for(i = 0; i < RK29_SDMMC_PROFILE_DIVS; i++)
+    {
+        if(prof->ok[i] || prof->err[i])
+            p += sprintf(p, "  div%s%d: ok=%u err=%u\n",
+                    (RK29_SDMMC_PROFILE_DIVS - 1 == i) ? ">=" : "", i, prof->ok[i], prof->err[i]);
+    }
+
+    return p - buf;
+}
+
+ssize_t rk29_sdmmc_profile_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf)
+{
+    struct rk29_sdmmc *host;
+    unsigned long iflags;
+    int i, len = 0;
+
+    for(i = 0; i < ARRAY_SIZE(globalSDhost); i++)
+    {
+        host = globalSDhost[i];
+        if(!host)
+            continue;
+
+        spin_lock_irqsave(&host->lock, iflags);
+        len += rk29_sdmmc_profile_print(host, buf + len);
+        spin_unlock_irqrestore(&host->lock, iflags);
+    }
+
+    return len;
+}
+
+//write "reset" to forget the profiles and run every card at the speed the core asked for again.
+ssize_t rk29_sdmmc_profile_store(struct kobject *kobj, struct kobj_attribute *attr,
+			 const char *buf, size_t count)
+{
+    struct rk29_sdmmc *host;
+    unsigned long iflags;
+    int i;
+
+    if(strncmp(buf, "reset", strlen("reset")))
+        return -EINVAL;
+
+    for(i = 0; i < ARRAY_SIZE(globalSDhost); i++)
+    {
+        host = globalSDhost[i];
+        if(!host)
+            continue;
+
+        spin_lock_irqsave(&host->lock, iflags);
+        rk29_sdmmc_profile_reset(&host->profile);
+        spin_unlock_irqrestore(&host->lock, iflags);
+    }
+
+    return count;
+}
+
+struct kobj_attribute mmc_profile_attrs = 
+{
+        .attr = {
+                .name = "profile",
+                .mode = 0664},
+        .show = rk29_sdmmc_profile_show,
+        .store = rk29_sdmmc_profile_store,
+};
 struct attribute *mmc_attrs[] = 
 {
         &mmc_reset_attrs.attr,
+        &mmc_profile_attrs.attr,
         NULL
 };
 
@@ -544,6 +676,7 @@ static int rk29_sdmmc_req_show(struct seq_file *s, void *v)
 	struct mmc_command	*cmd;
 	struct mmc_command	*stop;
 	struct mmc_data		*data;
+	int			i;
 
 	/* Make sure we get a consistent snapshot */
 	spin_lock(&host->lock);
@@ -572,6 +705,13 @@ static int rk29_sdmmc_req_show(struct seq_file *s, void *v)
 				stop->resp[2], stop->error);
 	}
 
+	seq_printf(s, "latency(us) read %u KB/s, write %u KB/s\n",
+		rk29_sdmmc_profile_kbps(&host->profile, 0),
+		rk29_sdmmc_profile_kbps(&host->profile, 1));
+	for (i = 0; i < RK29_SDMMC_PROFILE_LAT_BUCKETS; i++)
+		if (host->profile.lat[i])
+			seq_printf(s, "  <%8u: %u\n", 1U << i, host->profile.lat[i]);
+
 	spin_unlock(&host->lock);
 
 	return 0;
@@ -860,7 +1000,8 @@ static int rk29_sdmmc_wait_unbusy(struct rk29_sdmmc *host)
 
 static void rk29_sdmmc_dma_cleanup(struct rk29_sdmmc *host)
 {
-	if (host->data) 
+	/* data mapped in pre_req() is unmapped in post_req() */
+	if (host->data && !host->data->host_cookie) 
 	{
 		dma_unmap_sg(&host->pdev->dev, host->data->sg, host->data->sg_len,
 		     ((host->data->flags & MMC_DATA_WRITE)
@@ -1047,17 +1188,35 @@ static int rk29_sdmmc_submit_data_dma(struct rk29_sdmmc *host, struct mmc_data *
         return -ENOSYS;
     }
     
-	dma_len = dma_map_sg(&host->pdev->dev, data->sg, data->sg_len, sgDirection);						                	   
-	for (i = 0; i < dma_len; i++)
+	if (data->host_cookie)
+		dma_len = data->host_cookie;    /* already mapped by rk29_sdmmc_pre_req() */
+	else
+		dma_len = dma_map_sg(&host->pdev->dev, data->sg, data->sg_len, sgDirection);
+
+	/* one PL330 program for the whole list when it fits */
+	if (dma_len <= RK29_DMA_SG_MAX)
 	{
-    	ret = rk29_dma_enqueue(host->dma_info.chn, host, sg_dma_address(&data->sg[i]),sg_dma_len(&data->sg[i]));
+    	ret = rk29_dma_enqueue_sg(host->dma_info.chn, host, data->sg, dma_len);
     	if(ret < 0)
     	{
-            printk("%s..%d...call rk29_dma_devconfig() fail !!!!===xbw=[%s]====\n", __FUNCTION__, __LINE__, host->dma_name);
+            printk("%s..%d...call rk29_dma_enqueue_sg() fail !!!!===xbw=[%s]====\n", __FUNCTION__, __LINE__, host->dma_name);
             host->errorstep = 0x93;
             return -ENOSYS;
     	}
-    }
+	}
+	else
+	{
+    	for (i = 0; i < dma_len; i++)
+    	{
+        	ret = rk29_dma_enqueue(host->dma_info.chn, host, sg_dma_address(&data->sg[i]),sg_dma_len(&data->sg[i]));
+        	if(ret < 0)
+        	{
+                printk("%s..%d...call rk29_dma_devconfig() fail !!!!===xbw=[%s]====\n", __FUNCTION__, __LINE__, host->dma_name);
+                host->errorstep = 0x93;
+                return -ENOSYS;
+        	}
+        }
+	}
     	
 	rk29_sdmmc_control_host_dma(host, TRUE);// enable dma
 	ret = rk29_dma_ctrl(host->dma_info.chn, RK29_DMAOP_START);
@@ -1700,6 +1859,83 @@ SetFreq_error:
     
 }
 
+static u32 rk29_sdmmc_profile_clock(struct rk29_sdmmc *host, u32 freqHz)
+{
+    if(host->profile.clk_cap && (freqHz > host->profile.clk_cap))
+        return host->profile.clk_cap;
+
+    return freqHz;
+}
+
+//called with host->lock held and the controller idle, before a new command is sent.
+static void rk29_sdmmc_profile_retune(struct rk29_sdmmc *host)
+{
+    host->profile.retune = 0;
+    if(host->profile.ios_clock)
+        rk29_sdmmc_change_clk_div(host, rk29_sdmmc_profile_clock(host, host->profile.ios_clock));
+}
+
+//account a finished request and decide whether the clock needs to change.
+static void rk29_sdmmc_profile_done(struct rk29_sdmmc *host, struct mmc_request *mrq)
+{
+    struct rk29_sdmmc_profile *prof = &host->profile;
+    struct mmc_data *data = mrq->data;
+    int error, dir, slot;
+    s64 usecs;
+
+    if(!data)
+        return;
+
+    error = mrq->cmd->error ? mrq->cmd->error : data->error;
+    if(!error && mrq->stop)
+        error = mrq->stop->error;
+    if(-ENOMEDIUM == error)
+        return;
+
+    usecs = ktime_us_delta(ktime_get(), prof->start);
+    if(usecs < 0)
+        usecs = 0;
+    prof->lat[min(fls64(usecs), RK29_SDMMC_PROFILE_LAT_BUCKETS - 1)]++;
+
+    slot = min_t(u32, host->old_div, RK29_SDMMC_PROFILE_DIVS - 1);
+    if(error)
+    {
+        prof->err[slot]++;
+        prof->ok_run = 0;
+        if(++prof->err_run < RK29_SDMMC_FALLBACK_ERRORS)
+            return;
+
+        prof->err_run = 0;
+        if(host->clock / 2 < RK29_SDMMC_FALLBACK_MIN_FREQ)
+            return;
+
+        prof->clk_cap = host->clock / 2;
+        prof->ok_need = min(prof->ok_need * 2, (u32)RK29_SDMMC_UPSCALE_REQUESTS_MAX);
+        prof->fallbacks++;
+        prof->retune = 1;
+        printk("%s..%d..  %d data errors in a row, lower the clock to %uKhz ====xbw[%s]====\n",\
+            __FUNCTION__, __LINE__, RK29_SDMMC_FALLBACK_ERRORS, prof->clk_cap/1000, host->dma_name);
+        return;
+    }
+
+    prof->ok[slot]++;
+    prof->err_run = 0;
+    dir = (data->flags & MMC_DATA_WRITE) ? 1 : 0;
+    prof->reqs[dir]++;
+    prof->bytes[dir] += data->bytes_xfered;
+    prof->usecs[dir] += usecs;
+
+    if(prof->clk_cap && (++prof->ok_run >= prof->ok_need))
+    {
+        prof->ok_run = 0;
+        prof->clk_cap *= 2;
+        if(prof->clk_cap >= prof->ios_clock)
+            prof->clk_cap = 0;
+        prof->upscales++;
+        prof->retune = 1;
+    }
+}
+
 int rk29_sdmmc_hw_init(void *data)
 {
     struct rk29_sdmmc *host = (struct rk29_sdmmc *)data;
@@ -1891,8 +2127,14 @@ static int rk29_sdmmc_start_request(struct mmc_host *mmc )
         }
     }
     
+    if(host->profile.retune && !(cmdr & SDMMC_CMD_STOP))
+    {
+        rk29_sdmmc_profile_retune(host);
+    }
+
     host->state = STATE_SENDING_CMD;
     host->mrq = host->new_mrq;
+    host->profile.start = ktime_get();
 	mrq = host->mrq;
 	cmd = mrq->cmd;
 	cmd->error = 0;
@@ -1963,6 +2205,7 @@ start_request_Err:
     if(host->mrq && host->mmc->doneflag)
     {
         host->mmc->doneflag = 0;
+        rk29_sdmmc_profile_done(host, host->mrq);
         spin_unlock_irqrestore(&host->lock, iflags);
         
         mmc_request_done(host->mmc, host->mrq);
@@ -2167,6 +2410,7 @@ static void rk29_sdmmc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
                	
             	break;
             case MMC_POWER_OFF:
+                rk29_sdmmc_profile_reset(&host->profile);
               
                 if(RK29_CTRL_SDMMC_ID == host->pdev->id)
                 {
@@ -2218,14 +2462,15 @@ static void rk29_sdmmc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 	    
 	}
 	
-	if (ios->clock && (ios->clock != host->clock)) 
+	host->profile.ios_clock = ios->clock;
+	if (ios->clock && (rk29_sdmmc_profile_clock(host, ios->clock) != host->clock)) 
 	{	
 		/*
 		 * Use mirror of ios->clock to prevent race with mmc
 		 * core ios update when finding the minimum.
 		 */
 		//host->clock = ios->clock;	
-		rk29_sdmmc_change_clk_div(host, ios->clock);
+		rk29_sdmmc_change_clk_div(host, rk29_sdmmc_profile_clock(host, ios->clock));
 	}
 out:	
 
@@ -2344,14 +2589,79 @@ static int rk29_sdmmc_clear_fifo(struct rk29_sdmmc *host)
 
 
 
+/*
+ * Whether rk29_sdmmc_prepare_{read,write}_data() will move @data by DMA;
+ * short transfers go through the FIFO and must not be mapped, or the
+ * unmap would throw away what the CPU wrote to the buffer.
+ */
+static bool rk29_sdmmc_data_use_dma(struct rk29_sdmmc *host, struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	u32 count = (data->blocks*data->blksz) >> 2;
+	int i;
+
+	if (!host->use_dma || (host->dma_info.chn < 0) || (data->blksz & 3))
+		return false;
+
+	if (data->flags & MMC_DATA_READ) {
+		if (count <= (RX_WMARK+1))
+			return false;
+	} else if (count <= FIFO_DEPTH) {
+		return false;
+	}
+
+	for_each_sg(data->sg, sg, data->sg_len, i) {
+		if (sg->offset & 3 || sg->length & 3)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Map the next request while the current one is still on the bus, so
+ * that rk29_sdmmc_submit_data_dma() only has to load the PL330.
+ */
+static void rk29_sdmmc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq, bool is_first_req)
+{
+	struct rk29_sdmmc *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	data->host_cookie = 0;
+	if (!rk29_sdmmc_data_use_dma(host, data))
+		return;
+
+	data->host_cookie = dma_map_sg(&host->pdev->dev, data->sg, data->sg_len,
+		(data->flags & MMC_DATA_WRITE) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+}
+
+static void rk29_sdmmc_post_req(struct mmc_host *mmc, struct mmc_request *mrq, int err)
+{
+	struct rk29_sdmmc *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(&host->pdev->dev, data->sg, data->sg_len,
+		(data->flags & MMC_DATA_WRITE) ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops rk29_sdmmc_ops[] = {
 	{
+		.pre_req	= rk29_sdmmc_pre_req,
+		.post_req	= rk29_sdmmc_post_req,
 		.request	= rk29_sdmmc_request,
 		.set_ios	= rk29_sdmmc_set_ios,
 		.get_ro		= rk29_sdmmc_get_ro,
 		.get_cd		= rk29_sdmmc_get_cd,
 	},
 	{
+		.pre_req	= rk29_sdmmc_pre_req,
+		.post_req	= rk29_sdmmc_post_req,
 		.request	= rk29_sdmmc_request,
 		.set_ios	= rk29_sdmmc_set_ios,
 		.get_ro		= rk29_sdmmc_get_ro,
@@ -2820,6 +3130,7 @@ static void rk29_sdmmc_tasklet_func(unsigned long priv)
 	 if(host->mrq && host->mmc->doneflag)
 	 {
 	    host->mmc->doneflag = 0;
+	    rk29_sdmmc_profile_done(host, host->mrq);
 	    spin_unlock_irqrestore(&host->lock, iflags);
 	    
 	    mmc_request_done(host->mmc, host->mrq);
@@ -3117,6 +3428,7 @@ static int rk29_sdmmc_probe(struct platform_device *pdev)
 	host = mmc_priv(mmc);
 	host->mmc = mmc;
 	host->pdev = pdev;	
+	rk29_sdmmc_profile_reset(&host->profile);
 
 	host->ctype = 0; // set default 1 bit mode
 	host->errorstep = 0;
@@ -81,5 +81,47 @@ extern void rknand_buffer_shutdown(void);
 extern int add_rknand_device(struct rknand_info * prknand_Info);
 extern int get_rknand_device(struct rknand_info ** prknand_Info);
 extern int rknand_buffer_sync(void);
+extern struct rknand_info * gpNandInfo;
+
+#ifdef CONFIG_MTD_RKNAND_WBCACHE
+extern int rknand_cache_read(unsigned long lba, int nsec, void *buf);
+extern int rknand_cache_write(unsigned long lba, int nsec, const void *buf, int fua);
+extern int rknand_cache_flush(void);
+extern int rknand_cache_sync(void);
+extern int rknand_cache_proc_read(char *page);
+#else
+static inline int rknand_cache_read(unsigned long lba, int nsec, void *buf)
+{
+    return gpNandInfo->ftl_read ? gpNandInfo->ftl_read(lba, nsec, buf) : -EIO;
+}
+
+static inline int rknand_cache_write(unsigned long lba, int nsec, const void *buf, int fua)
+{
+    int ret;
+
+    if (!gpNandInfo->ftl_write)
+        return -EIO;
+    ret = gpNandInfo->ftl_write(lba, nsec, (void *)buf, lba < SysImageWriteEndAdd);
+    if (!ret && fua && gpNandInfo->ftl_sync)
+        ret = gpNandInfo->ftl_sync();
+    return ret;
+}
+
+static inline int rknand_cache_flush(void)
+{
+    return 0;
+}
+
+static inline int rknand_cache_sync(void)
+{
+    return gpNandInfo->ftl_sync ? gpNandInfo->ftl_sync() : 0;
+}
+#endif
+
+#ifdef CONFIG_MTD_RKNAND_BLK
+struct mtd_partition;
+extern int rknand_blk_add_partitions(struct mtd_partition *parts, int num);
+extern int rknand_blk_proc_read(char *page);
+#endif
 
 #endif
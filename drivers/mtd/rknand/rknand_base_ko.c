@@ -82,6 +82,12 @@ static int rkNand_proc_read(char *page,
             buf += gpNandInfo->proc_ftlread(buf);
         if(gpNandInfo->proc_bufread)
             buf += gpNandInfo->proc_bufread(buf);
+#ifdef CONFIG_MTD_RKNAND_WBCACHE
+        buf += rknand_cache_proc_read(buf);
+#endif
+#ifdef CONFIG_MTD_RKNAND_BLK
+        buf += rknand_blk_proc_read(buf);
+#endif
     }
 	return buf - page < count ? buf - page : count;
 }
@@ -119,9 +125,9 @@ static int rk28xxnand_read(struct mtd_info *mtd, loff_t from, size_t len,
 	int LBA = (int)(from>>9);
 	//if(rknand_debug)
     //   printk("rk28xxnand_read: from=%x,sector=%x,\n",(int)LBA,sector);
-    if(sector && gpNandInfo->ftl_read)
+    if(sector)
     {
-		ret = gpNandInfo->ftl_read(LBA, sector, buf);
+		ret = rknand_cache_read(LBA, sector, buf);
     }
 	*retlen = len;
 	return 0;//ret;
@@ -137,18 +143,8 @@ static int rk28xxnand_write(struct mtd_info *mtd, loff_t from, size_t len,
 	//if(rknand_debug)
     //    printk(KERN_NOTICE "write: from=%lx,sector=%x\n",(int)LBA,sector);
     //printk_write_log(LBA,sector,buf);
-	if(sector && gpNandInfo->ftl_write)// cmy
-	{
-		if(LBA < SysImageWriteEndAdd)//0x4E000)
-		{
-			NAND_DEBUG(NAND_DEBUG_LEVEL0,">>> FtlWriteImage: LBA=0x%08X  sector=%d\n",LBA, sector);
-            ret = gpNandInfo->ftl_write(LBA, sector, (void *)buf,1);
-        }
-		else
-        {
-            ret = gpNandInfo->ftl_write(LBA, sector, (void *)buf,0);
-        }
-	}
+	if(sector)// cmy
+        ret = rknand_cache_write(LBA, sector, buf, 0);
 	*retlen = len;
 	return 0;
 }
@@ -164,8 +160,7 @@ static int rk28xxnand_erase(struct mtd_info *mtd, struct erase_info *instr)
 static void rk28xxnand_sync(struct mtd_info *mtd)
 {
 	NAND_DEBUG(NAND_DEBUG_LEVEL0,"rk28xxnand_sync: \n");
-    if(gpNandInfo->ftl_sync)
-        gpNandInfo->ftl_sync();
+    rknand_cache_sync();
 }
 
 extern void FtlWriteCacheEn(int);
@@ -343,6 +338,9 @@ int add_rknand_device(struct rknand_info * prknand_Info)
     }
 
     gpNandInfo->SysImageWriteEndAdd = SysImageWriteEndAdd;
+#ifdef CONFIG_MTD_RKNAND_BLK
+    rknand_blk_add_partitions(rknand_parts, g_num_partitions);
+#endif
     return 0;
 }
 
@@ -400,6 +398,7 @@ exit_free:
 
 static int rknand_suspend(struct platform_device *pdev, pm_message_t state)
 {
+    rknand_cache_flush();
     gpNandInfo->rknand.rknand_schedule_enable = 0;
 	NAND_DEBUG(NAND_DEBUG_LEVEL0,"rknand_suspend: \n");
 	return 0;
@@ -415,6 +414,7 @@ static int rknand_resume(struct platform_device *pdev)
 void rknand_shutdown(struct platform_device *pdev)
 {
     printk("rknand_shutdown...\n");
+    rknand_cache_flush();
     gpNandInfo->rknand.rknand_schedule_enable = 0;
     if(gpNandInfo->rknand_buffer_shutdown)
         gpNandInfo->rknand_buffer_shutdown();    
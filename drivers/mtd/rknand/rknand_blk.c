@@ -0,0 +1,431 @@
+/*
+ *  linux/drivers/mtd/rknand/rknand_blk.c
+ *
+ *  Native block device front end for the rknand FTL.
+ *
+ *  Every partition gets its own request queue with the normal elevator
+ *  merging enabled.  A single dispatch thread drains all queues, services
+ *  reads ahead of writes, and coalesces LBA-adjacent requests (and all of
+ *  their bio segments) into one ftl_read/ftl_write call through a bounce
+ *  buffer, so the FTL sees a few large runs instead of one call per
+ *  request fragment.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+#include <linux/blkdev.h>
+#include <linux/highmem.h>
+#include <linux/kthread.h>
+#include <linux/sort.h>
+#include <linux/mtd/mtd.h>
+#include <linux/mtd/partitions.h>
+#include "rknand_base.h"
+
+#define RKNAND_BLK_NAME		"rknand"
+#define RKNAND_BLK_MAX_SECTORS	256	/* bounce buffer size, 128KB */
+#define RKNAND_BLK_MAX_SEGS	128
+#define RKNAND_BLK_BATCH	32	/* requests pulled per dispatch round */
+#define RKNAND_BLK_WRITE_RUNS	2	/* write runs issued between read checks */
+
+struct rknand_blk_dev {
+	struct list_head list;
+	struct gendisk *disk;
+	struct request_queue *rq;
+	spinlock_t queue_lock;
+	unsigned long offset;	/* first FTL sector of the partition */
+	unsigned long size;	/* in sectors */
+	int readonly;
+};
+
+struct rknand_blk_entry {
+	struct rknand_blk_dev *dev;
+	struct request *req;
+	unsigned long lba;	/* absolute FTL sector */
+	unsigned int nsect;
+};
+
+struct rknand_blk_stats {
+	unsigned long reqs[2];
+	unsigned long ftl_calls[2];
+	unsigned long sectors[2];
+	unsigned long merged[2];
+	unsigned long flushes;
+	unsigned long read_preempts;
+};
+
+static LIST_HEAD(rknand_blk_devs);
+static int rknand_blk_major;
+static struct task_struct *rknand_blk_thread;
+static char *rknand_blk_buf;
+static struct rknand_blk_stats rknand_blk_stats;
+
+static struct rknand_blk_entry rknand_blk_batch[2][RKNAND_BLK_BATCH];
+static int rknand_blk_nr[2];
+static struct rknand_blk_entry rknand_blk_flush[RKNAND_BLK_BATCH];
+static int rknand_blk_nr_flush;
+
+static void rknand_blk_end(struct rknand_blk_entry *e, int err)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&e->dev->queue_lock, flags);
+	__blk_end_request_all(e->req, err);
+	spin_unlock_irqrestore(&e->dev->queue_lock, flags);
+}
+
+/* Copy between the bounce buffer and every segment of a request. */
+static void rknand_blk_copy(struct request *req, char *buf, int dir)
+{
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	char *p;
+
+	rq_for_each_segment(bvec, req, iter) {
+		p = kmap_atomic(bvec->bv_page, KM_USER0);
+		if (dir == READ)
+			memcpy(p + bvec->bv_offset, buf, bvec->bv_len);
+		else
+			memcpy(buf, p + bvec->bv_offset, bvec->bv_len);
+		kunmap_atomic(p, KM_USER0);
+		buf += bvec->bv_len;
+	}
+	if (dir == READ)
+		rq_flush_dcache_pages(req);
+}
+
+static int rknand_blk_write_mode(unsigned long lba)
+{
+	return lba < SysImageWriteEndAdd ? 1 : 0;
+}
+
+/*
+ * Issue entries [0, n) as one FTL call.  The caller guarantees the
+ * entries are LBA-contiguous and fit in the bounce buffer.
+ */
+static void rknand_blk_issue(struct rknand_blk_entry *e, int n, int dir)
+{
+	unsigned long lba = e[0].lba;
+	unsigned int nsect = 0;
+	char *buf = rknand_blk_buf;
+	int i, ret, fua = 0;
+
+	if (dir == WRITE) {
+		for (i = 0; i < n; i++) {
+			rknand_blk_copy(e[i].req, buf, WRITE);
+			buf += e[i].nsect << 9;
+			nsect += e[i].nsect;
+			if (e[i].req->cmd_flags & REQ_FUA)
+				fua = 1;
+		}
+		ret = rknand_cache_write(lba, nsect, rknand_blk_buf, fua);
+	} else {
+		for (i = 0; i < n; i++)
+			nsect += e[i].nsect;
+		ret = rknand_cache_read(lba, nsect, rknand_blk_buf);
+		if (!ret) {
+			for (i = 0; i < n; i++) {
+				rknand_blk_copy(e[i].req, buf, READ);
+				buf += e[i].nsect << 9;
+			}
+		}
+	}
+
+	rknand_blk_stats.ftl_calls[dir]++;
+	rknand_blk_stats.sectors[dir] += nsect;
+	rknand_blk_stats.merged[dir] += n - 1;
+
+	for (i = 0; i < n; i++)
+		rknand_blk_end(&e[i], ret ? -EIO : 0);
+}
+
+/*
+ * Length of the LBA-contiguous run starting at e[0] that fits in one
+ * bounce buffer and does not cross the system image boundary.
+ */
+static int rknand_blk_run_len(struct rknand_blk_entry *e, int n, int dir)
+{
+	unsigned int nsect = e[0].nsect;
+	int i;
+
+	for (i = 1; i < n; i++) {
+		if (e[i].lba != e[i - 1].lba + e[i - 1].nsect)
+			break;
+		if (nsect + e[i].nsect > RKNAND_BLK_MAX_SECTORS)
+			break;
+		if (dir == WRITE && rknand_blk_write_mode(e[i].lba) !=
+				    rknand_blk_write_mode(e[0].lba))
+			break;
+		nsect += e[i].nsect;
+	}
+	return i;
+}
+
+static int rknand_blk_cmp(const void *a, const void *b)
+{
+	const struct rknand_blk_entry *ea = a, *eb = b;
+
+	if (ea->lba < eb->lba)
+		return -1;
+	return ea->lba > eb->lba;
+}
+
+/*
+ * Pull requests off one queue into the batch.  With @reads_only set, stop
+ * at the first request that is not a read so that writes keep their
+ * position in the elevator.  Called with the queue lock held.
+ */
+static int rknand_blk_fetch_queue(struct rknand_blk_dev *dev, int reads_only)
+{
+	struct request_queue *q = dev->rq;
+	struct rknand_blk_entry *e;
+	struct request *req;
+	int dir, fetched = 0;
+
+	while ((req = blk_peek_request(q)) != NULL) {
+		dir = rq_data_dir(req);
+		if (reads_only && (dir != READ || req->cmd_type != REQ_TYPE_FS))
+			break;
+		if (rknand_blk_nr[dir] >= RKNAND_BLK_BATCH ||
+		    rknand_blk_nr_flush >= RKNAND_BLK_BATCH)
+			break;
+
+		blk_start_request(req);
+
+		if (req->cmd_type != REQ_TYPE_FS) {
+			__blk_end_request_all(req, -EIO);
+			continue;
+		}
+		if ((req->cmd_flags & REQ_FLUSH) && !blk_rq_sectors(req)) {
+			e = &rknand_blk_flush[rknand_blk_nr_flush++];
+		} else {
+			if (blk_rq_pos(req) + blk_rq_sectors(req) > dev->size ||
+			    blk_rq_sectors(req) > RKNAND_BLK_MAX_SECTORS ||
+			    (dir == WRITE && dev->readonly)) {
+				__blk_end_request_all(req, -EIO);
+				continue;
+			}
+			e = &rknand_blk_batch[dir][rknand_blk_nr[dir]++];
+		}
+		e->dev = dev;
+		e->req = req;
+		e->lba = dev->offset + blk_rq_pos(req);
+		e->nsect = blk_rq_sectors(req);
+		rknand_blk_stats.reqs[dir]++;
+		fetched++;
+	}
+	return fetched;
+}
+
+static int rknand_blk_fetch(int reads_only)
+{
+	struct rknand_blk_dev *dev;
+	int fetched = 0;
+
+	list_for_each_entry(dev, &rknand_blk_devs, list) {
+		spin_lock_irq(&dev->queue_lock);
+		fetched += rknand_blk_fetch_queue(dev, reads_only);
+		spin_unlock_irq(&dev->queue_lock);
+	}
+	return fetched;
+}
+
+static void rknand_blk_do_reads(void)
+{
+	struct rknand_blk_entry *e = rknand_blk_batch[READ];
+	int n = rknand_blk_nr[READ];
+	int run;
+
+	sort(e, n, sizeof(*e), rknand_blk_cmp, NULL);
+	while (n) {
+		run = rknand_blk_run_len(e, n, READ);
+		rknand_blk_issue(e, run, READ);
+		e += run;
+		n -= run;
+	}
+	rknand_blk_nr[READ] = 0;
+}
+
+static void rknand_blk_do_writes(void)
+{
+	struct rknand_blk_entry *e = rknand_blk_batch[WRITE];
+	int n = rknand_blk_nr[WRITE];
+	int run, runs = 0;
+
+	sort(e, n, sizeof(*e), rknand_blk_cmp, NULL);
+	while (n) {
+		run = rknand_blk_run_len(e, n, WRITE);
+		rknand_blk_issue(e, run, WRITE);
+		e += run;
+		n -= run;
+
+		/* let reads that queued up behind a long write go first */
+		if (n && ++runs >= RKNAND_BLK_WRITE_RUNS) {
+			runs = 0;
+			if (rknand_blk_fetch(1)) {
+				rknand_blk_stats.read_preempts++;
+				rknand_blk_do_reads();
+			}
+		}
+	}
+	rknand_blk_nr[WRITE] = 0;
+}
+
+static void rknand_blk_do_flushes(void)
+{
+	int i, ret;
+
+	if (!rknand_blk_nr_flush)
+		return;
+	ret = rknand_cache_sync();
+	for (i = 0; i < rknand_blk_nr_flush; i++)
+		rknand_blk_end(&rknand_blk_flush[i], ret ? -EIO : 0);
+	rknand_blk_stats.flushes++;
+	rknand_blk_nr_flush = 0;
+}
+
+static int rknand_blk_thread_fn(void *arg)
+{
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!rknand_blk_fetch(0)) {
+			if (!kthread_should_stop())
+				schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		rknand_blk_do_reads();
+		rknand_blk_do_writes();
+		rknand_blk_do_flushes();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static void rknand_blk_request(struct request_queue *q)
+{
+	wake_up_process(rknand_blk_thread);
+}
+
+static const struct block_device_operations rknand_blk_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static int rknand_blk_add_one(struct mtd_partition *part, int index)
+{
+	struct rknand_blk_dev *dev;
+	struct gendisk *gd;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+
+	dev->offset = (unsigned long)(part->offset >> 9);
+	dev->size = (unsigned long)(part->size >> 9);
+	dev->readonly = (part->mask_flags & MTD_WRITEABLE) ? 1 : 0;
+
+	spin_lock_init(&dev->queue_lock);
+	dev->rq = blk_init_queue(rknand_blk_request, &dev->queue_lock);
+	if (!dev->rq)
+		goto err_free;
+	dev->rq->queuedata = dev;
+	blk_queue_logical_block_size(dev->rq, 512);
+	blk_queue_max_hw_sectors(dev->rq, RKNAND_BLK_MAX_SECTORS);
+	blk_queue_max_segments(dev->rq, RKNAND_BLK_MAX_SEGS);
+	/* the FTL does not export its geometry; a full bounce buffer is
+	 * what one ftl_write call handles best */
+	blk_queue_io_opt(dev->rq, RKNAND_BLK_MAX_SECTORS << 9);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, dev->rq);
+	blk_queue_flush(dev->rq, REQ_FLUSH | REQ_FUA);
+
+	gd = alloc_disk(1);
+	if (!gd)
+		goto err_queue;
+	dev->disk = gd;
+	gd->major = rknand_blk_major;
+	gd->first_minor = index;
+	gd->fops = &rknand_blk_fops;
+	gd->private_data = dev;
+	gd->queue = dev->rq;
+	snprintf(gd->disk_name, sizeof(gd->disk_name), "%s_%s",
+		 RKNAND_BLK_NAME, part->name);
+	set_capacity(gd, dev->size);
+	if (dev->readonly)
+		set_disk_ro(gd, 1);
+
+	list_add_tail(&dev->list, &rknand_blk_devs);
+	add_disk(gd);
+	return 0;
+
+err_queue:
+	blk_cleanup_queue(dev->rq);
+err_free:
+	kfree(dev);
+	return -ENOMEM;
+}
+
+/*
+ * Called from add_rknand_device() once the FTL is up and the partition
+ * table has been parsed.
+ */
+int rknand_blk_add_partitions(struct mtd_partition *parts, int num)
+{
+	int i, ret;
+
+	if (num <= 0 || rknand_blk_major)
+		return 0;
+
+	rknand_blk_buf = (char *)__get_free_pages(GFP_KERNEL,
+			get_order(RKNAND_BLK_MAX_SECTORS << 9));
+	if (!rknand_blk_buf)
+		return -ENOMEM;
+
+	ret = register_blkdev(0, RKNAND_BLK_NAME);
+	if (ret < 0)
+		goto err_buf;
+	rknand_blk_major = ret;
+
+	rknand_blk_thread = kthread_run(rknand_blk_thread_fn, NULL,
+					RKNAND_BLK_NAME);
+	if (IS_ERR(rknand_blk_thread)) {
+		ret = PTR_ERR(rknand_blk_thread);
+		goto err_major;
+	}
+
+	for (i = 0; i < num; i++) {
+		ret = rknand_blk_add_one(&parts[i], i);
+		if (ret)
+			printk(KERN_ERR "%s: failed to add %s: %d\n",
+			       RKNAND_BLK_NAME, parts[i].name, ret);
+	}
+	return 0;
+
+err_major:
+	unregister_blkdev(rknand_blk_major, RKNAND_BLK_NAME);
+	rknand_blk_major = 0;
+err_buf:
+	free_pages((unsigned long)rknand_blk_buf,
+		   get_order(RKNAND_BLK_MAX_SECTORS << 9));
+	rknand_blk_buf = NULL;
+	return ret;
+}
+
+int rknand_blk_proc_read(char *page)
+{
+	struct rknand_blk_stats *s = &rknand_blk_stats;
+	char *buf = page;
+
+	buf += sprintf(buf, "blk read : req=%lu ftl=%lu sec=%lu merged=%lu\n",
+		       s->reqs[READ], s->ftl_calls[READ],
+		       s->sectors[READ], s->merged[READ]);
+	buf += sprintf(buf, "blk write: req=%lu ftl=%lu sec=%lu merged=%lu\n",
+		       s->reqs[WRITE], s->ftl_calls[WRITE],
+		       s->sectors[WRITE], s->merged[WRITE]);
+	buf += sprintf(buf, "blk flush=%lu read_preempt=%lu\n",
+		       s->flushes, s->read_preempts);
+	return buf - page;
+}
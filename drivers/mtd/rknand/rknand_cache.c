@@ -0,0 +1,370 @@
+/*
+ *  linux/drivers/mtd/rknand/rknand_cache.c
+ *
+ *  Write-back sector cache in front of the rknand FTL.
+ *
+ *  Small writes are absorbed into a pool of page-sized entries, each
+ *  covering one 4KB-aligned group of eight sectors.  Dirty entries are
+ *  written back by a delayed work item, on memory pressure in the pool,
+ *  or on an explicit sync; write-back sorts the entries by LBA and
+ *  coalesces adjacent dirty sectors into large sequential FTL writes.
+ *  Large, FUA and system image writes go straight to the FTL.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/bitops.h>
+#include <linux/workqueue.h>
+#include "rknand_base.h"
+
+#define RKNAND_CACHE_ENTRIES	256	/* 1MB of cached data */
+#define RKNAND_CACHE_SECS	8	/* sectors per entry, one page */
+#define RKNAND_CACHE_HASH	64
+#define RKNAND_CACHE_HIGH	(RKNAND_CACHE_ENTRIES * 3 / 4)
+#define RKNAND_CACHE_BYPASS	64	/* writes this large skip the cache */
+#define RKNAND_CACHE_STAGE	256	/* sectors per write-back FTL call */
+#define RKNAND_CACHE_DELAY	(HZ / 2)
+
+struct rknand_cache_entry {
+	struct hlist_node hash;
+	struct list_head list;
+	unsigned long blk;	/* lba / RKNAND_CACHE_SECS */
+	unsigned int dirty;	/* one bit per sector */
+	char *data;
+};
+
+struct rknand_cache_stats {
+	unsigned long read_hits;	/* sectors served from the cache */
+	unsigned long write_secs;	/* sectors absorbed */
+	unsigned long write_hits;	/* absorbed sectors that were already dirty */
+	unsigned long bypass;		/* writes sent straight to the FTL */
+	unsigned long flushes;
+	unsigned long flush_runs;	/* FTL calls issued by write-back */
+	unsigned long flush_secs;
+	unsigned long flush_errors;	/* failed FTL calls, kept dirty */
+};
+
+static DEFINE_MUTEX(rknand_cache_lock);
+static struct hlist_head rknand_cache_hash[RKNAND_CACHE_HASH];
+static LIST_HEAD(rknand_cache_free);
+static LIST_HEAD(rknand_cache_dirty);
+static int rknand_cache_nr_dirty;
+static int rknand_cache_ready;
+static char *rknand_cache_stage;
+static struct rknand_cache_entry rknand_cache_pool[RKNAND_CACHE_ENTRIES];
+static struct rknand_cache_entry *rknand_cache_sorted[RKNAND_CACHE_ENTRIES];
+static struct rknand_cache_stats rknand_cache_stats;
+
+static void rknand_cache_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(rknand_cache_work, rknand_cache_work_fn);
+
+static inline unsigned int rknand_cache_mask(int off, int n)
+{
+	return ((1U << n) - 1) << off;
+}
+
+static int rknand_cache_write_mode(unsigned long lba)
+{
+	return lba < SysImageWriteEndAdd ? 1 : 0;
+}
+
+static struct rknand_cache_entry *rknand_cache_lookup(unsigned long blk)
+{
+	struct rknand_cache_entry *e;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(e, node,
+			     &rknand_cache_hash[blk % RKNAND_CACHE_HASH], hash)
+		if (e->blk == blk)
+			return e;
+	return NULL;
+}
+
+static struct rknand_cache_entry *rknand_cache_get(unsigned long blk)
+{
+	struct rknand_cache_entry *e;
+
+	if (list_empty(&rknand_cache_free))
+		return NULL;
+	e = list_first_entry(&rknand_cache_free, struct rknand_cache_entry, list);
+	list_move_tail(&e->list, &rknand_cache_dirty);
+	hlist_add_head(&e->hash, &rknand_cache_hash[blk % RKNAND_CACHE_HASH]);
+	e->blk = blk;
+	e->dirty = 0;
+	rknand_cache_nr_dirty++;
+	return e;
+}
+
+static void rknand_cache_put(struct rknand_cache_entry *e)
+{
+	hlist_del(&e->hash);
+	list_move(&e->list, &rknand_cache_free);
+	rknand_cache_nr_dirty--;
+}
+
+static int rknand_cache_cmp(const void *a, const void *b)
+{
+	const struct rknand_cache_entry *ea = *(struct rknand_cache_entry **)a;
+	const struct rknand_cache_entry *eb = *(struct rknand_cache_entry **)b;
+
+	if (ea->blk < eb->blk)
+		return -1;
+	return ea->blk > eb->blk;
+}
+
+static void rknand_cache_drop(unsigned long lba, int nsec);
+
+/*
+ * Write one staged run to the FTL.  Only once it is on flash are its
+ * sectors marked clean; a failed run stays dirty for the next flush.
+ */
+static int rknand_cache_emit(unsigned long lba, int nsec)
+{
+	if (gpNandInfo->ftl_write(lba, nsec, rknand_cache_stage,
+				  rknand_cache_write_mode(lba))) {
+		rknand_cache_stats.flush_errors++;
+		return -EIO;
+	}
+	rknand_cache_stats.flush_runs++;
+	rknand_cache_stats.flush_secs += nsec;
+	rknand_cache_drop(lba, nsec);
+	return 0;
+}
+
+/*
+ * Write every dirty sector back to the FTL, coalescing adjacent sectors
+ * into runs of up to RKNAND_CACHE_STAGE sectors.  Returns -EIO if any
+ * run failed; those sectors are still dirty.
+ */
+static int rknand_cache_flush_locked(void)
+{
+	struct rknand_cache_entry *e;
+	unsigned long run_lba = 0, lba;
+	int n = 0, run_len = 0, i, s, ret = 0;
+
+	if (!rknand_cache_nr_dirty)
+		return 0;
+
+	list_for_each_entry(e, &rknand_cache_dirty, list)
+		rknand_cache_sorted[n++] = e;
+	sort(rknand_cache_sorted, n, sizeof(e), rknand_cache_cmp, NULL);
+
+	for (i = 0; i < n; i++) {
+		e = rknand_cache_sorted[i];
+		for (s = 0; s < RKNAND_CACHE_SECS; s++) {
+			if (!(e->dirty & (1U << s)))
+				continue;
+			lba = e->blk * RKNAND_CACHE_SECS + s;
+			if (run_len && (lba != run_lba + run_len ||
+					run_len == RKNAND_CACHE_STAGE)) {
+				if (rknand_cache_emit(run_lba, run_len))
+					ret = -EIO;
+				run_len = 0;
+			}
+			if (!run_len)
+				run_lba = lba;
+			memcpy(rknand_cache_stage + (run_len << 9),
+			       e->data + (s << 9), 512);
+			run_len++;
+		}
+	}
+	if (run_len && rknand_cache_emit(run_lba, run_len))
+		ret = -EIO;
+
+	rknand_cache_stats.flushes++;
+	return ret;
+}
+
+/* Forget cached sectors that a direct FTL write is about to supersede. */
+static void rknand_cache_drop(unsigned long lba, int nsec)
+{
+	struct rknand_cache_entry *e;
+	int off, n;
+
+	while (nsec > 0 && rknand_cache_nr_dirty) {
+		off = lba % RKNAND_CACHE_SECS;
+		n = min(RKNAND_CACHE_SECS - off, nsec);
+		e = rknand_cache_lookup(lba / RKNAND_CACHE_SECS);
+		if (e) {
+			e->dirty &= ~rknand_cache_mask(off, n);
+			if (!e->dirty)
+				rknand_cache_put(e);
+		}
+		lba += n;
+		nsec -= n;
+	}
+}
+
+int rknand_cache_read(unsigned long lba, int nsec, void *buf)
+{
+	struct rknand_cache_entry *e;
+	char *p = buf;
+	int off, n, s, ret;
+
+	if (!gpNandInfo->ftl_read)
+		return -EIO;
+
+	mutex_lock(&rknand_cache_lock);
+	ret = gpNandInfo->ftl_read(lba, nsec, buf);
+
+	/* overlay sectors that are newer in the cache than on flash */
+	while (!ret && nsec > 0 && rknand_cache_nr_dirty) {
+		off = lba % RKNAND_CACHE_SECS;
+		n = min(RKNAND_CACHE_SECS - off, nsec);
+		e = rknand_cache_lookup(lba / RKNAND_CACHE_SECS);
+		if (e) {
+			for (s = off; s < off + n; s++) {
+				if (!(e->dirty & (1U << s)))
+					continue;
+				memcpy(p + ((s - off) << 9), e->data + (s << 9), 512);
+				rknand_cache_stats.read_hits++;
+			}
+		}
+		lba += n;
+		nsec -= n;
+		p += n << 9;
+	}
+	mutex_unlock(&rknand_cache_lock);
+	return ret;
+}
+
+int rknand_cache_write(unsigned long lba, int nsec, const void *buf, int fua)
+{
+	struct rknand_cache_entry *e;
+	unsigned int mask;
+	const char *p = buf;
+	int off, n, ret = 0;
+
+	if (!gpNandInfo->ftl_write)
+		return -EIO;
+
+	mutex_lock(&rknand_cache_lock);
+	if (!rknand_cache_ready || fua || nsec >= RKNAND_CACHE_BYPASS ||
+	    rknand_cache_write_mode(lba)) {
+		rknand_cache_drop(lba, nsec);
+		ret = gpNandInfo->ftl_write(lba, nsec, (void *)buf,
+					    rknand_cache_write_mode(lba));
+		if (!ret && fua && gpNandInfo->ftl_sync)
+			ret = gpNandInfo->ftl_sync();
+		rknand_cache_stats.bypass++;
+		goto out;
+	}
+
+	while (nsec > 0) {
+		off = lba % RKNAND_CACHE_SECS;
+		n = min(RKNAND_CACHE_SECS - off, nsec);
+		mask = rknand_cache_mask(off, n);
+		e = rknand_cache_lookup(lba / RKNAND_CACHE_SECS);
+		if (!e) {
+			e = rknand_cache_get(lba / RKNAND_CACHE_SECS);
+			if (!e) {
+				rknand_cache_flush_locked();
+				e = rknand_cache_get(lba / RKNAND_CACHE_SECS);
+			}
+			if (!e) {
+				/* write-back failed and the pool is still full */
+				rknand_cache_drop(lba, nsec);
+				if (gpNandInfo->ftl_write(lba, nsec, (void *)p,
+						rknand_cache_write_mode(lba)))
+					ret = -EIO;
+				rknand_cache_stats.bypass++;
+				goto out;
+			}
+		} else {
+			rknand_cache_stats.write_hits += hweight32(e->dirty & mask);
+		}
+		memcpy(e->data + (off << 9), p, n << 9);
+		e->dirty |= mask;
+		rknand_cache_stats.write_secs += n;
+		lba += n;
+		nsec -= n;
+		p += n << 9;
+	}
+
+	/*
+	 * The data is safe in the cache whether or not write-back works
+	 * now; a failure is retried later and reported by the next sync.
+	 */
+	if (rknand_cache_nr_dirty < RKNAND_CACHE_HIGH ||
+	    rknand_cache_flush_locked())
+		schedule_delayed_work(&rknand_cache_work, RKNAND_CACHE_DELAY);
+out:
+	mutex_unlock(&rknand_cache_lock);
+	return ret;
+}
+
+int rknand_cache_flush(void)
+{
+	int ret;
+
+	mutex_lock(&rknand_cache_lock);
+	ret = rknand_cache_flush_locked();
+	mutex_unlock(&rknand_cache_lock);
+	return ret;
+}
+
+int rknand_cache_sync(void)
+{
+	int ret;
+
+	mutex_lock(&rknand_cache_lock);
+	ret = rknand_cache_flush_locked();
+	if (gpNandInfo->ftl_sync)
+		ret |= gpNandInfo->ftl_sync();
+	mutex_unlock(&rknand_cache_lock);
+	return ret;
+}
+
+static void rknand_cache_work_fn(struct work_struct *work)
+{
+	if (rknand_cache_flush()) {
+		printk(KERN_ERR "rknand_cache: write-back failed, %d entries "
+		       "still dirty\n", rknand_cache_nr_dirty);
+		schedule_delayed_work(&rknand_cache_work, RKNAND_CACHE_DELAY * 4);
+	}
+}
+
+int rknand_cache_proc_read(char *page)
+{
+	struct rknand_cache_stats *s = &rknand_cache_stats;
+	char *buf = page;
+
+	buf += sprintf(buf, "cache dirty=%d/%d read_hit=%lu write=%lu write_hit=%lu bypass=%lu\n",
+		       rknand_cache_nr_dirty, RKNAND_CACHE_ENTRIES,
+		       s->read_hits, s->write_secs, s->write_hits, s->bypass);
+	buf += sprintf(buf, "cache flush=%lu runs=%lu sec=%lu errors=%lu\n",
+		       s->flushes, s->flush_runs, s->flush_secs, s->flush_errors);
+	return buf - page;
+}
+
+static int __init rknand_cache_init(void)
+{
+	struct rknand_cache_entry *e;
+	int i;
+
+	rknand_cache_stage = (char *)__get_free_pages(GFP_KERNEL,
+			get_order(RKNAND_CACHE_STAGE << 9));
+	if (!rknand_cache_stage)
+		return -ENOMEM;
+
+	for (i = 0; i < RKNAND_CACHE_HASH; i++)
+		INIT_HLIST_HEAD(&rknand_cache_hash[i]);
+
+	for (i = 0; i < RKNAND_CACHE_ENTRIES; i++) {
+		e = &rknand_cache_pool[i];
+		e->data = (char *)__get_free_page(GFP_KERNEL);
+		if (!e->data)
+			break;
+		list_add_tail(&e->list, &rknand_cache_free);
+	}
+	rknand_cache_ready = !list_empty(&rknand_cache_free);
+	return 0;
+}
+
+module_init(rknand_cache_init);
@@ -0,0 +1,161 @@
+/*
+ *  linux/drivers/mtd/rknand/rknand_ramftl.c
+ *
+ *  RAM backed stand-in for the rknand FTL module, for measuring the
+ *  block front ends (mtdblock, rknand_blk, the write-back cache) on a
+ *  board without touching its NAND.  Load it instead of the vendor FTL,
+ *  with the partitions given on the command line as usual:
+ *
+ *	mtdparts=rk29xxnand:0x8000@0x2000(system),-(user)
+ *	insmod rknand_ramftl.ko size_mb=128
+ *
+ *  Each FTL call sleeps for call_us plus the time the transfer would
+ *  take at read_kbps/write_kbps, under one lock as the real FTL runs,
+ *  so queueing in front of it behaves as it does on flash.  The defaults
+ *  are close to the MLC parts we ship; zero disables a delay.  The
+ *  module cannot be unloaded once the partitions are registered.
+ *
+ *  tools/block/blk-bench drives the resulting block devices.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include "rknand_base.h"
+
+static unsigned int size_mb = 64;
+module_param(size_mb, uint, 0444);
+MODULE_PARM_DESC(size_mb, "capacity of the RAM FTL");
+
+static unsigned int call_us = 200;
+module_param(call_us, uint, 0644);
+MODULE_PARM_DESC(call_us, "fixed cost of every FTL call");
+
+static unsigned int read_kbps = 20000;
+module_param(read_kbps, uint, 0644);
+MODULE_PARM_DESC(read_kbps, "read bandwidth in KB/s");
+
+static unsigned int write_kbps = 8000;
+module_param(write_kbps, uint, 0644);
+MODULE_PARM_DESC(write_kbps, "write bandwidth in KB/s");
+
+static DEFINE_MUTEX(ramftl_lock);
+static char *ramftl_data;
+static unsigned long ramftl_sectors;
+static unsigned long ramftl_calls[2], ramftl_secs[2];
+
+static void ramftl_delay(int nsec, unsigned int kbps)
+{
+	unsigned long us = call_us;
+
+	if (kbps)
+		us += (unsigned long)nsec * 500000 / kbps;
+	if (us >= 20)
+		usleep_range(us, us + us / 8);
+	else if (us)
+		udelay(us);
+}
+
+static int ramftl_check(int Index, int nSec)
+{
+	return Index < 0 || nSec < 0 ||
+	       (unsigned long)Index + nSec > ramftl_sectors;
+}
+
+static int ramftl_read(int Index, int nSec, void *buf)
+{
+	if (ramftl_check(Index, nSec))
+		return -EIO;
+	mutex_lock(&ramftl_lock);
+	memcpy(buf, ramftl_data + ((size_t)Index << 9), nSec << 9);
+	ramftl_delay(nSec, read_kbps);
+	ramftl_calls[READ]++;
+	ramftl_secs[READ] += nSec;
+	mutex_unlock(&ramftl_lock);
+	return 0;
+}
+
+static int ramftl_write(int Index, int nSec, void *buf, int mode)
+{
+	if (ramftl_check(Index, nSec))
+		return -EIO;
+	mutex_lock(&ramftl_lock);
+	memcpy(ramftl_data + ((size_t)Index << 9), buf, nSec << 9);
+	ramftl_delay(nSec, write_kbps);
+	ramftl_calls[WRITE]++;
+	ramftl_secs[WRITE] += nSec;
+	mutex_unlock(&ramftl_lock);
+	return 0;
+}
+
+static int ramftl_write_panic(int Index, int nSec, void *buf)
+{
+	if (ramftl_check(Index, nSec))
+		return -EIO;
+	memcpy(ramftl_data + ((size_t)Index << 9), buf, nSec << 9);
+	return 0;
+}
+
+static int ramftl_sync(void)
+{
+	mutex_lock(&ramftl_lock);
+	ramftl_delay(0, 0);
+	mutex_unlock(&ramftl_lock);
+	return 0;
+}
+
+static int ramftl_close(void)
+{
+	return 0;
+}
+
+static int ramftl_proc_read(char *page)
+{
+	return sprintf(page, "ramftl: %luMB read calls=%lu sec=%lu "
+		       "write calls=%lu sec=%lu\n", ramftl_sectors >> 11,
+		       ramftl_calls[READ], ramftl_secs[READ],
+		       ramftl_calls[WRITE], ramftl_secs[WRITE]);
+}
+
+static int __init rknand_ramftl_init(void)
+{
+	struct rknand_info *info = NULL;
+
+	get_rknand_device(&info);
+	if (!info || !info->add_rknand_device) {
+		printk(KERN_ERR "rknand_ramftl: no rk29xxnand device\n");
+		return -ENODEV;
+	}
+	if (info->ftl_read) {
+		printk(KERN_ERR "rknand_ramftl: an FTL is already loaded\n");
+		return -EBUSY;
+	}
+
+	ramftl_sectors = (unsigned long)size_mb << 11;
+	ramftl_data = vmalloc(ramftl_sectors << 9);
+	if (!ramftl_data)
+		return -ENOMEM;
+	memset(ramftl_data, 0, ramftl_sectors << 9);
+
+	info->nandCapacity = ramftl_sectors;
+	info->ftl_read = ramftl_read;
+	info->ftl_write = ramftl_write;
+	info->ftl_write_panic = ramftl_write_panic;
+	info->ftl_sync = ramftl_sync;
+	info->ftl_close = ramftl_close;
+	info->proc_ftlread = ramftl_proc_read;
+	info->add_rknand_device(info);
+
+	printk(KERN_INFO "rknand_ramftl: %uMB registered\n", size_mb);
+	return 0;
+}
+
+module_init(rknand_ramftl_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RAM backed stand-in for the rknand FTL");
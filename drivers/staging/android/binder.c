@@ -16,9 +16,11 @@
  */
 
 #include <asm/cacheflush.h>
+#include <linux/ashmem.h>
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ion.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -36,6 +38,15 @@
 
 #include "binder.h"
 
+/*
+ * binder_lock serializes all node, ref, thread and transaction state of
+ * every proc, so every ioctl, binder_thread_read/write and most of
+ * binder_transaction() still take turns on it, even between unrelated
+ * procs.  It has not been split per proc.  Only the buffer allocator of
+ * a proc has a lock of its own (proc->alloc_lock), so that
+ * binder_transaction() can allocate in the target and copy the payload
+ * in with binder_lock dropped.
+ */
 static DEFINE_MUTEX(binder_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
@@ -105,6 +116,10 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* pages per proc kept mapped after their buffer is freed */
+static int binder_page_cache_max = 32;
+module_param_named(page_cache_pages, binder_page_cache_max, int, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -150,6 +165,9 @@ struct binder_stats {
 	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
 	int obj_created[BINDER_STAT_COUNT];
 	int obj_deleted[BINDER_STAT_COUNT];
+	unsigned long bytes_copied;	/* transaction data and offsets */
+	unsigned long bytes_by_ref;	/* ashmem/ion regions sent as fds */
+	int fds_by_ref;
 };
 
 static struct binder_stats binder_stats;
@@ -279,6 +297,13 @@ enum binder_deferred_state {
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+struct binder_alloc_stats {
+	unsigned long page_faults;	/* pages allocated and mapped */
+	unsigned long page_hits;	/* pages reused while still mapped */
+	unsigned long page_frees;	/* pages unmapped and freed */
+	unsigned long map_batches;	/* map_vm_area calls */
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
 	struct rb_root threads;
@@ -298,6 +323,9 @@ struct binder_proc {
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
+	struct mutex alloc_lock;
+	int pages_cached;
+	struct binder_alloc_stats alloc_stats;
 
 	struct page **pages;
 	size_t buffer_size;
@@ -312,6 +340,8 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	int tmp_ref;
+	int release_pending;
 };
 
 enum {
@@ -583,8 +613,8 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
-static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
-						  void __user *user_ptr)
+static struct binder_buffer *__binder_buffer_lookup(struct binder_proc *proc,
+						    void __user *user_ptr)
 {
 	struct rb_node *n = proc->allocated_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -607,6 +637,32 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+/*
+ * Called when the page at page_addr is no longer covered by any buffer.
+ * Up to binder_page_cache_max such pages stay mapped so that the next
+ * buffer placed over them does not have to allocate and map them again.
+ */
+static void binder_release_page(struct binder_proc *proc, void *page_addr,
+				struct vm_area_struct *vma)
+{
+	struct page **page;
+
+	page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+	if (*page == NULL)
+		return;
+	if (vma && proc->pages_cached < binder_page_cache_max) {
+		proc->pages_cached++;
+		return;
+	}
+	if (vma)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			proc->user_buffer_offset, PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(*page);
+	*page = NULL;
+	proc->alloc_stats.page_frees++;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -615,7 +671,9 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
 	struct page **page;
+	struct page **page_array_ptr;
 	struct mm_struct *mm;
+	int ret, run, i;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -634,8 +692,11 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		vma = proc->vma;
 	}
 
-	if (allocate == 0)
-		goto free_range;
+	if (allocate == 0) {
+		for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE)
+			binder_release_page(proc, page_addr, vma);
+		goto out;
+	}
 
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
@@ -643,59 +704,78 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
+	/*
+	 * Pages still mapped from an earlier buffer are reused as they are;
+	 * each run of missing pages is allocated first and then mapped into
+	 * the kernel with a single map_vm_area call.
+	 */
+	for (page_addr = start; page_addr < end; page_addr += run * PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		if (*page) {
+			BUG_ON(proc->pages_cached <= 0);
+			proc->pages_cached--;
+			proc->alloc_stats.page_hits++;
+			run = 1;
+			continue;
+		}
+		for (run = 0; page_addr + run * PAGE_SIZE < end && !page[run];
+		     run++) {
+			page[run] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (page[run] == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n", proc->pid,
+				       page_addr + run * PAGE_SIZE);
+				goto err_alloc_page_failed;
+			}
 		}
 		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
+		tmp_area.size = run * PAGE_SIZE + PAGE_SIZE /* guard page? */;
 		page_array_ptr = page;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
+			       "to map pages at %p in kernel\n",
 			       proc->pid, page_addr);
 			goto err_map_kernel_failed;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+		proc->alloc_stats.map_batches++;
+		for (i = 0; i < run; i++) {
+			user_page_addr = (uintptr_t)page_addr + i * PAGE_SIZE +
+				proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr, page[i]);
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", proc->pid,
+				       user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+			/* vm_insert_page does not seem to increment the refcount */
 		}
-		/* vm_insert_page does not seem to increment the refcount */
+		proc->alloc_stats.page_faults += run;
 	}
+out:
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	if (i)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			proc->user_buffer_offset, i * PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, run * PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
 err_alloc_page_failed:
-		;
+	for (i = 0; i < run; i++) {
+		__free_page(page[i]);
+		page[i] = NULL;
+	}
+	/* hand back what this call had already set up */
+	while (page_addr > start) {
+		page_addr -= PAGE_SIZE;
+		binder_release_page(proc, page_addr, vma);
 	}
 err_no_vma:
 	if (mm) {
@@ -705,9 +785,10 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -811,6 +892,37 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/*
+ * The buffer allocator of a proc is guarded by proc->alloc_lock rather
+ * than binder_lock, so that senders can allocate and fill a buffer in
+ * the target without holding the global lock.  Lock order is
+ * binder_lock, then alloc_lock, then mmap_sem.
+ */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	if (buffer)
+		buffer->allow_user_free = 0;
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
+static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
+						  void __user *user_ptr)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_buffer_lookup(proc, user_ptr);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,8 +980,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -923,6 +1035,14 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -1375,6 +1495,41 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * A temporary reference keeps a proc from being released while a sender
+ * works on it without binder_lock held.  Both helpers are called with
+ * binder_lock held; a release requested in the meantime is re-queued by
+ * the last reference.
+ */
+static void binder_proc_inc_tmpref(struct binder_proc *proc)
+{
+	proc->tmp_ref++;
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	if (--proc->tmp_ref == 0 && proc->release_pending)
+		binder_defer_work(proc, BINDER_DEFERRED_RELEASE);
+}
+
+/*
+ * Size of the shared memory region behind a file sent as BINDER_TYPE_FD,
+ * or 0 if it is not an ashmem or ion buffer.
+ */
+static size_t binder_fd_region_size(struct file *file)
+{
+	size_t size;
+
+	size = ashmem_file_size(file);
+#ifdef CONFIG_ION
+	/* binder is built in, so it cannot call into a modular ion */
+	if (!size)
+		size = ion_share_file_size(file);
+#endif
+	return size;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1388,10 +1543,19 @@ static void binder_transaction(struct binder_proc *proc,
 	struct list_head *target_list;
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
-	struct binder_transaction_log_entry *e;
+	struct binder_transaction_log_entry log_entry, *e = &log_entry;
+	struct binder_buffer *buffer;
 	uint32_t return_error;
+	int copy_error;
+	size_t by_ref = 0;
+	int fds_by_ref = 0;
 
-	e = binder_transaction_log_add(&binder_transaction_log);
+	/*
+	 * The log entry is built on the stack and added to the log at the
+	 * end: while binder_lock is dropped below, other transactions may
+	 * recycle any slot of the log taken now.
+	 */
+	memset(e, 0, sizeof(*e));
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
 	e->from_proc = proc->pid;
 	e->from_thread = thread->pid;
@@ -1488,14 +1652,6 @@ static void binder_transaction(struct binder_proc *proc,
 			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1543,33 +1699,84 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
+	/*
+	 * Allocate the target buffer and copy the payload in without
+	 * binder_lock, so that large transactions and page faults on the
+	 * sender's data do not stall every other binder user.  The
+	 * temporary reference keeps target_proc and its buffer space alive;
+	 * everything else picked up above is re-validated afterwards.
+	 */
+	binder_proc_inc_tmpref(target_proc);
+	mutex_unlock(&binder_lock);
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
+	copy_error = 0;
+	if (buffer) {
+		if (copy_from_user(buffer->data, tr->data.ptr.buffer,
+				   tr->data_size))
+			copy_error = 1;
+		else if (copy_from_user(buffer->data +
+					ALIGN(tr->data_size, sizeof(void *)),
+					tr->data.ptr.offsets,
+					tr->offsets_size))
+			copy_error = 2;
+	}
+	mutex_lock(&binder_lock);
+	binder_proc_dec_tmpref(target_proc);
+
+	if (buffer == NULL) {
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
+	t->buffer = buffer;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	if (copy_error) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid,
+			copy_error == 1 ? "data" : "offsets");
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
+	if (target_proc->release_pending) {
+		return_error = BR_DEAD_REPLY;
 		goto err_copy_data_failed;
 	}
+	if (reply) {
+		if (in_reply_to->from != target_thread) {
+			/* the thread waiting for this reply has exited */
+			return_error = BR_DEAD_REPLY;
+			goto err_copy_data_failed;
+		}
+	} else if (!(t->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp = thread->transaction_stack;
+
+		target_thread = NULL;
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+	}
+	t->to_thread = target_thread;
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
+	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1672,6 +1879,7 @@ static void binder_transaction(struct binder_proc *proc,
 		case BINDER_TYPE_FD: {
 			int target_fd;
 			struct file *file;
+			size_t size;
 
 			if (reply) {
 				if (!(in_reply_to->flags & TF_ACCEPT_FDS)) {
@@ -1694,6 +1902,11 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_fget_failed;
 			}
+			size = binder_fd_region_size(file);
+			if (size) {
+				by_ref += size;
+				fds_by_ref++;
+			}
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
 			if (target_fd < 0) {
 				fput(file);
@@ -1732,12 +1945,19 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	binder_stats.bytes_copied += tr->data_size + tr->offsets_size;
+	proc->stats.bytes_copied += tr->data_size + tr->offsets_size;
+	binder_stats.bytes_by_ref += by_ref;
+	proc->stats.bytes_by_ref += by_ref;
+	binder_stats.fds_by_ref += fds_by_ref;
+	proc->stats.fds_by_ref += fds_by_ref;
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	*binder_transaction_log_add(&binder_transaction_log) = *e;
 	return;
 
 err_get_unused_fd_failed:
@@ -1769,11 +1989,8 @@ err_no_context_mgr_node:
 		     proc->pid, thread->pid, return_error,
 		     tr->data_size, tr->offsets_size);
 
-	{
-		struct binder_transaction_log_entry *fe;
-		fe = binder_transaction_log_add(&binder_transaction_log_failed);
-		*fe = *e;
-	}
+	*binder_transaction_log_add(&binder_transaction_log) = *e;
+	*binder_transaction_log_add(&binder_transaction_log_failed) = *e;
 
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
@@ -2884,6 +3101,7 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
 	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
@@ -3095,8 +3313,12 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_FLUSH)
 			binder_deferred_flush(proc);
 
-		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+		if (defer & BINDER_DEFERRED_RELEASE) {
+			if (proc->tmp_ref)
+				proc->release_pending = 1;
+			else
+				binder_deferred_release(proc); /* frees proc */
+		}
 
 		mutex_unlock(&binder_lock);
 		if (files)
@@ -3279,9 +3501,13 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3375,6 +3601,41 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 				stats->obj_created[i] - stats->obj_deleted[i],
 				stats->obj_created[i]);
 	}
+
+	if (stats->bytes_copied || stats->fds_by_ref)
+		seq_printf(m, "%sbytes copied: %lu by reference: %lu in %d fds\n",
+			   prefix, stats->bytes_copied, stats->bytes_by_ref,
+			   stats->fds_by_ref);
+}
+
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct binder_alloc_stats *s = &proc->alloc_stats;
+	struct rb_node *n;
+	size_t free_size = 0, largest = 0, size;
+	int count = 0, mapped = 0, i;
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		size = binder_buffer_size(proc,
+			rb_entry(n, struct binder_buffer, rb_node));
+		free_size += size;
+		if (size > largest)
+			largest = size;
+		count++;
+	}
+	seq_printf(m, "  free buffers: %d, %zd bytes, largest %zd\n",
+		   count, free_size, largest);
+
+	if (proc->pages)
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++)
+			if (proc->pages[i])
+				mapped++;
+	seq_printf(m, "  pages: %d mapped, %d cached\n",
+		   mapped, proc->pages_cached);
+	seq_printf(m, "  page faults: %lu hits: %lu frees: %lu maps: %lu\n",
+		   s->page_faults, s->page_hits, s->page_frees,
+		   s->map_batches);
 }
 
 static void print_binder_proc_stats(struct seq_file *m,
@@ -3410,10 +3671,15 @@ static void print_binder_proc_stats(struct seq_file *m,
 	}
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
+	if (!binder_debug_no_lock)
+		mutex_lock(&proc->alloc_lock);
 	count = 0;
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	print_binder_alloc_stats(m, proc);
+	if (!binder_debug_no_lock)
+		mutex_unlock(&proc->alloc_lock);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -12,6 +12,10 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Free memory crossing a minfree level raised by notify_margin percent is
+ * reported through poll()/read() on /dev/lowmemorykiller, giving user-space
+ * a chance to trim caches before the kill level is reached.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -35,6 +39,14 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hash.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -51,6 +63,7 @@ static size_t lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static int lowmem_notify_margin = 25;	/* percent above minfree */
 
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
@@ -61,6 +74,99 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
+/*
+ * Candidate index.  Every user thread group is kept in a bucket keyed by
+ * its oom_adj, updated from fork, oom_adj writes and task free, so that
+ * victim selection only looks at the highest non-empty bucket instead of
+ * walking the whole task list.  Entries are keyed by the group leader;
+ * when exec makes another thread the leader it is reported like a fork,
+ * and the old leader's entry goes when that task is freed.  If an entry
+ * cannot be allocated the index is marked incomplete and selection falls
+ * back to the task list scan.
+ */
+#define LOWMEM_NR_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define LOWMEM_HASH_BITS	7
+
+struct lowmem_entry {
+	struct list_head bucket;
+	struct hlist_node hash;
+	struct task_struct *task;
+	int oom_adj;
+};
+
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static struct list_head lowmem_buckets[LOWMEM_NR_BUCKETS];
+static struct hlist_head lowmem_hash[1 << LOWMEM_HASH_BITS];
+static struct kmem_cache *lowmem_entry_cachep;
+static bool lowmem_index_incomplete;
+
+static inline struct hlist_head *lowmem_hash_head(struct task_struct *task)
+{
+	return &lowmem_hash[hash_ptr(task, LOWMEM_HASH_BITS)];
+}
+
+static inline struct list_head *lowmem_bucket(int oom_adj)
+{
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+static struct lowmem_entry *lowmem_index_find(struct task_struct *task)
+{
+	struct lowmem_entry *e;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(e, node, lowmem_hash_head(task), hash)
+		if (e->task == task)
+			return e;
+	return NULL;
+}
+
+/* Add @task or move it to the bucket of its current oom_adj. */
+static void lowmem_index_update(struct task_struct *task)
+{
+	struct lowmem_entry *e;
+	unsigned long flags;
+	int oom_adj;
+
+	if (task->flags & PF_KTHREAD)
+		return;
+	oom_adj = task->signal->oom_adj;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	e = lowmem_index_find(task);
+	if (!e) {
+		e = kmem_cache_alloc(lowmem_entry_cachep, GFP_ATOMIC);
+		if (!e) {
+			lowmem_index_incomplete = true;
+			goto out;
+		}
+		e->task = task;
+		hlist_add_head(&e->hash, lowmem_hash_head(task));
+	} else {
+		list_del(&e->bucket);
+	}
+	e->oom_adj = oom_adj;
+	list_add_tail(&e->bucket, lowmem_bucket(oom_adj));
+out:
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+}
+
+static void lowmem_index_remove(struct task_struct *task)
+{
+	struct lowmem_entry *e;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_index_lock, flags);
+	e = lowmem_index_find(task);
+	if (e) {
+		hlist_del(&e->hash);
+		list_del(&e->bucket);
+	}
+	spin_unlock_irqrestore(&lowmem_index_lock, flags);
+	if (e)
+		kmem_cache_free(lowmem_entry_cachep, e);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -75,61 +181,198 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 
 	if (task == lowmem_deathpending)
 		lowmem_deathpending = NULL;
+	lowmem_index_remove(task);
 
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static int
+task_fork_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
-	struct task_struct *p;
-	struct task_struct *selected = NULL;
-	int rem = 0;
-	int tasksize;
-	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
-	int selected_tasksize = 0;
-	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
-	int other_free = global_page_state(NR_FREE_PAGES);
-	int other_file = global_page_state(NR_FILE_PAGES) -
-						global_page_state(NR_SHMEM);
+	lowmem_index_update(data);
+	return NOTIFY_OK;
+}
 
-	/*
-	 * If we already have a death outstanding, then
-	 * bail out right away; indicating to vmscan
-	 * that we have nothing further to offer on
-	 * this pass.
-	 *
-	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-		return 0;
+static struct notifier_block task_fork_nb = {
+	.notifier_call	= task_fork_notify_func,
+};
+
+static int
+oom_adj_notify_func(struct notifier_block *self, unsigned long val, void *data)
+{
+	struct task_struct *task = data;
+
+	lowmem_index_update(task->group_leader);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block oom_adj_nb = {
+	.notifier_call	= oom_adj_notify_func,
+};
+
+/*
+ * Pressure notification.  /dev/lowmemorykiller becomes readable whenever
+ * free memory crosses one of the minfree levels raised by notify_margin
+ * percent, i.e. before the matching kill level is reached.  A read
+ * returns the oom_adj that is about to become killable (or -1 when the
+ * pressure is gone) followed by the free and file page counts.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+static DEFINE_SPINLOCK(lowmem_notify_lock);
+static unsigned int lowmem_notify_seq;
+static int lowmem_notify_adj = -1;
+static int lowmem_notify_free;
+static int lowmem_notify_file;
+
+static int lowmem_min_adj(int other_free, int other_file, int margin)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	size_t minfree;
+	int i;
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
+		minfree = lowmem_minfree[i] + lowmem_minfree[i] * margin / 100;
+		if (other_free < minfree && other_file < minfree)
+			return lowmem_adj[i];
 	}
-	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
-			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
-	rem = global_page_state(NR_ACTIVE_ANON) +
-		global_page_state(NR_ACTIVE_FILE) +
-		global_page_state(NR_INACTIVE_ANON) +
-		global_page_state(NR_INACTIVE_FILE);
-	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
-		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
-			     sc->nr_to_scan, sc->gfp_mask, rem);
-		return rem;
+	return OOM_ADJUST_MAX + 1;
+}
+
+static void lowmem_notify_pressure(int other_free, int other_file)
+{
+	unsigned long flags;
+	int adj;
+
+	adj = lowmem_min_adj(other_free, other_file, lowmem_notify_margin);
+	if (adj == OOM_ADJUST_MAX + 1)
+		adj = -1;
+	if (adj == lowmem_notify_adj)
+		return;
+
+	spin_lock_irqsave(&lowmem_notify_lock, flags);
+	lowmem_notify_adj = adj;
+	lowmem_notify_free = other_free;
+	lowmem_notify_file = other_file;
+	lowmem_notify_seq++;
+	spin_unlock_irqrestore(&lowmem_notify_lock, flags);
+	wake_up_interruptible(&lowmem_notify_wait);
+	lowmem_print(3, "lowmem_notify adj %d, ofree %d %d\n",
+		     adj, other_free, other_file);
+}
+
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(unsigned long)lowmem_notify_seq;
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	unsigned long seen = (unsigned long)file->private_data;
+	unsigned long flags;
+	unsigned int seq;
+	char tmp[48];
+	int len, ret;
+
+	if (!(file->f_flags & O_NONBLOCK)) {
+		ret = wait_event_interruptible(lowmem_notify_wait,
+					       lowmem_notify_seq != seen);
+		if (ret)
+			return ret;
+	}
+
+	spin_lock_irqsave(&lowmem_notify_lock, flags);
+	seq = lowmem_notify_seq;
+	len = snprintf(tmp, sizeof(tmp), "%d %d %d\n", lowmem_notify_adj,
+		       lowmem_notify_free, lowmem_notify_file);
+	spin_unlock_irqrestore(&lowmem_notify_lock, flags);
+
+	if (len > count)
+		len = count;
+	if (copy_to_user(buf, tmp, len))
+		return -EFAULT;
+	file->private_data = (void *)(unsigned long)seq;
+	return len;
+}
+
+static unsigned int lowmem_notify_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (lowmem_notify_seq != (unsigned long)file->private_data)
+		return POLLIN | POLLRDNORM | POLLPRI;
+	return 0;
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lowmem_notify_open,
+	.read		= lowmem_notify_read,
+	.poll		= lowmem_notify_poll,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "lowmemorykiller",
+	.fops		= &lowmem_notify_fops,
+};
+
+/*
+ * Pick the largest process in the highest oom_adj bucket at or above
+ * @min_adj.  Returns it with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select_indexed(int min_adj, int *size,
+						 int *adj)
+{
+	struct task_struct *selected = NULL;
+	struct lowmem_entry *e;
+	struct mm_struct *mm;
+	int oom_adj, tasksize;
+
+	spin_lock_irq(&lowmem_index_lock);
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		list_for_each_entry(e, lowmem_bucket(oom_adj), bucket) {
+			struct task_struct *p = e->task;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm || p->signal->oom_adj != oom_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+			if (selected && tasksize <= *size)
+				continue;
+			selected = p;
+			*size = tasksize;
+			*adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
 	}
-	selected_oom_adj = min_adj;
+	if (selected)
+		get_task_struct(selected);
+	spin_unlock_irq(&lowmem_index_lock);
+	return selected;
+}
+
+static struct task_struct *lowmem_select_scan(int min_adj, int *size,
+					      int *adj)
+{
+	struct task_struct *p;
+	struct task_struct *selected = NULL;
+	int tasksize;
+	int selected_tasksize = 0;
+	int selected_oom_adj = min_adj;
 
 	read_lock(&tasklist_lock);
 	for_each_process(p) {
@@ -166,6 +409,60 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
 			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	if (selected) {
+		get_task_struct(selected);
+		*size = selected_tasksize;
+		*adj = selected_oom_adj;
+	}
+	read_unlock(&tasklist_lock);
+	return selected;
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
+	int rem = 0;
+	int min_adj;
+	int selected_tasksize = 0;
+	int selected_oom_adj = 0;
+	int other_free = global_page_state(NR_FREE_PAGES);
+	int other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+
+	lowmem_notify_pressure(other_free, other_file);
+
+	/*
+	 * If we already have a death outstanding, then
+	 * bail out right away; indicating to vmscan
+	 * that we have nothing further to offer on
+	 * this pass.
+	 *
+	 */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout))
+		return 0;
+
+	min_adj = lowmem_min_adj(other_free, other_file, 0);
+	if (sc->nr_to_scan > 0)
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
+			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
+			     min_adj);
+	rem = global_page_state(NR_ACTIVE_ANON) +
+		global_page_state(NR_ACTIVE_FILE) +
+		global_page_state(NR_INACTIVE_ANON) +
+		global_page_state(NR_INACTIVE_FILE);
+	if (sc->nr_to_scan <= 0 || min_adj == OOM_ADJUST_MAX + 1) {
+		lowmem_print(5, "lowmem_shrink %lu, %x, return %d\n",
+			     sc->nr_to_scan, sc->gfp_mask, rem);
+		return rem;
+	}
+
+	if (lowmem_index_incomplete)
+		selected = lowmem_select_scan(min_adj, &selected_tasksize,
+					      &selected_oom_adj);
+	else
+		selected = lowmem_select_indexed(min_adj, &selected_tasksize,
+						 &selected_oom_adj);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -174,10 +471,10 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
 		rem -= selected_tasksize;
+		put_task_struct(selected);
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -188,7 +485,28 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_NR_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+	for (i = 0; i < ARRAY_SIZE(lowmem_hash); i++)
+		INIT_HLIST_HEAD(&lowmem_hash[i]);
+	lowmem_entry_cachep = KMEM_CACHE(lowmem_entry, 0);
+	if (!lowmem_entry_cachep)
+		lowmem_index_incomplete = true;
+
 	task_free_register(&task_nb);
+	if (lowmem_entry_cachep) {
+		task_fork_register(&task_fork_nb);
+		register_oom_adj_notifier(&oom_adj_nb);
+		read_lock(&tasklist_lock);
+		for_each_process(p)
+			lowmem_index_update(p);
+		read_unlock(&tasklist_lock);
+	}
+	if (misc_register(&lowmem_notify_misc))
+		printk(KERN_WARNING "lowmemorykiller: no notify device\n");
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
@@ -196,6 +514,11 @@ static int __init lowmem_init(void)
 static void __exit lowmem_exit(void)
 {
 	unregister_shrinker(&lowmem_shrinker);
+	misc_deregister(&lowmem_notify_misc);
+	if (lowmem_entry_cachep) {
+		unregister_oom_adj_notifier(&oom_adj_nb);
+		task_fork_unregister(&task_fork_nb);
+	}
 	task_free_unregister(&task_nb);
 }
 
@@ -205,6 +528,7 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_margin, lowmem_notify_margin, int, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
@@ -0,0 +1,119 @@
+/*
+ * drivers/staging/rk29/ipp/rk29-ipp-queue.c
+ *
+ * In-kernel job queue in front of the RK29 IPP.
+ *
+ * Callers hand ipp_queue_job() a job holding one or more requests and
+ * return straight away.  A single worker drains every queued job in one
+ * pass, runs each job's requests back to back on the IPP and then calls
+ * the job's completion callback, in submission order.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <mach/rk29-ipp.h>
+
+static DEFINE_SPINLOCK(ipp_queue_lock);
+static LIST_HEAD(ipp_queue_list);
+static struct workqueue_struct *ipp_queue_wq;
+
+static void ipp_queue_run(struct rk29_ipp_job *job)
+{
+	int ret = 0;
+
+	for (job->nr_done = 0; job->nr_done < job->nr_reqs; job->nr_done++) {
+		ret = ipp_blit_sync(&job->reqs[job->nr_done]);
+		if (ret)
+			break;
+	}
+
+	if (job->complete)
+		job->complete(job, ret);
+	complete(&job->done);
+}
+
+static void ipp_queue_work_fn(struct work_struct *work)
+{
+	struct rk29_ipp_job *job, *tmp;
+	unsigned long flags;
+	LIST_HEAD(batch);
+
+	for (;;) {
+		spin_lock_irqsave(&ipp_queue_lock, flags);
+		list_splice_init(&ipp_queue_list, &batch);
+		spin_unlock_irqrestore(&ipp_queue_lock, flags);
+
+		if (list_empty(&batch))
+			break;
+
+		list_for_each_entry_safe(job, tmp, &batch, node) {
+			list_del(&job->node);
+			ipp_queue_run(job);
+		}
+	}
+}
+
+static DECLARE_WORK(ipp_queue_work, ipp_queue_work_fn);
+
+/*
+ * Queue @job; its requests must stay valid until @job->complete has
+ * been called.  Safe from atomic context.
+ */
+int ipp_queue_job(struct rk29_ipp_job *job)
+{
+	unsigned long flags;
+
+	if (!job->reqs || job->nr_reqs <= 0)
+		return -EINVAL;
+
+	init_completion(&job->done);
+	job->nr_done = 0;
+
+	if (!ipp_queue_wq) {
+		/* too early for the worker, run it in line */
+		ipp_queue_run(job);
+		return 0;
+	}
+
+	spin_lock_irqsave(&ipp_queue_lock, flags);
+	list_add_tail(&job->node, &ipp_queue_list);
+	spin_unlock_irqrestore(&ipp_queue_lock, flags);
+
+	queue_work(ipp_queue_wq, &ipp_queue_work);
+	return 0;
+}
+EXPORT_SYMBOL(ipp_queue_job);
+
+/* Wait for @job, which must have been queued, to complete. */
+void ipp_job_wait(struct rk29_ipp_job *job)
+{
+	wait_for_completion(&job->done);
+}
+EXPORT_SYMBOL(ipp_job_wait);
+
+/* Wait until every job queued so far has completed. */
+void ipp_queue_flush(void)
+{
+	if (ipp_queue_wq)
+		flush_workqueue(ipp_queue_wq);
+}
+EXPORT_SYMBOL(ipp_queue_flush);
+
+static int __init ipp_queue_init(void)
+{
+	ipp_queue_wq = create_singlethread_workqueue("ipp_queue");
+	if (!ipp_queue_wq)
+		return -ENOMEM;
+	return 0;
+}
+/* before the framebuffer and camera drivers can queue anything */
+subsys_initcall(ipp_queue_init);
@@ -222,6 +222,27 @@
  <td> Read</td>
  </tr>
  
+ <tr>
+ <td> ep_stats </td>
+ <td> Device mode interrupt counts, endpoint interrupt coalescing activity
+ and, per endpoint, the completed requests, bytes and interrupts.</td>
+ <td> Read</td>
+ </tr>
+ 
+ <tr>
+ <td> ep_irq_limit </td>
+ <td> Endpoint interrupts per jiffy above which the device mode endpoints
+ are serviced from a tasklet with their interrupts masked. 0 disables.</td>
+ <td> Read/Write</td>
+ </tr>
+ 
+ <tr>
+ <td> hcd_stats </td>
+ <td> Host mode interrupt count and, per host channel, the interrupts,
+ transfer completions and NAKs.</td>
+ <td> Read</td>
+ </tr>
+ 
  <tr>
  <td> rd_reg_test </td>
  <td> Displays the time required to read the GNPTXFSIZ register many times
@@ -682,6 +703,103 @@ static ssize_t hcd_frrem_show( struct device *_dev,
 
 DEVICE_ATTR(hcd_frrem, S_IRUGO|S_IWUSR, hcd_frrem_show, 0);
 
+#ifndef DWC_HOST_ONLY
+static int ep_stats_line(char *buf, int len, dwc_otg_pcd_ep_t *ep, const char *dir)
+{
+	return len + scnprintf(buf + len, PAGE_SIZE - len,
+			"%-8s %-3s xfers %lu bytes %lu irqs %lu\n",
+			ep->ep.name, dir, ep->xfers, ep->xfer_bytes, ep->irqs);
+}
+#endif
+
+/**
+ * Show the device mode interrupt and per endpoint transfer counters.
+ */
+static ssize_t ep_stats_show( struct device *_dev,
+								struct device_attribute *attr, char *buf) 
+{
+#ifndef DWC_HOST_ONLY
+        dwc_otg_device_t *otg_dev = _dev->platform_data;
+	dwc_otg_pcd_t *pcd = otg_dev->pcd;
+	dwc_otg_dev_if_t *dev_if = otg_dev->core_if->dev_if;
+	int len, i;
+
+	if (!pcd)
+		return sprintf(buf, "Host Only Mode!\n");
+
+	len = scnprintf(buf, PAGE_SIZE,
+			"irqs %lu ep_irqs %lu polls %lu poll_passes %lu\n"
+			"descriptor dma %s\n",
+			pcd->irqs, pcd->ep_irqs, pcd->ep_polls, pcd->ep_poll_passes,
+			otg_dev->core_if->hwcfg4.b.desc_dma ? "capable" : "not supported");
+	len = ep_stats_line(buf, len, &pcd->ep0, "");
+	for (i = 0; i < dev_if->num_in_eps; i++)
+		len = ep_stats_line(buf, len, &pcd->in_ep[i], "in");
+	for (i = 0; i < dev_if->num_out_eps; i++)
+		len = ep_stats_line(buf, len, &pcd->out_ep[i], "out");
+	return len;
+#else
+	return sprintf(buf, "Host Only Mode!\n");
+#endif
+}
+
+DEVICE_ATTR(ep_stats, S_IRUGO, ep_stats_show, 0);
+
+static ssize_t ep_irq_limit_show( struct device *_dev,
+								struct device_attribute *attr, char *buf) 
+{
+#ifndef DWC_HOST_ONLY
+        dwc_otg_device_t *otg_dev = _dev->platform_data;
+
+	if (otg_dev->pcd)
+		return sprintf(buf, "%u\n", otg_dev->pcd->ep_irq_limit);
+#endif
+	return sprintf(buf, "Host Only Mode!\n");
+}
+
+static ssize_t ep_irq_limit_store( struct device *_dev,
+								struct device_attribute *attr, 
+								const char *buf, size_t count ) 
+{
+#ifndef DWC_HOST_ONLY
+        dwc_otg_device_t *otg_dev = _dev->platform_data;
+	uint32_t val = simple_strtoul(buf, NULL, 10);
+
+	if (otg_dev->pcd)
+		otg_dev->pcd->ep_irq_limit = val;
+#endif
+	return count;
+}
+
+DEVICE_ATTR(ep_irq_limit, S_IRUGO|S_IWUSR, ep_irq_limit_show, ep_irq_limit_store);
+
+/**
+ * Show the host mode interrupt and per channel transfer counters.
+ */
+static ssize_t hcd_stats_show( struct device *_dev,
+								struct device_attribute *attr, char *buf) 
+{
+#ifndef DWC_DEVICE_ONLY
+        dwc_otg_device_t *otg_dev = _dev->platform_data;
+	dwc_otg_hcd_t *hcd = otg_dev->hcd;
+	int len, i;
+
+	if (!hcd)
+		return sprintf(buf, "Device Only Mode!\n");
+
+	len = scnprintf(buf, PAGE_SIZE, "irqs %lu\n", hcd->irqs);
+	for (i = 0; i < otg_dev->core_if->core_params->host_channels; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"hc%-2d irqs %lu xfercomp %lu naks %lu\n", i,
+				hcd->hc_irqs[i], hcd->hc_xfercomp[i], hcd->hc_naks[i]);
+	return len;
+#else
+	return sprintf(buf, "Device Only Mode!\n");
+#endif
+}
+
+DEVICE_ATTR(hcd_stats, S_IRUGO, hcd_stats_show, 0);
+
 /**
  * Displays the time required to read the GNPTXFSIZ register many times (the
  * output shows the number of times the register is read).
@@ -797,6 +915,9 @@ void dwc_otg_attr_create (struct device *dev)
 	error |= device_create_file(dev, &dev_attr_regdump);
 	error |= device_create_file(dev, &dev_attr_hcddump);
 	error |= device_create_file(dev, &dev_attr_hcd_frrem);
+	error |= device_create_file(dev, &dev_attr_ep_stats);
+	error |= device_create_file(dev, &dev_attr_ep_irq_limit);
+	error |= device_create_file(dev, &dev_attr_hcd_stats);
 	error |= device_create_file(dev, &dev_attr_rd_reg_test);
 	error |= device_create_file(dev, &dev_attr_wr_reg_test);
 	error |= device_create_file(dev, &dev_attr_debug);
@@ -835,6 +956,9 @@ void dwc_otg_attr_remove (struct device *dev)
 	device_remove_file(dev, &dev_attr_regdump);
 	device_remove_file(dev, &dev_attr_hcddump);
 	device_remove_file(dev, &dev_attr_hcd_frrem);
+	device_remove_file(dev, &dev_attr_ep_stats);
+	device_remove_file(dev, &dev_attr_ep_irq_limit);
+	device_remove_file(dev, &dev_attr_hcd_stats);
 	device_remove_file(dev, &dev_attr_rd_reg_test);
 	device_remove_file(dev, &dev_attr_wr_reg_test);
 	device_remove_file(dev, &dev_attr_debug);
@@ -390,6 +390,12 @@ typedef struct dwc_otg_hcd {
     /** Flag to indicate whether host controller is enabled. */
     uint8_t host_enabled;
 
+	/** Interrupt and transfer counters for the hcd_stats attribute */
+	unsigned long		irqs;
+	unsigned long		hc_irqs[MAX_EPS_CHANNELS];
+	unsigned long		hc_xfercomp[MAX_EPS_CHANNELS];
+	unsigned long		hc_naks[MAX_EPS_CHANNELS];
+
 } dwc_otg_hcd_t;
 
 /** Gets the dwc_otg_hcd from a struct usb_hcd */
@@ -58,6 +58,7 @@ int32_t dwc_otg_hcd_handle_intr (dwc_otg_hcd_t *_dwc_otg_hcd)
 //			DWC_PRINT("%s,GINTSTS = 0\n",__func__);
 			return 0;
 		}
+		_dwc_otg_hcd->irqs++;
 
 #ifdef DEBUG
 		/* Don't print debug message in the interrupt handler on SOF */
@@ -1862,6 +1863,12 @@ int32_t dwc_otg_hcd_handle_hc_n_intr (dwc_otg_hcd_t *_dwc_otg_hcd, uint32_t _num
 		    hcint.d32, hcintmsk.d32, (hcint.d32 & hcintmsk.d32));
 	hcint.d32 = hcint.d32 & hcintmsk.d32;
 
+	_dwc_otg_hcd->hc_irqs[_num]++;
+	if (hcint.b.xfercomp)
+		_dwc_otg_hcd->hc_xfercomp[_num]++;
+	if (hcint.b.nak)
+		_dwc_otg_hcd->hc_naks[_num]++;
+
 	if (!_dwc_otg_hcd->core_if->dma_enable) {
 		if ((hcint.b.chhltd) && (hcint.d32 != 0x2)) {
 			hcint.b.chhltd = 0;
@@ -1896,6 +1896,9 @@ int dwc_otg_pcd_init(struct device *dev)
 	start_xfer_tasklet.data = (unsigned long)pcd;
 	pcd->start_xfer_tasklet = &start_xfer_tasklet;
 
+	tasklet_init(&pcd->ep_tasklet, dwc_otg_pcd_ep_poll, (unsigned long)pcd);
+	pcd->ep_irq_limit = 8;
+
 
 
     init_timer( &pcd->check_vbus_timer );
@@ -1926,6 +1929,7 @@ void dwc_otg_pcd_remove( struct device *dev )
 	 * Free the IRQ 
 	 */
 	free_irq( platform_get_irq(to_platform_device(dev),0), pcd );
+	tasklet_kill(&pcd->ep_tasklet);
 	
 	 /* start with the driver above us */
 	if (pcd->driver) 
@@ -114,6 +114,12 @@ typedef struct dwc_otg_pcd_ep
 
 	/** Pointer to PCD */
 	struct dwc_otg_pcd *pcd;
+
+	/** Completed requests, bytes and endpoint interrupts, for the
+	 * ep_stats attribute. */
+	unsigned long xfers;
+	unsigned long xfer_bytes;
+	unsigned long irqs;
 }dwc_otg_pcd_ep_t;
 
 
@@ -205,6 +211,22 @@ typedef struct dwc_otg_pcd
 
     /** pervent device suspend while usb connected */
     struct wake_lock wake_lock;
+
+	/** Endpoint interrupt coalescing.  Once more than ep_irq_limit
+	 * endpoint interrupts arrive within a jiffy, the IN/OUT endpoint
+	 * interrupts are masked and ep_tasklet services the endpoints
+	 * until they go quiet.  0 disables. */
+	unsigned ep_irq_limit;
+	unsigned ep_irq_count;
+	unsigned long ep_irq_jiffies;
+	unsigned ep_polling : 1;
+	struct tasklet_struct ep_tasklet;
+
+	/** Interrupt counters for the ep_stats attribute */
+	unsigned long irqs;
+	unsigned long ep_irqs;
+	unsigned long ep_polls;
+	unsigned long ep_poll_passes;
 } dwc_otg_pcd_t;
 
 
@@ -229,6 +251,7 @@ extern void dwc_otg_pcd_start_srp_timer(dwc_otg_pcd_t *_pcd );
 extern void dwc_otg_pcd_initiate_srp(dwc_otg_pcd_t *_pcd);
 extern void dwc_otg_pcd_remote_wakeup(dwc_otg_pcd_t *_pcd, int set);
 extern void dwc_otg_pcd_start_vbus_timer( dwc_otg_pcd_t * _pcd );
+extern void dwc_otg_pcd_ep_poll( unsigned long _data );
 
 
 #endif
@@ -1777,6 +1777,8 @@ static void complete_ep( dwc_otg_pcd_ep_t *_ep )
 			{
 				req->req.actual = _ep->dwc_ep.xfer_count;
 			}
+			_ep->xfers++;
+			_ep->xfer_bytes += req->req.actual;
 			request_done(_ep, req, 0);
         } else {
 //            DWC_PRINT("\n++++++FIND NULL req,ep=%s++++++++++\n" , _ep->ep.name );
@@ -2161,6 +2163,7 @@ do { \
 			/* Get EP pointer */	   
 			ep = get_in_ep(_pcd, epnum);
 			dwc_ep = &ep->dwc_ep;
+			ep->irqs++;
 
 			_diepctl = dwc_read_reg32(&dev_if->in_ep_regs[epnum]->diepctl);
 			_empty_msk = dwc_read_reg32(&dev_if->dev_global_regs->dtknqr4_fifoemptymsk);
@@ -2327,6 +2330,7 @@ do { \
 		{
 			/* Get EP pointer */	   
 			dwc_ep = &((get_out_ep(_pcd, epnum))->dwc_ep);
+			get_out_ep(_pcd, epnum)->irqs++;
 //			  dwc_ep = &_pcd->out_ep[ epnum - 1].dwc_ep;
 //#ifdef VERBOSE
 #if 1
@@ -2390,6 +2394,92 @@ do { \
 #undef CLEAR_OUT_EP_INTR
 }
 
+/** Passes over the endpoint interrupts per run of the ep tasklet */
+#define DWC_EP_POLL_BUDGET	16
+
+/**
+ * Count an endpoint interrupt and decide whether to service it here.
+ * When endpoint interrupts arrive faster than <code>ep_irq_limit</code>
+ * per jiffy (bulk completion storms from UMS or USB Ethernet), the IN
+ * and OUT endpoint interrupts are masked and the endpoints are serviced
+ * from <code>ep_tasklet</code> until they go quiet.
+ *
+ * @return 1 if the endpoints were handed to the tasklet.
+ */
+static int dwc_otg_pcd_ep_defer(dwc_otg_pcd_t *_pcd)
+{
+	dwc_otg_core_if_t *core_if = GET_CORE_IF(_pcd);
+	gintmsk_data_t intr_mask = {.d32 = 0};
+
+	_pcd->ep_irqs++;
+	if (_pcd->ep_irq_jiffies != jiffies) 
+	{
+		_pcd->ep_irq_jiffies = jiffies;
+		_pcd->ep_irq_count = 0;
+	}
+	if (!_pcd->ep_irq_limit || ++_pcd->ep_irq_count <= _pcd->ep_irq_limit) 
+	{
+		return 0;
+	}
+
+	intr_mask.b.inepintr = 1;
+	intr_mask.b.outepintr = 1;
+	dwc_modify_reg32(&core_if->core_global_regs->gintmsk, intr_mask.d32, 0);
+	_pcd->ep_polling = 1;
+	_pcd->ep_polls++;
+	tasklet_schedule(&_pcd->ep_tasklet);
+	return 1;
+}
+
+/**
+ * Endpoint tasklet.  Services the pending endpoint interrupts, picking
+ * up completions that arrive meanwhile without taking an interrupt for
+ * them, then unmasks the endpoint interrupts again once the endpoints
+ * are quiet or the budget is spent.
+ */
+void dwc_otg_pcd_ep_poll(unsigned long _data)
+{
+	dwc_otg_pcd_t *pcd = (dwc_otg_pcd_t *)_data;
+	dwc_otg_core_if_t *core_if = GET_CORE_IF(pcd);
+	gintmsk_data_t intr_mask = {.d32 = 0};
+	unsigned long flags;
+	uint32_t in_intr, out_intr;
+	int budget;
+
+	SPIN_LOCK_IRQSAVE(&pcd->lock, flags);
+	if (!pcd->ep_polling || !dwc_otg_is_device_mode(core_if)) 
+	{
+		pcd->ep_polling = 0;
+		SPIN_UNLOCK_IRQRESTORE(&pcd->lock, flags);
+		return;
+	}
+
+	for (budget = DWC_EP_POLL_BUDGET; budget; budget--) 
+	{
+		in_intr = dwc_otg_read_dev_all_in_ep_intr(core_if);
+		out_intr = dwc_otg_read_dev_all_out_ep_intr(core_if);
+		if (!in_intr && !out_intr) 
+		{
+			break;
+		}
+		if (in_intr) 
+		{
+			dwc_otg_pcd_handle_in_ep_intr(pcd);
+		}
+		if (out_intr) 
+		{
+			dwc_otg_pcd_handle_out_ep_intr(pcd);
+		}
+		pcd->ep_poll_passes++;
+	}
+
+	pcd->ep_polling = 0;
+	intr_mask.b.inepintr = 1;
+	intr_mask.b.outepintr = 1;
+	dwc_modify_reg32(&core_if->core_global_regs->gintmsk, 0, intr_mask.d32);
+	SPIN_UNLOCK_IRQRESTORE(&pcd->lock, flags);
+}
+
 /**
  * Incomplete ISO IN Transfer Interrupt.
  * This interrupt indicates one of the following conditions occurred
@@ -2573,6 +2663,7 @@ int32_t dwc_otg_pcd_handle_intr( dwc_otg_pcd_t *_pcd )
 		}
 		DWC_DEBUGPL(DBG_PCDV, "%s: gintsts&gintmsk=%08x\n",
 					__func__, gintr_status.d32 );
+		_pcd->irqs++;
 	
 		if (gintr_status.b.sofintr) 
 		{
@@ -2623,6 +2714,13 @@ int32_t dwc_otg_pcd_handle_intr( dwc_otg_pcd_t *_pcd )
 		{
 			retval |= dwc_otg_pcd_handle_ep_mismatch_intr( core_if );
 		}
+		if ((gintr_status.b.inepint || gintr_status.b.outepintr) &&
+			dwc_otg_pcd_ep_defer( _pcd )) 
+		{
+			gintr_status.b.inepint = 0;
+			gintr_status.b.outepintr = 0;
+			retval |= 1;
+		}
 		if (gintr_status.b.inepint) 
 		{
 			retval |= dwc_otg_pcd_handle_in_ep_intr( _pcd );
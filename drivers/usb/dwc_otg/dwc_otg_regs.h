@@ -771,7 +771,8 @@ typedef union hwcfg4_data
 		unsigned session_end_filt_en : 1;				 
 		unsigned ded_fifo_en : 1;
 		unsigned num_in_eps : 4;
-		unsigned reserved31_30 : 2;
+		unsigned desc_dma : 1;
+		unsigned desc_dma_dyn : 1;
 	} b;
 } hwcfg4_data_t;
 
@@ -284,12 +284,14 @@
 #include <linux/kref.h>
 #include <linux/kthread.h>
 #include <linux/limits.h>
+#include <linux/pagemap.h>
 #include <linux/rwsem.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
 #include <linux/string.h>
 #include <linux/freezer.h>
 #include <linux/utsname.h>
+#include <linux/workqueue.h>
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
@@ -302,9 +304,14 @@
 
 
 #ifdef CONFIG_ARCH_RK29
-/* flush after every 4 meg of writes to avoid excessive block level caching */
-#define MAX_UNFLUSHED_BYTES  (64 * 1024)// (4 * 1024 * 1024) //original value is 4MB,Modifyed by xbw at 2011-08-18
+/*
+ * Bound the dirty data a cable pull can lose.  The flush runs on the
+ * I/O workqueue, not in the data path: once MAX_UNFLUSHED_BYTES have
+ * been written, or after UNFLUSHED_IDLE_DELAY without writes.
+ */
+#define MAX_UNFLUSHED_BYTES  (1024 * 1024)
 #define MAX_UNFLUSHED_PACKETS 4//16
+#define UNFLUSHED_IDLE_DELAY	(HZ / 5)
 
 #include <linux/power_supply.h>
 #include <linux/reboot.h>
@@ -392,7 +399,30 @@ struct fsg_common {
 
 	struct fsg_buffhd	*next_buffhd_to_fill;
 	struct fsg_buffhd	*next_buffhd_to_drain;
-	struct fsg_buffhd	buffhds[FSG_NUM_BUFFERS];
+	struct fsg_buffhd	*buffhds;
+	unsigned int		fsg_num_buffers;
+	unsigned int		buflen;
+
+	/*
+	 * Read-ahead of sequential READs and deferred fsyncs run on
+	 * io_wq, next to the main thread.  ra_* are the main thread's
+	 * view of the READ stream; prefetch_* (under lock) are handed
+	 * to the worker.
+	 */
+	struct workqueue_struct	*io_wq;
+	struct work_struct	prefetch_work;
+	struct fsg_lun		*ra_lun;
+	loff_t			ra_next;
+	loff_t			ra_until;
+	struct fsg_lun		*prefetch_lun;
+	loff_t			prefetch_start;
+	loff_t			prefetch_len;
+	struct file		*prefetch_filp;
+	struct file_ra_state	prefetch_ra;
+#ifdef MAX_UNFLUSHED_PACKETS
+	struct delayed_work	flush_work;
+	unsigned long		last_write;
+#endif
 
 	int			cmnd_size;
 	u8			cmnd[MAX_COMMAND_SIZE];
@@ -741,6 +771,26 @@ static bool start_out_transfer(struct fsg_common *common, struct fsg_buffhd *bh)
 	return true;
 }
 
+/*
+ * Buffer ring.  More and larger buffers keep the bus busy while the
+ * backing file is read or written.  Changes take effect the next time
+ * the host configures the function, e.g. after a reconnect.
+ */
+#define FSG_MAX_NUM_BUFFERS	32
+
+static unsigned int fsg_num_buffers = 4;
+module_param(fsg_num_buffers, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fsg_num_buffers, "number of mass storage I/O buffers (2-32)");
+
+static unsigned int fsg_buflen = 65536;
+module_param(fsg_buflen, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fsg_buflen, "size of each mass storage I/O buffer");
+
+/* how far to read ahead of a sequential READ stream, 0 disables */
+static unsigned int fsg_readahead_kb = 512;
+module_param(fsg_readahead_kb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(fsg_readahead_kb, "read-ahead for sequential READs, in KB");
+
 static int sleep_thread(struct fsg_common *common)
 {
 	int	rc = 0;
@@ -765,6 +815,166 @@ static int sleep_thread(struct fsg_common *common)
 
 /*-------------------------------------------------------------------------*/
 
+/*
+ * Sequential READ read-ahead.  A READ that starts where the previous
+ * one on the same LUN ended has the window after it read into the page
+ * cache on io_wq, so the following READs are served from memory while
+ * the main thread is busy on the bus.
+ */
+static void fsg_prefetch(struct fsg_common *common, struct fsg_lun *curlun,
+			 loff_t offset, u32 len)
+{
+	loff_t	window = (loff_t)fsg_readahead_kb << 10;
+	loff_t	end = offset + len;
+	loff_t	start, stop;
+
+	if (!window)
+		return;
+	if (curlun != common->ra_lun || offset != common->ra_next) {
+		common->ra_lun = curlun;
+		common->ra_next = end;
+		common->ra_until = end;
+		return;
+	}
+	common->ra_next = end;
+
+	/* Still well ahead of the host? */
+	if (common->ra_until - end > window / 2)
+		return;
+
+	start = max(end, common->ra_until);
+	stop = min(end + window, curlun->file_length);
+	if (stop <= start)
+		return;
+	common->ra_until = stop;
+
+	spin_lock_irq(&common->lock);
+	if (common->prefetch_lun == curlun &&
+	    common->prefetch_start + common->prefetch_len == start) {
+		/* the worker has not picked up the last one yet */
+		common->prefetch_len = stop - common->prefetch_start;
+	} else {
+		common->prefetch_lun = curlun;
+		common->prefetch_start = start;
+		common->prefetch_len = stop - start;
+	}
+	spin_unlock_irq(&common->lock);
+
+	queue_work(common->io_wq, &common->prefetch_work);
+}
+
+static void fsg_prefetch_work(struct work_struct *work)
+{
+	struct fsg_common	*common =
+		container_of(work, struct fsg_common, prefetch_work);
+	struct fsg_lun		*curlun;
+	struct file		*filp;
+	loff_t			start, len;
+	pgoff_t			index, nr;
+
+	spin_lock_irq(&common->lock);
+	curlun = common->prefetch_lun;
+	start = common->prefetch_start;
+	len = common->prefetch_len;
+	common->prefetch_lun = NULL;
+	spin_unlock_irq(&common->lock);
+	if (!curlun)
+		return;
+
+	/* filesem keeps the LUN from being ejected under us */
+	down_read(&common->filesem);
+	if (fsg_lun_is_open(curlun)) {
+		filp = curlun->filp;
+		if (filp != common->prefetch_filp) {
+			file_ra_state_init(&common->prefetch_ra,
+					   filp->f_mapping);
+			common->prefetch_filp = filp;
+		}
+		index = start >> PAGE_CACHE_SHIFT;
+		nr = ((start + len - 1) >> PAGE_CACHE_SHIFT) - index + 1;
+		common->prefetch_ra.ra_pages = nr;
+		page_cache_sync_readahead(filp->f_mapping,
+					  &common->prefetch_ra, filp,
+					  index, nr);
+	}
+	up_read(&common->filesem);
+}
+
+#ifdef MAX_UNFLUSHED_PACKETS
+
+/*
+ * Written data is synced in the background: at once when a LUN has
+ * MAX_UNFLUSHED_BYTES outstanding, otherwise when writes have stopped
+ * for UNFLUSHED_IDLE_DELAY.  Returns true while some LUN still has
+ * unsynced data.
+ */
+static bool fsg_flush_luns(struct fsg_common *common, bool all)
+{
+	struct fsg_lun	*curlun;
+	unsigned int	bytes;
+	bool		pending = false;
+	int		i;
+
+	down_read(&common->filesem);
+	for (i = 0; i < common->nluns; ++i) {
+		curlun = &common->luns[i];
+
+		spin_lock_irq(&common->lock);
+		bytes = curlun->unflushed_bytes;
+		if (bytes && (all || bytes >= MAX_UNFLUSHED_BYTES)) {
+			curlun->unflushed_packet = 0;
+			curlun->unflushed_bytes = 0;
+		}
+		spin_unlock_irq(&common->lock);
+
+		if (!bytes)
+			continue;
+		if (all || bytes >= MAX_UNFLUSHED_BYTES)
+			fsg_lun_fsync_sub(curlun);
+		else
+			pending = true;
+	}
+	up_read(&common->filesem);
+
+	return pending;
+}
+
+static void fsg_flush_work(struct work_struct *work)
+{
+	struct fsg_common	*common =
+		container_of(work, struct fsg_common, flush_work.work);
+	unsigned long		idle_at;
+
+	idle_at = ACCESS_ONCE(common->last_write) + UNFLUSHED_IDLE_DELAY;
+	if (fsg_flush_luns(common, time_after_eq(jiffies, idle_at)))
+		queue_delayed_work(common->io_wq, &common->flush_work,
+				   UNFLUSHED_IDLE_DELAY);
+}
+
+static void fsg_note_write(struct fsg_common *common, struct fsg_lun *curlun,
+			   int packets, unsigned int bytes)
+{
+	bool	full;
+
+	spin_lock_irq(&common->lock);
+	curlun->unflushed_packet += packets;
+	curlun->unflushed_bytes += bytes;
+	full = curlun->unflushed_bytes >= MAX_UNFLUSHED_BYTES;
+	spin_unlock_irq(&common->lock);
+
+	common->last_write = jiffies;
+	if (full) {
+		/* pull a pending idle flush forward */
+		cancel_delayed_work(&common->flush_work);
+		queue_delayed_work(common->io_wq, &common->flush_work, 0);
+	} else {
+		queue_delayed_work(common->io_wq, &common->flush_work,
+				   UNFLUSHED_IDLE_DELAY);
+	}
+}
+
+#endif /* MAX_UNFLUSHED_PACKETS */
+
 static int do_read(struct fsg_common *common)
 {
 	struct fsg_lun		*curlun = common->curlun;
@@ -807,6 +1017,8 @@ static int do_read(struct fsg_common *common)
 	if (unlikely(amount_left == 0))
 		return -EIO;		/* No default reply */
 
+	fsg_prefetch(common, curlun, file_offset, amount_left);
+
 	for (;;) {
 		/*
 		 * Figure out how much we need to read:
@@ -818,7 +1030,7 @@ static int do_read(struct fsg_common *common)
 		 * If this means reading 0 then we were asked to read past
 		 *	the end of file.
 		 */
-		amount = min(amount_left, FSG_BUFLEN);
+		amount = min(amount_left, common->buflen);
 		amount = min((loff_t)amount,
 			     curlun->file_length - file_offset);
 		partial_page = file_offset & (PAGE_CACHE_SIZE - 1);
@@ -978,7 +1190,7 @@ static int do_write(struct fsg_common *common)
 			 *	to write past the end of file.
 			 * Finally, round down to a block boundary.
 			 */
-			amount = min(amount_left_to_req, FSG_BUFLEN);
+			amount = min(amount_left_to_req, common->buflen);
 			amount = min((loff_t)amount,
 				     curlun->file_length - usb_offset);
 			partial_page = usb_offset & (PAGE_CACHE_SIZE - 1);
@@ -1005,13 +1217,6 @@ static int do_write(struct fsg_common *common)
 				continue;
 			}
 
-			/* Get the next buffer */
-			usb_offset += amount;
-			common->usb_amount_left -= amount;
-			amount_left_to_req -= amount;
-			if (amount_left_to_req == 0)
-				get_some_more = 0;
-				
 			/* kever@rk
 			 * max size for dwc_otg ctonroller is 64(max pkt sizt) * 1023(pkt)
 			 * because of the DOEPTSIZ.PKTCNT has only 10 bits
@@ -1019,6 +1224,13 @@ static int do_write(struct fsg_common *common)
 			if((common->gadget->speed != USB_SPEED_HIGH)&&(amount >0x8000))
 			    amount = 0x8000;
 
+			/* Get the next buffer */
+			usb_offset += amount;
+			common->usb_amount_left -= amount;
+			amount_left_to_req -= amount;
+			if (amount_left_to_req == 0)
+				get_some_more = 0;
+
 			/*
 			 * amount is always divisible by 512, hence by
 			 * the bulk-out maxpacket size
@@ -1038,36 +1250,65 @@ static int do_write(struct fsg_common *common)
 		if (bh->state == BUF_STATE_EMPTY && !get_some_more)
 			break;			/* We stopped early */
 		if (bh->state == BUF_STATE_FULL) {
-			smp_rmb();
-			common->next_buffhd_to_drain = bh->next;
-			bh->state = BUF_STATE_EMPTY;
-
-			/* Did something go wrong with the transfer? */
-			if (bh->outreq->status != 0) {
-				curlun->sense_data = SS_COMMUNICATION_FAILURE;
-				curlun->sense_data_info = file_offset >> 9;
-				curlun->info_valid = 1;
-				break;
-			}
+			struct iovec	iov[FSG_MAX_NUM_BUFFERS];
+			int		nr_iov = 0;
+			int		failed = 0, short_packet = 0;
+			loff_t		end_offset = file_offset;
 
-			amount = bh->outreq->actual;
-			if (curlun->file_length - file_offset < amount) {
-				LERROR(curlun,
-				       "write %u @ %llu beyond end %llu\n",
-				       amount, (unsigned long long)file_offset,
-				       (unsigned long long)curlun->file_length);
-				amount = curlun->file_length - file_offset;
-			}
+			/*
+			 * Take every buffer that has already arrived and
+			 * write them to the backing file in one go.
+			 */
+			amount = 0;
+			do {
+				unsigned int	len;
+
+				smp_rmb();
+				common->next_buffhd_to_drain = bh->next;
+				bh->state = BUF_STATE_EMPTY;
+
+				/* Did something go wrong with the transfer? */
+				if (bh->outreq->status != 0) {
+					failed = 1;
+					break;
+				}
+
+				len = bh->outreq->actual;
+				if (curlun->file_length - end_offset < len) {
+					LERROR(curlun,
+					       "write %u @ %llu beyond end %llu\n",
+					       len, (unsigned long long)end_offset,
+					       (unsigned long long)curlun->file_length);
+					len = curlun->file_length - end_offset;
+				}
+				iov[nr_iov].iov_base = (void __user *)bh->buf;
+				iov[nr_iov].iov_len = len;
+				nr_iov++;
+				amount += len;
+				end_offset += len;
+
+				/* Did the host decide to stop early? */
+				if (bh->outreq->actual != bh->outreq->length) {
+					short_packet = 1;
+					break;
+				}
+				bh = bh->next;
+			} while (bh->state == BUF_STATE_FULL);
 
 			/* Perform the write */
-			file_offset_tmp = file_offset;
-			nwritten = vfs_write(curlun->filp,
-					     (char __user *)bh->buf,
-					     amount, &file_offset_tmp);
-			VLDBG(curlun, "file write %u @ %llu -> %d\n", amount,
-			      (unsigned long long)file_offset, (int)nwritten);
-			if (signal_pending(current))
-				return -EINTR;		/* Interrupted! */
+			nwritten = 0;
+			if (nr_iov) {
+				file_offset_tmp = file_offset;
+				nwritten = vfs_writev(curlun->filp,
+						(const struct iovec __user *)iov,
+						nr_iov, &file_offset_tmp);
+				VLDBG(curlun, "file write %u/%d @ %llu -> %d\n",
+				      amount, nr_iov,
+				      (unsigned long long)file_offset,
+				      (int)nwritten);
+				if (signal_pending(current))
+					return -EINTR;		/* Interrupted! */
+			}
 
 			if (nwritten < 0) {
 				LDBG(curlun, "error in file write: %d\n",
@@ -1084,13 +1325,8 @@ static int do_write(struct fsg_common *common)
 			common->residue -= nwritten;
 
 #ifdef MAX_UNFLUSHED_PACKETS
-			curlun->unflushed_packet ++;
-			curlun->unflushed_bytes += nwritten;
-			if( (curlun->unflushed_packet >= MAX_UNFLUSHED_PACKETS) || (curlun->unflushed_bytes >= MAX_UNFLUSHED_BYTES)) {
-				fsg_lun_fsync_sub(curlun);
-				curlun->unflushed_packet = 0;
-				curlun->unflushed_bytes = 0;
-			}
+			if (nwritten)
+				fsg_note_write(common, curlun, nr_iov, nwritten);
 #endif
 			/* If an error occurred, report it and its position */
 			if (nwritten < amount) {
@@ -1099,9 +1335,13 @@ static int do_write(struct fsg_common *common)
 				curlun->info_valid = 1;
 				break;
 			}
-
-			/* Did the host decide to stop early? */
-			if (bh->outreq->actual != bh->outreq->length) {
+			if (failed) {
+				curlun->sense_data = SS_COMMUNICATION_FAILURE;
+				curlun->sense_data_info = file_offset >> 9;
+				curlun->info_valid = 1;
+				break;
+			}
+			if (short_packet) {
 				common->short_packet_received = 1;
 				break;
 			}
@@ -1203,7 +1443,7 @@ static int do_verify(struct fsg_common *common)
 		 * If this means reading 0 then we were asked to read
 		 * past the end of file.
 		 */
-		amount = min(amount_left, FSG_BUFLEN);
+		amount = min(amount_left, common->buflen);
 		amount = min((loff_t)amount,
 			     curlun->file_length - file_offset);
 		if (amount == 0) {
@@ -1432,7 +1672,7 @@ static int do_mode_sense(struct fsg_common *common, struct fsg_buffhd *bh)
 	} else {			/* MODE_SENSE_10 */
 		buf[3] = (curlun->ro ? 0x80 : 0x00);		/* WP, DPOFUA */
 		buf += 8;
-		limit = 65535;		/* Should really be FSG_BUFLEN */
+		limit = 65535;		/* Should really be common->buflen */
 	}
 
 	/* No block descriptors */
@@ -1672,7 +1912,10 @@ static int throw_away_data(struct fsg_common *common)
 		bh = common->next_buffhd_to_fill;
 		if (bh->state == BUF_STATE_EMPTY
 		 && common->usb_amount_left > 0) {
-			amount = min(common->usb_amount_left, FSG_BUFLEN);
+			amount = min(common->usb_amount_left, common->buflen);
+			if (common->gadget->speed != USB_SPEED_HIGH &&
+			    amount > 0x8000)
+				amount = 0x8000;
 
 			/*
 			 * amount is always divisible by 512, hence by
@@ -2572,6 +2815,56 @@ static int alloc_request(struct fsg_common *common, struct usb_ep *ep,
 	return -ENOMEM;
 }
 
+/*
+ * Make the buffer ring match fsg_num_buffers and fsg_buflen.  The ring
+ * must be idle: this runs from fsg_common_init() and from the main
+ * thread while no requests are allocated.  On failure the current ring,
+ * if any, is kept.
+ */
+static int fsg_alloc_buffhds(struct fsg_common *common)
+{
+	unsigned int num = clamp(fsg_num_buffers, 2U,
+				 (unsigned)FSG_MAX_NUM_BUFFERS);
+	/* whole blocks, and dwc_otg's 10 bit packet count at high speed */
+	unsigned int len = clamp(fsg_buflen, FSG_BUFLEN, 512U * 1023) & ~511;
+	struct fsg_buffhd *buffhds, *old = common->buffhds;
+	unsigned int old_num = common->fsg_num_buffers, i;
+
+	if (old && num == old_num && len == common->buflen)
+		return 0;
+
+	buffhds = kcalloc(num, sizeof *buffhds, GFP_KERNEL);
+	if (unlikely(!buffhds))
+		return -ENOMEM;
+	for (i = 0; i < num; ++i) {
+		buffhds[i].next = &buffhds[(i + 1) % num];
+		buffhds[i].buf = kmalloc(len, GFP_KERNEL);
+		if (unlikely(!buffhds[i].buf))
+			goto error;
+	}
+
+	spin_lock_irq(&common->lock);
+	common->buffhds = buffhds;
+	common->fsg_num_buffers = num;
+	common->buflen = len;
+	common->next_buffhd_to_fill = buffhds;
+	common->next_buffhd_to_drain = buffhds;
+	spin_unlock_irq(&common->lock);
+
+	if (old) {
+		for (i = 0; i < old_num; ++i)
+			kfree(old[i].buf);
+		kfree(old);
+	}
+	return 0;
+
+error:
+	while (i--)
+		kfree(buffhds[i].buf);
+	kfree(buffhds);
+	return -ENOMEM;
+}
+
 /* Reset interface setting and re-init endpoint state (toggle etc). */
 static int do_set_interface(struct fsg_common *common, struct fsg_dev *new_fsg)
 {
@@ -2587,7 +2880,7 @@ reset:
 	if (common->fsg) {
 		fsg = common->fsg;
 
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < common->fsg_num_buffers; ++i) {
 			struct fsg_buffhd *bh = &common->buffhds[i];
 
 			if (bh->inreq) {
@@ -2618,6 +2911,11 @@ reset:
 	if (!new_fsg || rc)
 		return rc;
 
+	/* No requests reference the ring now, apply new buffer parameters */
+	if (fsg_alloc_buffhds(common))
+		WARNING(common, "can't resize buffers, keeping %u x %u bytes\n",
+			common->fsg_num_buffers, common->buflen);
+
 	common->fsg = new_fsg;
 	fsg = common->fsg;
 
@@ -2639,7 +2937,7 @@ reset:
 	clear_bit(IGNORE_BULK_OUT, &fsg->atomic_bitflags);
 
 	/* Allocate the requests */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < common->fsg_num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &common->buffhds[i];
 
 		rc = alloc_request(common, fsg->bulk_in, &bh->inreq);
@@ -2710,7 +3008,7 @@ static void handle_exception(struct fsg_common *common)
 
 	/* Cancel all the pending transfers */
 	if (likely(common->fsg)) {
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < common->fsg_num_buffers; ++i) {
 			bh = &common->buffhds[i];
 			if (bh->inreq_busy)
 				usb_ep_dequeue(common->fsg->bulk_in, bh->inreq);
@@ -2722,7 +3020,7 @@ static void handle_exception(struct fsg_common *common)
 		/* Wait until everything is idle */
 		for (;;) {
 			int num_active = 0;
-			for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+			for (i = 0; i < common->fsg_num_buffers; ++i) {
 				bh = &common->buffhds[i];
 				num_active += bh->inreq_busy + bh->outreq_busy;
 			}
@@ -2745,7 +3043,7 @@ static void handle_exception(struct fsg_common *common)
 	 */
 	spin_lock_irq(&common->lock);
 
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < common->fsg_num_buffers; ++i) {
 		bh = &common->buffhds[i];
 		bh->state = BUF_STATE_EMPTY;
 	}
@@ -2948,7 +3246,6 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 					  struct fsg_config *cfg)
 {
 	struct usb_gadget *gadget = cdev->gadget;
-	struct fsg_buffhd *bh;
 	struct fsg_lun *curlun;
 	struct fsg_lun_config *lcfg;
 	int nluns, i, rc;
@@ -2975,6 +3272,16 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 	common->ops = cfg->ops;
 	common->private_data = cfg->private_data;
 
+	INIT_WORK(&common->prefetch_work, fsg_prefetch_work);
+#ifdef MAX_UNFLUSHED_PACKETS
+	INIT_DELAYED_WORK(&common->flush_work, fsg_flush_work);
+#endif
+	common->io_wq = create_singlethread_workqueue("file-storage-io");
+	if (!common->io_wq) {
+		rc = -ENOMEM;
+		goto error_release;
+	}
+
 	common->gadget = gadget;
 	common->ep0 = gadget->ep0;
 	common->ep0req = cdev->req;
@@ -3048,20 +3355,9 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 	common->nluns = nluns;
 
 	/* Data buffers cyclic list */
-	bh = common->buffhds;
-	i = FSG_NUM_BUFFERS;
-	goto buffhds_first_it;
-	do {
-		bh->next = bh + 1;
-		++bh;
-buffhds_first_it:
-		bh->buf = kmalloc(FSG_BUFLEN, GFP_KERNEL);
-		if (unlikely(!bh->buf)) {
-			rc = -ENOMEM;
-			goto error_release;
-		}
-	} while (--i);
-	bh->next = common->buffhds;
+	rc = fsg_alloc_buffhds(common);
+	if (unlikely(rc))
+		goto error_release;
 
 	/* Prepare inquiryString */
 	if (cfg->release != 0xffff) {
@@ -3157,6 +3453,17 @@ static void fsg_common_release(struct kref *ref)
 		wait_for_completion(&common->thread_notifier);
 	}
 
+	if (common->io_wq) {
+#ifdef MAX_UNFLUSHED_PACKETS
+		/* run a pending flush now rather than dropping it */
+		cancel_delayed_work_sync(&common->flush_work);
+		if (common->nluns)
+			fsg_flush_luns(common, true);
+#endif
+		cancel_work_sync(&common->prefetch_work);
+		destroy_workqueue(common->io_wq);
+	}
+
 	if (likely(common->luns)) {
 		struct fsg_lun *lun = common->luns;
 		unsigned i = common->nluns;
@@ -3173,12 +3480,13 @@ static void fsg_common_release(struct kref *ref)
 		kfree(common->luns);
 	}
 
-	{
+	if (common->buffhds) {
 		struct fsg_buffhd *bh = common->buffhds;
-		unsigned i = FSG_NUM_BUFFERS;
+		unsigned i = common->fsg_num_buffers;
 		do {
 			kfree(bh->buf);
 		} while (++bh, --i);
+		kfree(common->buffhds);
 	}
 
 	if (common->free_storage_on_release)
@@ -28,8 +28,13 @@
 
 #include <linux/types.h>
 #include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/backing-dev.h>
 #include <linux/device.h>
 #include <linux/miscdevice.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 
 #include <linux/usb.h>
 #include <linux/usb_usual.h>
@@ -49,11 +54,30 @@
 #define STATE_CANCELED              3   /* transaction canceled by host */
 #define STATE_ERROR                 4   /* error from completion routine */
 
-/* number of tx and rx requests to allocate */
-#define TX_REQ_MAX 4
-#define RX_REQ_MAX 2
+/* upper bounds on the number of tx and rx requests to allocate */
+#define MTP_TX_REQ_MAX 32
+#define MTP_RX_REQ_MAX 16
 #define INTR_REQ_MAX 5
 
+/*
+ * Bulk request rings, applied when the function is bound.  File
+ * transfers keep the whole ring in flight, so the file I/O for one
+ * request overlaps the USB transfer of the others.  If the large
+ * buffers cannot be allocated the old 16KB x 4 / 16KB x 2 rings are
+ * used instead.
+ */
+static unsigned int mtp_tx_req_len = 65536;
+module_param(mtp_tx_req_len, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int mtp_tx_reqs = 16;
+module_param(mtp_tx_reqs, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int mtp_rx_req_len = 65536;
+module_param(mtp_rx_req_len, uint, S_IRUGO | S_IWUSR);
+
+static unsigned int mtp_rx_reqs = 4;
+module_param(mtp_rx_reqs, uint, S_IRUGO | S_IWUSR);
+
 /* ID for Microsoft MTP OS String */
 #define MTP_OS_STRING_ID   0xEE
 
@@ -92,8 +116,16 @@ struct mtp_dev {
 	wait_queue_head_t read_wq;
 	wait_queue_head_t write_wq;
 	wait_queue_head_t intr_wq;
-	struct usb_request *rx_req[RX_REQ_MAX];
-	int rx_done;
+	struct usb_request *rx_req[MTP_RX_REQ_MAX];
+	int rx_done;		/* rx requests completed since reset to 0 */
+
+	/* ring geometry actually allocated */
+	unsigned tx_req_len;
+	unsigned tx_reqs;
+	unsigned rx_req_len;
+	unsigned rx_reqs;
+
+	struct mtp_stats stats;
 
 	/* for processing MTP_SEND_FILE, MTP_RECEIVE_FILE and
 	 * MTP_SEND_FILE_WITH_HEADER ioctls on a work queue
@@ -362,8 +394,10 @@ static void mtp_complete_out(struct usb_ep *ep, struct usb_request *req)
 {
 	struct mtp_dev *dev = _mtp_dev;
 
-	dev->rx_done = 1;
-	if (req->status != 0 && dev->state != STATE_CANCELED)
+	dev->rx_done++;
+	/* -ECONNRESET is a request we dequeued ourselves */
+	if (req->status != 0 && req->status != -ECONNRESET &&
+	    dev->state != STATE_CANCELED)
 		dev->state = STATE_ERROR;
 
 	wake_up(&dev->read_wq);
@@ -430,20 +464,46 @@ static int mtp_create_bulk_endpoints(struct mtp_dev *dev,
 	dev->ep_intr = ep;
 
 	/* now allocate requests for our endpoints */
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_in, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->tx_req_len = max(mtp_tx_req_len, (unsigned)MTP_BULK_BUFFER_SIZE);
+	dev->tx_reqs = clamp(mtp_tx_reqs, 2U, (unsigned)MTP_TX_REQ_MAX);
+	dev->rx_req_len = max(mtp_rx_req_len, (unsigned)MTP_BULK_BUFFER_SIZE);
+	dev->rx_reqs = clamp(mtp_rx_reqs, 2U, (unsigned)MTP_RX_REQ_MAX);
+
+retry_tx_alloc:
+	for (i = 0; i < dev->tx_reqs; i++) {
+		req = mtp_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len <= MTP_BULK_BUFFER_SIZE)
+				goto fail;
+			while ((req = mtp_req_get(dev, &dev->tx_idle)))
+				mtp_request_free(req, dev->ep_in);
+			dev->tx_req_len = MTP_BULK_BUFFER_SIZE;
+			dev->tx_reqs = 4;
+			goto retry_tx_alloc;
+		}
 		req->complete = mtp_complete_in;
 		mtp_req_put(dev, &dev->tx_idle, req);
 	}
-	for (i = 0; i < RX_REQ_MAX; i++) {
-		req = mtp_request_new(dev->ep_out, MTP_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+
+retry_rx_alloc:
+	for (i = 0; i < dev->rx_reqs; i++) {
+		req = mtp_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req) {
+			if (dev->rx_req_len <= MTP_BULK_BUFFER_SIZE)
+				goto fail;
+			while (i--)
+				mtp_request_free(dev->rx_req[i], dev->ep_out);
+			dev->rx_req_len = MTP_BULK_BUFFER_SIZE;
+			dev->rx_reqs = 2;
+			goto retry_rx_alloc;
+		}
 		req->complete = mtp_complete_out;
 		dev->rx_req[i] = req;
 	}
+	dev->stats.tx_req_len = dev->tx_req_len;
+	dev->stats.tx_reqs = dev->tx_reqs;
+	dev->stats.rx_req_len = dev->rx_req_len;
+	dev->stats.rx_reqs = dev->rx_reqs;
 	for (i = 0; i < INTR_REQ_MAX; i++) {
 		req = mtp_request_new(dev->ep_intr, INTR_BUFFER_SIZE);
 		if (!req)
@@ -470,8 +530,8 @@ static ssize_t mtp_read(struct file *fp, char __user *buf,
 
 	DBG(cdev, "mtp_read(%d)\n", count);
 
-	if (count > MTP_BULK_BUFFER_SIZE)
-        count = MTP_BULK_BUFFER_SIZE;
+	if (count > dev->rx_req_len)
+		count = dev->rx_req_len;
 
 	/* we will block until we're online */
 	DBG(cdev, "mtp_read: waiting for online state\n");
@@ -590,8 +650,8 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 		if (xfer && copy_from_user(req->buf, buf, xfer)) {
@@ -628,7 +688,51 @@ static ssize_t mtp_write(struct file *fp, const char __user *buf,
 	return r;
 }
 
-/* read from a local file and write to USB */
+/* number of tx requests currently idle */
+static unsigned mtp_tx_idle_count(struct mtp_dev *dev)
+{
+	struct usb_request *req;
+	unsigned long flags;
+	unsigned n = 0;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	list_for_each_entry(req, &dev->tx_idle, list)
+		n++;
+	spin_unlock_irqrestore(&dev->lock, flags);
+	return n;
+}
+
+/* fold one finished file transfer into the counters */
+static void mtp_stats_account(struct mtp_dev *dev, int tx, int64_t bytes,
+			      ktime_t start)
+{
+	struct mtp_stats *st = &dev->stats;
+	u64 us = ktime_us_delta(ktime_get(), start);
+	u32 kbps = 0;
+
+	if (us)
+		kbps = div64_u64((u64)bytes * 1000, us);
+
+	if (tx) {
+		st->tx_files++;
+		st->tx_bytes += bytes;
+		st->tx_usecs += us;
+		st->tx_last_kbps = kbps;
+	} else {
+		st->rx_files++;
+		st->rx_bytes += bytes;
+		st->rx_usecs += us;
+		st->rx_last_kbps = kbps;
+	}
+}
+
+/*
+ * read from a local file and write to USB
+ *
+ * Requests are filled with vfs_read and queued as soon as one is idle,
+ * so with a deep ring the page cache reads run while earlier requests
+ * are still on the bus.
+ */
 static void send_file_work(struct work_struct *data) {
 	struct mtp_dev	*dev = container_of(data, struct mtp_dev, send_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
@@ -636,10 +740,11 @@ static void send_file_work(struct work_struct *data) {
 	struct mtp_data_header *header;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
+	int64_t count, sent = 0;
 	int xfer, ret, hdr_size;
 	int r = 0;
 	int sendZLP = 0;
+	ktime_t start;
 
 	/* read our parameters */
 	smp_rmb();
@@ -649,6 +754,16 @@ static void send_file_work(struct work_struct *data) {
 
 	DBG(cdev, "send_file_work(%lld %lld)\n", offset, count);
 
+	/* as POSIX_FADV_SEQUENTIAL: read ahead far enough to keep the ring full */
+	if (filp->f_mapping && filp->f_mapping->backing_dev_info) {
+		unsigned long ra = filp->f_mapping->backing_dev_info->ra_pages * 2;
+
+		spin_lock(&filp->f_lock);
+		if (filp->f_ra.ra_pages < ra)
+			filp->f_ra.ra_pages = ra;
+		spin_unlock(&filp->f_lock);
+	}
+
 	if (dev->xfer_send_header) {
 		hdr_size = sizeof(struct mtp_data_header);
 		count += hdr_size;
@@ -663,16 +778,21 @@ static void send_file_work(struct work_struct *data) {
 		sendZLP = 1;
 	}
 
+	start = ktime_get();
 	while (count > 0 || sendZLP) {
 		/* so we exit after sending ZLP */
 		if (count == 0)
 			sendZLP = 0;
 
 		/* get an idle tx request to use */
-		req = 0;
-		ret = wait_event_interruptible(dev->write_wq,
-			(req = mtp_req_get(dev, &dev->tx_idle))
-			|| dev->state != STATE_BUSY);
+		req = mtp_req_get(dev, &dev->tx_idle);
+		if (!req) {
+			/* the whole ring is on the bus: USB bound */
+			dev->stats.tx_stalls++;
+			ret = wait_event_interruptible(dev->write_wq,
+				(req = mtp_req_get(dev, &dev->tx_idle))
+				|| dev->state != STATE_BUSY);
+		}
 		if (dev->state == STATE_CANCELED) {
 			r = -ECANCELED;
 			break;
@@ -682,8 +802,8 @@ static void send_file_work(struct work_struct *data) {
 			break;
 		}
 
-		if (count > MTP_BULK_BUFFER_SIZE)
-			xfer = MTP_BULK_BUFFER_SIZE;
+		if (count > dev->tx_req_len)
+			xfer = dev->tx_req_len;
 		else
 			xfer = count;
 
@@ -714,6 +834,7 @@ static void send_file_work(struct work_struct *data) {
 		}
 
 		count -= xfer;
+		sent += xfer;
 
 		/* zero this so we don't try to free it on error exit */
 		req = 0;
@@ -722,23 +843,39 @@ static void send_file_work(struct work_struct *data) {
 	if (req)
 		mtp_req_put(dev, &dev->tx_idle, req);
 
+	if (!r) {
+		/* let the ring drain so the rate covers the whole transfer */
+		wait_event_interruptible(dev->write_wq,
+			mtp_tx_idle_count(dev) == dev->tx_reqs
+			|| dev->state != STATE_BUSY);
+		mtp_stats_account(dev, 1, sent, start);
+	}
+
 	DBG(cdev, "send_file_work returning %d\n", r);
 	/* write the result */
 	dev->xfer_result = r;
 	smp_wmb();
 }
 
-/* read from USB and write to a local file */
+/*
+ * read from USB and write to a local file
+ *
+ * Up to rx_reqs requests are kept queued on the OUT endpoint.  They
+ * complete in order, and each is written to the file while the ones
+ * behind it are still receiving.  The host ends the data phase with a
+ * short packet, after which requests still queued are taken back.
+ */
 static void receive_file_work(struct work_struct *data)
 {
 	struct mtp_dev	*dev = container_of(data, struct mtp_dev, receive_file_work);
 	struct usb_composite_dev *cdev = dev->cdev;
-	struct usb_request *read_req = NULL, *write_req = NULL;
+	struct usb_request *req;
 	struct file *filp;
 	loff_t offset;
-	int64_t count;
-	int ret, cur_buf = 0;
+	int64_t count, to_queue, received = 0;
+	int ret, queued = 0, done = 0, i;
 	int r = 0;
+	ktime_t start;
 
 	/* read our parameters */
 	smp_rmb();
@@ -748,62 +885,77 @@ static void receive_file_work(struct work_struct *data)
 
 	DBG(cdev, "receive_file_work(%lld)\n", count);
 
-	while (count > 0 || write_req) {
-		if (count > 0) {
-			/* queue a request */
-			read_req = dev->rx_req[cur_buf];
-			cur_buf = (cur_buf + 1) % RX_REQ_MAX;
+	/* if xfer_file_length is 0xFFFFFFFF, then we read until
+	 * we get a zero length packet
+	 */
+	to_queue = count;
+	dev->rx_done = 0;
+	smp_wmb();
 
-			read_req->length = (count > MTP_BULK_BUFFER_SIZE
-					? MTP_BULK_BUFFER_SIZE : count);
-			dev->rx_done = 0;
-			ret = usb_ep_queue(dev->ep_out, read_req, GFP_KERNEL);
+	start = ktime_get();
+	while (1) {
+		/* keep the ring queued */
+		while (queued - done < dev->rx_reqs && to_queue > 0) {
+			req = dev->rx_req[queued % dev->rx_reqs];
+			req->length = (to_queue > dev->rx_req_len
+					? dev->rx_req_len : to_queue);
+			ret = usb_ep_queue(dev->ep_out, req, GFP_KERNEL);
 			if (ret < 0) {
 				r = -EIO;
 				dev->state = STATE_ERROR;
 				break;
 			}
+			queued++;
+			if (count != 0xFFFFFFFF)
+				to_queue -= req->length;
 		}
+		if (r || done == queued)
+			break;
 
-		if (write_req) {
-			DBG(cdev, "rx %p %d\n", write_req, write_req->actual);
-			ret = vfs_write(filp, write_req->buf, write_req->actual,
-				&offset);
-			DBG(cdev, "vfs_write %d\n", ret);
-			if (ret != write_req->actual) {
-				r = -EIO;
-				dev->state = STATE_ERROR;
-				break;
-			}
-			write_req = NULL;
+		/* wait for the oldest request */
+		req = dev->rx_req[done % dev->rx_reqs];
+		if (dev->rx_done == done)
+			dev->stats.rx_stalls++;
+		ret = wait_event_interruptible(dev->read_wq,
+			dev->rx_done > done || dev->state != STATE_BUSY);
+		if (dev->state == STATE_CANCELED) {
+			r = -ECANCELED;
+			break;
 		}
+		if (dev->state != STATE_BUSY || ret < 0) {
+			r = -EIO;
+			break;
+		}
+		done++;
 
-		if (read_req) {
-			/* wait for our last read to complete */
-			ret = wait_event_interruptible(dev->read_wq,
-				dev->rx_done || dev->state != STATE_BUSY);
-			if (dev->state == STATE_CANCELED) {
-				r = -ECANCELED;
-				if (!dev->rx_done)
-					usb_ep_dequeue(dev->ep_out, read_req);
-				break;
-			}
-			/* if xfer_file_length is 0xFFFFFFFF, then we read until
-			 * we get a zero length packet
-			 */
-			if (count != 0xFFFFFFFF)
-				count -= read_req->actual;
-			if (read_req->actual < read_req->length) {
-				/* short packet is used to signal EOF for sizes > 4 gig */
-				DBG(cdev, "got short packet\n");
-				count = 0;
-			}
+		DBG(cdev, "rx %p %d\n", req, req->actual);
+		ret = vfs_write(filp, req->buf, req->actual, &offset);
+		DBG(cdev, "vfs_write %d\n", ret);
+		if (ret != req->actual) {
+			r = -EIO;
+			dev->state = STATE_ERROR;
+			break;
+		}
+		received += req->actual;
 
-			write_req = read_req;
-			read_req = NULL;
+		if (req->actual < req->length) {
+			/* short packet is used to signal EOF for sizes > 4 gig */
+			DBG(cdev, "got short packet\n");
+			break;
 		}
 	}
 
+	/* take back anything still queued */
+	if (done != queued) {
+		for (i = done; i < queued; i++)
+			usb_ep_dequeue(dev->ep_out,
+				       dev->rx_req[i % dev->rx_reqs]);
+		wait_event_timeout(dev->read_wq, dev->rx_done >= queued, HZ);
+	}
+
+	if (!r)
+		mtp_stats_account(dev, 0, received, start);
+
 	DBG(cdev, "receive_file_work returning %d\n", r);
 	/* write the result */
 	dev->xfer_result = r;
@@ -848,6 +1000,12 @@ static long mtp_ioctl(struct file *fp, unsigned code, unsigned long value)
 
 
 	switch (code) {
+	case MTP_GET_STATS:
+		/* no lock: meant to be read while a transfer is running */
+		if (copy_to_user((void __user *)value, &dev->stats,
+				 sizeof(dev->stats)))
+			return -EFAULT;
+		return 0;
 	case MTP_SEND_FILE:
 	case MTP_RECEIVE_FILE:
     case MTP_SEND_FILE_WITH_HEADER:
@@ -1126,8 +1284,10 @@ mtp_function_unbind(struct usb_configuration *c, struct usb_function *f)
 
 	while ((req = mtp_req_get(dev, &dev->tx_idle)))
 		mtp_request_free(req, dev->ep_in);
-	for (i = 0; i < RX_REQ_MAX; i++)
+	for (i = 0; i < dev->rx_reqs; i++) {
 		mtp_request_free(dev->rx_req[i], dev->ep_out);
+		dev->rx_req[i] = NULL;
+	}
 	while ((req = mtp_req_get(dev, &dev->intr_idle)))
 		mtp_request_free(req, dev->ep_intr);
 	dev->state = STATE_OFFLINE;
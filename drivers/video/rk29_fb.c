@@ -34,6 +34,9 @@
 #include <linux/earlysuspend.h>
 #include <linux/cpufreq.h>
 #include <linux/wakelock.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
 
 #include <asm/io.h>
 #include <asm/div64.h>
@@ -288,6 +291,154 @@ static DECLARE_WAIT_QUEUE_HEAD(wq);
 static int wq_condition = 0;
 static int wq_condition2 = 0;
 static int fb1_open_init = 0;
+
+/*
+ * Frame-start event stream for /dev/rk29fb_event.  Every opener gets
+ * its own ring; the irq posts a VSYNC record per frame and a FLIP record
+ * once the buffer armed by FB0_IOCTL_FLIP_ASYNC has been latched.  When
+ * a reader falls behind the oldest records are dropped.
+ */
+#define FB_EVENT_RING	32
+struct fb_event_client {
+    struct list_head node;
+    wait_queue_head_t wait;
+    unsigned int head, tail;
+    struct rk29fb_event ring[FB_EVENT_RING];
+};
+static DEFINE_SPINLOCK(fb_event_lock);
+static LIST_HEAD(fb_event_clients);
+static u32 fb_vblank_count;
+static u32 fb_flip_seq;             /* last seq handed out */
+static u32 fb_flip_pending;         /* seq to report at the next frame start */
+static int fb_frame_posted;         /* fb0 panned since the last frame start */
+
+static void fb_event_post(u32 type, u32 seq, u64 ts)
+{
+    struct fb_event_client *c;
+    struct rk29fb_event *ev;
+
+    list_for_each_entry(c, &fb_event_clients, node) {
+        ev = &c->ring[c->head++ % FB_EVENT_RING];
+        ev->type = type;
+        ev->seq = seq;
+        ev->vblank = fb_vblank_count;
+        ev->reserved = 0;
+        ev->timestamp = ts;
+        if (c->head - c->tail > FB_EVENT_RING)
+            c->tail = c->head - FB_EVENT_RING;
+        wake_up_interruptible(&c->wait);
+    }
+}
+
+/* called from the frame start irq */
+static void fb_event_vblank(void)
+{
+    u64 ts = ktime_to_ns(ktime_get());
+
+    spin_lock(&fb_event_lock);
+    fb_vblank_count++;
+    if (fb_flip_pending) {
+        fb_event_post(RK29FB_EVENT_FLIP, fb_flip_pending, ts);
+        fb_flip_pending = 0;
+    }
+    fb_event_post(RK29FB_EVENT_VSYNC, 0, ts);
+    spin_unlock(&fb_event_lock);
+
+    /* lets the interactive governor see frames that miss their vsync */
+    cpufreq_notify_frame(fb_frame_posted);
+    fb_frame_posted = 0;
+}
+
+/* the registers for flip seq have been written, report it next frame */
+static void fb_flip_arm(u32 seq)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&fb_event_lock, flags);
+    fb_flip_pending = seq;
+    spin_unlock_irqrestore(&fb_event_lock, flags);
+}
+
+static int fb_event_open(struct inode *inode, struct file *file)
+{
+    struct fb_event_client *c;
+    unsigned long flags;
+
+    c = kzalloc(sizeof(*c), GFP_KERNEL);
+    if (!c)
+        return -ENOMEM;
+    init_waitqueue_head(&c->wait);
+
+    spin_lock_irqsave(&fb_event_lock, flags);
+    list_add_tail(&c->node, &fb_event_clients);
+    spin_unlock_irqrestore(&fb_event_lock, flags);
+
+    file->private_data = c;
+    return nonseekable_open(inode, file);
+}
+
+static int fb_event_release(struct inode *inode, struct file *file)
+{
+    struct fb_event_client *c = file->private_data;
+    unsigned long flags;
+
+    spin_lock_irqsave(&fb_event_lock, flags);
+    list_del(&c->node);
+    spin_unlock_irqrestore(&fb_event_lock, flags);
+
+    kfree(c);
+    return 0;
+}
+
+static ssize_t fb_event_read(struct file *file, char __user *buf,
+                             size_t count, loff_t *ppos)
+{
+    struct fb_event_client *c = file->private_data;
+    struct rk29fb_event ev[8];
+    unsigned long flags;
+    int n = 0, ret;
+
+    if (count < sizeof(ev[0]))
+        return -EINVAL;
+    if (c->head == c->tail && (file->f_flags & O_NONBLOCK))
+        return -EAGAIN;
+    ret = wait_event_interruptible(c->wait, c->head != c->tail);
+    if (ret)
+        return ret;
+
+    spin_lock_irqsave(&fb_event_lock, flags);
+    while (c->tail != c->head && n < ARRAY_SIZE(ev) &&
+           (n + 1) * sizeof(ev[0]) <= count)
+        ev[n++] = c->ring[c->tail++ % FB_EVENT_RING];
+    spin_unlock_irqrestore(&fb_event_lock, flags);
+
+    if (copy_to_user(buf, ev, n * sizeof(ev[0])))
+        return -EFAULT;
+    return n * sizeof(ev[0]);
+}
+
+static unsigned int fb_event_poll(struct file *file, poll_table *wait)
+{
+    struct fb_event_client *c = file->private_data;
+
+    poll_wait(file, &c->wait, wait);
+    return c->head != c->tail ? POLLIN | POLLRDNORM : 0;
+}
+
+static const struct file_operations fb_event_fops = {
+    .owner   = THIS_MODULE,
+    .open    = fb_event_open,
+    .release = fb_event_release,
+    .read    = fb_event_read,
+    .poll    = fb_event_poll,
+    .llseek  = no_llseek,
+};
+
+static struct miscdevice fb_event_misc = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name  = "rk29fb_event",
+    .fops  = &fb_event_fops,
+};
 #if ANDROID_USE_THREE_BUFS
 static int new_frame_seted = 1;
 #endif
@@ -1613,6 +1764,7 @@ static int fb0_set_par(struct fb_info *info)
             ipp_req.timeout = 100;
             ipp_req.flag = IPP_ROT_0;
             //ipp_do_blit(&ipp_req);
+            ipp_queue_flush();  /* don't let a queued pan land after this */
             ipp_blit_sync(&ipp_req);
         }else
         #endif
@@ -1640,7 +1792,56 @@ static int fb0_set_par(struct fb_info *info)
     return 0;
 }
 
-static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
+#ifdef CONFIG_FB_SCALING_OSD
+/*
+ * HDMI OSD scaling blits queued by fb0_pan_display.  Two slots, so a
+ * pan only waits when the blit from two pans ago is still running; the
+ * new buffer is shown from the completion, once it has been scaled.
+ */
+struct fb0_scale_job {
+    struct rk29_ipp_job job;
+    struct rk29_ipp_req req;
+    struct fb_info *info;
+    u32 y_offset;
+    u32 seq;
+    int queued;
+};
+static struct fb0_scale_job fb0_scale_jobs[2];
+static int fb0_scale_next;
+
+static void fb0_scale_done(struct rk29_ipp_job *job, int ret)
+{
+    struct fb0_scale_job *sj = container_of(job, struct fb0_scale_job, job);
+    struct rk29fb_inf *inf = dev_get_drvdata(sj->info->device);
+    struct win0_par *par = sj->info->par;
+
+    if(ret || inf->in_suspend)
+        return;
+    par->y_offset = sj->y_offset;
+    win1_pan(sj->info);
+    if(sj->seq)
+        fb_flip_arm(sj->seq);
+}
+
+static struct fb0_scale_job *fb0_scale_get(void)
+{
+    struct fb0_scale_job *sj = &fb0_scale_jobs[fb0_scale_next];
+
+    fb0_scale_next = !fb0_scale_next;
+    if(sj->queued) {
+        ipp_job_wait(&sj->job);
+        sj->queued = 0;
+    }
+    memset(&sj->req, 0, sizeof(sj->req));
+    return sj;
+}
+#endif
+
+/*
+ * Show the buffer at var's offsets.  seq != 0 is an FB0_IOCTL_FLIP_ASYNC
+ * flip: it is armed for the next frame start instead of waited for.
+ */
+static int fb0_do_pan(struct fb_var_screeninfo *var, struct fb_info *info, u32 seq)
 {
 
     struct rk29fb_inf *inf = dev_get_drvdata(info->device);
@@ -1653,13 +1854,14 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
     u16 xpos_virtual = var->xoffset;
    #ifdef CONFIG_FB_SCALING_OSD
     struct fb_fix_screeninfo *fix = &info->fix;
-    struct rk29_ipp_req ipp_req;
-    u32 dstoffset = 0;
-	memset(&ipp_req, 0, sizeof(struct rk29_ipp_req));
+    struct fb0_scale_job *sj;
+    struct rk29_ipp_req *ipp_req;
+    u32 dstoffset = 0, ipp_fmt;
    #endif
 	//fbprintk(">>>>>> %s : %s \n", __FILE__, __FUNCTION__);
 
 	CHK_SUSPEND(inf);
+    fb_frame_posted = 1;
 
     if(inf->fb0_color_deepth)var->bits_per_pixel=inf->fb0_color_deepth;
     #if !defined(CONFIG_FB_SCALING_OSD)
@@ -1672,8 +1874,7 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
         var->xoffset = (var->xoffset) & (~0x1);
         #ifdef CONFIG_FB_SCALING_OSD
         dstoffset = ((ypos_virtual*screen->y_res/var->yres) *screen->x_res + (xpos_virtual*screen->x_res)/var->xres) * 2;
-        ipp_req.src0.fmt = IPP_RGB_565;
-        ipp_req.dst0.fmt = IPP_RGB_565;
+        ipp_fmt = IPP_RGB_565;
         #endif
         offset = (ypos_virtual*var1->xres_virtual + xpos_virtual)*(inf->fb0_color_deepth ? 4:2);
         if(ypos_virtual == 3*var->yres && inf->fb0_color_deepth)
@@ -1682,8 +1883,7 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
     case 32:    // rgb888
         #ifdef CONFIG_FB_SCALING_OSD
         dstoffset = ((ypos_virtual*screen->y_res/var->yres) *screen->x_res + (xpos_virtual*screen->x_res)/var->xres )*4;
-        ipp_req.src0.fmt = IPP_XRGB_8888;
-        ipp_req.dst0.fmt = IPP_XRGB_8888;
+        ipp_fmt = IPP_XRGB_8888;
         #endif
         offset = (ypos_virtual*var1->xres_virtual + xpos_virtual)*4;
         if(ypos_virtual >= 2*var->yres)
@@ -1691,8 +1891,7 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
             par->format = 1;
             #ifdef CONFIG_FB_SCALING_OSD
            	dstoffset = (((ypos_virtual-2*var->yres)*screen->y_res/var->yres) *screen->x_res + (xpos_virtual*screen->x_res)/var->xres )*4;
-            ipp_req.src0.fmt = IPP_RGB_565;
-            ipp_req.dst0.fmt = IPP_RGB_565;
+            ipp_fmt = IPP_RGB_565;
             #endif
             if(ypos_virtual == 3*var->yres)
             {            
@@ -1713,23 +1912,31 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
 		#endif
 		)
         {
-            par->y_offset = dstoffset;
-
-            ipp_req.src0.YrgbMst = fix->smem_start + offset;
-            ipp_req.src0.w = var->xres;
-            ipp_req.src0.h = var->yres;
-
-            ipp_req.dst0.YrgbMst = fix->mmio_start + dstoffset* hdmi_get_fbscale()/100;
-            ipp_req.dst0.w = screen->x_res* hdmi_get_fbscale()/100;
-            ipp_req.dst0.h = screen->y_res* hdmi_get_fbscale()/100;
-
-            ipp_req.src_vir_w = ipp_req.src0.w;
-            ipp_req.dst_vir_w = ipp_req.dst0.w;
-            ipp_req.timeout = 100;
-            ipp_req.flag = IPP_ROT_0;
-            //ipp_do_blit(&ipp_req);
-            ipp_blit_sync(&ipp_req);
-            win1_pan(info);
+            /* only now take a slot: it is queued before returning */
+            sj = fb0_scale_get();
+            ipp_req = &sj->req;
+            ipp_req->src0.fmt = ipp_fmt;
+            ipp_req->dst0.fmt = ipp_fmt;
+            ipp_req->src0.YrgbMst = fix->smem_start + offset;
+            ipp_req->src0.w = var->xres;
+            ipp_req->src0.h = var->yres;
+
+            ipp_req->dst0.YrgbMst = fix->mmio_start + dstoffset* hdmi_get_fbscale()/100;
+            ipp_req->dst0.w = screen->x_res* hdmi_get_fbscale()/100;
+            ipp_req->dst0.h = screen->y_res* hdmi_get_fbscale()/100;
+
+            ipp_req->src_vir_w = ipp_req->src0.w;
+            ipp_req->dst_vir_w = ipp_req->dst0.w;
+            ipp_req->timeout = 100;
+            ipp_req->flag = IPP_ROT_0;
+
+            sj->info = info;
+            sj->y_offset = dstoffset;
+            sj->seq = seq;
+            sj->job.reqs = ipp_req;
+            sj->job.nr_reqs = 1;
+            sj->job.complete = fb0_scale_done;
+            sj->queued = !ipp_queue_job(&sj->job);
             return 0;
         }else
         #endif
@@ -1740,6 +1947,10 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
     {
         par->y_offset = offset;
         win0_pan(info);
+    }
+    if(seq) {
+        fb_flip_arm(seq);
+        return 0;
     }
         // flush end when wq_condition=1 in mcu panel, but not in rgb panel
 #if !ANDROID_USE_THREE_BUFS
@@ -1755,6 +1966,41 @@ static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
     return 0;
 }
 
+static int fb0_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
+{
+    return fb0_do_pan(var, info, 0);
+}
+
+/* FB0_IOCTL_FLIP_ASYNC: queue a pan for the next frame and return */
+static int fb0_flip_async(struct fb_info *info, struct rk29fb_flip __user *argp)
+{
+    struct fb_var_screeninfo var = info->var;
+    struct rk29fb_flip flip;
+    int ret;
+
+    if(copy_from_user(&flip, argp, sizeof(flip)))
+        return -EFAULT;
+    if((flip.xoffset + var.xres > var.xres_virtual) ||
+       (flip.yoffset + var.yres > var.yres_virtual))
+        return -EINVAL;
+
+    var.xoffset = flip.xoffset;
+    var.yoffset = flip.yoffset;
+    if(++fb_flip_seq == 0)
+        fb_flip_seq = 1;
+    flip.seq = fb_flip_seq;
+
+    ret = fb0_do_pan(&var, info, flip.seq);
+    if(ret)
+        return ret;
+    info->var.xoffset = var.xoffset;
+    info->var.yoffset = var.yoffset;
+
+    if(copy_to_user(argp, &flip, sizeof(flip)))
+        return -EFAULT;
+    return 0;
+}
+
 #ifdef	FB_WIMO_FLAG
 unsigned long temp_vv;
 static int frame_num = 0;
@@ -1948,6 +2194,8 @@ static int fb0_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
             inf->mcu_usetimer = 0;
         }
         break;
+    case FB0_IOCTL_FLIP_ASYNC:
+        return fb0_flip_async(info, (struct rk29fb_flip __user *)arg);
    case FBIOPUT_16OR32:
 
         inf->fb0_color_deepth = arg;
@@ -3040,6 +3288,7 @@ static irqreturn_t rk29fb_irq(int irq, void *dev_id)
     wq_condition2 = 1;
 	wq_condition = 1;
  	wake_up_interruptible(&wq);
+    fb_event_vblank();
 
 	rk29fb_irq_notify_ddr();
 	return IRQ_HANDLED;
@@ -3067,6 +3316,9 @@ static void rk29fb_early_suspend(struct early_suspend *h)
         return;
     }
 
+#ifdef CONFIG_FB_SCALING_OSD
+    ipp_queue_flush();
+#endif
 #ifdef CONFIG_CLOSE_WIN1_DYNAMIC   
      cancel_delayed_work_sync(&rk29_win1_check_work);
 #endif  
@@ -3487,6 +3739,9 @@ static int __devinit rk29fb_probe (struct platform_device *pdev)
         }
     }
 
+    if(misc_register(&fb_event_misc))
+        printk(">> rk29fb_event misc_register err\n");
+
 #if !defined(CONFIG_FRAMEBUFFER_CONSOLE) && defined(CONFIG_LOGO)
     fb0_set_par(inf->fb0);
     if (fb_prepare_logo(inf->fb0, FB_ROTATE_UR)) {
@@ -3542,6 +3797,7 @@ static int __devexit rk29fb_remove(struct platform_device *pdev)
         return -EINVAL;
     }
     device_remove_file(inf->fb1->dev, &dev_attr_dsp_win0_info);
+    misc_deregister(&fb_event_misc);
 
     irq = platform_get_irq(pdev, 0);
     if (irq >0)
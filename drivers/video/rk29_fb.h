@@ -370,6 +370,28 @@
 
 #define FB0_IOCTL_STOP_TIMER_FLUSH		0x6001
 #define FB0_IOCTL_SET_PANEL				0x6002
+#define FB0_IOCTL_FLIP_ASYNC			0x6003
+
+/* FB0_IOCTL_FLIP_ASYNC: show (xoffset, yoffset) from the next frame on,
+ * without waiting for it.  seq is returned and later reported by an
+ * RK29FB_EVENT_FLIP event; a flip is done once an event with seq at
+ * least as new has been read. */
+struct rk29fb_flip {
+	__u32 xoffset;
+	__u32 yoffset;
+	__u32 seq;
+};
+
+/* records read() from /dev/rk29fb_event, which is also pollable */
+#define RK29FB_EVENT_VSYNC		1
+#define RK29FB_EVENT_FLIP		2
+struct rk29fb_event {
+	__u32 type;
+	__u32 seq;			/* flip seq, RK29FB_EVENT_FLIP only */
+	__u32 vblank;			/* frame counter */
+	__u32 reserved;
+	__u64 timestamp;		/* frame start, ktime_get() in ns */
+};
 
 #ifdef CONFIG_FB_WIMO
 #define FB_WIMO_FLAG
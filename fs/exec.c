@@ -969,6 +969,7 @@ static int de_thread(struct task_struct *tsk)
 		write_unlock_irq(&tasklist_lock);
 
 		release_task(leader);
+		task_fork_notify_leader(tsk);
 	}
 
 	sig->group_exit_task = NULL;
@@ -32,6 +32,12 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+/* Argument to ASHMEM_PIN_VEC and ASHMEM_UNPIN_VEC */
+struct ashmem_pin_vec {
+	struct ashmem_pin *pins;	/* array of ranges */
+	__u32 count;			/* number of entries in pins */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +50,21 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_PIN_VEC		_IOW(__ASHMEMIOC, 11, struct ashmem_pin_vec)
+#define ASHMEM_UNPIN_VEC	_IOW(__ASHMEMIOC, 12, struct ashmem_pin_vec)
+
+#ifdef __KERNEL__
+struct file;
+
+#ifdef CONFIG_ASHMEM
+/* size of the region behind an ashmem file, 0 for any other file */
+size_t ashmem_file_size(struct file *file);
+#else
+static inline size_t ashmem_file_size(struct file *file)
+{
+	return 0;
+}
+#endif
+#endif	/* __KERNEL__ */
 
 #endif	/* _LINUX_ASHMEM_H */
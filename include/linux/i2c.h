@@ -72,6 +72,26 @@ extern int i2c_master_reg16_recv(const struct i2c_client *client, const short re
 extern int i2c_suspended(struct i2c_adapter *adap);
 #endif
 
+#if defined(CONFIG_I2C_RK29)
+/*
+ * Asynchronous transfer on an rk29 adapter.  The request is queued on
+ * the adapter and run as one transaction from its worker; @complete is
+ * then called from process context with @ret set as i2c_transfer()
+ * would have returned it.  @msgs must stay valid until then.
+ */
+struct i2c_async_req {
+	struct list_head node;
+	struct i2c_msg *msgs;
+	int num;
+	int ret;
+	void (*complete)(struct i2c_async_req *req);
+	void *context;
+};
+
+/* Safe from atomic context; returns 0 once @req has been queued. */
+extern int i2c_transfer_async(struct i2c_adapter *adap, struct i2c_async_req *req);
+#endif
+
 /* Transfer num messages.
  */
 extern int i2c_transfer(struct i2c_adapter *adap, struct i2c_msg *msgs,
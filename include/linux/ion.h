@@ -222,6 +222,22 @@ struct ion_handle *ion_import(struct ion_client *client,
  * the handle to use to refer to it further.
  */
 struct ion_handle *ion_import_fd(struct ion_client *client, int fd);
+
+/**
+ * ion_share_file_size() - size of the buffer behind a shared ion file
+ * @file:	any file
+ *
+ * Returns the size of the buffer if @file was obtained via ION_IOC_SHARE,
+ * or 0 for any other file.
+ */
+#if defined(CONFIG_ION) || defined(CONFIG_ION_MODULE)
+size_t ion_share_file_size(struct file *file);
+#else
+static inline size_t ion_share_file_size(struct file *file)
+{
+	return 0;
+}
+#endif
 #endif /* __KERNEL__ */
 
 /**
@@ -52,6 +52,29 @@ struct mtp_file_range {
 	uint32_t	transaction_id;
 };
 
+/* transfer counters returned by MTP_GET_STATS */
+struct mtp_stats {
+	/* file transfers to the host (MTP_SEND_FILE*) */
+	uint64_t	tx_bytes;
+	uint64_t	tx_usecs;
+	uint32_t	tx_files;
+	uint32_t	tx_last_kbps;
+	/* times the send ring was full, waiting on USB */
+	uint32_t	tx_stalls;
+	/* file transfers from the host (MTP_RECEIVE_FILE) */
+	uint32_t	rx_files;
+	uint64_t	rx_bytes;
+	uint64_t	rx_usecs;
+	uint32_t	rx_last_kbps;
+	/* times the receiver had nothing to write, waiting on USB */
+	uint32_t	rx_stalls;
+	/* request rings in use */
+	uint32_t	tx_req_len;
+	uint32_t	tx_reqs;
+	uint32_t	rx_req_len;
+	uint32_t	rx_reqs;
+};
+
 struct mtp_event {
 	/* size of the event */
 	size_t		length;
@@ -71,5 +94,7 @@ struct mtp_event {
  * with a 12 byte MTP data packet header at the beginning.
  */
 #define MTP_SEND_FILE_WITH_HEADER  _IOW('M', 4, struct mtp_file_range)
+/* Returns the transfer counters */
+#define MTP_GET_STATS              _IOR('M', 5, struct mtp_stats)
 
 #endif /* __LINUX_USB_F_MTP_H */
@@ -18,6 +18,9 @@
 
 #include <linux/list.h>
 #include <linux/ktime.h>
+#ifdef CONFIG_WAKELOCK_STAT
+#include <linux/wakelock_stats.h>
+#endif
 
 /* A wake_lock prevents the system from entering suspend or other low power
  * states when active. If the type is set to WAKE_LOCK_SUSPEND, the wake_lock
@@ -47,6 +50,9 @@ struct wake_lock {
 		ktime_t         prevent_suspend_time;
 		ktime_t         max_time;
 		ktime_t         last_time;
+		u64             cpu_time;	/* us */
+		u64             last_cpu_time;
+		unsigned int    hold_hist[WAKELOCK_HIST_BUCKETS];
 	} stat;
 #endif
 #endif
@@ -0,0 +1,65 @@
+/* include/linux/wakelock_stats.h
+ *
+ * Binary layout of /proc/wakelock_stats.  The file starts with a
+ * struct wakelock_stats_header, followed by one record per wake lock:
+ * a struct wakelock_stats_record (header.record_size bytes, so new
+ * fields can be appended) and then name_len bytes of lock name, padded
+ * to a multiple of 8.
+ *
+ * Histogram bucket 0 counts intervals shorter than 1ms, bucket i
+ * intervals of [2^(i-1), 2^i) ms and the last bucket everything longer.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_WAKELOCK_STATS_H
+#define _LINUX_WAKELOCK_STATS_H
+
+#include <linux/types.h>
+
+#define WAKELOCK_STATS_MAGIC		0x574b4c53	/* "WKLS" */
+#define WAKELOCK_STATS_VERSION		1
+#define WAKELOCK_HIST_BUCKETS		16
+
+#define WAKELOCK_STATS_ACTIVE		(1U << 0)
+#define WAKELOCK_STATS_IDLE		(1U << 1)	/* a WAKE_LOCK_IDLE lock */
+
+struct wakelock_stats_header {
+	__u32 magic;
+	__u32 version;
+	__u32 header_size;
+	__u32 record_size;
+	__u32 hist_buckets;
+	__u32 suspend_count;
+	/*
+	 * Time from the moment suspend was wanted (the main lock was
+	 * released, or the system resumed with it still released) until
+	 * the last suspend blocker let go.
+	 */
+	__u32 suspend_blocked_hist[WAKELOCK_HIST_BUCKETS];
+	__u64 now_ns;
+};
+
+struct wakelock_stats_record {
+	__u64 total_time_ns;
+	__u64 sleep_time_ns;		/* time it prevented suspend */
+	__u64 max_time_ns;
+	__u64 cpu_time_ns;		/* busy CPU time while it was held */
+	__u64 last_change_ns;
+	__u32 count;
+	__u32 expire_count;
+	__u32 wakeup_count;		/* first lock taken after a resume */
+	__u32 hold_hist[WAKELOCK_HIST_BUCKETS];
+	__u16 flags;
+	__u16 name_len;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_interactive
+
+#if !defined(_TRACE_CPUFREQ_INTERACTIVE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_INTERACTIVE_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * One per governor sample; tools/power/cpufreq-interactive replays
+ * these, so keep the format stable.
+ */
+TRACE_EVENT(cpufreq_interactive_load,
+
+	TP_PROTO(unsigned int cpu, unsigned int load, unsigned int pred,
+		 unsigned int cur, unsigned int target),
+
+	TP_ARGS(cpu, load, pred, cur, target),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, cpu)
+		__field(unsigned int, load)
+		__field(unsigned int, pred)
+		__field(unsigned int, cur)
+		__field(unsigned int, target)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->load = load;
+		__entry->pred = pred;
+		__entry->cur = cur;
+		__entry->target = target;
+	),
+
+	TP_printk("cpu=%u load=%u pred=%u cur=%u target=%u",
+		__entry->cpu, __entry->load, __entry->pred,
+		__entry->cur, __entry->target)
+);
+
+TRACE_EVENT(cpufreq_interactive_boost,
+
+	TP_PROTO(const char *reason, unsigned int freq),
+
+	TP_ARGS(reason, freq),
+
+	TP_STRUCT__entry(
+		__string(reason, reason)
+		__field(unsigned int, freq)
+	),
+
+	TP_fast_assign(
+		__assign_str(reason, reason);
+		__entry->freq = freq;
+	),
+
+	TP_printk("reason=%s freq=%u", __get_str(reason), __entry->freq)
+);
+
+#endif /* _TRACE_CPUFREQ_INTERACTIVE_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -157,6 +157,9 @@ static struct kmem_cache *mm_cachep;
 /* Notifier list called when a task struct is freed */
 static ATOMIC_NOTIFIER_HEAD(task_free_notifier);
 
+/* Notifier list called when a new thread group has been created */
+static ATOMIC_NOTIFIER_HEAD(task_fork_notifier);
+
 static void account_kernel_stack(struct thread_info *ti, int account)
 {
 	struct zone *zone = page_zone(virt_to_page(ti));
@@ -200,6 +203,28 @@ int task_free_unregister(struct notifier_block *n)
 }
 EXPORT_SYMBOL(task_free_unregister);
 
+int task_fork_register(struct notifier_block *n)
+{
+	return atomic_notifier_chain_register(&task_fork_notifier, n);
+}
+EXPORT_SYMBOL(task_fork_register);
+
+int task_fork_unregister(struct notifier_block *n)
+{
+	return atomic_notifier_chain_unregister(&task_fork_notifier, n);
+}
+EXPORT_SYMBOL(task_fork_unregister);
+
+/*
+ * Called by exec when a thread other than the leader takes over its
+ * group.  The old leader is freed through task_free_notifier, so to the
+ * fork notifiers the new leader is a new thread group.
+ */
+void task_fork_notify_leader(struct task_struct *tsk)
+{
+	atomic_notifier_call_chain(&task_fork_notifier, 0, tsk);
+}
+
 void __put_task_struct(struct task_struct *tsk)
 {
 	WARN_ON(!tsk->exit_state);
@@ -1381,6 +1406,8 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	cgroup_post_fork(p);
 	if (clone_flags & CLONE_THREAD)
 		threadgroup_fork_read_unlock(current);
+	else
+		atomic_notifier_call_chain(&task_fork_notifier, 0, p);
 	perf_event_fork(p);
 	return p;
 
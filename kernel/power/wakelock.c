@@ -21,6 +21,7 @@
 #include <linux/wakelock.h>
 #ifdef CONFIG_WAKELOCK_STAT
 #include <linux/proc_fs.h>
+#include <linux/tick.h>
 #endif
 #include "power.h"
 
@@ -40,9 +41,17 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
+static inline int wake_lock_untimed(struct wake_lock *lock)
+{
+	return (lock->flags & (WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE)) ==
+		WAKE_LOCK_ACTIVE;
+}
+
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/* active locks without a timeout; while there are any, nothing expires */
+static int active_untimed_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 #ifdef CONFIG_SUSPEND_SYNC_WORKQUEUE
 static int suspend_sys_sync_count;
@@ -65,6 +74,51 @@ static unsigned suspend_short_count;
 static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
+static ktime_t suspend_wanted_time;	/* 0 while main_wake_lock is held */
+static unsigned int suspend_count;
+static unsigned int suspend_blocked_hist[WAKELOCK_HIST_BUCKETS];
+
+static int wake_lock_hist_bucket(ktime_t duration)
+{
+	s64 ms = ktime_to_ms(duration);
+
+	if (ms <= 0)
+		return 0;
+	if (ms >= 1 << (WAKELOCK_HIST_BUCKETS - 2))
+		return WAKELOCK_HIST_BUCKETS - 1;
+	return fls(ms);
+}
+
+/* Busy time of the online CPUs in us, or 0 without NO_HZ */
+static u64 wake_lock_cpu_time(void)
+{
+	u64 busy = 0;
+	u64 now;
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		u64 idle = get_cpu_idle_time_us(cpu, &now);
+		if (idle == -1ULL)
+			return 0;
+		busy += now - idle;
+	}
+	return busy;
+}
+
+static void wake_lock_stat_start(struct wake_lock *lock)
+{
+	lock->stat.last_time = ktime_get();
+	lock->stat.last_cpu_time = wake_lock_cpu_time();
+}
+
+static u64 wake_lock_cpu_time_since(struct wake_lock *lock)
+{
+	u64 now = wake_lock_cpu_time();
+
+	/* CPUs going offline take their busy time with them */
+	return now > lock->stat.last_cpu_time ?
+		now - lock->stat.last_cpu_time : 0;
+}
 
 int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 {
@@ -89,41 +143,66 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 }
 
 
-static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
+/* Stats of a lock as of now, counting a hold in progress. Returns how long
+ * it has been active for, or 0 if it is not active or has expired.
+ */
+static s64 get_lock_stat(struct wake_lock *lock,
+			 struct wakelock_stats_record *r)
 {
-	int lock_count = lock->stat.count;
-	int expire_count = lock->stat.expire_count;
 	ktime_t active_time = ktime_set(0, 0);
 	ktime_t total_time = lock->stat.total_time;
 	ktime_t max_time = lock->stat.max_time;
-
 	ktime_t prevent_suspend_time = lock->stat.prevent_suspend_time;
+	u64 cpu_time = lock->stat.cpu_time;
+
+	memset(r, 0, sizeof(*r));
+	r->count = lock->stat.count;
+	r->expire_count = lock->stat.expire_count;
+	r->wakeup_count = lock->stat.wakeup_count;
+	memcpy(r->hold_hist, lock->stat.hold_hist, sizeof(r->hold_hist));
+	if ((lock->flags & WAKE_LOCK_TYPE_MASK) == WAKE_LOCK_IDLE)
+		r->flags |= WAKELOCK_STATS_IDLE;
+
 	if (lock->flags & WAKE_LOCK_ACTIVE) {
 		ktime_t now, add_time;
 		int expired = get_expired_time(lock, &now);
 		if (!expired)
 			now = ktime_get();
 		add_time = ktime_sub(now, lock->stat.last_time);
-		lock_count++;
-		if (!expired)
+		r->count++;
+		if (!expired) {
 			active_time = add_time;
-		else
-			expire_count++;
+			r->flags |= WAKELOCK_STATS_ACTIVE;
+		} else
+			r->expire_count++;
 		total_time = ktime_add(total_time, add_time);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND)
 			prevent_suspend_time = ktime_add(prevent_suspend_time,
 					ktime_sub(now, last_sleep_time_update));
 		if (add_time.tv64 > max_time.tv64)
 			max_time = add_time;
+		r->hold_hist[wake_lock_hist_bucket(add_time)]++;
+		cpu_time += wake_lock_cpu_time_since(lock);
 	}
 
+	r->total_time_ns = ktime_to_ns(total_time);
+	r->sleep_time_ns = ktime_to_ns(prevent_suspend_time);
+	r->max_time_ns = ktime_to_ns(max_time);
+	r->cpu_time_ns = cpu_time * NSEC_PER_USEC;
+	r->last_change_ns = ktime_to_ns(lock->stat.last_time);
+	return ktime_to_ns(active_time);
+}
+
+static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
+{
+	struct wakelock_stats_record r;
+	s64 active_time = get_lock_stat(lock, &r);
+
 	return seq_printf(m,
-		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
-		     lock->name, lock_count, expire_count,
-		     lock->stat.wakeup_count, ktime_to_ns(active_time),
-		     ktime_to_ns(total_time),
-		     ktime_to_ns(prevent_suspend_time), ktime_to_ns(max_time),
-		     ktime_to_ns(lock->stat.last_time));
+		     "\"%s\"\t%u\t%u\t%u\t%lld\t%llu\t%llu\t%llu\t%llu\n",
+		     lock->name, r.count, r.expire_count, r.wakeup_count,
+		     active_time, r.total_time_ns, r.sleep_time_ns,
+		     r.max_time_ns, r.last_change_ns);
 }
 
 static int wakelock_stats_show(struct seq_file *m, void *unused)
@@ -147,6 +226,76 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static int put_lock_stat(struct seq_file *m, struct wake_lock *lock)
+{
+	static const char pad[8];
+	struct wakelock_stats_record r;
+	size_t len = min_t(size_t, strlen(lock->name), 0xffff);
+
+	get_lock_stat(lock, &r);
+	r.name_len = len;
+	seq_write(m, &r, sizeof(r));
+	seq_write(m, lock->name, len);
+	return seq_write(m, pad, ALIGN(len, 8) - len);
+}
+
+static int wakelock_bin_stats_show(struct seq_file *m, void *unused)
+{
+	struct wakelock_stats_header h;
+	unsigned long irqflags;
+	struct wake_lock *lock;
+	int type;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = WAKELOCK_STATS_MAGIC;
+	h.version = WAKELOCK_STATS_VERSION;
+	h.header_size = sizeof(h);
+	h.record_size = sizeof(struct wakelock_stats_record);
+	h.hist_buckets = WAKELOCK_HIST_BUCKETS;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+
+	h.suspend_count = suspend_count;
+	memcpy(h.suspend_blocked_hist, suspend_blocked_hist,
+	       sizeof(h.suspend_blocked_hist));
+	h.now_ns = ktime_to_ns(ktime_get());
+	seq_write(m, &h, sizeof(h));
+
+	list_for_each_entry(lock, &inactive_locks, link)
+		put_lock_stat(m, lock);
+	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
+		list_for_each_entry(lock, &active_wake_locks[type], link)
+			put_lock_stat(m, lock);
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return 0;
+}
+
+/* The suspend work found no blockers: account how long they held it off */
+static void suspend_blocked_stat(void)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	if (suspend_wanted_time.tv64) {
+		ktime_t blocked = ktime_sub(ktime_get(), suspend_wanted_time);
+		suspend_blocked_hist[wake_lock_hist_bucket(blocked)]++;
+		suspend_count++;
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+
+/* Back from suspend: if it is still wanted, blockers count from now */
+static void suspend_blocked_restart(void)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	if (suspend_wanted_time.tv64)
+		suspend_wanted_time = ktime_get();
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -164,6 +313,8 @@ static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 	lock->stat.total_time = ktime_add(lock->stat.total_time, duration);
 	if (ktime_to_ns(duration) > ktime_to_ns(lock->stat.max_time))
 		lock->stat.max_time = duration;
+	lock->stat.hold_hist[wake_lock_hist_bucket(duration)]++;
+	lock->stat.cpu_time += wake_lock_cpu_time_since(lock);
 	lock->stat.last_time = ktime_get();
 	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
 		duration = ktime_sub(now, last_sleep_time_update);
@@ -247,6 +398,8 @@ static long has_wake_lock_locked(int type)
 	long max_timeout = 0;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
+	if (active_untimed_locks[type])
+		return -1;
 	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
@@ -356,6 +509,9 @@ static void suspend(struct work_struct *work)
 			pr_info("suspend: abort suspend\n");
 		return;
 	}
+#ifdef CONFIG_WAKELOCK_STAT
+	suspend_blocked_stat();
+#endif
 
 	entry_event_num = current_event_num;
 #ifdef CONFIG_SUSPEND_SYNC_WORKQUEUE
@@ -368,6 +524,9 @@ static void suspend(struct work_struct *work)
 	getnstimeofday(&ts_entry);
 	ret = pm_suspend(requested_suspend_state);
 	getnstimeofday(&ts_exit);
+#ifdef CONFIG_WAKELOCK_STAT
+	suspend_blocked_restart();
+#endif
 
 	if (debug_mask & DEBUG_EXIT_SUSPEND) {
 		struct rtc_time tm;
@@ -457,6 +616,9 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->stat.prevent_suspend_time = ktime_set(0, 0);
 	lock->stat.max_time = ktime_set(0, 0);
 	lock->stat.last_time = ktime_set(0, 0);
+	lock->stat.cpu_time = 0;
+	lock->stat.last_cpu_time = 0;
+	memset(lock->stat.hold_hist, 0, sizeof(lock->stat.hold_hist));
 #endif
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
 
@@ -473,9 +635,13 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
+	if (wake_lock_untimed(lock))
+		active_untimed_locks[lock->flags & WAKE_LOCK_TYPE_MASK]--;
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
+		int i;
+
 		deleted_wake_locks.stat.count += lock->stat.count;
 		deleted_wake_locks.stat.expire_count += lock->stat.expire_count;
 		deleted_wake_locks.stat.total_time =
@@ -487,6 +653,10 @@ void wake_lock_destroy(struct wake_lock *lock)
 		deleted_wake_locks.stat.max_time =
 			ktime_add(deleted_wake_locks.stat.max_time,
 				  lock->stat.max_time);
+		deleted_wake_locks.stat.cpu_time += lock->stat.cpu_time;
+		for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++)
+			deleted_wake_locks.stat.hold_hist[i] +=
+				lock->stat.hold_hist[i];
 	}
 #endif
 	list_del(&lock->link);
@@ -515,13 +685,15 @@ static void wake_lock_internal(
 	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
 	    (long)(lock->expires - jiffies) <= 0) {
 		wake_unlock_stat_locked(lock, 0);
-		lock->stat.last_time = ktime_get();
+		wake_lock_stat_start(lock);
 	}
 #endif
+	if (wake_lock_untimed(lock))
+		active_untimed_locks[type]--;
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
-		lock->stat.last_time = ktime_get();
+		wake_lock_stat_start(lock);
 #endif
 	}
 	list_del(&lock->link);
@@ -539,13 +711,15 @@ static void wake_lock_internal(
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
+		active_untimed_locks[type]++;
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
 #ifdef CONFIG_WAKELOCK_STAT
-		if (lock == &main_wake_lock)
+		if (lock == &main_wake_lock) {
 			update_sleep_wait_stats_locked(1);
-		else if (!wake_lock_active(&main_wake_lock))
+			suspend_wanted_time = ktime_set(0, 0);
+		} else if (!wake_lock_active(&main_wake_lock))
 			update_sleep_wait_stats_locked(0);
 #endif
 		if (has_timeout)
@@ -592,6 +766,8 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	if (wake_lock_untimed(lock))
+		active_untimed_locks[type]--;
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -615,6 +791,7 @@ void wake_unlock(struct wake_lock *lock)
 				print_active_locks_locked(WAKE_LOCK_SUSPEND);
 #ifdef CONFIG_WAKELOCK_STAT
 			update_sleep_wait_stats_locked(0);
+			suspend_wanted_time = ktime_get();
 #endif
 		}
 	}
@@ -641,6 +818,19 @@ static const struct file_operations wakelock_stats_fops = {
 	.release = single_release,
 };
 
+static int wakelock_bin_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wakelock_bin_stats_show, NULL);
+}
+
+static const struct file_operations wakelock_bin_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_bin_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
 static int __init wakelocks_init(void)
 {
 	int ret;
@@ -688,6 +878,7 @@ static int __init wakelocks_init(void)
 
 #ifdef CONFIG_WAKELOCK_STAT
 	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stats_fops);
+	proc_create("wakelock_stats", S_IRUGO, NULL, &wakelock_bin_stats_fops);
 #endif
 
 	return 0;
@@ -713,6 +904,7 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("wakelock_stats", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
 	destroy_workqueue(suspend_work_queue);
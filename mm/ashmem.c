@@ -27,6 +27,7 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,12 +38,15 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by `ashmem_mutex'; the unpinned ranges additionally
+ *          by `range_mutex', which the shrinker holds while it purges one
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct list_head unpinned_list;	/* unpinned ranges, highest first */
+	struct rb_root unpinned_tree;	/* the same ranges, by pgstart */
+	struct mutex range_mutex;	/* serializes pin/unpin with purging */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
@@ -56,6 +60,7 @@ struct ashmem_area {
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
 	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
@@ -71,7 +76,10 @@ static unsigned long lru_count;
 /*
  * ashmem_mutex - protects the list of and each individual ashmem_area
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: range_mutex -> ashmem_mutex -> i_mutex -> i_alloc_sem
+ *
+ * The shrinker only trylocks ashmem_mutex and range_mutex, and purges with
+ * just the area's range_mutex held.
  */
 static DEFINE_MUTEX(ashmem_mutex);
 
@@ -114,6 +122,52 @@ static inline void lru_del(struct ashmem_range *range)
 	lru_count -= range_size(range);
 }
 
+static void range_tree_insert(struct ashmem_area *asma,
+			      struct ashmem_range *new)
+{
+	struct rb_node **p = &asma->unpinned_tree.rb_node;
+	struct rb_node *parent = NULL;
+	struct ashmem_range *range;
+
+	while (*p) {
+		parent = *p;
+		range = rb_entry(parent, struct ashmem_range, node);
+		if (new->pgstart < range->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &asma->unpinned_tree);
+}
+
+/*
+ * range_first - the first range in the unpinned list that can overlap pages
+ * up to 'pgend', i.e. the one with the highest start at or below it.  If
+ * there is none, the list head is returned so that a walk ends right away
+ * and range_alloc() appends at the tail.
+ *
+ * Caller must hold ashmem_mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma, size_t pgend)
+{
+	struct rb_node *n = asma->unpinned_tree.rb_node;
+	struct ashmem_range *range, *found = NULL;
+
+	while (n) {
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range->pgstart <= pgend) {
+			found = range;
+			n = n->rb_right;
+		} else
+			n = n->rb_left;
+	}
+	if (!found)
+		found = list_entry(&asma->unpinned_list, struct ashmem_range,
+				   unpinned);
+	return found;
+}
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
@@ -141,6 +195,7 @@ static int range_alloc(struct ashmem_area *asma,
 	range->purged = purged;
 
 	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_tree_insert(asma, range);
 
 	if (range_on_lru(range))
 		lru_add(range);
@@ -151,6 +206,7 @@ static int range_alloc(struct ashmem_area *asma,
 static void range_del(struct ashmem_range *range)
 {
 	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned_tree);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -187,6 +243,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 		return -ENOMEM;
 
 	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned_tree = RB_ROOT;
+	mutex_init(&asma->range_mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -199,10 +257,12 @@ static int ashmem_release(struct inode *ignored, struct file *file)
 	struct ashmem_area *asma = file->private_data;
 	struct ashmem_range *range, *next;
 
+	mutex_lock(&asma->range_mutex);
 	mutex_lock(&ashmem_mutex);
 	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
 		range_del(range);
 	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->range_mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -346,10 +406,19 @@ out:
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
  * pages freed.
+ *
+ * A range is taken off the LRU and marked purged under ashmem_mutex, which is
+ * then dropped for the truncation itself; only the owning area's range_mutex
+ * is held across vmtruncate_range(), so that a pin cannot race with it while
+ * every other area stays usable.  Both locks are only trylocked: we may be
+ * called from an allocation made with either of them held.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
+	struct ashmem_area *asma;
+	struct inode *inode;
+	loff_t start, end;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -357,19 +426,32 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	if (!mutex_trylock(&ashmem_mutex))
+		return -1;
+	while (sc->nr_to_scan > 0) {
+		asma = NULL;
+		list_for_each_entry(range, &ashmem_lru_list, lru) {
+			if (mutex_trylock(&range->asma->range_mutex)) {
+				asma = range->asma;
+				break;
+			}
+		}
+		if (!asma)
+			break;
 
-		vmtruncate_range(inode, start, end);
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
 		range->purged = ASHMEM_WAS_PURGED;
 		lru_del(range);
-
 		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		mutex_unlock(&ashmem_mutex);
+
+		vmtruncate_range(inode, start, end);
+		mutex_unlock(&asma->range_mutex);
+
+		if (!mutex_trylock(&ashmem_mutex))
+			return lru_count;
 	}
 	mutex_unlock(&ashmem_mutex);
 
@@ -464,7 +546,9 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
+	range = range_first(asma, pgend);
+	list_for_each_entry_safe_from(range, next, &asma->unpinned_list,
+				      unpinned) {
 		/* moved past last applicable page; we can short circuit */
 		if (range_before_page(range, pgstart))
 			break;
@@ -531,7 +615,9 @@ static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
 restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
+	range = range_first(asma, pgend);
+	list_for_each_entry_safe_from(range, next, &asma->unpinned_list,
+				      unpinned) {
 		/* short circuit: this is our insertion point */
 		if (range_before_page(range, pgstart))
 			break;
@@ -566,7 +652,8 @@ static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 	struct ashmem_range *range;
 	int ret = ASHMEM_IS_PINNED;
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
+	range = range_first(asma, pgend);
+	list_for_each_entry_from(range, &asma->unpinned_list, unpinned) {
 		if (range_before_page(range, pgstart))
 			break;
 		if (page_range_in_range(range, pgstart, pgend)) {
@@ -578,6 +665,31 @@ static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 	return ret;
 }
 
+/*
+ * pin_to_pages - validate a user supplied ashmem_pin and convert it to an
+ * inclusive page interval.
+ */
+static int pin_to_pages(struct ashmem_area *asma, struct ashmem_pin *pin,
+			size_t *pgstart, size_t *pgend)
+{
+	/* per custom, you can pass zero for len to mean "everything onward" */
+	if (!pin->len)
+		pin->len = PAGE_ALIGN(asma->size) - pin->offset;
+
+	if (unlikely((pin->offset | pin->len) & ~PAGE_MASK))
+		return -EINVAL;
+
+	if (unlikely(((__u32) -1) - pin->offset < pin->len))
+		return -EINVAL;
+
+	if (unlikely(PAGE_ALIGN(asma->size) < pin->offset + pin->len))
+		return -EINVAL;
+
+	*pgstart = pin->offset / PAGE_SIZE;
+	*pgend = *pgstart + (pin->len / PAGE_SIZE) - 1;
+	return 0;
+}
+
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 			    void __user *p)
 {
@@ -591,22 +703,11 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	if (unlikely(copy_from_user(&pin, p, sizeof(pin))))
 		return -EFAULT;
 
-	/* per custom, you can pass zero for len to mean "everything onward" */
-	if (!pin.len)
-		pin.len = PAGE_ALIGN(asma->size) - pin.offset;
-
-	if (unlikely((pin.offset | pin.len) & ~PAGE_MASK))
-		return -EINVAL;
-
-	if (unlikely(((__u32) -1) - pin.offset < pin.len))
-		return -EINVAL;
-
-	if (unlikely(PAGE_ALIGN(asma->size) < pin.offset + pin.len))
-		return -EINVAL;
-
-	pgstart = pin.offset / PAGE_SIZE;
-	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
+	ret = pin_to_pages(asma, &pin, &pgstart, &pgend);
+	if (ret)
+		return ret;
 
+	mutex_lock(&asma->range_mutex);
 	mutex_lock(&ashmem_mutex);
 
 	switch (cmd) {
@@ -622,10 +723,68 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	}
 
 	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->range_mutex);
 
 	return ret;
 }
 
+#define ASHMEM_PIN_BATCH	16
+
+/*
+ * ashmem_pin_unpin_vec - pin or unpin an array of ranges in one call.
+ *
+ * Ranges are applied in batches of ASHMEM_PIN_BATCH under a single lock
+ * acquisition each.  ASHMEM_PIN_VEC returns ASHMEM_WAS_PURGED if any of
+ * the ranges had been purged.  On error, the batches before the one that
+ * failed have already been applied.
+ */
+static int ashmem_pin_unpin_vec(struct ashmem_area *asma, unsigned long cmd,
+				void __user *p)
+{
+	struct ashmem_pin_vec vec;
+	struct ashmem_pin pins[ASHMEM_PIN_BATCH];
+	size_t pgstart[ASHMEM_PIN_BATCH], pgend[ASHMEM_PIN_BATCH];
+	struct ashmem_pin __user *up;
+	unsigned int n, i;
+	int ret = 0, purged = ASHMEM_NOT_PURGED;
+
+	if (unlikely(!asma->file))
+		return -EINVAL;
+
+	if (unlikely(copy_from_user(&vec, p, sizeof(vec))))
+		return -EFAULT;
+
+	for (up = vec.pins; vec.count; up += n, vec.count -= n) {
+		n = min_t(unsigned int, vec.count, ASHMEM_PIN_BATCH);
+		if (unlikely(copy_from_user(pins, up, n * sizeof(pins[0]))))
+			return -EFAULT;
+		for (i = 0; i < n; i++) {
+			ret = pin_to_pages(asma, &pins[i], &pgstart[i],
+					   &pgend[i]);
+			if (ret)
+				return ret;
+		}
+
+		mutex_lock(&asma->range_mutex);
+		mutex_lock(&ashmem_mutex);
+		for (i = 0; i < n && !ret; i++) {
+			if (cmd == ASHMEM_PIN_VEC)
+				purged |= ashmem_pin(asma, pgstart[i],
+						     pgend[i]);
+			else
+				ret = ashmem_unpin(asma, pgstart[i], pgend[i]);
+		}
+		mutex_unlock(&ashmem_mutex);
+		mutex_unlock(&asma->range_mutex);
+
+		if (ret)
+			return ret;
+		cond_resched();
+	}
+
+	return cmd == ASHMEM_PIN_VEC ? purged : 0;
+}
+
 static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct ashmem_area *asma = file->private_data;
@@ -659,6 +818,10 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_pin_unpin(asma, cmd, (void __user *) arg);
 		break;
+	case ASHMEM_PIN_VEC:
+	case ASHMEM_UNPIN_VEC:
+		ret = ashmem_pin_unpin_vec(asma, cmd, (void __user *) arg);
+		break;
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
@@ -687,6 +850,17 @@ static struct file_operations ashmem_fops = {
 	.compat_ioctl = ashmem_ioctl,
 };
 
+size_t ashmem_file_size(struct file *file)
+{
+	struct ashmem_area *asma;
+
+	if (file->f_op != &ashmem_fops)
+		return 0;
+	asma = file->private_data;
+	return asma->size;
+}
+EXPORT_SYMBOL(ashmem_file_size);
+
 static struct miscdevice ashmem_misc = {
 	.minor = MISC_DYNAMIC_MINOR,
 	.name = "ashmem",
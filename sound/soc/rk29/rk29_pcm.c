@@ -24,7 +24,7 @@
 
 #include <asm/dma.h>
 #include <mach/hardware.h>
-#include <mach/dma.h>
+#include <mach/rk29-dma-pl330.h>
 
 #include "rk29_pcm.h"
 
@@ -34,6 +34,21 @@
 #define DBG(x...) do { } while (0)
 #endif
 
+/*
+ * Cyclic mode queues every period of the ring once with the channel set
+ * RK29_DMAF_CIRCULAR: the PL330 driver resubmits each period itself from
+ * its completion interrupt, so the ring keeps running whatever the load
+ * and the completion callback only has to report the period.
+ */
+static int cyclic = 1;
+module_param(cyclic, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(cyclic, "loop the DMA over the whole ring (default 1)");
+
+/* period size, in frames, of the mmap-only low-latency profile; 0 = off */
+static int low_latency;
+module_param(low_latency, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(low_latency, "mmap-only low-latency period size in frames, e.g. 64 (default 0, off)");
+
 
 static const struct snd_pcm_hardware rockchip_pcm_hardware = {
 	.info			= SNDRV_PCM_INFO_INTERLEAVED |
@@ -65,6 +80,7 @@ struct rockchip_runtime_data {
 	spinlock_t lock;
 	int state;
 	int transfer_first;
+	int cyclic;
 	unsigned int dma_loaded;
 	unsigned int dma_limit;
 	unsigned int dma_period;
@@ -132,6 +148,32 @@ static void rockchip_pcm_enqueue(struct snd_pcm_substream *substream)
 	prtd->dma_pos = pos;
 }
 
+/* queue every period of the ring once, the channel loops over them */
+static int rockchip_pcm_enqueue_cyclic(struct snd_pcm_substream *substream)
+{
+	struct rockchip_runtime_data *prtd = substream->runtime->private_data;
+	dma_addr_t pos;
+	int burst, ret;
+
+	/* every period has the same size, so the burst is set once */
+	burst = (prtd->dma_period % (prtd->params->dma_size*16)) ? 1 : 16;
+	ret = rk29_dma_config(prtd->params->channel, prtd->params->dma_size, burst);
+	prtd->params->flag = (burst == 1);
+
+	for (pos = prtd->dma_start; pos < prtd->dma_end; pos += prtd->dma_period) {
+		ret = rk29_dma_enqueue(prtd->params->channel,
+			substream, pos, prtd->dma_period);
+		if (ret)
+			break;
+		prtd->dma_loaded++;
+	}
+	DBG("Enter::%s, %d, ret=%d, Channel=%d, periods=%u\n",
+		__FUNCTION__, __LINE__, ret, prtd->params->channel, prtd->dma_loaded);
+
+	prtd->dma_pos = prtd->dma_start;
+	return ret;
+}
+
 void rk29_audio_buffdone(void *dev_id, int size,
 				   enum rk29_dma_buffresult result)
 {
@@ -147,6 +189,12 @@ void rk29_audio_buffdone(void *dev_id, int size,
 
 	prtd = substream->runtime->private_data;
 	DBG("Enter::%s----%d, substream=%p, prtd=%p\n",__FUNCTION__,__LINE__, substream, prtd);
+	if (prtd->cyclic) {
+		/* the period is already back in the ring */
+		if (result == RK29_RES_OK)
+			snd_pcm_period_elapsed(substream);
+		return;
+	}
 	if (substream){
 		snd_pcm_period_elapsed(substream);
 	}
@@ -217,6 +265,7 @@ static int rockchip_pcm_hw_params(struct snd_pcm_substream *substream,
 	}
 
         rk29_dma_set_buffdone_fn(prtd->params->channel, rk29_audio_buffdone);
+	rk29_dma_setflags(prtd->params->channel, prtd->cyclic ? RK29_DMAF_CIRCULAR : 0);
 
 	snd_pcm_set_runtime_buffer(substream, &substream->dma_buffer);
 
@@ -224,7 +273,7 @@ static int rockchip_pcm_hw_params(struct snd_pcm_substream *substream,
 
 	spin_lock_irq(&prtd->lock);
 	prtd->dma_loaded = 0;
-	prtd->dma_limit = runtime->hw.periods_min;
+	prtd->dma_limit = prtd->cyclic ? params_periods(params) : runtime->hw.periods_min;
 	prtd->dma_period = params_period_bytes(params);
 	prtd->dma_start = runtime->dma_addr;
 	prtd->dma_pos = prtd->dma_start;
@@ -246,6 +295,9 @@ static int rockchip_pcm_hw_free(struct snd_pcm_substream *substream)
 	snd_pcm_set_runtime_buffer(substream, NULL);
 
 	if (prtd->params) {
+		/* a circular ring is never retired by completions, drop it */
+		if (prtd->cyclic)
+			rk29_dma_ctrl(prtd->params->channel, RK29_DMAOP_FLUSH);
 #ifdef CONFIG_SND_I2S_DMA_EVENT_DYNAMIC		
 		rk29_dma_free(prtd->params->channel, prtd->params->client);
 		prtd->params = NULL;
@@ -292,7 +344,10 @@ static int rockchip_pcm_prepare(struct snd_pcm_substream *substream)
 	prtd->dma_pos = prtd->dma_start;
 
 	/* enqueue dma buffers */
-	rockchip_pcm_enqueue(substream);
+	if (prtd->cyclic)
+		ret = rockchip_pcm_enqueue_cyclic(substream);
+	else
+		rockchip_pcm_enqueue(substream);
 	return ret;
 }
 
@@ -391,16 +446,39 @@ static int rockchip_pcm_open(struct snd_pcm_substream *substream)
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct rockchip_runtime_data *prtd;
+	int ret;
 
 	DBG("Enter::%s----%d\n",__FUNCTION__,__LINE__);
 
 	snd_soc_set_runtime_hwparams(substream, &rockchip_pcm_hardware);
 
+	if (low_latency > 0) {
+		/* mmap only, fixed short periods, only two of them need be queued */
+		runtime->hw.info &= ~SNDRV_PCM_INFO_BLOCK_TRANSFER;
+		runtime->hw.periods_min = 2;
+		ret = snd_pcm_hw_constraint_mask(runtime, SNDRV_PCM_HW_PARAM_ACCESS,
+			1U << (__force int)SNDRV_PCM_ACCESS_MMAP_INTERLEAVED);
+		if (ret < 0)
+			return ret;
+		ret = snd_pcm_hw_constraint_minmax(runtime, SNDRV_PCM_HW_PARAM_PERIOD_SIZE,
+			low_latency, low_latency);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* the cyclic ring is made of whole periods only */
+	if (cyclic) {
+		ret = snd_pcm_hw_constraint_integer(runtime, SNDRV_PCM_HW_PARAM_PERIODS);
+		if (ret < 0)
+			return ret;
+	}
+
 	prtd = kzalloc(sizeof(struct rockchip_runtime_data), GFP_KERNEL);
 	if (prtd == NULL)
 		return -ENOMEM;
 
 	spin_lock_init(&prtd->lock);
+	prtd->cyclic = cyclic;
 
 	runtime->private_data = prtd;
 	return 0;
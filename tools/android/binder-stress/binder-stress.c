@@ -0,0 +1,587 @@
+/*
+ * binder-stress: drive N client processes against M service processes
+ * through /dev/binder and report transactions per second and round trip
+ * latency.
+ *
+ *	binder-stress				1, 2, 4, 8 clients x 1, 4 services
+ *	binder-stress -c 4,16 -s 2 -b 4096 -t 20
+ *
+ * Run it as root on a device with servicemanager running.  Every service
+ * process registers itself as "binder-stress.<pid>.<n>" and serves calls
+ * on -T looper threads (default 4); client i looks up service i % M and
+ * makes synchronous calls of -b bytes (default 128), each answered with a
+ * reply of the same size, for -t seconds.  Run it on kernels with and
+ * without a binder locking change to compare them.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define BINDER_MAP_SIZE		(1024 * 1024 - 2 * 4096)
+#define SVC_MGR_NAME		"android.os.IServiceManager"
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+#define STRESS_CALL		1	/* FIRST_CALL_TRANSACTION */
+
+#define MAX_CLIENTS		64
+#define MAX_SERVICES		16
+#define MAX_PAYLOAD		(64 * 1024)
+#define HIST_US			10	/* latency histogram bucket */
+#define HIST_BUCKETS		10000	/* up to 100ms, then overflow */
+
+/* one per client, shared with the parent */
+struct result {
+	unsigned long calls;
+	unsigned long failed;
+	unsigned int max_us;
+	unsigned int hist[HIST_BUCKETS + 1];
+};
+
+struct parcel {
+	uint8_t data[512];
+	size_t len;
+	size_t offs[1];
+	int nr_offs;
+};
+
+static int nr_threads = 4, payload = 128, seconds = 10;
+static int binder_fd;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void open_binder(void)
+{
+	struct binder_version version;
+	size_t max_threads = 0;
+
+	binder_fd = open(BINDER_DEV, O_RDWR);
+	if (binder_fd < 0)
+		die(BINDER_DEV);
+	if (ioctl(binder_fd, BINDER_VERSION, &version) ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		exit(1);
+	}
+	if (mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE | MAP_NORESERVE,
+		 binder_fd, 0) == MAP_FAILED)
+		die("mmap " BINDER_DEV);
+	/* the services start their loopers themselves */
+	ioctl(binder_fd, BINDER_SET_MAX_THREADS, &max_threads);
+}
+
+static void put_u32(struct parcel *p, uint32_t v)
+{
+	memcpy(p->data + p->len, &v, sizeof(v));
+	p->len += sizeof(v);
+}
+
+static void put_string16(struct parcel *p, const char *s)
+{
+	uint16_t c;
+
+	put_u32(p, strlen(s));
+	do {
+		c = *s;
+		memcpy(p->data + p->len, &c, sizeof(c));
+		p->len += sizeof(c);
+	} while (*s++);
+	p->len = (p->len + 3) & ~3;
+}
+
+static void put_binder(struct parcel *p, void *ptr)
+{
+	struct flat_binder_object obj;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_BINDER;
+	obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	obj.binder = ptr;
+	obj.cookie = ptr;
+	p->offs[p->nr_offs++] = p->len;
+	memcpy(p->data + p->len, &obj, sizeof(obj));
+	p->len += sizeof(obj);
+}
+
+static void put_cmd(uint8_t *buf, size_t *len, uint32_t cmd,
+		    const void *arg, size_t size)
+{
+	memcpy(buf + *len, &cmd, sizeof(cmd));
+	memcpy(buf + *len + sizeof(cmd), arg, size);
+	*len += sizeof(cmd) + size;
+}
+
+static void write_cmds(const void *buf, size_t len)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)buf;
+	if (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0)
+		die("BINDER_WRITE_READ");
+}
+
+/*
+ * Answer the reference count changes on a service's object.  The other
+ * return commands are consumed by the callers; returns the size of the
+ * command's argument.
+ */
+static size_t handle_refs(uint32_t cmd, const uint8_t *arg, uint8_t *out,
+			  size_t *out_len)
+{
+	switch (cmd) {
+	case BR_INCREFS:
+		put_cmd(out, out_len, BC_INCREFS_DONE, arg,
+			sizeof(struct binder_ptr_cookie));
+		break;
+	case BR_ACQUIRE:
+		put_cmd(out, out_len, BC_ACQUIRE_DONE, arg,
+			sizeof(struct binder_ptr_cookie));
+		break;
+	case BR_RELEASE:
+	case BR_DECREFS:
+		break;
+	case BR_NOOP:
+	case BR_SPAWN_LOOPER:
+	case BR_TRANSACTION_COMPLETE:
+		return 0;
+	default:
+		fprintf(stderr, "unexpected binder command %#x\n", cmd);
+		exit(1);
+	}
+	return sizeof(struct binder_ptr_cookie);
+}
+
+/*
+ * A synchronous call.  'release' is a reply buffer of the previous call,
+ * freed on the way.  On success the reply is in *reply and its buffer
+ * must be released by the caller.
+ */
+static int transact(uint32_t handle, uint32_t code, const void *data,
+		    size_t len, const size_t *offs, int nr_offs,
+		    struct binder_transaction_data *reply, const void *release)
+{
+	struct binder_transaction_data tr;
+	struct binder_write_read bwr;
+	uint8_t wbuf[128], rbuf[256];
+	size_t wlen = 0;
+
+	if (release)
+		put_cmd(wbuf, &wlen, BC_FREE_BUFFER, &release, sizeof(release));
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.flags = TF_ACCEPT_FDS;
+	tr.data_size = len;
+	tr.offsets_size = nr_offs * sizeof(size_t);
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offs;
+	put_cmd(wbuf, &wlen, BC_TRANSACTION, &tr, sizeof(tr));
+
+	for (;;) {
+		uint8_t *p, *end;
+		uint8_t out[128];
+		size_t out_len = 0;
+
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.write_size = wlen;
+		bwr.write_buffer = (unsigned long)wbuf;
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("BINDER_WRITE_READ");
+		}
+		wlen = 0;
+
+		p = rbuf;
+		end = rbuf + bwr.read_consumed;
+		while (p < end) {
+			uint32_t cmd;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			switch (cmd) {
+			case BR_REPLY:
+				/* always the last command of a read */
+				memcpy(reply, p, sizeof(*reply));
+				if (reply->flags & TF_STATUS_CODE) {
+					release = reply->data.ptr.buffer;
+					put_cmd(out, &out_len, BC_FREE_BUFFER,
+						&release, sizeof(release));
+				}
+				if (out_len)
+					write_cmds(out, out_len);
+				return reply->flags & TF_STATUS_CODE ? -1 : 0;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				if (out_len)
+					write_cmds(out, out_len);
+				return -1;
+			case BR_ERROR:
+				p += sizeof(int);
+				break;
+			default:
+				p += handle_refs(cmd, p, out, &out_len);
+			}
+		}
+		if (out_len)
+			write_cmds(out, out_len);
+	}
+}
+
+static void release_buffer(const void *buffer)
+{
+	uint8_t buf[16];
+	size_t len = 0;
+
+	put_cmd(buf, &len, BC_FREE_BUFFER, &buffer, sizeof(buffer));
+	write_cmds(buf, len);
+}
+
+static void *service_loop(void *arg)
+{
+	static const uint32_t enter = BC_ENTER_LOOPER;
+	uint8_t *reply_data = calloc(1, payload);
+	struct binder_write_read bwr;
+	uint8_t wbuf[256], rbuf[256];
+	size_t wlen = 0;
+
+	write_cmds(&enter, sizeof(enter));
+	for (;;) {
+		uint8_t *p, *end;
+
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.write_size = wlen;
+		bwr.write_buffer = (unsigned long)wbuf;
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("BINDER_WRITE_READ");
+		}
+		wlen = 0;
+
+		p = rbuf;
+		end = rbuf + bwr.read_consumed;
+		while (p < end) {
+			struct binder_transaction_data tr;
+			uint32_t cmd;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			if (cmd != BR_TRANSACTION) {
+				p += handle_refs(cmd, p, wbuf, &wlen);
+				continue;
+			}
+			memcpy(&tr, p, sizeof(tr));
+			p += sizeof(tr);
+			put_cmd(wbuf, &wlen, BC_FREE_BUFFER,
+				&tr.data.ptr.buffer, sizeof(void *));
+			memset(&tr, 0, sizeof(tr));
+			tr.data_size = payload;
+			tr.data.ptr.buffer = reply_data;
+			put_cmd(wbuf, &wlen, BC_REPLY, &tr, sizeof(tr));
+		}
+	}
+	return NULL;
+}
+
+static void run_service(const char *name, int ready_fd)
+{
+	struct binder_transaction_data reply;
+	struct parcel p;
+	pthread_t thread;
+	static int object;
+	int i;
+
+	open_binder();
+	memset(&p, 0, sizeof(p));
+	put_u32(&p, 0);
+	put_string16(&p, SVC_MGR_NAME);
+	put_string16(&p, name);
+	put_binder(&p, &object);
+	put_u32(&p, 0);
+	if (transact(0, SVC_MGR_ADD_SERVICE, p.data, p.len, p.offs,
+		     p.nr_offs, &reply, NULL)) {
+		fprintf(stderr, "%s: servicemanager refused it\n", name);
+		exit(1);
+	}
+	release_buffer(reply.data.ptr.buffer);
+
+	for (i = 1; i < nr_threads; i++)
+		pthread_create(&thread, NULL, service_loop, NULL);
+	if (write(ready_fd, "", 1) != 1)
+		die("pipe");
+	service_loop(NULL);
+}
+
+static void run_client(const char *name, struct result *res, int start_fd)
+{
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	const void *release = NULL;
+	unsigned long long deadline;
+	uint8_t buf[16], *data;
+	uint32_t handle;
+	struct parcel p;
+	size_t len = 0;
+	char c;
+
+	open_binder();
+	memset(&p, 0, sizeof(p));
+	put_u32(&p, 0);
+	put_string16(&p, SVC_MGR_NAME);
+	put_string16(&p, name);
+	if (transact(0, SVC_MGR_CHECK_SERVICE, p.data, p.len, NULL, 0,
+		     &reply, NULL) || reply.data_size < sizeof(obj)) {
+		fprintf(stderr, "%s: not found\n", name);
+		exit(1);
+	}
+	memcpy(&obj, reply.data.ptr.buffer, sizeof(obj));
+	if (obj.type != BINDER_TYPE_HANDLE) {
+		fprintf(stderr, "%s: not found\n", name);
+		exit(1);
+	}
+	/* hold the reference before the reply that carries it goes away */
+	handle = obj.handle;
+	put_cmd(buf, &len, BC_ACQUIRE, &handle, sizeof(handle));
+	write_cmds(buf, len);
+	release_buffer(reply.data.ptr.buffer);
+
+	data = calloc(1, payload);
+	if (read(start_fd, &c, 1) < 0)
+		die("pipe");
+
+	deadline = now_us() + seconds * 1000000ULL;
+	for (;;) {
+		unsigned long long t = now_us();
+		unsigned int us;
+
+		if (t >= deadline)
+			break;
+		if (transact(handle, STRESS_CALL, data, payload, NULL, 0,
+			     &reply, release)) {
+			res->failed++;
+			release = NULL;
+			continue;
+		}
+		release = reply.data.ptr.buffer;
+		us = now_us() - t;
+		res->calls++;
+		res->hist[us / HIST_US < HIST_BUCKETS ?
+			  us / HIST_US : HIST_BUCKETS]++;
+		if (us > res->max_us)
+			res->max_us = us;
+	}
+	if (release)
+		release_buffer(release);
+	exit(0);
+}
+
+/* upper bound of the bucket holding the given fraction of the calls */
+static double percentile(const unsigned int *hist, unsigned long calls,
+			 double frac, unsigned int max_us)
+{
+	unsigned long seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen >= calls * frac)
+			return (i + 1) * HIST_US / 1000.0;
+	}
+	return max_us / 1000.0;
+}
+
+static void run(int nr_clients, int nr_services, struct result *res)
+{
+	static unsigned int hist[HIST_BUCKETS + 1];
+	static int generation;
+	pid_t services[MAX_SERVICES];
+	unsigned long calls = 0, failed = 0;
+	unsigned int max_us = 0;
+	int ready[2], start[2], i, j;
+	char name[64];
+	char c;
+
+	generation++;
+	if (pipe(ready) || pipe(start))
+		die("pipe");
+	for (i = 0; i < nr_services; i++) {
+		snprintf(name, sizeof(name), "binder-stress.%d.%d",
+			 getpid(), generation * MAX_SERVICES + i);
+		services[i] = fork();
+		if (services[i] < 0)
+			die("fork");
+		if (!services[i])
+			run_service(name, ready[1]);
+	}
+	close(ready[1]);
+	for (i = 0; i < nr_services; i++)
+		if (read(ready[0], &c, 1) != 1) {
+			fprintf(stderr, "a service failed to start\n");
+			exit(1);
+		}
+	close(ready[0]);
+
+	memset(res, 0, nr_clients * sizeof(*res));
+	for (i = 0; i < nr_clients; i++) {
+		pid_t pid;
+
+		snprintf(name, sizeof(name), "binder-stress.%d.%d", getpid(),
+			 generation * MAX_SERVICES + i % nr_services);
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid) {
+			close(start[1]);
+			run_client(name, &res[i], start[0]);
+		}
+	}
+	/* let the clients look their services up, then start them at once */
+	usleep(200000);
+	close(start[1]);
+	close(start[0]);
+	for (i = 0; i < nr_clients; i++)
+		wait(NULL);
+	for (i = 0; i < nr_services; i++) {
+		kill(services[i], SIGKILL);
+		waitpid(services[i], NULL, 0);
+	}
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < nr_clients; i++) {
+		calls += res[i].calls;
+		failed += res[i].failed;
+		if (res[i].max_us > max_us)
+			max_us = res[i].max_us;
+		for (j = 0; j <= HIST_BUCKETS; j++)
+			hist[j] += res[i].hist[j];
+	}
+	if (!calls) {
+		printf("%7d %8d  no calls completed\n", nr_clients, nr_services);
+		return;
+	}
+	printf("%7d %8d %9.0f %8.2f %8.2f %8.2f %7lu\n", nr_clients,
+	       nr_services, (double)calls / seconds,
+	       percentile(hist, calls, 0.5, max_us),
+	       percentile(hist, calls, 0.99, max_us), max_us / 1000.0, failed);
+}
+
+static int parse_list(char *s, int *list, int max)
+{
+	int n = 0;
+	char *tok;
+
+	for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == 8 || atoi(tok) < 1 || atoi(tok) > max)
+			return -1;
+		list[n++] = atoi(tok);
+	}
+	return n ? n : -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: binder-stress [-c clients,...] [-s services,...] "
+		"[-T threads] [-b bytes] [-t seconds]\n"
+		"  -c  client process counts to run (default 1,2,4,8)\n"
+		"  -s  service process counts to run (default 1,4)\n"
+		"  -T  looper threads per service (default 4)\n"
+		"  -b  bytes per call and per reply (default 128)\n"
+		"  -t  seconds per run (default 10)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int clients[8] = { 1, 2, 4, 8 }, nr_clients = 4;
+	int services[8] = { 1, 4 }, nr_services = 2;
+	struct result *res;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "c:s:T:b:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_clients = parse_list(optarg, clients, MAX_CLIENTS);
+			if (nr_clients < 0)
+				usage();
+			break;
+		case 's':
+			nr_services = parse_list(optarg, services,
+						 MAX_SERVICES);
+			if (nr_services < 0)
+				usage();
+			break;
+		case 'T':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1)
+				usage();
+			break;
+		case 'b':
+			payload = atoi(optarg);
+			if (payload < 4 || payload > MAX_PAYLOAD)
+				usage();
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			if (seconds < 1)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	res = mmap(NULL, MAX_CLIENTS * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		die("mmap");
+
+	printf("%d byte calls, %d looper threads per service, %d s per run\n",
+	       payload, nr_threads, seconds);
+	printf("%7s %8s %9s %8s %8s %8s %7s\n", "clients", "services",
+	       "calls/s", "p50 ms", "p99 ms", "max ms", "failed");
+	for (i = 0; i < nr_services; i++)
+		for (j = 0; j < nr_clients; j++)
+			run(clients[j], services[i], res);
+	return 0;
+}
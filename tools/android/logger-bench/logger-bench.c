@@ -0,0 +1,311 @@
+/*
+ * logger-bench: measure the latency of writes to an Android log device
+ * with 1 to 8 concurrent writers while a reader is blocked on the log.
+ *
+ *	logger-bench				/dev/log/main, 1, 2, 4, 8 writers
+ *	logger-bench -w 4 -n 50000 -s 200 /dev/log/system
+ *	logger-bench -r 4			four threads reading one fd
+ *
+ * Every writer thread logs -n entries of -s bytes of payload through
+ * writev(), as liblog does, and times each call.  The readers share one
+ * file descriptor and sit in read() until the writers produce something;
+ * they check that each entry written by the benchmark arrived intact, so
+ * -r above 1 also exercises readers racing on the same fd.  The log is
+ * only appended to; other users of the device see the benchmark entries
+ * under the tag "logger-bench".
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "logger.h"
+
+#define TAG		"logger-bench"
+#define STOP_TAG	"logger-bench-stop"
+#define PRIO_INFO	4
+#define MAX_WRITERS	8
+#define MAX_READERS	8
+
+static const char *device = "/dev/log/main";
+static int nr_writes = 10000;
+static int payload = 64;
+
+static int read_fd;
+static pthread_barrier_t start;
+
+struct writer {
+	pthread_t thread;
+	int id;
+	unsigned int *lat_ns;
+};
+
+struct reader {
+	pthread_t thread;
+	unsigned long entries;
+	unsigned long corrupt;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int log_write(int fd, const char *tag, const char *msg, size_t len)
+{
+	unsigned char prio = PRIO_INFO;
+	struct iovec vec[3];
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = (void *)tag;
+	vec[1].iov_len = strlen(tag) + 1;
+	vec[2].iov_base = (void *)msg;
+	vec[2].iov_len = len;
+	return writev(fd, vec, 3) < 0 ? -1 : 0;
+}
+
+/* writer id and sequence number, then a fill both can be checked against */
+static void make_msg(char *msg, int id, int seq)
+{
+	int i, n;
+
+	n = snprintf(msg, payload, "%02d %08d ", id, seq);
+	for (i = n; i < payload - 1; i++)
+		msg[i] = 'a' + (id * 7 + seq + i) % 26;
+	msg[payload - 1] = '\0';
+}
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	char *msg = malloc(payload);
+	int fd, i;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0 || !msg) {
+		perror(device);
+		exit(1);
+	}
+	pthread_barrier_wait(&start);
+	for (i = 0; i < nr_writes; i++) {
+		unsigned long long t;
+
+		make_msg(msg, w->id, i);
+		t = now_ns();
+		if (log_write(fd, TAG, msg, payload)) {
+			perror("writev");
+			exit(1);
+		}
+		w->lat_ns[i] = now_ns() - t;
+	}
+	close(fd);
+	free(msg);
+	return NULL;
+}
+
+static int check_entry(const struct logger_entry *e)
+{
+	const char *tag = e->msg + 1, *msg;
+	char *want;
+	int id, seq, ok;
+
+	if (e->len < 2 || e->msg[e->len - 1] != '\0')
+		return 1;
+	msg = tag + strlen(tag) + 1;
+	if (msg - e->msg != (int)sizeof(TAG) + 1 || e->len != msg - e->msg + payload)
+		return 1;
+	if (sscanf(msg, "%d %d", &id, &seq) != 2)
+		return 1;
+	want = malloc(payload);
+	make_msg(want, id, seq);
+	ok = !memcmp(msg, want, payload);
+	free(want);
+	return !ok;
+}
+
+static void *reader_fn(void *arg)
+{
+	struct reader *r = arg;
+	union {
+		unsigned char buf[LOGGER_ENTRY_MAX_LEN + 1];
+		struct logger_entry e;
+	} u;
+
+	for (;;) {
+		const char *tag = u.e.msg + 1;
+		ssize_t n;
+
+		n = read(read_fd, u.buf, LOGGER_ENTRY_MAX_LEN);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			exit(1);
+		}
+		if (n < (ssize_t)sizeof(u.e) || n != sizeof(u.e) + u.e.len) {
+			r->corrupt++;
+			continue;
+		}
+		u.buf[n] = '\0';
+		if (!strcmp(tag, STOP_TAG))
+			break;
+		if (strcmp(tag, TAG))
+			continue;
+		r->entries++;
+		r->corrupt += check_entry(&u.e);
+	}
+	return NULL;
+}
+
+/* a new reader starts at the oldest entry, move it to the newest */
+static void skip_backlog(int fd)
+{
+	unsigned char buf[LOGGER_ENTRY_MAX_LEN];
+	int flags = fcntl(fd, F_GETFL);
+
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	fcntl(fd, F_SETFL, flags);
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void run(int nr_writers, int nr_readers)
+{
+	struct writer w[MAX_WRITERS];
+	struct reader r[MAX_READERS];
+	unsigned int *lat;
+	unsigned long long t, elapsed;
+	unsigned long entries = 0, corrupt = 0;
+	size_t total = (size_t)nr_writers * nr_writes;
+	int fd, i;
+
+	lat = malloc(total * sizeof(*lat));
+	if (!lat) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	/* start the readers at the end of the log, blocked in read() */
+	read_fd = open(device, O_RDONLY);
+	if (read_fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	skip_backlog(read_fd);
+	memset(r, 0, sizeof(r));
+	for (i = 0; i < nr_readers; i++)
+		pthread_create(&r[i].thread, NULL, reader_fn, &r[i]);
+
+	pthread_barrier_init(&start, NULL, nr_writers + 1);
+	for (i = 0; i < nr_writers; i++) {
+		w[i].id = i;
+		w[i].lat_ns = lat + (size_t)i * nr_writes;
+		pthread_create(&w[i].thread, NULL, writer_fn, &w[i]);
+	}
+	usleep(100000);
+	t = now_ns();
+	pthread_barrier_wait(&start);
+	for (i = 0; i < nr_writers; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - t;
+	pthread_barrier_destroy(&start);
+
+	fd = open(device, O_WRONLY);
+	for (i = 0; i < nr_readers; i++)
+		log_write(fd, STOP_TAG, "", 1);
+	close(fd);
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(r[i].thread, NULL);
+		entries += r[i].entries;
+		corrupt += r[i].corrupt;
+	}
+	close(read_fd);
+
+	qsort(lat, total, sizeof(*lat), cmp_uint);
+	printf("%7d %9.0f %8.1f %8.1f %8.1f %8.1f %9lu %8lu\n", nr_writers,
+	       total * 1e9 / elapsed, lat[total / 2] / 1e3,
+	       lat[total * 99 / 100] / 1e3, lat[total * 999 / 1000] / 1e3,
+	       lat[total - 1] / 1e3, total - entries, corrupt);
+	free(lat);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: logger-bench [-w writers] [-n writes] [-s bytes] "
+		"[-r readers] [device]\n"
+		"  -w  run with 1, 2, 4 ... up to this many writers (default 8)\n"
+		"  -n  entries logged by each writer (default 10000)\n"
+		"  -s  payload bytes per entry (default 64)\n"
+		"  -r  reader threads sharing one fd (default 1)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	int opt, max_writers = MAX_WRITERS, nr_readers = 1, n;
+
+	while ((opt = getopt(argc, argv, "w:n:s:r:")) != -1) {
+		switch (opt) {
+		case 'w':
+			max_writers = atoi(optarg);
+			if (max_writers < 1 || max_writers > MAX_WRITERS)
+				usage();
+			break;
+		case 'n':
+			nr_writes = atoi(optarg);
+			if (nr_writes < 1)
+				usage();
+			break;
+		case 's':
+			payload = atoi(optarg);
+			if (payload < 16 || payload > LOGGER_ENTRY_MAX_PAYLOAD -
+					(int)sizeof(TAG) - 1)
+				usage();
+			break;
+		case 'r':
+			nr_readers = atoi(optarg);
+			if (nr_readers < 1 || nr_readers > MAX_READERS)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind > 1)
+		usage();
+	if (argc > optind)
+		device = argv[optind];
+
+	printf("%s: %d entries of %d bytes per writer, %d reader%s\n",
+	       device, nr_writes, payload, nr_readers, nr_readers > 1 ? "s" : "");
+	printf("%7s %9s %8s %8s %8s %8s %9s %8s\n", "writers", "entries/s",
+	       "p50 us", "p99 us", "p99.9 us", "max us", "overrun", "corrupt");
+	for (n = 1; n <= max_writers; n *= 2)
+		run(n, nr_readers);
+	if (max_writers & (max_writers - 1))
+		run(max_writers, nr_readers);
+	return 0;
+}
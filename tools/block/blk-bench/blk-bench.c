@@ -0,0 +1,395 @@
+/*
+ * blk-bench: fio-style throughput and latency jobs against a block device.
+ *
+ *	blk-bench /dev/block/mmcblk1			read jobs only
+ *	blk-bench -w /dev/block/rknand_user		read and write jobs
+ *	blk-bench -w -t 30 -s 256 /dev/sdb seqwrite mixed
+ *
+ * Jobs, run in the order given (default: all of them, writes with -w):
+ *
+ *	seqread		sequential reads of -B bytes (default 128KB)
+ *	seqwrite	sequential writes of -B bytes
+ *	randread	random reads of -b bytes (default 4KB)
+ *	randwrite	random writes of -b bytes
+ *	mixed		randread with one seqwrite stream running beside it,
+ *			to show read latency behind a large write
+ *	verify		(only when named) write the whole span with every
+ *			sector stamped, in requests of varying size, then
+ *			read it back in differently cut requests and check
+ *			the stamps; read errors are counted, not fatal
+ *
+ * Each job runs -j threads (default 1) for -t seconds over the first -s
+ * MB of the device (or file), with O_DIRECT so the page cache stays out of it.
+ * Writes destroy the data on the device and are only run with -w.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS	16
+#define ALIGN		4096
+
+enum { SEQREAD, SEQWRITE, RANDREAD, RANDWRITE, MIXED, VERIFY, NR_JOBS };
+
+static const char *job_names[NR_JOBS] = {
+	"seqread", "seqwrite", "randread", "randwrite", "mixed", "verify",
+};
+
+/* request sizes the verify job cycles through */
+static const unsigned int verify_sizes[] = {
+	4096, 131072, 8192, 65536, 512, 32768, 1024, 262144,
+};
+#define NR_VERIFY_SIZES	(sizeof(verify_sizes) / sizeof(verify_sizes[0]))
+#define VERIFY_MAX	262144
+
+static const char *device;
+static int fd;
+static unsigned long long span;		/* bytes of the device used */
+static unsigned int seq_bs = 128 * 1024, rand_bs = 4096;
+static int seconds = 10, nr_threads = 1, allow_write;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int write, random;
+	unsigned int bs;
+	unsigned long long pos;
+	unsigned int seed;
+	unsigned int *lat_us;
+	size_t nr, size;
+};
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long blocks = span / w->bs, off;
+	void *buf;
+
+	if (posix_memalign(&buf, ALIGN, w->bs)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(buf, 0x5a, w->bs);
+
+	while (!stop) {
+		unsigned long long t;
+		ssize_t n;
+
+		if (w->random) {
+			off = ((unsigned long long)rand_r(&w->seed) << 31 |
+			       rand_r(&w->seed)) % blocks * w->bs;
+		} else {
+			off = w->pos;
+			w->pos += w->bs;
+			if (w->pos + w->bs > span)
+				w->pos = 0;
+		}
+
+		t = now_us();
+		if (w->write)
+			n = pwrite(fd, buf, w->bs, off);
+		else
+			n = pread(fd, buf, w->bs, off);
+		if (n != (ssize_t)w->bs) {
+			fprintf(stderr, "%s at %llu: %s\n", device, off,
+				n < 0 ? strerror(errno) : "short transfer");
+			exit(1);
+		}
+		t = now_us() - t;
+
+		if (w->nr == w->size) {
+			w->size = w->size ? w->size * 2 : 4096;
+			w->lat_us = realloc(w->lat_us,
+					    w->size * sizeof(*w->lat_us));
+			if (!w->lat_us) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		w->lat_us[w->nr++] = t;
+	}
+	free(buf);
+	return NULL;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sum up workers [first, first + n) as one line of the report */
+static void report(const char *name, struct worker *w, int n,
+		   unsigned long long elapsed_us)
+{
+	unsigned int *lat;
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		total += w[i].nr;
+	if (!total) {
+		printf("%-10s no I/O completed\n", name);
+		return;
+	}
+	lat = malloc(total * sizeof(*lat));
+	if (!lat) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	total = 0;
+	for (i = 0; i < n; i++) {
+		memcpy(lat + total, w[i].lat_us, w[i].nr * sizeof(*lat));
+		total += w[i].nr;
+	}
+	qsort(lat, total, sizeof(*lat), cmp_uint);
+
+	printf("%-10s %6uK %8.2f %8.0f %9.2f %9.2f %9.2f\n", name,
+	       w[0].bs / 1024, (double)total * w[0].bs / elapsed_us,
+	       total * 1e6 / elapsed_us, lat[total / 2] / 1e3,
+	       lat[total * 99 / 100] / 1e3, lat[total - 1] / 1e3);
+	free(lat);
+}
+
+static void setup(struct worker *w, int write, int random, unsigned int bs,
+		  int index, int count)
+{
+	memset(w, 0, sizeof(*w));
+	w->write = write;
+	w->random = random;
+	w->bs = bs;
+	w->seed = index * 7919 + 1;
+	/* sequential streams each start in their own slice of the span */
+	w->pos = span / bs / count * index * bs;
+}
+
+static void run(int job)
+{
+	struct worker w[MAX_THREADS + 1];
+	unsigned long long t;
+	int i, n = nr_threads;
+
+	for (i = 0; i < nr_threads; i++) {
+		switch (job) {
+		case SEQREAD:
+		case SEQWRITE:
+			setup(&w[i], job == SEQWRITE, 0, seq_bs, i, nr_threads);
+			break;
+		default:
+			setup(&w[i], job == RANDWRITE, 1, rand_bs, i,
+			      nr_threads);
+		}
+	}
+	if (job == MIXED)
+		setup(&w[n++], 1, 0, seq_bs, 0, 1);
+
+	stop = 0;
+	t = now_us();
+	for (i = 0; i < n; i++)
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < n; i++)
+		pthread_join(w[i].thread, NULL);
+	t = now_us() - t;
+
+	if (job == MIXED) {
+		report("mixed-rd", w, nr_threads, t);
+		report("mixed-wr", &w[nr_threads], 1, t);
+	} else {
+		report(job_names[job], w, nr_threads, t);
+	}
+	for (i = 0; i < n; i++)
+		free(w[i].lat_us);
+
+	/* let a write-back cache settle before the next job */
+	if (job == SEQWRITE || job == RANDWRITE || job == MIXED)
+		fsync(fd);
+}
+
+static void stamp(uint64_t *p, unsigned long long sector, unsigned int tag)
+{
+	int i;
+
+	for (i = 0; i < 512 / 8; i++)
+		p[i] = (sector << 32 | tag) ^ ((uint64_t)i << 24);
+}
+
+static void run_verify(void)
+{
+	unsigned long long off, t, bad = 0, io_errors = 0;
+	unsigned int tag = time(NULL), len, i, j;
+	uint64_t *buf, want[512 / 8];
+
+	if (posix_memalign((void **)&buf, ALIGN, VERIFY_MAX)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	t = now_us();
+	for (off = 0, i = 0; off < span; off += len, i++) {
+		len = verify_sizes[i % NR_VERIFY_SIZES];
+		if (len > span - off)
+			len = span - off;
+		for (j = 0; j < len / 512; j++)
+			stamp(buf + j * 64, off / 512 + j, tag);
+		if (pwrite(fd, buf, len, off) != len) {
+			perror("verify write");
+			exit(1);
+		}
+	}
+	fsync(fd);
+
+	/* start the cycle elsewhere so no read lines up with a write */
+	for (off = 0, i = 3; off < span; off += len, i++) {
+		len = verify_sizes[i % NR_VERIFY_SIZES];
+		if (len > span - off)
+			len = span - off;
+		if (pread(fd, buf, len, off) != len) {
+			io_errors++;
+			continue;
+		}
+		for (j = 0; j < len / 512; j++) {
+			stamp(want, off / 512 + j, tag);
+			if (memcmp(buf + j * 64, want, 512))
+				bad++;
+		}
+	}
+	t = now_us() - t;
+
+	printf("%-10s %6s %8.2f %llu MB written and read back, "
+	       "%llu bad sectors, %llu failed reads\n", "verify", "mix",
+	       2.0 * span / t, span >> 20, bad, io_errors);
+	free(buf);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: blk-bench [-w] [-t seconds] [-j threads] [-s MB] "
+		"[-b bytes] [-B bytes] device [job...]\n"
+		"  -w  run the write jobs, destroying the data on the device\n"
+		"  -t  seconds per job (default 10)\n"
+		"  -j  threads per job (default 1)\n"
+		"  -s  use only the first MB of the device\n"
+		"  -b  random I/O size (default 4096)\n"
+		"  -B  sequential I/O size (default 131072)\n"
+		"jobs: seqread seqwrite randread randwrite mixed verify\n");
+	exit(2);
+}
+
+static unsigned int parse_bs(const char *s)
+{
+	int bs = atoi(s);
+
+	if (bs < 512 || bs % 512)
+		usage();
+	return bs;
+}
+
+int main(int argc, char **argv)
+{
+	off_t size;
+	int opt, i, j, jobs[NR_JOBS * 4], nr_jobs = 0, span_mb = 0;
+
+	while ((opt = getopt(argc, argv, "wt:j:s:b:B:")) != -1) {
+		switch (opt) {
+		case 'w':
+			allow_write = 1;
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			if (seconds < 1)
+				usage();
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1 || nr_threads > MAX_THREADS)
+				usage();
+			break;
+		case 's':
+			span_mb = atoi(optarg);
+			if (span_mb < 1)
+				usage();
+			break;
+		case 'b':
+			rand_bs = parse_bs(optarg);
+			break;
+		case 'B':
+			seq_bs = parse_bs(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind >= argc || argc - optind > 1 + NR_JOBS * 4)
+		usage();
+	device = argv[optind++];
+
+	for (i = optind; i < argc; i++) {
+		for (j = 0; j < NR_JOBS; j++)
+			if (!strcmp(argv[i], job_names[j]))
+				break;
+		if (j == NR_JOBS)
+			usage();
+		if (j != SEQREAD && j != RANDREAD && !allow_write) {
+			fprintf(stderr, "%s writes to the device, add -w\n",
+				job_names[j]);
+			return 2;
+		}
+		jobs[nr_jobs++] = j;
+	}
+	if (!nr_jobs)
+		for (j = 0; j < VERIFY; j++)
+			if (allow_write || j == SEQREAD || j == RANDREAD)
+				jobs[nr_jobs++] = j;
+
+	fd = open(device, (allow_write ? O_RDWR : O_RDONLY) | O_DIRECT);
+	size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+	if (size < 0) {
+		perror(device);
+		return 1;
+	}
+	span = size;
+	if (span_mb && (unsigned long long)span_mb << 20 < span)
+		span = (unsigned long long)span_mb << 20;
+	span &= ~511ULL;
+	if (span < seq_bs * (unsigned long long)nr_threads || span < rand_bs) {
+		fprintf(stderr, "%s: too small\n", device);
+		return 1;
+	}
+
+	printf("%s: %llu MB used, %d thread%s, %d s per job\n", device,
+	       span >> 20, nr_threads, nr_threads > 1 ? "s" : "", seconds);
+	printf("%-10s %7s %8s %8s %9s %9s %9s\n", "job", "bs", "MB/s", "IOPS",
+	       "p50 ms", "p99 ms", "max ms");
+	for (i = 0; i < nr_jobs; i++) {
+		if (jobs[i] == VERIFY)
+			run_verify();
+		else
+			run(jobs[i]);
+	}
+	close(fd);
+	return 0;
+}
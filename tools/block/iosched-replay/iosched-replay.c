@@ -0,0 +1,430 @@
+/*
+ * iosched-replay: replay a recorded block I/O trace against a block device
+ * under one or more I/O schedulers and compare the latency the reads see.
+ *
+ * Record on the target, e.g. around an app launch, with
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/block/block_bio_queue/enable
+ *	... launch the app ...
+ *	cat /sys/kernel/debug/tracing/trace > launch.txt
+ *
+ * then, on a device whose contents may be overwritten,
+ *
+ *	iosched-replay -w launch.txt /dev/block/mmcblk1 cfq deadline flash
+ *
+ * Each block_bio_queue event is issued at its recorded time:
+ *
+ *	R	O_DIRECT read, its latency is measured
+ *	RA	readahead of the range through posix_fadvise(WILLNEED)
+ *	WS	O_DIRECT write, its latency is measured
+ *	W	buffered write, left to writeback as on the target
+ *	F	(with no data) fdatasync()
+ *
+ * so that sync and async requests reach the scheduler as they did when
+ * recorded.  Sectors beyond the end of the device wrap around.  Writes
+ * are only replayed with -w.
+ *
+ * The scheduler is switched through /sys/class/block/<dev>/queue, so
+ * the device must be request based: in this kernel brd (/dev/ram*) and
+ * loop devices bypass the elevator.  A spare partition or SD card works.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#define MAX_THREADS	64
+
+enum op { OP_READ, OP_READAHEAD, OP_WRITE_SYNC, OP_WRITE, OP_FLUSH };
+
+struct event {
+	double ts;
+	enum op op;
+	unsigned long long sector;
+	unsigned int nr;
+	double issued;
+	double latency;		/* seconds, -1 if not measured */
+};
+
+static struct event *events;
+static int nr_events;
+static unsigned int trace_major, trace_minor;
+static int any_dev = 1;
+static int do_writes;
+static int nr_threads = 8;
+static double speed = 1.0;
+
+static int direct_fd, buffered_fd;
+static unsigned long long dev_sectors;
+static double start_time;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static int queue_head, queue_tail, queue_done;
+static int *queue;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double event_time(const char *line, const char *event)
+{
+	const char *p = event;
+
+	/* "...  [000] d...   123.456789: block_bio_queue: ..." */
+	while (p > line && p[-1] == ' ')
+		p--;
+	while (p > line && p[-1] != ' ')
+		p--;
+	return strtod(p, NULL);
+}
+
+static int parse_op(const char *rwbs, unsigned int nr, enum op *op)
+{
+	int sync = strchr(rwbs, 'S') != NULL;
+
+	if (strchr(rwbs, 'D'))
+		return -1;	/* discard */
+	if (strchr(rwbs, 'R'))
+		*op = strchr(rwbs, 'A') ? OP_READAHEAD : OP_READ;
+	else if (strchr(rwbs, 'W'))
+		*op = nr ? (sync ? OP_WRITE_SYNC : OP_WRITE) : OP_FLUSH;
+	else if (strchr(rwbs, 'F'))
+		*op = OP_FLUSH;
+	else
+		return -1;
+	if (!nr && *op != OP_FLUSH)
+		return -1;
+	return 0;
+}
+
+static int read_trace(const char *path)
+{
+	char line[512];
+	int size = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct event e;
+		unsigned int major, minor;
+		char rwbs[8];
+		char *ev;
+
+		ev = strstr(line, "block_bio_queue: ");
+		if (!ev || sscanf(ev, "block_bio_queue: %u,%u %7s %llu + %u",
+				  &major, &minor, rwbs, &e.sector, &e.nr) != 5)
+			continue;
+		if (any_dev) {
+			trace_major = major;
+			trace_minor = minor;
+			any_dev = 0;
+		}
+		if (major != trace_major || minor != trace_minor)
+			continue;
+		if (parse_op(rwbs, e.nr, &e.op))
+			continue;
+
+		e.ts = event_time(line, ev);
+		e.latency = -1;
+
+		if (nr_events == size) {
+			size = size ? size * 2 : 4096;
+			events = realloc(events, size * sizeof(*events));
+			if (!events) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		events[nr_events++] = e;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void issue(struct event *e, void *buf)
+{
+	off_t off = (off_t)((e->sector % dev_sectors) << 9);
+	size_t len = (size_t)e->nr << 9;
+	ssize_t ret = 0;
+
+	if (((e->sector % dev_sectors) + e->nr) > dev_sectors)
+		off = 0;
+
+	switch (e->op) {
+	case OP_READ:
+		ret = pread(direct_fd, buf, len, off);
+		break;
+	case OP_READAHEAD:
+		posix_fadvise(buffered_fd, off, len, POSIX_FADV_WILLNEED);
+		return;
+	case OP_WRITE_SYNC:
+		ret = pwrite(direct_fd, buf, len, off);
+		break;
+	case OP_WRITE:
+		ret = pwrite(buffered_fd, buf, len, off);
+		return;
+	case OP_FLUSH:
+		fdatasync(buffered_fd);
+		return;
+	}
+	if (ret < 0)
+		fprintf(stderr, "%s @%llu + %u: %s\n",
+			e->op == OP_READ ? "read" : "write",
+			e->sector, e->nr, strerror(errno));
+	/* time queued behind busy workers counts, as it would for an app */
+	e->latency = now() - e->issued;
+}
+
+static void *worker(void *arg)
+{
+	void *buf;
+
+	if (posix_memalign(&buf, 4096, 1 << 20)) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(buf, 0x5a, 1 << 20);
+
+	pthread_mutex_lock(&queue_lock);
+	for (;;) {
+		struct event *e;
+
+		while (queue_head == queue_tail && !queue_done)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+		if (queue_head == queue_tail)
+			break;
+		e = &events[queue[queue_head++]];
+		pthread_mutex_unlock(&queue_lock);
+
+		if (e->nr > (1 << 11))
+			e->nr = 1 << 11;
+		issue(e, buf);
+
+		pthread_mutex_lock(&queue_lock);
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	free(buf);
+	return NULL;
+}
+
+static int set_scheduler(const char *dev, const char *sched)
+{
+	char path[256], *name, *copy = strdup(dev);
+	FILE *f;
+	int ret;
+
+	name = basename(copy);
+	snprintf(path, sizeof(path), "/sys/class/block/%s/queue/scheduler", name);
+	if (access(path, W_OK))	/* a partition: the queue is the disk's */
+		snprintf(path, sizeof(path),
+			 "/sys/class/block/%s/../queue/scheduler", name);
+	free(copy);
+
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	ret = fprintf(f, "%s\n", sched) < 0;
+	if (fclose(f) || ret) {
+		fprintf(stderr, "cannot select scheduler %s\n", sched);
+		return -1;
+	}
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *what, enum op op)
+{
+	double *lat = malloc(nr_events * sizeof(*lat));
+	double sum = 0;
+	int i, n = 0;
+
+	for (i = 0; i < nr_events; i++)
+		if (events[i].op == op && events[i].latency >= 0) {
+			lat[n++] = events[i].latency * 1000;
+			sum += events[i].latency * 1000;
+		}
+	if (n) {
+		qsort(lat, n, sizeof(*lat), cmp_double);
+		printf("  %-12s %6d  avg %7.2f  p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n",
+		       what, n, sum / n, lat[n / 2], lat[n * 95 / 100],
+		       lat[n * 99 / 100], lat[n - 1]);
+	}
+	free(lat);
+}
+
+static int replay(const char *dev, const char *sched)
+{
+	pthread_t threads[MAX_THREADS];
+	double t0 = events[0].ts, end;
+	int i;
+
+	if (set_scheduler(dev, sched))
+		return -1;
+
+	/* start each run from a cold cache and a clean device */
+	fsync(buffered_fd);
+	posix_fadvise(buffered_fd, 0, 0, POSIX_FADV_DONTNEED);
+	ioctl(buffered_fd, BLKFLSBUF, 0);
+
+	queue_head = queue_tail = queue_done = 0;
+	for (i = 0; i < nr_events; i++)
+		events[i].latency = -1;
+	for (i = 0; i < nr_threads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+
+	start_time = now();
+	for (i = 0; i < nr_events; i++) {
+		double due = start_time + (events[i].ts - t0) / speed;
+		double wait = due - now();
+
+		if (wait > 0) {
+			struct timespec ts = {
+				.tv_sec = (time_t)wait,
+				.tv_nsec = (long)((wait - (time_t)wait) * 1e9),
+			};
+			nanosleep(&ts, NULL);
+		}
+		events[i].issued = now();
+
+		pthread_mutex_lock(&queue_lock);
+		queue[queue_tail++] = i;
+		pthread_cond_signal(&queue_cond);
+		pthread_mutex_unlock(&queue_lock);
+	}
+
+	pthread_mutex_lock(&queue_lock);
+	queue_done = 1;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+	fsync(buffered_fd);
+	end = now();
+
+	printf("%s: %.3fs (recorded %.3fs)\n", sched, end - start_time,
+	       (events[nr_events - 1].ts - t0) / speed);
+	report("sync read", OP_READ);
+	report("sync write", OP_WRITE_SYNC);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: iosched-replay [-w] [-d major,minor] [-j threads] [-x speed]\n"
+		"                      trace device scheduler...\n"
+		"  -w  replay writes too (destroys the contents of device)\n"
+		"  -d  device to take from the trace (default: the first seen)\n"
+		"  -j  concurrent requests (default 8)\n"
+		"  -x  replay speed factor (default 1)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dev;
+	int i, opt, writes = 0;
+
+	while ((opt = getopt(argc, argv, "wd:j:x:")) != -1) {
+		switch (opt) {
+		case 'w':
+			do_writes = 1;
+			break;
+		case 'd':
+			if (sscanf(optarg, "%u,%u", &trace_major, &trace_minor) != 2)
+				usage();
+			any_dev = 0;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			if (nr_threads < 1 || nr_threads > MAX_THREADS)
+				usage();
+			break;
+		case 'x':
+			speed = atof(optarg);
+			if (speed <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind < 3)
+		usage();
+
+	if (read_trace(argv[optind]))
+		return 1;
+	if (!nr_events) {
+		fprintf(stderr, "%s: no block_bio_queue events\n", argv[optind]);
+		return 1;
+	}
+	for (i = 0; i < nr_events; i++)
+		if (events[i].op == OP_WRITE || events[i].op == OP_WRITE_SYNC)
+			writes++;
+	if (writes && !do_writes) {
+		fprintf(stderr, "trace has %d writes; pass -w to replay them "
+			"(overwrites the device)\n", writes);
+		return 1;
+	}
+
+	dev = argv[optind + 1];
+	direct_fd = open(dev, (do_writes ? O_RDWR : O_RDONLY) | O_DIRECT);
+	buffered_fd = open(dev, do_writes ? O_RDWR : O_RDONLY);
+	if (direct_fd < 0 || buffered_fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(direct_fd, BLKGETSIZE64, &dev_sectors)) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	dev_sectors >>= 9;
+	if (!dev_sectors)
+		return 1;
+
+	queue = malloc(nr_events * sizeof(*queue));
+	if (!queue)
+		return 1;
+
+	printf("%d events from %u,%u over %.3fs\n\n", nr_events, trace_major,
+	       trace_minor, events[nr_events - 1].ts - events[0].ts);
+	for (i = optind + 2; i < argc; i++)
+		if (replay(dev, argv[i]))
+			return 1;
+
+	return 0;
+}
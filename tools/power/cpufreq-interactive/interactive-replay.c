@@ -0,0 +1,290 @@
+/*
+ * interactive-replay: run a recorded interactive governor trace through
+ * the governor's frequency selection offline, under one or more sets of
+ * tunables, and compare the outcome.
+ *
+ * Record on the target with
+ *
+ *	echo 1 > /sys/kernel/debug/tracing/events/cpufreq_interactive/enable
+ *	... use the device ...
+ *	cat /sys/kernel/debug/tracing/trace > trace.txt
+ *
+ * then
+ *
+ *	interactive-replay trace.txt predict=0 predict=3 predict=3,boost=0
+ *
+ * Each cpufreq_interactive_load sample is turned back into demand (load
+ * times the speed it was measured at) so a policy that runs at another
+ * speed sees the load it would have measured.  Input boosts are replayed
+ * from the cpufreq_interactive_boost events; frame boosts depend on the
+ * display and are not.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpufreq_interactive_policy.h"
+
+#define MAX_FREQS	32
+
+struct sample {
+	double ts;
+	unsigned int load;
+	unsigned int cur;
+	int boost;		/* an input boost fired just before this sample */
+};
+
+struct policy {
+	const char *name;
+	struct interactive_tunables t;
+	double min_sample_time;
+	double input_boost_time;
+};
+
+static struct sample *samples;
+static int nr_samples;
+static unsigned int freqs[MAX_FREQS];
+static int nr_freqs;
+static int trace_cpu;
+
+static void add_freq(unsigned int f)
+{
+	int i, j;
+
+	if (!f)
+		return;
+	for (i = 0; i < nr_freqs && freqs[i] < f; i++)
+		;
+	if (i < nr_freqs && freqs[i] == f)
+		return;
+	if (nr_freqs == MAX_FREQS)
+		return;
+	for (j = nr_freqs++; j > i; j--)
+		freqs[j] = freqs[j - 1];
+	freqs[i] = f;
+}
+
+/* CPUFREQ_RELATION_H: highest table speed at or below target */
+static unsigned int table_freq(unsigned int target)
+{
+	int i;
+
+	for (i = nr_freqs - 1; i > 0; i--)
+		if (freqs[i] <= target)
+			break;
+	return freqs[i];
+}
+
+static double event_time(const char *line, const char *event)
+{
+	const char *p = event;
+
+	/* "...  [000] d...   123.456789: cpufreq_interactive_load: ..." */
+	while (p > line && p[-1] == ' ')
+		p--;
+	while (p > line && p[-1] != ' ')
+		p--;
+	return strtod(p, NULL);
+}
+
+static int read_trace(const char *path)
+{
+	char line[512];
+	int size = 0, boost = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct sample s;
+		unsigned int cpu, pred, target;
+		char *ev;
+
+		if (strstr(line, "cpufreq_interactive_boost: reason=input")) {
+			boost = 1;
+			continue;
+		}
+
+		ev = strstr(line, "cpufreq_interactive_load: ");
+		if (!ev || sscanf(ev, "cpufreq_interactive_load: cpu=%u load=%u pred=%u cur=%u target=%u",
+				  &cpu, &s.load, &pred, &s.cur, &target) != 5)
+			continue;
+		if (cpu != trace_cpu)
+			continue;
+
+		s.ts = event_time(line, ev);
+		s.boost = boost;
+		boost = 0;
+		add_freq(s.cur);
+		add_freq(target);
+
+		if (nr_samples == size) {
+			size = size ? size * 2 : 1024;
+			samples = realloc(samples, size * sizeof(*samples));
+			if (!samples) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		samples[nr_samples++] = s;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int parse_policy(struct policy *p, char *spec)
+{
+	char *tok;
+
+	p->name = strdup(spec);
+	p->t.go_hispeed_load = 80;
+	p->t.hispeed_freq = 816000;
+	p->t.predict_weight = 3;
+	p->min_sample_time = 0.020;
+	p->input_boost_time = 0.100;
+
+	for (tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+		char *val = strchr(tok, '=');
+
+		if (!val)
+			return -1;
+		*val++ = '\0';
+
+		if (!strcmp(tok, "go"))
+			p->t.go_hispeed_load = atoi(val);
+		else if (!strcmp(tok, "hispeed"))
+			p->t.hispeed_freq = atoi(val);
+		else if (!strcmp(tok, "predict"))
+			p->t.predict_weight = atoi(val);
+		else if (!strcmp(tok, "min_sample"))
+			p->min_sample_time = atoi(val) / 1e6;
+		else if (!strcmp(tok, "boost"))
+			p->input_boost_time = atoi(val) / 1e6;
+		else
+			return -1;
+	}
+	return 0;
+}
+
+static void replay(const struct policy *p)
+{
+	struct interactive_load_state state = { 0 };
+	unsigned int cur = table_freq(samples[0].cur);
+	double last_change = samples[0].ts;
+	double boost_until = -1;
+	double busy = 0, starved = 0, khz_time = 0, total = 0;
+	int changes = 0;
+	int i;
+
+	for (i = 0; i < nr_samples - 1; i++) {
+		const struct sample *s = &samples[i];
+		double dt = samples[i + 1].ts - s->ts;
+		double demand = (double)s->load * s->cur;
+		unsigned int load, pred, target;
+
+		if (s->boost && p->input_boost_time > 0)
+			boost_until = s->ts + p->input_boost_time;
+
+		load = demand / cur > 100 ? 100 : demand / cur;
+		pred = interactive_predict_load(&p->t, &state, load);
+		target = interactive_choose_freq(&p->t, pred, cur,
+						 freqs[0], freqs[nr_freqs - 1]);
+		if (s->ts < boost_until && target < p->t.hispeed_freq)
+			target = p->t.hispeed_freq;
+		target = table_freq(target);
+
+		if (target < cur && s->ts - last_change < p->min_sample_time)
+			target = cur;
+		if (target != cur) {
+			cur = target;
+			last_change = s->ts;
+			changes++;
+		}
+
+		/* what the next interval costs at the speed chosen now */
+		if (dt <= 0)
+			continue;
+		total += dt;
+		khz_time += cur * dt;
+		busy += (demand < cur * 100.0 ? demand / (cur * 100.0) : 1) * dt;
+		if (demand > cur * 100.0)
+			starved += dt;
+	}
+
+	if (total <= 0)
+		return;
+	printf("%-32s %8.0f %6.1f%% %6.1f%% %8.1f\n", p->name,
+	       khz_time / total / 1000, 100 * busy / total,
+	       100 * starved / total, changes / total);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: interactive-replay [-c cpu] trace [policy...]\n"
+		"  policy: comma separated go=, hispeed= (kHz), predict= (0-8),\n"
+		"          min_sample= (us), boost= (us, input boost time)\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	static char *defaults[] = { "predict=0,boost=0", "predict=0", "predict=3" };
+	char **specs;
+	int nr_specs;
+	int i;
+
+	if (argc > 2 && !strcmp(argv[1], "-c")) {
+		trace_cpu = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 2)
+		usage();
+
+	if (read_trace(argv[1]))
+		return 1;
+	if (nr_samples < 2 || !nr_freqs) {
+		fprintf(stderr, "%s: no cpufreq_interactive_load samples for cpu %d\n",
+			argv[1], trace_cpu);
+		return 1;
+	}
+
+	if (argc > 2) {
+		specs = argv + 2;
+		nr_specs = argc - 2;
+	} else {
+		specs = defaults;
+		nr_specs = sizeof(defaults) / sizeof(defaults[0]);
+	}
+
+	printf("%d samples over %.1fs, %d speeds %u-%u kHz\n\n", nr_samples,
+	       samples[nr_samples - 1].ts - samples[0].ts, nr_freqs,
+	       freqs[0], freqs[nr_freqs - 1]);
+	printf("%-32s %8s %7s %7s %8s\n", "policy", "avg MHz", "busy",
+	       "starved", "chg/s");
+
+	for (i = 0; i < nr_specs; i++) {
+		struct policy p;
+		char *spec = strdup(specs[i]);
+
+		if (parse_policy(&p, spec)) {
+			fprintf(stderr, "bad policy '%s'\n", specs[i]);
+			usage();
+		}
+		replay(&p);
+		free(spec);
+	}
+
+	return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * wakelock-stats: decode /proc/wakelock_stats and rank the wake locks by
+ * the suspend time they cost.
+ *
+ *	wakelock-stats				current totals
+ *	wakelock-stats -s 600			over the next ten minutes
+ *	cat /proc/wakelock_stats > before.bin
+ *	... leave the device in standby ...
+ *	wakelock-stats before.bin /proc/wakelock_stats
+ *
+ * With two snapshots, every figure is the difference between them, so
+ * an overnight standby test shows what kept the device awake that night.
+ * Locks are matched by name; several locks sharing a name are summed.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../../../include/linux/wakelock_stats.h"
+
+#define PROC_FILE	"/proc/wakelock_stats"
+
+struct lock {
+	char *name;
+	struct wakelock_stats_record r;
+};
+
+struct snapshot {
+	struct wakelock_stats_header h;
+	struct lock *locks;
+	int nr_locks;
+};
+
+static struct lock *find_lock(struct snapshot *s, const char *name)
+{
+	int i;
+
+	for (i = 0; i < s->nr_locks; i++)
+		if (!strcmp(s->locks[i].name, name))
+			return &s->locks[i];
+	return NULL;
+}
+
+static void add_record(struct wakelock_stats_record *a,
+		       const struct wakelock_stats_record *b, int sign)
+{
+	int i;
+
+	a->total_time_ns += sign * b->total_time_ns;
+	a->sleep_time_ns += sign * b->sleep_time_ns;
+	a->cpu_time_ns += sign * b->cpu_time_ns;
+	a->count += sign * b->count;
+	a->expire_count += sign * b->expire_count;
+	a->wakeup_count += sign * b->wakeup_count;
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++)
+		a->hold_hist[i] += sign * b->hold_hist[i];
+	if (sign > 0) {
+		if (b->max_time_ns > a->max_time_ns)
+			a->max_time_ns = b->max_time_ns;
+		a->flags |= b->flags;
+	}
+}
+
+static int read_snapshot(const char *path, struct snapshot *s)
+{
+	char *buf = NULL, *p, *end;
+	size_t len = 0, size = 0, n;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			buf = realloc(buf, size);
+			if (!buf) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+		}
+		n = fread(buf + len, 1, size - len, f);
+		if (!n)
+			break;
+		len += n;
+	}
+	fclose(f);
+
+	if (len < sizeof(s->h))
+		goto bad;
+	memcpy(&s->h, buf, sizeof(s->h));
+	if (s->h.magic != WAKELOCK_STATS_MAGIC ||
+	    s->h.header_size < sizeof(s->h) ||
+	    s->h.record_size < sizeof(struct wakelock_stats_record) ||
+	    s->h.hist_buckets != WAKELOCK_HIST_BUCKETS)
+		goto bad;
+
+	s->locks = NULL;
+	s->nr_locks = 0;
+	p = buf + s->h.header_size;
+	end = buf + len;
+	while (p + s->h.record_size <= end) {
+		struct wakelock_stats_record r;
+		struct lock *l;
+		char *name;
+
+		memcpy(&r, p, sizeof(r));
+		p += s->h.record_size;
+		if (p + r.name_len > end)
+			goto bad;
+		name = strndup(p, r.name_len);
+		p += (r.name_len + 7) & ~7;
+
+		l = find_lock(s, name);
+		if (l) {
+			add_record(&l->r, &r, 1);
+			free(name);
+			continue;
+		}
+		s->locks = realloc(s->locks, (s->nr_locks + 1) * sizeof(*l));
+		if (!s->locks) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		l = &s->locks[s->nr_locks++];
+		l->name = name;
+		l->r = r;
+	}
+
+	free(buf);
+	return 0;
+bad:
+	fprintf(stderr, "%s: not a wakelock_stats file\n", path);
+	free(buf);
+	return -1;
+}
+
+static void subtract(struct snapshot *after, struct snapshot *before)
+{
+	int i;
+
+	for (i = 0; i < before->nr_locks; i++) {
+		struct lock *l = find_lock(after, before->locks[i].name);
+
+		/* a lock that went away was folded into deleted_wake_locks */
+		if (l)
+			add_record(&l->r, &before->locks[i].r, -1);
+	}
+	after->h.suspend_count -= before->h.suspend_count;
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++)
+		after->h.suspend_blocked_hist[i] -=
+			before->h.suspend_blocked_hist[i];
+}
+
+static int cmp_lock(const void *a, const void *b)
+{
+	const struct lock *x = a, *y = b;
+
+	if (x->r.sleep_time_ns != y->r.sleep_time_ns)
+		return x->r.sleep_time_ns < y->r.sleep_time_ns ? 1 : -1;
+	if (x->r.total_time_ns != y->r.total_time_ns)
+		return x->r.total_time_ns < y->r.total_time_ns ? 1 : -1;
+	return strcmp(x->name, y->name);
+}
+
+static const char *bucket_name(int i)
+{
+	static char buf[16];
+
+	if (i == 0)
+		return "<1ms";
+	if (i == WAKELOCK_HIST_BUCKETS - 1)
+		snprintf(buf, sizeof(buf), ">=%ums", 1U << (i - 1));
+	else
+		snprintf(buf, sizeof(buf), "<%ums", 1U << i);
+	return buf;
+}
+
+/* upper bound of the bucket holding the median hold */
+static const char *median_hold(const struct wakelock_stats_record *r)
+{
+	unsigned int n = 0, seen = 0;
+	int i;
+
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++)
+		n += r->hold_hist[i];
+	if (!n)
+		return "-";
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++) {
+		seen += r->hold_hist[i];
+		if (seen * 2 >= n)
+			break;
+	}
+	return bucket_name(i);
+}
+
+static void print_hist(const unsigned int *hist)
+{
+	unsigned int max = 0;
+	int i, j;
+
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++)
+		if (hist[i] > max)
+			max = hist[i];
+	for (i = 0; i < WAKELOCK_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("  %9s %8u  ", bucket_name(i), hist[i]);
+		for (j = 0; j < (int)(40ULL * hist[i] / max); j++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+static void report(struct snapshot *s, int verbose)
+{
+	int i;
+
+	qsort(s->locks, s->nr_locks, sizeof(*s->locks), cmp_lock);
+
+	printf("%-32s %7s %7s %7s %10s %10s %9s %8s\n", "name", "count",
+	       "expired", "wakeups", "sleep ms", "held ms", "cpu ms", "median");
+	for (i = 0; i < s->nr_locks; i++) {
+		const struct lock *l = &s->locks[i];
+
+		if (!verbose && !l->r.count)
+			continue;
+		printf("%-32.32s %7u %7u %7u %10llu %10llu %9llu %8s%s\n",
+		       l->name, l->r.count, l->r.expire_count,
+		       l->r.wakeup_count,
+		       (unsigned long long)l->r.sleep_time_ns / 1000000,
+		       (unsigned long long)l->r.total_time_ns / 1000000,
+		       (unsigned long long)l->r.cpu_time_ns / 1000000,
+		       median_hold(&l->r),
+		       l->r.flags & WAKELOCK_STATS_ACTIVE ? " *" : "");
+	}
+
+	printf("\nsuspend blocked for, over %u suspends:\n", s->h.suspend_count);
+	print_hist(s->h.suspend_blocked_hist);
+
+	if (!verbose)
+		return;
+	for (i = 0; i < s->nr_locks; i++) {
+		if (!s->locks[i].r.count)
+			continue;
+		printf("\n%s held for:\n", s->locks[i].name);
+		print_hist(s->locks[i].r.hold_hist);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: wakelock-stats [-v] [-s seconds | [before] [after]]\n"
+		"  -v  list idle locks and print hold time histograms\n"
+		"  -s  report the difference over the given time\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct snapshot before, after;
+	int opt, verbose = 0, interval = 0;
+
+	while ((opt = getopt(argc, argv, "vs:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 's':
+			interval = atoi(optarg);
+			if (interval <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind > 2 || (interval && argc > optind))
+		usage();
+
+	if (interval) {
+		if (read_snapshot(PROC_FILE, &before))
+			return 1;
+		sleep(interval);
+		if (read_snapshot(PROC_FILE, &after))
+			return 1;
+		subtract(&after, &before);
+	} else if (argc - optind == 2) {
+		if (read_snapshot(argv[optind], &before) ||
+		    read_snapshot(argv[optind + 1], &after))
+			return 1;
+		subtract(&after, &before);
+	} else {
+		if (read_snapshot(argc > optind ? argv[optind] : PROC_FILE,
+				  &after))
+			return 1;
+	}
+
+	report(&after, verbose);
+	return 0;
+}
@@ -0,0 +1,149 @@
+#!/bin/sh
+#
+# Mass storage gadget throughput on a plain Linux box: g_mass_storage
+# exports a RAM disk through dummy_hcd, and blk-bench runs against the
+# disk the host side sees.  Needs root, and a kernel with brd and
+# usb-storage.
+#
+# dummy_hcd and g_mass_storage must be built from this tree, e.g. with
+# USB_GADGET_DUMMY_HCD and USB_MASS_STORAGE as modules; a stock
+# g_mass_storage has none of the parameters tuned here.  Point MODDIR
+# at the directory holding the two .ko files to load those instead of
+# whatever modprobe finds.  The script stops before benchmarking if the
+# gadget lacks fsg_num_buffers, fsg_buflen or fsg_readahead_kb.
+#
+#	./msc-bench.sh				default buffer rings, read jobs
+#	WRITE=1 ./msc-bench.sh 4:16384 16:131072
+#	RA='0 512' ./msc-bench.sh 8:65536
+#	MODDIR=../../drivers/usb/gadget ./msc-bench.sh
+#
+# Each argument is a buffer ring, fsg_num_buffers:fsg_buflen.  The ring
+# is changed at runtime: the new parameters are written to sysfs and the
+# host re-configures the device by de-authorising and authorising it,
+# which is when f_mass_storage re-sizes its buffers.  RA lists the
+# fsg_readahead_kb values to try with each ring.
+#
+
+BENCH=${BENCH:-../block/blk-bench/blk-bench}
+RAM_MB=${RAM_MB:-256}
+SECONDS_PER_JOB=${SECONDS_PER_JOB:-10}
+RA=${RA:-512}
+RINGS=${*:-4:16384 4:65536 8:65536 16:131072 16:262144}
+PARAMS=/sys/module/g_mass_storage/parameters
+
+if [ "$WRITE" = "" ]; then
+	JOBS='seqread randread'
+	BENCH_ARGS=''
+else
+	JOBS='seqread seqwrite randread randwrite mixed'
+	BENCH_ARGS='-w'
+fi
+
+fail ()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+load ()
+{
+	if [ "$MODDIR" = "" ]; then
+		modprobe "$@"
+	else
+		MOD=$1
+		shift
+		insmod $MODDIR/$MOD.ko "$@"
+	fi
+}
+
+# set a parameter and read it back
+set_param ()
+{
+	echo $2 > $PARAMS/$1 2>/dev/null && [ "$(cat $PARAMS/$1)" = $2 ] ||
+		fail "can't set $1 to $2"
+}
+
+# the gadget as the host sees it, a usb device under dummy_hcd
+find_usb_dev ()
+{
+	for d in /sys/bus/usb/devices/*; do
+		[ -f $d/idVendor ] || continue
+		case $(readlink -f $d) in
+		*dummy_hcd*)
+			[ "$(cat $d/bDeviceClass)" = 09 ] || echo $d
+			;;
+		esac
+	done
+}
+
+# and the disk usb-storage made of it
+find_disk ()
+{
+	for d in /sys/block/sd*; do
+		case $(readlink -f $d) in
+		*dummy_hcd*)
+			echo /dev/${d##*/}
+			;;
+		esac
+	done
+}
+
+wait_disk ()
+{
+	i=0
+	while [ $i -lt 30 ]; do
+		DISK=$(find_disk)
+		if [ "$DISK" != "" ] && [ -b "$DISK" ]; then
+			return
+		fi
+		sleep 1
+		i=$((i + 1))
+	done
+	fail "no disk appeared behind dummy_hcd"
+}
+
+reconfigure ()
+{
+	USB_DEV=$(find_usb_dev)
+	[ "$USB_DEV" != "" ] || fail "gadget not enumerated"
+	echo 0 > $USB_DEV/authorized
+	echo 1 > $USB_DEV/authorized
+	wait_disk
+}
+
+cleanup ()
+{
+	rmmod g_mass_storage 2>/dev/null
+	rmmod dummy_hcd 2>/dev/null
+	rmmod brd 2>/dev/null
+}
+
+[ -x "$BENCH" ] || fail "build $BENCH first, or set BENCH"
+[ "$(find_disk)" = "" ] || fail "a dummy_hcd disk already exists"
+[ -d /sys/module/g_mass_storage ] && fail "g_mass_storage is already loaded"
+
+trap cleanup EXIT
+modprobe brd rd_nr=1 rd_size=$((RAM_MB * 1024)) || fail "can't load brd"
+load dummy_hcd || fail "can't load dummy_hcd"
+load g_mass_storage file=/dev/ram0 removable=0 stall=0 ||
+	fail "can't load g_mass_storage"
+for P in fsg_num_buffers fsg_buflen fsg_readahead_kb; do
+	[ -w $PARAMS/$P ] ||
+		fail "g_mass_storage has no writable $P, is it built from this tree?"
+done
+wait_disk
+echo "$DISK: ${RAM_MB}MB RAM disk through dummy_hcd"
+
+for RING in $RINGS; do
+	for KB in $RA; do
+		set_param fsg_num_buffers ${RING%:*}
+		set_param fsg_buflen ${RING#*:}
+		set_param fsg_readahead_kb $KB
+		reconfigure
+
+		echo ""
+		echo "** ${RING%:*} x ${RING#*:} byte buffers, read-ahead ${KB}KB"
+		$BENCH $BENCH_ARGS -t $SECONDS_PER_JOB $DISK $JOBS ||
+			fail "blk-bench failed"
+	done
+done
@@ -0,0 +1,524 @@
+/*
+ * mtp-bench: f_mtp file transfer throughput over a dummy_hcd loopback,
+ * so the request rings can be measured on a plain Linux box.
+ *
+ *	mtp-bench				send and receive 64MB, 5 runs each
+ *	mtp-bench -s 256 -n 3 send
+ *
+ * It needs a kernel with dummy_hcd as the USB peripheral controller and
+ * the android gadget built in, running the mtp function:
+ *
+ *	echo 0 > /sys/class/android_usb/android0/enable
+ *	echo mtp > /sys/class/android_usb/android0/functions
+ *	echo 1 > /sys/class/android_usb/android0/enable
+ *
+ * That kernel must be built from this tree: a stock f_mtp has neither
+ * MTP_GET_STATS nor the ring parameters, and mtp-bench refuses to run
+ * without them.  The parameters (/sys/module/g_android/parameters/
+ * mtp_tx_reqs and friends) are applied when the function is bound, so
+ * write them before enabling.
+ *
+ * Both ends run in this program.  The device side drives /dev/mtp_usb
+ * with MTP_SEND_FILE and MTP_RECEIVE_FILE as the MTP server does; the
+ * host side moves the data through usbfs, keeping -q URBs in flight so
+ * it is not what limits the rate.  No MTP commands are exchanged, only
+ * the data phase of a transfer is timed:
+ *
+ *	send	 device to host, as GetObject; the file is read from -f
+ *	receive	 host to device, as SendObject; the file is written to -f
+ *
+ * Every run is checked: the host verifies the data it is sent, and the
+ * file received is read back and compared.  The rates are followed by
+ * the f_mtp counters from MTP_GET_STATS.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <linux/usbdevice_fs.h>
+
+#include "../../../include/linux/usb/f_mtp.h"
+
+#define MTP_DEV		"/dev/mtp_usb"
+#define MTP_PARAMS	"/sys/module/g_android/parameters"
+#define URB_LEN		16384		/* usbfs limit for one bulk URB */
+#define MAX_URBS	64
+
+struct usb_link {
+	int fd;
+	unsigned int ep_in, ep_out;
+	unsigned int maxpacket;
+};
+
+struct job {
+	int mtp_fd;
+	unsigned long ioctl_cmd;
+	struct mtp_file_range mfr;
+	int result;
+};
+
+static const char *file = "/tmp/mtp-bench.dat";
+static unsigned long long size = 64 << 20;
+static int nr_urbs = 8, runs = 5;
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* the data at byte offset off, a word at a time */
+static uint32_t pattern(unsigned long long off)
+{
+	return (uint32_t)(off / 4) * 2654435761U;
+}
+
+static void fill(uint32_t *buf, unsigned long long off, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / 4; i++)
+		buf[i] = pattern(off + i * 4);
+}
+
+static int check(const uint32_t *buf, unsigned long long off, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len / 4; i++)
+		if (buf[i] != pattern(off + i * 4))
+			return -1;
+	return 0;
+}
+
+static int read_sysfs(const char *dir, const char *name, char *buf, int len)
+{
+	char path[PATH_MAX + NAME_MAX + 2];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(buf, len, f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	buf[strcspn(buf, "\n")] = 0;
+	return 0;
+}
+
+static unsigned long sysfs_ul(const char *dir, const char *name, int base)
+{
+	char buf[32];
+
+	if (read_sysfs(dir, name, buf, sizeof(buf)))
+		return ~0UL;
+	return strtoul(buf, NULL, base);
+}
+
+/* the bulk endpoints of an interface, from its ep_XX directories */
+static int find_endpoints(const char *intf, struct usb_link *l)
+{
+	char path[PATH_MAX + NAME_MAX + 2], buf[16];
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(intf);
+	if (!d)
+		return -1;
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, "ep_", 3))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", intf, de->d_name);
+		if (read_sysfs(path, "type", buf, sizeof(buf)) ||
+		    strcmp(buf, "Bulk"))
+			continue;
+		if (sysfs_ul(path, "bEndpointAddress", 16) & 0x80) {
+			l->ep_in = sysfs_ul(path, "bEndpointAddress", 16);
+			l->maxpacket = sysfs_ul(path, "wMaxPacketSize", 16);
+		} else {
+			l->ep_out = sysfs_ul(path, "bEndpointAddress", 16);
+		}
+	}
+	closedir(d);
+	return l->ep_in && l->ep_out ? 0 : -1;
+}
+
+/* find the MTP (or PTP) interface the gadget exposes behind dummy_hcd */
+static int open_link(struct usb_link *l)
+{
+	char intf[PATH_MAX], real[PATH_MAX], usbfs[64], *p;
+	unsigned long cls, sub;
+	unsigned int ifnum;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir("/sys/bus/usb/devices");
+	if (!d) {
+		perror("/sys/bus/usb/devices");
+		return -1;
+	}
+	while ((de = readdir(d))) {
+		if (!strchr(de->d_name, ':'))
+			continue;
+		snprintf(intf, sizeof(intf), "/sys/bus/usb/devices/%s",
+			 de->d_name);
+		if (!realpath(intf, real) || !strstr(real, "dummy_hcd"))
+			continue;
+		cls = sysfs_ul(real, "bInterfaceClass", 16);
+		sub = sysfs_ul(real, "bInterfaceSubClass", 16);
+		if (!(cls == 0xff && sub == 0xff) && !(cls == 6 && sub == 1))
+			continue;
+		memset(l, 0, sizeof(*l));
+		if (find_endpoints(real, l))
+			continue;
+		ifnum = sysfs_ul(real, "bInterfaceNumber", 16);
+
+		/* the usb device is the parent directory */
+		p = strrchr(real, '/');
+		*p = 0;
+		snprintf(usbfs, sizeof(usbfs), "/dev/bus/usb/%03lu/%03lu",
+			 sysfs_ul(real, "busnum", 10),
+			 sysfs_ul(real, "devnum", 10));
+		closedir(d);
+
+		l->fd = open(usbfs, O_RDWR);
+		if (l->fd < 0) {
+			perror(usbfs);
+			return -1;
+		}
+		if (ioctl(l->fd, USBDEVFS_CLAIMINTERFACE, &ifnum)) {
+			perror("USBDEVFS_CLAIMINTERFACE");
+			return -1;
+		}
+		printf("host side: %s interface %u, ep in 0x%02x out 0x%02x, "
+		       "%u byte packets\n", usbfs, ifnum, l->ep_in, l->ep_out,
+		       l->maxpacket);
+		return 0;
+	}
+	closedir(d);
+	fprintf(stderr, "no mtp interface found behind dummy_hcd\n");
+	return -1;
+}
+
+static void submit(struct usb_link *l, struct usbdevfs_urb *urb,
+		   unsigned int ep, unsigned long long off, size_t len)
+{
+	urb->type = USBDEVFS_URB_TYPE_BULK;
+	urb->endpoint = ep;
+	urb->buffer_length = len;
+	urb->actual_length = 0;
+	urb->status = 0;
+	urb->usercontext = (void *)(uintptr_t)off;
+	if (ep & 0x80)
+		memset(urb->buffer, 0, len);
+	else
+		fill(urb->buffer, off, len);
+	if (ioctl(l->fd, USBDEVFS_SUBMITURB, urb)) {
+		perror("USBDEVFS_SUBMITURB");
+		exit(1);
+	}
+}
+
+static struct usbdevfs_urb *reap(struct usb_link *l)
+{
+	struct usbdevfs_urb *urb;
+
+	if (ioctl(l->fd, USBDEVFS_REAPURB, &urb)) {
+		perror("USBDEVFS_REAPURB");
+		exit(1);
+	}
+	if (urb->status) {
+		fprintf(stderr, "urb at %llu: %s\n",
+			(unsigned long long)(uintptr_t)urb->usercontext,
+			strerror(-urb->status));
+		exit(1);
+	}
+	return urb;
+}
+
+/*
+ * Move size bytes over one endpoint with up to nr_urbs URBs queued, and
+ * for IN check what arrives.  f_mtp ends a transfer that is a multiple
+ * of the packet size with a zero length packet, which is read too.
+ */
+static int host_transfer(struct usb_link *l, struct usbdevfs_urb *urbs,
+			 int in)
+{
+	unsigned long long queued = 0, done = 0;
+	struct usbdevfs_urb *urb;
+	int i, busy = 0, bad = 0;
+
+	for (i = 0; i < nr_urbs && queued < size; i++, busy++) {
+		size_t len = size - queued < URB_LEN ? size - queued : URB_LEN;
+
+		submit(l, &urbs[i], in ? l->ep_in : l->ep_out, queued, len);
+		queued += len;
+	}
+	while (busy) {
+		urb = reap(l);
+		busy--;
+		if (urb->actual_length != urb->buffer_length) {
+			fprintf(stderr, "short transfer at %llu\n", done);
+			return -1;
+		}
+		if (in && check(urb->buffer,
+				(uintptr_t)urb->usercontext,
+				urb->actual_length))
+			bad++;
+		done += urb->actual_length;
+		if (queued < size) {
+			size_t len = size - queued < URB_LEN ?
+				size - queued : URB_LEN;
+
+			submit(l, urb, in ? l->ep_in : l->ep_out, queued, len);
+			queued += len;
+			busy++;
+		}
+	}
+
+	if (in && !(size % l->maxpacket)) {
+		submit(l, &urbs[0], l->ep_in, size, l->maxpacket);
+		urb = reap(l);
+		if (urb->actual_length) {
+			fprintf(stderr, "expected a zero length packet\n");
+			return -1;
+		}
+	}
+	if (bad)
+		fprintf(stderr, "%d URBs with wrong data\n", bad);
+	return bad ? -1 : 0;
+}
+
+static void *device_fn(void *arg)
+{
+	struct job *j = arg;
+
+	j->result = ioctl(j->mtp_fd, j->ioctl_cmd, &j->mfr) ? -errno : 0;
+	return NULL;
+}
+
+/* compare the file received with what was sent */
+static int check_file(int fd)
+{
+	static uint32_t buf[URB_LEN / 4];
+	unsigned long long off;
+	ssize_t n;
+
+	for (off = 0; off < size; off += n) {
+		n = pread(fd, buf, sizeof(buf), off);
+		if (n <= 0 || check(buf, off, n)) {
+			fprintf(stderr, "%s: wrong data at %llu\n", file, off);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int make_file(void)
+{
+	static uint32_t buf[URB_LEN / 4];
+	unsigned long long off;
+	int fd;
+
+	fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(file);
+		return -1;
+	}
+	for (off = 0; off < size; off += sizeof(buf)) {
+		size_t len = size - off < sizeof(buf) ? size - off : sizeof(buf);
+
+		fill(buf, off, len);
+		if (pwrite(fd, buf, len, off) != (ssize_t)len) {
+			perror(file);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+static int run(struct usb_link *l, struct usbdevfs_urb *urbs, int mtp_fd,
+	       int send)
+{
+	struct mtp_stats before, after;
+	double mbps, min = 0, max = 0, sum = 0;
+	struct job j;
+	pthread_t thread;
+	int i, fd;
+
+	fd = send ? make_file() : open(file, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(file);
+		return -1;
+	}
+	if (ioctl(mtp_fd, MTP_GET_STATS, &before)) {
+		perror("MTP_GET_STATS");
+		return -1;
+	}
+
+	for (i = 0; i < runs; i++) {
+		unsigned long long t;
+		int r;
+
+		if (!send && ftruncate(fd, 0)) {
+			perror(file);
+			return -1;
+		}
+		memset(&j, 0, sizeof(j));
+		j.mtp_fd = mtp_fd;
+		j.ioctl_cmd = send ? MTP_SEND_FILE : MTP_RECEIVE_FILE;
+		j.mfr.fd = fd;
+		j.mfr.length = size;
+
+		t = now_us();
+		if (pthread_create(&thread, NULL, device_fn, &j)) {
+			perror("pthread_create");
+			return -1;
+		}
+		r = host_transfer(l, urbs, send);
+		pthread_join(thread, NULL);
+		t = now_us() - t;
+
+		if (r)
+			return -1;
+		if (j.result) {
+			fprintf(stderr, "%s: %s\n", send ? "MTP_SEND_FILE" :
+				"MTP_RECEIVE_FILE", strerror(-j.result));
+			return -1;
+		}
+		if (!send && check_file(fd))
+			return -1;
+
+		mbps = size / (double)t;
+		printf("%-8s %6llu MB %8.1f MB/s\n", send ? "send" : "receive",
+		       size >> 20, mbps);
+		if (!i || mbps < min)
+			min = mbps;
+		if (mbps > max)
+			max = mbps;
+		sum += mbps;
+	}
+	close(fd);
+
+	if (ioctl(mtp_fd, MTP_GET_STATS, &after)) {
+		perror("MTP_GET_STATS");
+		return -1;
+	}
+	printf("%-8s min %.1f avg %.1f max %.1f MB/s", send ? "send" : "receive",
+	       min, sum / runs, max);
+	if (send)
+		printf(", ring %u x %u, %u stalls on USB\n\n",
+		       after.tx_reqs, after.tx_req_len,
+		       after.tx_stalls - before.tx_stalls);
+	else
+		printf(", ring %u x %u, %u stalls on USB\n\n",
+		       after.rx_reqs, after.rx_req_len,
+		       after.rx_stalls - before.rx_stalls);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mtp-bench [-s MB] [-n runs] [-q urbs] [-f file] "
+		"[send] [receive]\n"
+		"  -s  transfer size (default 64)\n"
+		"  -n  runs of each direction (default 5)\n"
+		"  -q  host URBs in flight (default 8, at most %d)\n"
+		"  -f  device side file (default %s)\n", MAX_URBS, file);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct usbdevfs_urb urbs[MAX_URBS];
+	int opt, i, mtp_fd, send = 0, receive = 0;
+	struct usb_link link;
+	struct mtp_stats stats;
+
+	while ((opt = getopt(argc, argv, "s:n:q:f:")) != -1) {
+		switch (opt) {
+		case 's':
+			size = strtoull(optarg, NULL, 0) << 20;
+			if (!size)
+				usage();
+			break;
+		case 'n':
+			runs = atoi(optarg);
+			if (runs < 1)
+				usage();
+			break;
+		case 'q':
+			nr_urbs = atoi(optarg);
+			if (nr_urbs < 1 || nr_urbs > MAX_URBS)
+				usage();
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "send"))
+			send = 1;
+		else if (!strcmp(argv[i], "receive"))
+			receive = 1;
+		else
+			usage();
+	}
+	if (!send && !receive)
+		send = receive = 1;
+
+	mtp_fd = open(MTP_DEV, O_RDWR);
+	if (mtp_fd < 0) {
+		perror(MTP_DEV);
+		return 1;
+	}
+	/* only this tree's f_mtp has the rings being measured */
+	if (ioctl(mtp_fd, MTP_GET_STATS, &stats) ||
+	    access(MTP_PARAMS "/mtp_tx_reqs", R_OK)) {
+		fprintf(stderr, "%s has no MTP_GET_STATS or ring parameters, "
+			"is the kernel built from this tree?\n", MTP_DEV);
+		return 1;
+	}
+	if (open_link(&link))
+		return 1;
+
+	memset(urbs, 0, sizeof(urbs));
+	for (i = 0; i < nr_urbs; i++) {
+		urbs[i].buffer = malloc(URB_LEN);
+		if (!urbs[i].buffer) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+	}
+
+	if (send && run(&link, urbs, mtp_fd, 1))
+		return 1;
+	if (receive && run(&link, urbs, mtp_fd, 0))
+		return 1;
+	unlink(file);
+	return 0;
+}